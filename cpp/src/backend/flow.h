@@ -33,7 +33,10 @@ class FlowGraph {
         graph_.AddEdge(i, i + 1);
       }
       for (auto const& t : body[i]->Jumps()) {
-        graph_.AddEdge(i, targets.find(t)->second);
+        // jumps out of the function, e.g. to L_raise_bounds, have no edge
+        if (auto it = targets.find(t); it != targets.end()) {
+          graph_.AddEdge(i, it->second);
+        }
       }
     }
   }
@@ -26,7 +26,7 @@ class Interference {
   Interference(F &function, const Liveness<Target> &liveness) {
     auto ignore = std::unordered_set<R>(Target::MACHINE_REGS.begin(),
                                         Target::MACHINE_REGS.end());
-    for (auto r : Target::GENERAL_PURPOSE_REGS) {
+    for (auto r : Target::GeneralPurposeRegs(function)) {
       ignore.erase(r);
     }
 
@@ -34,6 +34,14 @@ class Interference {
     int n = body.size();
 
     for (int i = 0; i < n; i++) {
+      if (auto m = body[i]->IsMoveBetweenTemps()) {
+        if (ignore.find(m->first) == ignore.end() &&
+            ignore.find(m->second) == ignore.end()) {
+          moves_.AddEdge(m->first, m->second);
+          moves_.AddEdge(m->second, m->first);
+        }
+      }
+
       for (auto b : body[i]->Defs()) {
         if (ignore.find(b) != ignore.end()) continue;
 
@@ -52,8 +60,12 @@ class Interference {
 
   const Graph<R> &GetGraph() const { return interference_; }
 
+  // Pairs of registers that are related by a move instruction
+  const Graph<R> &GetMoves() const { return moves_; }
+
  private:
   Graph<R> interference_;
+  Graph<R> moves_;
 };
 
 }  // namespace mjc
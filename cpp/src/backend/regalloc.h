@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include <functional>
+#include <limits>
 #include <stack>
 #include <unordered_map>
 #include <unordered_set>
@@ -13,6 +14,7 @@
 #include "backend/flow.h"
 #include "backend/interference.h"
 #include "backend/liveness.h"
+#include "intermediate/profile.h"
 
 namespace mjc {
 
@@ -24,13 +26,23 @@ class RegAlloc {
   using P = typename Target::Prg;
 
  public:
+  // With a profile, temps that are used less frequently relative to their
+  // degree are spilled first; otherwise temps of the highest degree.
+  explicit RegAlloc(const Profile *profile = nullptr) : profile_(profile) {}
+
   void Process(P &prg) {
     for (auto &f : prg.functions) {
+      spill_temps_.clear();
       Regalloc(*f);
     }
   }
 
  private:
+  const Profile *profile_;
+  // Temps that load or store a spilled temp. Spilling them again would not
+  // shorten any live range.
+  std::unordered_set<R> spill_temps_;
+
   class colour_result {
    public:
     colour_result(const colour_result &) = delete;
@@ -41,31 +53,72 @@ class RegAlloc {
 
   void Regalloc(F &fun) {
     auto interference = Build(fun);
-    auto stack = SimplifyAndSpill(interference);
-    auto result = Select(interference, stack);
+    auto &regs = Target::GeneralPurposeRegs(fun);
+    auto stack = SimplifyAndSpill(interference, regs.size(), SpillCosts(fun));
+    auto result = Select(interference, stack, regs);
     if (result.spills.size() == 0) {
-      std::function<R(R)> sigma = [&result](R t) {
+      std::function<R(R)> sigma = [&result, &regs](R t) {
         auto it = result.colouring.find(t);
-        return (it == result.colouring.end()) ? Target::GENERAL_PURPOSE_REGS[0]
-                                              : it->second;
+        return (it == result.colouring.end()) ? regs[0] : it->second;
       };
       fun.rename(sigma);
     } else {
+      auto before = Temps(fun);
       fun.spill(result.spills);
+      for (auto &t : Temps(fun)) {
+        if (before.count(t) == 0) spill_temps_.insert(t);
+      }
       Regalloc(fun);
     }
   }
 
+  static std::unordered_set<R> Temps(F &fun) {
+    auto temps = std::unordered_set<R>{};
+    for (auto &i : fun.GetBody()) {
+      for (auto regs : {i->Uses(), i->Defs()}) {
+        temps.insert(regs.begin(), regs.end());
+      }
+    }
+    return temps;
+  }
+
   Interference<Target> Build(F &fun) {
     auto flow = FlowGraph<Target>(fun);
     auto liveness = Liveness<Target>(fun, flow);
     return Interference<Target>(fun, liveness);
   }
 
-  std::stack<R> SimplifyAndSpill(const Interference<Target> &interference) {
+  // Number of executions of the uses and definitions of each temp according
+  // to the profile, or nothing if the profile does not cover the function.
+  // Labels unknown to the profile inherit the count of the code before.
+  std::unordered_map<R, double> SpillCosts(F &fun) {
+    auto costs = std::unordered_map<R, double>{};
+    if (!profile_) return costs;
+    auto entry = profile_->BlockCount(fun.GetName(), fun.GetName());
+    if (!entry) return costs;
+    auto count = static_cast<double>(*entry);
+    for (auto &i : fun.GetBody()) {
+      if (auto l = i->IsLabel()) {
+        count = profile_->BlockCount(fun.GetName(), *l).value_or(count);
+      }
+      // temps of instructions that never ran still cost a little
+      for (auto regs : {i->Uses(), i->Defs()}) {
+        for (auto &t : regs) {
+          if (!t.IsMachineReg()) costs[t] += count + 1;
+        }
+      }
+    }
+    for (auto &t : spill_temps_) {
+      costs[t] = std::numeric_limits<double>::max();
+    }
+    return costs;
+  }
+
+  std::stack<R> SimplifyAndSpill(const Interference<Target> &interference,
+                                 std::size_t K,
+                                 const std::unordered_map<R, double> &costs) {
     auto stack = std::stack<R>{};
     auto &graph = interference.GetGraph();
-    auto K = Target::GENERAL_PURPOSE_REGS.size();
     auto low_degrees = std::vector<R>{};
     auto high_degrees = std::unordered_map<R, unsigned>{};
 
@@ -84,6 +137,17 @@ class RegAlloc {
       if (low_degrees.size() > 0) {
         next_temp = low_degrees.back();
         low_degrees.pop_back();
+      } else if (!costs.empty()) {
+        auto min_cost = std::numeric_limits<double>::infinity();
+        for (auto &[t, deg] : high_degrees) {
+          auto it = costs.find(t);
+          auto cost = (it == costs.end() ? 0 : it->second) / deg;
+          if (cost < min_cost) {
+            next_temp = t;
+            min_cost = cost;
+          }
+        }
+        high_degrees.erase(next_temp);
       } else {
         auto max_degree = static_cast<unsigned>(0);
         for (auto &[t, deg] : high_degrees) {
@@ -111,9 +175,10 @@ class RegAlloc {
   }
 
   colour_result Select(const Interference<Target> &interference,
-                       std::stack<R> &stack) {
+                       std::stack<R> &stack, const std::vector<R> &regs) {
     auto result = colour_result{};
     auto &graph = interference.GetGraph();
+    auto &moves = interference.GetMoves();
 
     result.colouring.reserve(graph.size());
     for (const R &t : Target::MACHINE_REGS) {
@@ -121,8 +186,7 @@ class RegAlloc {
     }
 
     auto usable_colours = std::unordered_set<R>{};
-    usable_colours.insert(Target::GENERAL_PURPOSE_REGS.begin(),
-                          Target::GENERAL_PURPOSE_REGS.end());
+    usable_colours.insert(regs.begin(), regs.end());
 
     while (stack.size() > 0) {
       auto s = stack.top();
@@ -135,10 +199,24 @@ class RegAlloc {
           possible_colours.erase(it->second);
         }
       }
-      if (possible_colours.begin() != possible_colours.end()) {
-        result.colouring[s] = *possible_colours.begin();
-      } else {
+      if (possible_colours.begin() == possible_colours.end()) {
         result.spills.push_back(s);
+        continue;
+      }
+      // the first possible colour in the order of the target's registers
+      result.colouring[s] = *std::find_if(
+          regs.begin(), regs.end(),
+          [&](auto r) { return possible_colours.count(r) > 0; });
+
+      // Biased colouring: prefer the colour of a move partner, so that
+      // the move becomes a self move and is removed by renaming.
+      for (const auto &t : moves.GetSuccessors(s)) {
+        auto it = result.colouring.find(t);
+        if (it != result.colouring.end() &&
+            possible_colours.find(it->second) != possible_colours.end()) {
+          result.colouring[s] = it->second;
+          break;
+        }
       }
     }
     return result;
@@ -1,4 +1,6 @@
 #include <iostream>
+#include <string>
+#include <utility>
 
 #include "backend/x86/x86_function.h"
 #include "backend/x86/x86_instr.h"
@@ -63,6 +65,54 @@ std::ostream &operator<<(std::ostream &os, const BinaryInstrKind &cond) {
   return os;
 }
 
+std::ostream &operator<<(std::ostream &os, const TernaryInstrKind &kind) {
+  switch (kind) {
+    case IMUL3:
+      return os << "IMUL";
+    case SHLX:
+      return os << "SHLX";
+    case SHRX:
+      return os << "SHRX";
+    case SARX:
+      return os << "SARX";
+  }
+  return os;
+}
+
+std::ostream &operator<<(std::ostream &os, const VectorInstrKind &kind) {
+  switch (kind) {
+    case MOVDQA:
+      return os << "MOVDQA";
+    case MOVDQU:
+      return os << "MOVDQU";
+    case MOVD:
+      return os << "MOVD";
+    case PSHUFD:
+      return os << "PSHUFD";
+    case PUNPCKLDQ:
+      return os << "PUNPCKLDQ";
+    case PUNPCKLQDQ:
+      return os << "PUNPCKLQDQ";
+    case PADDD:
+      return os << "PADDD";
+    case PSUBD:
+      return os << "PSUBD";
+    case PMULLD:
+      return os << "PMULLD";
+    case PXOR:
+      return os << "PXOR";
+    case VPBROADCASTD:
+      return os << "VPBROADCASTD";
+    case VINSERTI128:
+      return os << "VINSERTI128";
+    case VEXTRACTI128:
+      return os << "VEXTRACTI128";
+    case VZEROUPPER:
+      return os << "VZEROUPPER";
+  }
+  return os;
+}
+
 std::ostream &operator<<(std::ostream &os, const JInstr::Kind &cond) {
   switch (cond) {
     case JInstr::E:
@@ -74,60 +124,98 @@ std::ostream &operator<<(std::ostream &os, const JInstr::Kind &cond) {
     case JInstr::LE:
       return os << "LE";
     case JInstr::G:
-      return os << "GE";
+      return os << "G";
     case JInstr::GE:
       return os << "GE";
     case JInstr::Z:
       return os << "Z";
+    case JInstr::B:
+      return os << "B";
+    case JInstr::BE:
+      return os << "BE";
+    case JInstr::A:
+      return os << "A";
+    case JInstr::AE:
+      return os << "AE";
   }
   return os;
 }
 
-std::ostream &Assem(std::ostream &os, X86Register reg) {
+std::ostream &Assem(std::ostream &os, X86Register reg, bool word64 = false) {
   if (reg.number < NUMBER_OF_REGS) {
-    return os << REG_NAMES[reg.number];
+    return os << (word64 ? REG_NAMES_64 : REG_NAMES)[reg.number];
   } else {
     return os << "t" << reg.number;
   }
 }
 
 // TODO: this breaks abstraction
-std::ostream &Assem(std::ostream &os, const X86Function &f, const Operand &op) {
+std::ostream &Assem(std::ostream &os, const X86Function &f, const Operand &op,
+                    OperandSize size) {
+  // On x86-64, addresses are computed with the 64-bit registers and labels
+  // are addressed relative to RIP.
+  auto x86_64 = f.GetWordSize() == X8664Target::WORD_SIZE;
+  auto ptr = (x86_64 && size == OperandSize::WORD) ? "QWORD PTR ["
+                                                    : "DWORD PTR [";
+  if (size == OperandSize::VECTOR128) ptr = "XMMWORD PTR [";
+  if (size == OperandSize::VECTOR256) ptr = "YMMWORD PTR [";
   switch (op.kind_) {
     case Operand::IMM:
       return os << op.imms_[0];
     case Operand::MEM_BASE:
-      os << "DWORD PTR [ ";
-      Assem(os, op.regs_[0]);
+      os << ptr << " ";
+      Assem(os, op.regs_[0], x86_64);
       if (op.imms_.size() == 1) {
         os << " + " << op.imms_[0];
       }
       return os << " ]";
     case Operand::MEM_INDEX:
-      os << "DWORD PTR [" << op.imms_[0];
+      os << ptr << op.imms_[0];
       os << " * ";
-      Assem(os, op.regs_[0]);
+      Assem(os, op.regs_[0], x86_64);
       if (op.imms_.size() == 2) {
         os << " + " << op.imms_[1];
       }
       return os << "]";
     case Operand::MEM_BASE_INDEX:
-      os << "DWORD PTR [";
-      Assem(os, op.regs_[0]);
+      os << ptr;
+      Assem(os, op.regs_[0], x86_64);
       os << " + " << op.imms_[0] << " * ";
-      Assem(os, op.regs_[1]);
+      Assem(os, op.regs_[1], x86_64);
       if (op.imms_.size() == 2) {
         os << " + " << op.imms_[1];
       }
       return os << "]";
     case Operand::REG:
-      return Assem(os, op.regs_[0]);
+      return Assem(os, op.regs_[0], x86_64 && size == OperandSize::WORD);
     case Operand::FRAMESIZE:
       return os << f.GetFrameSize();
+    case Operand::FRAME_SLOT:
+      if (f.OmitsFramePointer()) {
+        os << ptr << " ";
+        Assem(os, ESP, x86_64);
+        return os << " + " << f.GetFrameSize() + op.imms_[0] << " ]";
+      } else {
+        // EBP points to the saved EBP below the return address
+        os << ptr << " ";
+        Assem(os, EBP, x86_64);
+        return os << " + " << op.imms_[0] + (std::int32_t)f.GetWordSize()
+                  << " ]";
+      }
+    case Operand::MEM_LABEL:
+      return os << ptr << (x86_64 ? "rip + " : "") << *op.label_ << "]";
   }
   return os;
 }
 
+Label ProfileTable() { return Label{"L_profile"}; }
+
+// The profile table L_profile consists of the number of counters, the name
+// of the profile file and a (key, count) pair for each counter.
+std::size_t ProfileCounterOffset(unsigned counter, unsigned word_size) {
+  return word_size * (2 + 2 * counter + 1);
+}
+
 class AssemInstrVisitor : public X86InstrVisitor {
  public:
   AssemInstrVisitor(std::ostream &os, X86Function &function)
@@ -135,18 +223,127 @@ class AssemInstrVisitor : public X86InstrVisitor {
 
   void Visit(UnaryInstr &i) {
     os_ << i.kind << " ";
-    Assem(os_, function_, i.src);
+    Assem(os_, function_, i.src, i.size);
   }
   void Visit(BinaryInstr &i) {
     os_ << i.kind << " ";
-    Assem(os_, function_, i.dst) << ", ";
-    Assem(os_, function_, i.src);
+    Assem(os_, function_, i.dst, i.size) << ", ";
+    auto shift = i.kind == SHL || i.kind == SHR || i.kind == SAL ||
+                 i.kind == SAR;
+    if (shift && i.src.IsReg()) {
+      // the count register
+      os_ << "cl";
+    } else {
+      Assem(os_, function_, i.src, i.size);
+    }
+  }
+  void Visit(TernaryInstr &i) {
+    os_ << i.kind << " ";
+    Assem(os_, function_, i.dst, i.size) << ", ";
+    Assem(os_, function_, i.src, i.size) << ", ";
+    Assem(os_, function_, i.src2, i.size);
   }
   void Visit(LabelInstr &i) { os_ << i.label << ":"; }
-  void Visit(CallInstr &i) { os_ << "CALL " << i.target; }
+  void Visit(CallInstr &i) {
+    os_ << "CALL " << i.target;
+    if (i.stack_map) os_ << std::endl << i.stack_map->return_address << ":";
+  }
+  void Visit(TailCallInstr &i) { os_ << "JMP " << i.target; }
   void Visit(JmpInstr &i) { os_ << "JMP " << i.target; }
   void Visit(JInstr &i) { os_ << "J" << i.cond << " " << i.target; }
+  void Visit(CondInstr &i) {
+    if (i.kind == SET) {
+      os_ << "SET" << i.cond << " ";
+      if (i.dst.IsReg() && i.dst.GetReg().IsMachineReg()) {
+        os_ << REG_NAMES_8[i.dst.GetReg().number];
+      } else {
+        Assem(os_, function_, i.dst, i.size);
+      }
+      return;
+    }
+    os_ << "CMOV" << i.cond << " ";
+    Assem(os_, function_, i.dst, i.size) << ", ";
+    Assem(os_, function_, i.src, i.size);
+  }
   void Visit(RetInstr &i) { os_ << "RET"; }
+  void Visit(VectorInstr &i) {
+    auto sse = i.encoding == VectorEncoding::SSE;
+    auto wide = i.encoding == VectorEncoding::VEX256;
+    auto vector = [this](std::uint8_t v, bool wide) -> std::ostream & {
+      return os_ << (wide ? "ymm" : "xmm") << unsigned{v};
+    };
+    auto size = wide ? OperandSize::VECTOR256 : OperandSize::VECTOR128;
+    // the AVX2 instructions have their V already
+    if (!sse && i.kind < VPBROADCASTD) os_ << "V";
+    os_ << i.kind;
+    switch (i.kind) {
+      case MOVDQA:
+        os_ << " ";
+        vector(i.dst, wide) << ", ";
+        vector(i.src, wide);
+        return;
+      case MOVDQU:
+        os_ << " ";
+        if (i.store) {
+          Assem(os_, function_, i.op, size) << ", ";
+          vector(i.src, wide);
+        } else {
+          vector(i.dst, wide) << ", ";
+          Assem(os_, function_, i.op, size);
+        }
+        return;
+      case MOVD:
+        os_ << " ";
+        if (i.store) {
+          Assem(os_, function_, i.op, OperandSize::INT32) << ", ";
+          vector(i.src, false);
+        } else {
+          vector(i.dst, false) << ", ";
+          Assem(os_, function_, i.op, OperandSize::INT32);
+        }
+        return;
+      case PSHUFD:
+        os_ << " ";
+        vector(i.dst, wide) << ", ";
+        vector(i.src, wide) << ", " << i.op.GetImm();
+        return;
+      case VPBROADCASTD:
+        os_ << " ";
+        vector(i.dst, wide) << ", ";
+        vector(i.src, false);
+        return;
+      case VINSERTI128:
+        os_ << " ";
+        vector(i.dst, true) << ", ";
+        vector(i.dst, true) << ", ";
+        vector(i.src, false) << ", 1";
+        return;
+      case VEXTRACTI128:
+        os_ << " ";
+        vector(i.dst, false) << ", ";
+        vector(i.src, true) << ", 1";
+        return;
+      case VZEROUPPER:
+        return;
+      default:
+        // dst <- dst op src
+        os_ << " ";
+        vector(i.dst, wide) << ", ";
+        if (!sse) vector(i.dst, wide) << ", ";
+        vector(i.src, wide);
+        return;
+    }
+  }
+  void Visit(CountInstr &i) {
+    auto word_size = function_.GetWordSize();
+    if (word_size == X8664Target::WORD_SIZE) {
+      os_ << "INC QWORD PTR [rip + ";
+    } else {
+      os_ << "INC DWORD PTR [";
+    }
+    os_ << ProfileTable() << " + " << ProfileCounterOffset(i.counter, word_size)
+        << "]";
+  }
 
  private:
   std::ostream &os_;
@@ -163,13 +360,94 @@ void AssemFunction(std::ostream &os, X86Function &f) {
   }
 }
 
+void ProfileData(const X86Prg &p, std::vector<X86Data> &data) {
+  auto file = Label{"L_profile$file"};
+  auto key = [](std::size_t i) {
+    return Label{"L_profile$" + std::to_string(i)};
+  };
+  auto table = X86Data{ProfileTable(), true, {}};
+  table.items.push_back(static_cast<std::int32_t>(p.profile_keys.size()));
+  table.items.push_back(file);
+  for (std::size_t i = 0; i < p.profile_keys.size(); i++) {
+    table.items.push_back(key(i));
+    table.items.push_back(0);
+  }
+  data.push_back(std::move(table));
+  data.push_back(X86Data{file, false, {p.profile_file}});
+  for (std::size_t i = 0; i < p.profile_keys.size(); i++) {
+    data.push_back(X86Data{key(i), false, {p.profile_keys[i]}});
+  }
+}
+
+// The table of the stack maps, read by the garbage collector: the number
+// of entries, then for each call the return address, the distance on the
+// stack from the return address to the one of the calling function, the
+// number of roots and their offsets (Operand::FrameSlot) relative to the
+// latter.
+void StackMapData(const X86Prg &p, std::vector<X86Data> &data) {
+  auto table = X86Data{Label{"L_stack_maps"}, true, {0}};
+  auto entries = std::int32_t{0};
+  for (auto &f : p.functions) {
+    std::int32_t size = f->GetWordSize() + f->GetFrameSize() +
+                        (f->OmitsFramePointer() ? 0 : f->GetWordSize());
+    for (auto &i : f->GetBody()) {
+      auto call = dynamic_cast<CallInstr *>(i.get());
+      if (!call || !call->stack_map) continue;
+      auto &roots = call->stack_map->roots;
+      table.items.push_back(call->stack_map->return_address);
+      table.items.push_back(size);
+      table.items.push_back(static_cast<std::int32_t>(roots.size()));
+      table.items.insert(table.items.end(), roots.begin(), roots.end());
+      entries++;
+    }
+  }
+  table.items[0] = entries;
+  if (entries > 0) data.push_back(std::move(table));
+}
+
+std::vector<X86Data> ProgramData(const X86Prg &p) {
+  auto data = std::vector<X86Data>{};
+  StackMapData(p, data);
+  if (!p.profile_keys.empty()) {
+    ProfileData(p, data);
+  }
+  return data;
+}
+
+void AssemData(std::ostream &os, const X86Data &d, unsigned word_size) {
+  auto word = (word_size == X8664Target::WORD_SIZE) ? "  .quad " : "  .long ";
+  if (d.global) os << ".global " << d.label << std::endl;
+  os << d.label << ":" << std::endl;
+  for (auto &item : d.items) {
+    if (auto s = std::get_if<std::string>(&item)) {
+      os << "  .asciz \"" << *s << "\"" << std::endl;
+    } else if (auto l = std::get_if<Label>(&item)) {
+      os << word << *l << std::endl;
+    } else {
+      os << word << std::get<std::int32_t>(item) << std::endl;
+    }
+  }
+}
+
 void AssemPrg(std::ostream &os, X86Prg &p) {
   os << ".intel_syntax noprefix" << std::endl;
   os << ".global Lmain" << std::endl;
+  auto cold = false;
   for (auto &f : p.functions) {
+    if (f->IsCold() != cold) {
+      cold = f->IsCold();
+      os << (cold ? ".section .text.unlikely,\"ax\",@progbits" : ".text")
+         << std::endl;
+    }
     AssemFunction(os, *f);
     os << std::endl;
   }
+  auto data = ProgramData(p);
+  if (!data.empty()) os << ".data" << std::endl;
+  for (auto &d : data) {
+    AssemData(os, d, p.word_size);
+  }
+  os << ".section .note.GNU-stack,\"\",@progbits" << std::endl;
 }
 
 std::ostream &operator<<(std::ostream &os, X86Function &f) {
@@ -0,0 +1,199 @@
+#include "backend/x86/x86_dead_code.h"
+
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "backend/flow.h"
+#include "backend/x86/x86_instr.h"
+#include "backend/x86/x86_target.h"
+
+namespace mjc {
+
+namespace {
+
+// Local slots (locals and spills) have negative offsets. Parameter slots
+// are not considered, since tail calls pass arguments in them.
+bool IsLocalSlot(const Operand &o) {
+  return o.IsFrameSlot() && o.GetFrameSlot() < 0;
+}
+
+struct Live {
+  std::set<X86Register> regs;
+  std::set<std::int32_t> slots;
+
+  bool operator==(const Live &other) const {
+    return regs == other.regs && slots == other.slots;
+  }
+};
+
+// Local slots read and (completely) written by an instruction
+class SlotAccess : public X86InstrVisitor {
+ public:
+  std::vector<std::int32_t> uses;
+  std::vector<std::int32_t> defs;
+
+  void Visit(UnaryInstr &i) {
+    if (!IsLocalSlot(i.src)) return;
+    if (i.kind == POP) {
+      defs.push_back(i.src.GetFrameSlot());
+    } else {
+      uses.push_back(i.src.GetFrameSlot());
+    }
+  }
+  void Visit(BinaryInstr &i) {
+    if (IsLocalSlot(i.src)) uses.push_back(i.src.GetFrameSlot());
+    if (IsLocalSlot(i.dst)) {
+      if (i.kind == MOV) {
+        defs.push_back(i.dst.GetFrameSlot());
+      } else {
+        uses.push_back(i.dst.GetFrameSlot());
+      }
+    }
+  }
+  void Visit(TernaryInstr &i) {
+    if (IsLocalSlot(i.src)) uses.push_back(i.src.GetFrameSlot());
+  }
+  void Visit(LabelInstr &i) {}
+  void Visit(CallInstr &i) {}
+  void Visit(TailCallInstr &i) {}
+  void Visit(JmpInstr &i) {}
+  void Visit(JInstr &i) {}
+  void Visit(CondInstr &i) {
+    if (IsLocalSlot(i.src)) uses.push_back(i.src.GetFrameSlot());
+    if (IsLocalSlot(i.dst)) uses.push_back(i.dst.GetFrameSlot());
+  }
+  void Visit(RetInstr &i) {}
+  void Visit(CountInstr &i) {}
+  void Visit(VectorInstr &i) {
+    if (IsLocalSlot(i.op)) uses.push_back(i.op.GetFrameSlot());
+  }
+};
+
+// Instructions whose only effect is to define registers or local slots
+class IsRemovable : public X86InstrVisitor {
+ public:
+  bool removable = false;
+
+  void Visit(UnaryInstr &i) {
+    removable = (i.kind == NEG || i.kind == NOT || i.kind == INC ||
+                 i.kind == DEC) &&
+                (i.src.IsReg() || IsLocalSlot(i.src));
+  }
+  void Visit(BinaryInstr &i) {
+    if (i.kind == CMP || i.kind == TEST) return;
+    // loads from other memory may fault
+    auto src_ok = !i.src.IsMem() || IsLocalSlot(i.src) || i.kind == LEA;
+    removable = src_ok && (i.dst.IsReg() || IsLocalSlot(i.dst));
+  }
+  void Visit(TernaryInstr &i) {
+    removable = !i.src.IsMem() || IsLocalSlot(i.src);
+  }
+  void Visit(LabelInstr &i) {}
+  void Visit(CallInstr &i) {}
+  void Visit(TailCallInstr &i) {}
+  void Visit(JmpInstr &i) {}
+  void Visit(JInstr &i) {}
+  void Visit(CondInstr &i) {
+    removable = i.dst.IsReg() && (!i.src.IsMem() || IsLocalSlot(i.src));
+  }
+  void Visit(RetInstr &i) {}
+  void Visit(CountInstr &i) {}
+  // the vector registers are not tracked
+  void Visit(VectorInstr &i) {}
+};
+
+// Removes dead instructions once; returns the number of removed ones.
+unsigned RemoveDead(X86Function &f) {
+  auto &body = f.GetBody();
+  auto n = body.size();
+  auto flow = FlowGraph<X86Target>(f);
+
+  auto slot_uses = std::vector<std::vector<std::int32_t>>(n);
+  auto slot_defs = std::vector<std::vector<std::int32_t>>(n);
+  for (std::size_t i = 0; i < n; i++) {
+    auto access = SlotAccess{};
+    body[i]->accept(access);
+    slot_uses[i] = std::move(access.uses);
+    slot_defs[i] = std::move(access.defs);
+  }
+
+  auto live_in = std::vector<Live>(n);
+  auto live_out = std::vector<Live>(n);
+  for (auto change = true; change;) {
+    change = false;
+    for (auto a = n; a-- > 0;) {
+      auto out = Live{};
+      for (auto s : flow.GetGraph().GetSuccessors(a)) {
+        out.regs.insert(live_in[s].regs.begin(), live_in[s].regs.end());
+        out.slots.insert(live_in[s].slots.begin(), live_in[s].slots.end());
+      }
+      auto in = out;
+      for (auto r : body[a]->Defs()) in.regs.erase(r);
+      for (auto s : slot_defs[a]) in.slots.erase(s);
+      for (auto r : body[a]->Uses()) in.regs.insert(r);
+      for (auto s : slot_uses[a]) in.slots.insert(s);
+      if (!(in == live_in[a])) change = true;
+      live_out[a] = std::move(out);
+      live_in[a] = std::move(in);
+    }
+  }
+
+  auto &allocatable = f.GetWordSize() == X8664Target::WORD_SIZE
+                          ? X8664Target::GeneralPurposeRegs(f)
+                          : X86Target::GeneralPurposeRegs(f);
+  auto is_dead = [&](std::size_t i) {
+    auto removable = IsRemovable{};
+    body[i]->accept(removable);
+    if (!removable.removable) return false;
+    // flags for a conditional jump
+    if (i + 1 < n && !body[i + 1]->Jumps().empty() &&
+        body[i + 1]->IsFallThrough())
+      return false;
+    for (auto r : body[i]->Defs()) {
+      if (std::find(allocatable.begin(), allocatable.end(), r) ==
+          allocatable.end())
+        return false;
+      if (live_out[i].regs.count(r) > 0) return false;
+    }
+    for (auto s : slot_defs[i]) {
+      if (live_out[i].slots.count(s) > 0) return false;
+    }
+    return true;
+  };
+
+  auto removed = 0u;
+  auto new_body = std::vector<std::unique_ptr<X86Instr>>{};
+  new_body.reserve(n);
+  for (std::size_t i = 0; i < n; i++) {
+    if (is_dead(i)) {
+      removed++;
+    } else {
+      new_body.push_back(std::move(body[i]));
+    }
+  }
+  std::exchange(body, std::move(new_body));
+  return removed;
+}
+
+}  // namespace
+
+unsigned X86DeadCode::Process(X86Prg &prg) {
+  auto removed = 0u;
+  for (auto &f : prg.functions) {
+    removed += Process(*f);
+  }
+  return removed;
+}
+
+unsigned X86DeadCode::Process(X86Function &f) {
+  auto removed = 0u;
+  while (auto r = RemoveDead(f)) {
+    removed += r;
+  }
+  return removed;
+}
+
+}  // namespace mjc
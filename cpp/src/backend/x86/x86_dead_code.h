@@ -0,0 +1,29 @@
+//
+// Dead code elimination on x86 code after register allocation
+//
+#ifndef MJC_BACKEND_X86DEADCODE_H
+#define MJC_BACKEND_X86DEADCODE_H
+
+#include "backend/x86/x86_function.h"
+#include "backend/x86/x86_prg.h"
+
+namespace mjc {
+
+// Removes instructions without side effects whose results are dead, using
+// liveness of registers and of the local slots of the frame. Calls, stores
+// to memory other than local slots, loads that may fault, instructions that
+// set flags for a following conditional jump and changes of ESP and of the
+// frame pointer are kept.
+//
+// To be run before X86Function::LayoutFrame, which adds the saves of the
+// callee-save registers.
+class X86DeadCode {
+ public:
+  // Returns the number of removed instructions.
+  static unsigned Process(X86Prg &prg);
+  static unsigned Process(X86Function &f);
+};
+
+}  // namespace mjc
+
+#endif
@@ -0,0 +1,343 @@
+#include "backend/x86/x86_elf.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "backend/x86/x86_encoder.h"
+
+namespace mjc {
+
+namespace {
+
+// Constants of the ELF specification
+enum : std::uint32_t {
+  SHT_PROGBITS = 1,
+  SHT_SYMTAB = 2,
+  SHT_STRTAB = 3,
+  SHT_RELA = 4,
+  SHT_REL = 9,
+  SHF_WRITE = 0x1,
+  SHF_ALLOC = 0x2,
+  SHF_EXECINSTR = 0x4,
+  SHF_INFO_LINK = 0x40,
+  STB_LOCAL = 0,
+  STB_GLOBAL = 1,
+  STT_NOTYPE = 0,
+  STT_SECTION = 3,
+  R_386_32 = 1,
+  R_386_PC32 = 2,
+  R_X86_64_64 = 1,
+  R_X86_64_PC32 = 2,
+  R_X86_64_PLT32 = 4,
+};
+
+// Sizes of the structures of ELF32 and ELF64 files
+struct Layout {
+  std::uint32_t header_size;
+  std::uint32_t section_header_size;
+  std::uint32_t symbol_size;
+  std::uint32_t relocation_size;
+};
+
+const Layout ELF32 = {52, 40, 16, 8};
+const Layout ELF64 = {64, 64, 24, 24};
+
+std::string Name(const Label &l) {
+  auto s = std::ostringstream{};
+  s << l;
+  return s.str();
+}
+
+void Put8(std::vector<std::uint8_t> &out, std::uint8_t value) {
+  out.push_back(value);
+}
+
+void Put16(std::vector<std::uint8_t> &out, std::uint16_t value) {
+  Put8(out, value);
+  Put8(out, value >> 8);
+}
+
+void Put32(std::vector<std::uint8_t> &out, std::uint32_t value) {
+  Put16(out, value);
+  Put16(out, value >> 16);
+}
+
+void Put64(std::vector<std::uint8_t> &out, std::uint64_t value) {
+  Put32(out, value);
+  Put32(out, value >> 32);
+}
+
+// An address, offset or size of the file class
+void PutWord(std::vector<std::uint8_t> &out, bool elf64, std::uint64_t value) {
+  if (elf64) return Put64(out, value);
+  Put32(out, value);
+}
+
+// String table, starting with the empty string
+class StringTable {
+ public:
+  std::vector<std::uint8_t> bytes = {0};
+
+  std::uint32_t Add(const std::string &s) {
+    auto offset = static_cast<std::uint32_t>(bytes.size());
+    bytes.insert(bytes.end(), s.begin(), s.end());
+    bytes.push_back(0);
+    return offset;
+  }
+};
+
+struct Section {
+  std::string name;
+  std::uint32_t type;
+  std::uint32_t flags;
+  std::vector<std::uint8_t> bytes;
+  std::uint32_t link = 0;
+  std::uint32_t info = 0;
+  std::uint32_t align = 1;
+  std::uint32_t entry_size = 0;
+};
+
+X86Section DataSection(const std::vector<X86Data> &data, unsigned word_size) {
+  auto section = X86Section{};
+  auto &out = section.bytes;
+  for (auto &d : data) {
+    section.labels.push_back({d.label, (std::uint32_t)out.size()});
+    for (auto &item : d.items) {
+      if (auto s = std::get_if<std::string>(&item)) {
+        out.insert(out.end(), s->begin(), s->end());
+        out.push_back(0);
+      } else if (auto l = std::get_if<Label>(&item)) {
+        section.relocations.push_back(
+            {(std::uint32_t)out.size(), *l, X86Section::ABSOLUTE});
+        PutWord(out, word_size == 8, 0);
+      } else {
+        PutWord(out, word_size == 8, std::get<std::int32_t>(item));
+      }
+    }
+  }
+  return section;
+}
+
+}  // namespace
+
+void X86Elf::Write(std::ostream &os, const X86Prg &prg) {
+  auto elf64 = prg.word_size == 8;
+  auto &layout = elf64 ? ELF64 : ELF32;
+  auto data = ProgramData(prg);
+  auto globals = std::unordered_set<Label>{Label{"Lmain"}};
+  for (auto &d : data) {
+    if (d.global) globals.insert(d.label);
+  }
+
+  // the contents of the sections, hot functions first
+  auto hot = std::vector<const X86Function *>{};
+  auto cold = std::vector<const X86Function *>{};
+  for (auto &f : prg.functions) {
+    (f->IsCold() ? cold : hot).push_back(f.get());
+  }
+  auto contents = std::vector<X86Section>{};
+  auto sections = std::vector<Section>{{"", 0, 0}};
+  contents.push_back(X86Encoder::Encode(hot, globals));
+  sections.push_back({".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR});
+  if (!cold.empty()) {
+    contents.push_back(X86Encoder::Encode(cold, globals));
+    sections.push_back(
+        {".text.unlikely", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR});
+  }
+  contents.push_back(DataSection(data, prg.word_size));
+  sections.push_back({".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE});
+
+  // symbols: the sections, the local labels, then the global labels and
+  // the undefined labels of the runtime
+  struct Symbol {
+    std::uint32_t name;
+    std::uint32_t value;
+    std::uint8_t info;
+    std::uint16_t section;
+  };
+  auto strings = StringTable{};
+  auto symbols = std::vector<Symbol>{{0, 0, 0, 0}};
+  auto section_symbol = std::vector<std::uint32_t>{};
+  for (std::size_t i = 0; i < contents.size(); i++) {
+    section_symbol.push_back(symbols.size());
+    symbols.push_back({0, 0, STT_SECTION, std::uint16_t(i + 1)});
+  }
+  struct Definition {
+    std::size_t section;
+    std::uint32_t offset;
+  };
+  auto definitions = std::unordered_map<Label, Definition>{};
+  for (std::size_t i = 0; i < contents.size(); i++) {
+    for (auto &[l, offset] : contents[i].labels) {
+      definitions[l] = {i, offset};
+      if (globals.count(l) > 0) continue;
+      symbols.push_back({strings.Add(Name(l)), offset,
+                         STB_LOCAL << 4 | STT_NOTYPE, std::uint16_t(i + 1)});
+    }
+  }
+  auto first_global = static_cast<std::uint32_t>(symbols.size());
+  auto global_symbol = std::unordered_map<Label, std::uint32_t>{};
+  auto add_global = [&](const Label &l) {
+    if (global_symbol.count(l) > 0) return;
+    auto d = definitions.find(l);
+    global_symbol[l] = symbols.size();
+    auto symbol =
+        Symbol{strings.Add(Name(l)), 0, STB_GLOBAL << 4 | STT_NOTYPE, 0};
+    if (d != definitions.end()) {
+      symbol.value = d->second.offset;
+      symbol.section = d->second.section + 1;
+    }
+    symbols.push_back(symbol);
+  };
+  for (auto &c : contents) {
+    for (auto &[l, offset] : c.labels) {
+      if (globals.count(l) > 0) add_global(l);
+    }
+  }
+
+  // relocations against local labels refer to their section, with the
+  // offset of the label added to the addend. ELF64 keeps the addends in the
+  // relocations and zeros in the section.
+  for (std::size_t i = 0; i < contents.size(); i++) {
+    auto &c = contents[i];
+    if (c.relocations.empty()) continue;
+    auto rel = elf64 ? Section{".rela" + sections[i + 1].name, SHT_RELA,
+                               SHF_INFO_LINK}
+                     : Section{".rel" + sections[i + 1].name, SHT_REL,
+                               SHF_INFO_LINK};
+    rel.info = i + 1;
+    rel.align = elf64 ? 8 : 4;
+    rel.entry_size = layout.relocation_size;
+    for (auto &r : c.relocations) {
+      auto d = definitions.find(r.label);
+      auto local = d != definitions.end() && globals.count(r.label) == 0;
+      auto type = std::uint32_t{0};
+      if (!elf64) {
+        type = r.kind == X86Section::ABSOLUTE ? R_386_32 : R_386_PC32;
+      } else if (r.kind == X86Section::ABSOLUTE) {
+        type = R_X86_64_64;
+      } else {
+        type = r.kind == X86Section::BRANCH && !local ? R_X86_64_PLT32
+                                                      : R_X86_64_PC32;
+      }
+      auto size = elf64 && r.kind == X86Section::ABSOLUTE ? 8 : 4;
+      auto addend = std::int64_t{0};
+      for (auto k = 0; k < size; k++) {
+        addend |= std::int64_t{c.bytes[r.offset + k]} << (8 * k);
+      }
+      if (size == 4) addend = std::int32_t(addend);
+      auto symbol = std::uint32_t{0};
+      if (local) {
+        symbol = section_symbol[d->second.section];
+        addend += d->second.offset;
+      } else {
+        add_global(r.label);
+        symbol = global_symbol[r.label];
+      }
+      for (auto k = 0; k < size; k++) {
+        c.bytes[r.offset + k] = elf64 ? 0 : addend >> (8 * k);
+      }
+      if (elf64) {
+        Put64(rel.bytes, r.offset);
+        Put64(rel.bytes, std::uint64_t{symbol} << 32 | type);
+        Put64(rel.bytes, addend);
+      } else {
+        Put32(rel.bytes, r.offset);
+        Put32(rel.bytes, symbol << 8 | type);
+      }
+    }
+    sections.push_back(std::move(rel));
+  }
+  for (std::size_t i = 0; i < contents.size(); i++) {
+    sections[i + 1].bytes = std::move(contents[i].bytes);
+  }
+  // the stack need not be executable
+  sections.push_back({".note.GNU-stack", SHT_PROGBITS, 0});
+
+  auto symtab = Section{".symtab", SHT_SYMTAB, 0};
+  symtab.align = elf64 ? 8 : 4;
+  symtab.entry_size = layout.symbol_size;
+  symtab.info = first_global;
+  for (auto &s : symbols) {
+    Put32(symtab.bytes, s.name);
+    if (elf64) {
+      Put8(symtab.bytes, s.info);
+      Put8(symtab.bytes, 0);  // visibility
+      Put16(symtab.bytes, s.section);
+      Put64(symtab.bytes, s.value);
+      Put64(symtab.bytes, 0);  // size
+    } else {
+      Put32(symtab.bytes, s.value);
+      Put32(symtab.bytes, 0);  // size
+      Put8(symtab.bytes, s.info);
+      Put8(symtab.bytes, 0);  // visibility
+      Put16(symtab.bytes, s.section);
+    }
+  }
+  auto symtab_index = static_cast<std::uint32_t>(sections.size());
+  symtab.link = symtab_index + 1;
+  for (auto &s : sections) {
+    if (s.type == SHT_REL || s.type == SHT_RELA) s.link = symtab_index;
+  }
+  sections.push_back(std::move(symtab));
+  sections.push_back({".strtab", SHT_STRTAB, 0, std::move(strings.bytes)});
+  auto names = StringTable{};
+  auto name_offsets = std::vector<std::uint32_t>{};
+  sections.push_back({".shstrtab", SHT_STRTAB, 0});
+  for (auto &s : sections) name_offsets.push_back(names.Add(s.name));
+  sections.back().bytes = std::move(names.bytes);
+
+  // the file: header, contents of the sections, section headers
+  auto out = std::vector<std::uint8_t>(layout.header_size);
+  auto offsets = std::vector<std::uint32_t>{};
+  for (auto &s : sections) {
+    while (out.size() % s.align != 0) out.push_back(0);
+    offsets.push_back(out.size());
+    out.insert(out.end(), s.bytes.begin(), s.bytes.end());
+  }
+  while (out.size() % (elf64 ? 8 : 4) != 0) out.push_back(0);
+  auto section_headers = static_cast<std::uint32_t>(out.size());
+  for (std::size_t i = 0; i < sections.size(); i++) {
+    auto &s = sections[i];
+    auto empty = i == 0;
+    Put32(out, empty ? 0 : name_offsets[i]);
+    Put32(out, s.type);
+    PutWord(out, elf64, s.flags);
+    PutWord(out, elf64, 0);  // address
+    PutWord(out, elf64, empty ? 0 : offsets[i]);
+    PutWord(out, elf64, s.bytes.size());
+    Put32(out, s.link);
+    Put32(out, s.info);
+    PutWord(out, elf64, empty ? 0 : s.align);
+    PutWord(out, elf64, s.entry_size);
+  }
+
+  auto header = std::vector<std::uint8_t>{0x7f, 'E', 'L', 'F',
+                                          std::uint8_t(elf64 ? 2 : 1),
+                                          1,  // little endian
+                                          1,  // version
+                                          0, 0, 0, 0, 0, 0, 0, 0, 0};
+  Put16(header, 1);                // relocatable
+  Put16(header, elf64 ? 62 : 3);  // x86-64 or i386
+  Put32(header, 1);                // version
+  PutWord(header, elf64, 0);       // entry point
+  PutWord(header, elf64, 0);       // program headers
+  PutWord(header, elf64, section_headers);
+  Put32(header, 0);  // flags
+  Put16(header, layout.header_size);
+  Put16(header, 0);  // size and number of program headers
+  Put16(header, 0);
+  Put16(header, layout.section_header_size);
+  Put16(header, sections.size());
+  Put16(header, sections.size() - 1);  // .shstrtab
+  std::copy(header.begin(), header.end(), out.begin());
+
+  os.write(reinterpret_cast<const char *>(out.data()), out.size());
+}
+
+}  // namespace mjc
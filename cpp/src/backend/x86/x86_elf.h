@@ -0,0 +1,25 @@
+//
+// ELF object files for x86 programs
+//
+#ifndef MJC_BACKEND_X86ELF_H
+#define MJC_BACKEND_X86ELF_H
+
+#include <iostream>
+
+#include "backend/x86/x86_prg.h"
+
+namespace mjc {
+
+// Writes a program as an ELF32 relocatable object file for Linux on i386,
+// or as an ELF64 one for x86-64 if its word size is 8, with the same
+// sections, symbols and relocations that the GNU assembler produces for the
+// text of AssemPrg. References to labels in other
+// sections and to the runtime are left to the linker.
+class X86Elf {
+ public:
+  static void Write(std::ostream &os, const X86Prg &prg);
+};
+
+}  // namespace mjc
+
+#endif
@@ -0,0 +1,724 @@
+#include "backend/x86/x86_encoder.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <optional>
+#include <unordered_map>
+
+#include "backend/x86/x86_instr.h"
+#include "backend/x86/x86_prg.h"
+#include "backend/x86/x86_target.h"
+
+namespace mjc {
+
+namespace {
+
+// Numbers of the registers in the encoding. The fourth bit of the numbers
+// of R8 to R15 goes to the REX prefix.
+const std::uint8_t REG_CODES[] = {0, 3, 1, 2, 6, 7, 5, 4,
+                                  8, 9, 10, 11, 12, 13, 14, 15};
+
+std::uint8_t Code(X86Register r) {
+  assert(r.IsMachineReg());
+  return REG_CODES[r.number];
+}
+
+bool IsByte(std::int64_t value) { return -128 <= value && value <= 127; }
+
+std::uint8_t ConditionCode(JInstr::Kind cond) {
+  switch (cond) {
+    case JInstr::E:
+    case JInstr::Z:
+      return 0x4;
+    case JInstr::NE:
+      return 0x5;
+    case JInstr::L:
+      return 0xc;
+    case JInstr::LE:
+      return 0xe;
+    case JInstr::G:
+      return 0xf;
+    case JInstr::GE:
+      return 0xd;
+    case JInstr::B:
+      return 0x2;
+    case JInstr::BE:
+      return 0x6;
+    case JInstr::A:
+      return 0x7;
+    case JInstr::AE:
+      return 0x3;
+  }
+  abort();
+}
+
+// A memory operand with the frame slots resolved
+struct Address {
+  std::optional<X86Register> base;
+  std::optional<X86Register> index;
+  std::uint8_t scale = 0;  // log2 of the factor of the index
+  std::int32_t disp = 0;
+  std::optional<Label> label;  // absolute address, plus disp
+};
+
+std::uint8_t Log2(std::int32_t scale) {
+  switch (scale) {
+    case 1:
+      return 0;
+    case 2:
+      return 1;
+    case 4:
+      return 2;
+    case 8:
+      return 3;
+  }
+  abort();
+}
+
+Address ToAddress(const X86Function &f, const Operand &op) {
+  auto &regs = op.GetRegs();
+  auto &imms = op.GetImms();
+  auto a = Address{};
+  switch (op.GetKind()) {
+    case Operand::MEM_BASE:
+      a.base = regs[0];
+      if (imms.size() == 1) a.disp = imms[0];
+      return a;
+    case Operand::MEM_INDEX:
+      a.index = regs[0];
+      a.scale = Log2(imms[0]);
+      if (imms.size() == 2) a.disp = imms[1];
+      return a;
+    case Operand::MEM_BASE_INDEX:
+      a.base = regs[0];
+      a.index = regs[1];
+      a.scale = Log2(imms[0]);
+      if (imms.size() == 2) a.disp = imms[1];
+      return a;
+    case Operand::FRAME_SLOT:
+      // as in Assem
+      if (f.OmitsFramePointer()) {
+        a.base = ESP;
+        a.disp = f.GetFrameSize() + imms[0];
+      } else {
+        a.base = EBP;
+        a.disp = imms[0] + f.GetWordSize();
+      }
+      return a;
+    case Operand::MEM_LABEL:
+      a.label = op.GetLabel();
+      return a;
+    default:
+      assert(false);
+      abort();
+  }
+}
+
+// A jump whose encoding depends on the distance to its target
+struct Jump {
+  std::optional<JInstr::Kind> cond;  // none for JMP
+  Label target;
+  bool near = false;
+
+  std::uint32_t Size() const { return near ? (cond ? 6 : 5) : 2; }
+};
+
+// Instructions between labels, possibly ending with a jump
+struct Chunk {
+  std::vector<Label> labels;  // at the start
+  std::vector<std::uint8_t> bytes;
+  std::vector<X86Section::Relocation> relocations;  // offsets in bytes
+  std::optional<Jump> jump;  // after the bytes
+};
+
+void Patch(std::vector<std::uint8_t> &bytes, std::uint32_t offset,
+           std::int32_t value) {
+  for (auto k = 0; k < 4; k++) {
+    bytes[offset + k] = (std::uint32_t)value >> (8 * k);
+  }
+}
+
+std::int32_t Read(const std::vector<std::uint8_t> &bytes,
+                  std::uint32_t offset) {
+  auto value = std::uint32_t{0};
+  for (auto k = 0; k < 4; k++) {
+    value |= std::uint32_t{bytes[offset + k]} << (8 * k);
+  }
+  return value;
+}
+
+class EncodeVisitor : public X86InstrVisitor {
+ public:
+  explicit EncodeVisitor(std::vector<Chunk> &chunks) : chunks_(chunks) {}
+
+  void SetFunction(const X86Function &f) {
+    function_ = &f;
+    x86_64_ = f.GetWordSize() == X8664Target::WORD_SIZE;
+  }
+
+  void Define(const Label &l) {
+    auto &c = chunks_.back();
+    if (!c.bytes.empty() || c.jump) chunks_.emplace_back();
+    chunks_.back().labels.push_back(l);
+  }
+
+  void Visit(UnaryInstr &i) {
+    Encode(i);
+    FinishRipRelative();
+  }
+
+  void Visit(BinaryInstr &i) {
+    Encode(i);
+    FinishRipRelative();
+  }
+
+  void Visit(TernaryInstr &i) {
+    Encode(i);
+    FinishRipRelative();
+  }
+
+  void Visit(LabelInstr &i) { Define(i.label); }
+
+  void Visit(CallInstr &i) {
+    Byte(0xe8);
+    Relative(i.target, X86Section::BRANCH);
+    if (i.stack_map) Define(i.stack_map->return_address);
+  }
+
+  void Visit(TailCallInstr &i) { End(Jump{std::nullopt, i.target}); }
+
+  void Visit(JmpInstr &i) { End(Jump{std::nullopt, i.target}); }
+
+  void Visit(JInstr &i) { End(Jump{i.cond, i.target}); }
+
+  void Visit(CondInstr &i) {
+    auto cc = ConditionCode(i.cond);
+    if (i.kind == SET) {
+      // without REX, the codes of ESI to ESP denote DH to AH
+      auto code = Code(i.dst.GetReg());
+      if (code >= 4) {
+        assert(x86_64_);
+        Byte(0x40 | code >> 3);
+      }
+      Bytes({0x0f, std::uint8_t(0x90 + cc)});
+      return ModRM(0, i.dst);
+    }
+    Rex(i.size, Code(i.dst.GetReg()), i.src);
+    Bytes({0x0f, std::uint8_t(0x40 + cc)});
+    ModRM(Code(i.dst.GetReg()), i.src);
+    FinishRipRelative();
+  }
+
+  void Visit(RetInstr &i) { Byte(0xc3); }
+
+  void Visit(VectorInstr &i) {
+    Encode(i);
+    FinishRipRelative();
+  }
+
+  void Visit(CountInstr &i) {
+    auto counter = Operand::Mem(ProfileTable());
+    auto a = Address{};
+    a.label = ProfileTable();
+    a.disp = ProfileCounterOffset(i.counter, function_->GetWordSize());
+    Rex(OperandSize::WORD, 0, counter);
+    Byte(0xff);
+    ModRM(0, a);
+    FinishRipRelative();
+  }
+
+ private:
+  std::vector<Chunk> &chunks_;
+  const X86Function *function_ = nullptr;
+  bool x86_64_ = false;
+  // offset of the displacement of a RIP-relative operand in the current
+  // instruction
+  std::optional<std::uint32_t> rip_relative_;
+
+  void Encode(UnaryInstr &i) {
+    auto &src = i.src;
+    auto size = i.size;
+    switch (i.kind) {
+      case PUSH:
+        // the operand of PUSH and POP has 64 bits without REX.W
+        if (src.IsReg()) {
+          Rex(OperandSize::INT32, 0, src);
+          return Byte(0x50 + (Code(src.GetReg()) & 7));
+        }
+        if (auto imm = Immediate(src)) {
+          if (IsByte(*imm)) return Bytes({0x6a, std::uint8_t(*imm)});
+          Byte(0x68);
+          return Word(*imm);
+        }
+        return Opcode(OperandSize::INT32, 0xff, 6, src);
+      case POP:
+        if (src.IsReg()) {
+          Rex(OperandSize::INT32, 0, src);
+          return Byte(0x58 + (Code(src.GetReg()) & 7));
+        }
+        return Opcode(OperandSize::INT32, 0x8f, 0, src);
+      case NEG:
+        return Opcode(size, 0xf7, 3, src);
+      case NOT:
+        return Opcode(size, 0xf7, 2, src);
+      case INC:
+        // the short forms are REX prefixes on x86-64
+        if (src.IsReg() && !x86_64_) return Byte(0x40 + Code(src.GetReg()));
+        return Opcode(size, 0xff, 0, src);
+      case DEC:
+        if (src.IsReg() && !x86_64_) return Byte(0x48 + Code(src.GetReg()));
+        return Opcode(size, 0xff, 1, src);
+      case IDIV:
+        return Opcode(size, 0xf7, 7, src);
+    }
+  }
+
+  void Encode(BinaryInstr &i) {
+    auto &dst = i.dst;
+    auto &src = i.src;
+    auto size = i.size;
+    auto imm = Immediate(src);
+    switch (i.kind) {
+      case MOV:
+        if (imm && dst.IsReg()) {
+          // a sign-extended immediate for 64 bits
+          if (x86_64_ && size == OperandSize::WORD) {
+            Opcode(size, 0xc7, 0, dst);
+            return Word(*imm);
+          }
+          Rex(size, 0, dst);
+          Byte(0xb8 + (Code(dst.GetReg()) & 7));
+          return Word(*imm);
+        }
+        if (imm) {
+          Opcode(size, 0xc7, 0, dst);
+          return Word(*imm);
+        }
+        // the accumulator has a short form for absolute addresses
+        if (!x86_64_ && src.IsReg() && src.GetReg() == EAX &&
+            dst.GetKind() == Operand::MEM_LABEL) {
+          Byte(0xa3);
+          return Absolute(dst.GetLabel(), 0);
+        }
+        if (!x86_64_ && dst.IsReg() && dst.GetReg() == EAX &&
+            src.GetKind() == Operand::MEM_LABEL) {
+          Byte(0xa1);
+          return Absolute(src.GetLabel(), 0);
+        }
+        if (src.IsReg()) return Opcode(size, 0x89, Code(src.GetReg()), dst);
+        return Opcode(size, 0x8b, Code(dst.GetReg()), src);
+      case ADD:
+        return Arithmetic(size, 0, dst, src);
+      case OR:
+        return Arithmetic(size, 1, dst, src);
+      case AND:
+        return Arithmetic(size, 4, dst, src);
+      case SUB:
+        return Arithmetic(size, 5, dst, src);
+      case XOR:
+        return Arithmetic(size, 6, dst, src);
+      case CMP:
+        return Arithmetic(size, 7, dst, src);
+      case TEST:
+        if (imm && dst.IsReg() && dst.GetReg() == EAX) {
+          Rex(size, 0, dst);
+          Byte(0xa9);
+          return Word(*imm);
+        }
+        if (imm) {
+          Opcode(size, 0xf7, 0, dst);
+          return Word(*imm);
+        }
+        if (src.IsReg()) return Opcode(size, 0x85, Code(src.GetReg()), dst);
+        return Opcode(size, 0x85, Code(dst.GetReg()), src);
+      case SHL:
+      case SAL:
+        return Shift(size, 4, dst, src);
+      case SHR:
+        return Shift(size, 5, dst, src);
+      case SAR:
+        return Shift(size, 7, dst, src);
+      case LEA:
+        return Opcode(size, 0x8d, Code(dst.GetReg()), src);
+      case IMUL:
+        if (imm && IsByte(*imm)) {
+          Opcode(size, 0x6b, Code(dst.GetReg()), dst);
+          return Byte(*imm);
+        }
+        if (imm) {
+          Opcode(size, 0x69, Code(dst.GetReg()), dst);
+          return Word(*imm);
+        }
+        Rex(size, Code(dst.GetReg()), src);
+        Byte(0x0f);
+        Byte(0xaf);
+        return ModRM(Code(dst.GetReg()), src);
+    }
+  }
+
+  void Encode(TernaryInstr &i) {
+    auto reg = Code(i.dst.GetReg());
+    if (i.kind == IMUL3) {
+      auto imm = i.src2.GetImm();
+      Opcode(i.size, IsByte(imm) ? 0x6b : 0x69, reg, i.src);
+      return IsByte(imm) ? Byte(imm) : Word(imm);
+    }
+    // VEX prefix with the inverted fourth bits of the registers, the map
+    // 0F38, the count register and the mandatory prefix
+    std::uint8_t rxb = (reg >> 3) << 2;
+    if (i.src.IsReg()) {
+      rxb |= Code(i.src.GetReg()) >> 3;
+    } else {
+      auto a = ToAddress(*function_, i.src);
+      if (a.index) rxb |= (Code(*a.index) >> 3) << 1;
+      if (a.base) rxb |= Code(*a.base) >> 3;
+    }
+    auto count = Code(i.src2.GetReg());
+    std::uint8_t pp = i.kind == SHLX ? 1 : (i.kind == SARX ? 2 : 3);
+    std::uint8_t w = i.size == OperandSize::WORD && x86_64_ ? 0x80 : 0;
+    Bytes({0xc4, std::uint8_t((~rxb & 7) << 5 | 0x02),
+           std::uint8_t(w | (~count & 15) << 3 | pp), 0xf7});
+    ModRM(reg, i.src);
+  }
+
+  // The legacy form is [66|F3] [REX] 0F [38|3A] opcode ModRM, the VEX form
+  // has the second operand of the three-operand instructions in VEX.vvvv.
+  // The operand in the ModRM byte is op, or else the vector register rm.
+  void Encode(VectorInstr &i) {
+    std::uint8_t pp = 1;   // 66
+    std::uint8_t map = 1;  // 0F
+    std::uint8_t opcode = 0;
+    std::uint8_t reg = i.dst;
+    std::uint8_t rm = i.src;
+    std::uint8_t vvvv = 0;  // none
+    auto op = static_cast<const Operand *>(nullptr);
+    auto imm = std::optional<std::uint8_t>{};
+    switch (i.kind) {
+      case MOVDQA:
+        opcode = 0x6f;
+        break;
+      case MOVDQU:
+      case MOVD:
+        if (i.kind == MOVDQU) pp = 2;  // F3
+        opcode = i.kind == MOVDQU ? (i.store ? 0x7f : 0x6f)
+                                  : (i.store ? 0x7e : 0x6e);
+        if (i.store) reg = i.src;
+        op = &i.op;
+        break;
+      case PSHUFD:
+        opcode = 0x70;
+        imm = i.op.GetImm();
+        break;
+      case PUNPCKLDQ:
+        opcode = 0x62;
+        vvvv = i.dst;
+        break;
+      case PUNPCKLQDQ:
+        opcode = 0x6c;
+        vvvv = i.dst;
+        break;
+      case PADDD:
+        opcode = 0xfe;
+        vvvv = i.dst;
+        break;
+      case PSUBD:
+        opcode = 0xfa;
+        vvvv = i.dst;
+        break;
+      case PMULLD:
+        map = 2;
+        opcode = 0x40;
+        vvvv = i.dst;
+        break;
+      case PXOR:
+        opcode = 0xef;
+        vvvv = i.dst;
+        break;
+      case VPBROADCASTD:
+        map = 2;
+        opcode = 0x58;
+        break;
+      case VINSERTI128:
+        map = 3;
+        opcode = 0x38;
+        vvvv = i.dst;
+        imm = 1;
+        break;
+      case VEXTRACTI128:
+        map = 3;
+        opcode = 0x39;
+        reg = i.src;
+        rm = i.dst;
+        imm = 1;
+        break;
+      case VZEROUPPER:
+        return Bytes({0xc5, 0xf8, 0x77});
+    }
+    if (i.encoding == VectorEncoding::SSE) {
+      Byte(pp == 1 ? 0x66 : 0xf3);
+      if (op) Rex(OperandSize::INT32, reg, *op);
+      Byte(0x0f);
+      if (map > 1) Byte(map == 2 ? 0x38 : 0x3a);
+    } else {
+      std::uint8_t xb = 0;
+      if (op && op->IsReg()) {
+        xb = Code(op->GetReg()) >> 3;
+      } else if (op) {
+        auto a = ToAddress(*function_, *op);
+        if (a.index) xb |= (Code(*a.index) >> 3) << 1;
+        if (a.base) xb |= Code(*a.base) >> 3;
+      }
+      std::uint8_t l = i.encoding == VectorEncoding::VEX256 ? 0x04 : 0;
+      std::uint8_t last = (~vvvv & 15) << 3 | l | pp;
+      // the two-byte form for the map 0F
+      if (map == 1 && xb == 0) {
+        Bytes({0xc5, std::uint8_t(0x80 | last)});
+      } else {
+        Bytes({0xc4, std::uint8_t(0x80 | (~xb & 3) << 5 | map), last});
+      }
+    }
+    Byte(opcode);
+    if (op) {
+      ModRM(reg, *op);
+    } else {
+      Byte(0xc0 | (reg & 7) << 3 | (rm & 7));
+    }
+    if (imm) Byte(*imm);
+  }
+
+  std::vector<std::uint8_t> &Out() {
+    if (chunks_.back().jump) chunks_.emplace_back();
+    return chunks_.back().bytes;
+  }
+
+  void Byte(std::uint8_t b) { Out().push_back(b); }
+
+  void Bytes(std::initializer_list<std::uint8_t> bs) {
+    Out().insert(Out().end(), bs);
+  }
+
+  void Word(std::int32_t w) {
+    for (auto k = 0; k < 32; k += 8) Byte((std::uint32_t)w >> k);
+  }
+
+  void Absolute(const Label &l, std::int32_t addend) {
+    auto offset = static_cast<std::uint32_t>(Out().size());
+    chunks_.back().relocations.push_back({offset, l, X86Section::ABSOLUTE});
+    Word(addend);
+  }
+
+  // relative to the end of the word
+  void Relative(const Label &l, X86Section::RelocationKind kind,
+                std::int32_t addend = 0) {
+    auto offset = static_cast<std::uint32_t>(Out().size());
+    chunks_.back().relocations.push_back({offset, l, kind});
+    Word(addend - 4);
+  }
+
+  // A RIP-relative displacement is relative to the end of the instruction,
+  // which may have an immediate after it.
+  void FinishRipRelative() {
+    if (!rip_relative_) return;
+    auto &out = Out();
+    auto offset = *rip_relative_;
+    Patch(out, offset, Read(out, offset) + 4 - (out.size() - offset));
+    rip_relative_.reset();
+  }
+
+  void End(Jump j) {
+    Out();
+    chunks_.back().jump = std::move(j);
+  }
+
+  std::optional<std::int32_t> Immediate(const Operand &op) {
+    if (op.IsImm()) return op.GetImm();
+    if (op.GetKind() == Operand::FRAMESIZE) return function_->GetFrameSize();
+    return std::nullopt;
+  }
+
+  // The REX prefix on x86-64 for 64-bit operands and for the fourth bits of
+  // the register field and of the registers of the other operand
+  void Rex(OperandSize size, std::uint8_t reg, const Operand &rm) {
+    if (!x86_64_) return;
+    std::uint8_t rex = (size == OperandSize::WORD ? 0x08 : 0) | (reg >> 3) << 2;
+    if (rm.IsReg()) {
+      rex |= Code(rm.GetReg()) >> 3;
+    } else if (rm.IsMem()) {
+      auto a = ToAddress(*function_, rm);
+      if (a.index) rex |= (Code(*a.index) >> 3) << 1;
+      if (a.base) rex |= Code(*a.base) >> 3;
+    }
+    if (rex != 0) Byte(0x40 | rex);
+  }
+
+  // ModRM byte with the given register field, followed by the SIB byte and
+  // the displacement of a memory operand
+  void ModRM(std::uint8_t reg, const Address &a) {
+    reg = (reg & 7) << 3;
+    if (a.label) {
+      Byte(reg | 0x05);
+      if (!x86_64_) return Absolute(*a.label, a.disp);
+      rip_relative_ = Out().size();
+      return Relative(*a.label, X86Section::RELATIVE, a.disp);
+    }
+    if (!a.base) {
+      Bytes({std::uint8_t(reg | 0x04),
+             std::uint8_t(a.scale << 6 | (Code(*a.index) & 7) << 3 | 0x05)});
+      return Word(a.disp);
+    }
+    auto base = Code(*a.base) & 7;
+    std::uint8_t mod = 0x80;
+    // EBP and R13 as base need a displacement
+    if (a.disp == 0 && base != 5) {
+      mod = 0x00;
+    } else if (IsByte(a.disp)) {
+      mod = 0x40;
+    }
+    if (a.index) {
+      Bytes({std::uint8_t(mod | reg | 0x04),
+             std::uint8_t(a.scale << 6 | (Code(*a.index) & 7) << 3 | base)});
+    } else if (base == 4) {
+      // ESP and R12 as base need a SIB byte
+      Bytes({std::uint8_t(mod | reg | 0x04), 0x24});
+    } else {
+      Byte(mod | reg | base);
+    }
+    if (mod == 0x40) Byte(a.disp);
+    if (mod == 0x80) Word(a.disp);
+  }
+
+  void ModRM(std::uint8_t reg, const Operand &rm) {
+    if (rm.IsReg()) {
+      return Byte(0xc0 | (reg & 7) << 3 | (Code(rm.GetReg()) & 7));
+    }
+    ModRM(reg, ToAddress(*function_, rm));
+  }
+
+  void Opcode(OperandSize size, std::uint8_t opcode, std::uint8_t reg,
+              const Operand &rm) {
+    Rex(size, reg, rm);
+    Byte(opcode);
+    ModRM(reg, rm);
+  }
+
+  // ADD, OR, AND, SUB, XOR and CMP, selected by the opcode extension
+  void Arithmetic(OperandSize size, std::uint8_t ext, const Operand &dst,
+                  const Operand &src) {
+    if (auto imm = Immediate(src)) {
+      if (IsByte(*imm)) {
+        Opcode(size, 0x83, ext, dst);
+        return Byte(*imm);
+      }
+      if (dst.IsReg() && dst.GetReg() == EAX) {
+        Rex(size, 0, dst);
+        Byte(ext << 3 | 0x05);
+        return Word(*imm);
+      }
+      Opcode(size, 0x81, ext, dst);
+      return Word(*imm);
+    }
+    if (src.IsReg()) {
+      return Opcode(size, ext << 3 | 0x01, Code(src.GetReg()), dst);
+    }
+    Opcode(size, ext << 3 | 0x03, Code(dst.GetReg()), src);
+  }
+
+  void Shift(OperandSize size, std::uint8_t ext, const Operand &dst,
+             const Operand &src) {
+    if (!src.IsImm()) {
+      assert(src.IsReg() && src.GetReg() == ECX);
+      return Opcode(size, 0xd3, ext, dst);
+    }
+    if (src.GetImm() == 1) return Opcode(size, 0xd1, ext, dst);
+    Opcode(size, 0xc1, ext, dst);
+    Byte(src.GetImm());
+  }
+};
+
+}  // namespace
+
+X86Section X86Encoder::Encode(
+    const std::vector<const X86Function *> &functions,
+    const std::unordered_set<Label> &globals) {
+  auto chunks = std::vector<Chunk>(1);
+  auto visitor = EncodeVisitor{chunks};
+  for (auto f : functions) {
+    visitor.SetFunction(*f);
+    visitor.Define(f->GetName());
+    for (auto &i : f->GetBody()) {
+      i->accept(visitor);
+    }
+  }
+
+  // Jumps to labels outside of the section are near. The others start
+  // short and become near while their target is out of reach.
+  auto chunk_of = std::unordered_map<Label, std::size_t>{};
+  for (std::size_t i = 0; i < chunks.size(); i++) {
+    for (auto &l : chunks[i].labels) chunk_of[l] = i;
+  }
+  auto resolved = [&](const Label &l) {
+    return chunk_of.count(l) > 0 && globals.count(l) == 0;
+  };
+  for (auto &c : chunks) {
+    if (c.jump && !resolved(c.jump->target)) c.jump->near = true;
+  }
+  auto offsets = std::vector<std::uint32_t>(chunks.size() + 1);
+  for (auto changed = true; changed;) {
+    changed = false;
+    for (std::size_t i = 0; i < chunks.size(); i++) {
+      auto &c = chunks[i];
+      offsets[i + 1] =
+          offsets[i] + c.bytes.size() + (c.jump ? c.jump->Size() : 0);
+    }
+    for (std::size_t i = 0; i < chunks.size(); i++) {
+      auto &j = chunks[i].jump;
+      if (!j || j->near) continue;
+      std::int64_t distance =
+          std::int64_t{offsets[chunk_of[j->target]]} - offsets[i + 1];
+      if (!IsByte(distance)) {
+        j->near = true;
+        changed = true;
+      }
+    }
+  }
+
+  auto section = X86Section{};
+  auto &out = section.bytes;
+  for (std::size_t i = 0; i < chunks.size(); i++) {
+    auto &c = chunks[i];
+    for (auto &l : c.labels) section.labels.push_back({l, offsets[i]});
+    out.insert(out.end(), c.bytes.begin(), c.bytes.end());
+    for (auto r : c.relocations) {
+      r.offset += offsets[i];
+      if (r.kind != X86Section::ABSOLUTE && resolved(r.label)) {
+        Patch(out, r.offset,
+              offsets[chunk_of[r.label]] + Read(out, r.offset) - r.offset);
+      } else {
+        section.relocations.push_back(std::move(r));
+      }
+    }
+    if (!c.jump) continue;
+    auto &j = *c.jump;
+    if (!j.near) {
+      out.push_back(j.cond ? 0x70 + ConditionCode(*j.cond) : 0xeb);
+      out.push_back(offsets[chunk_of[j.target]] - offsets[i + 1]);
+      continue;
+    }
+    if (j.cond) {
+      out.push_back(0x0f);
+      out.push_back(0x80 + ConditionCode(*j.cond));
+    } else {
+      out.push_back(0xe9);
+    }
+    auto offset = static_cast<std::uint32_t>(out.size());
+    out.insert(out.end(), {0xfc, 0xff, 0xff, 0xff});
+    if (resolved(j.target)) {
+      Patch(out, offset, offsets[chunk_of[j.target]] - offsets[i + 1]);
+    } else {
+      section.relocations.push_back({offset, j.target, X86Section::BRANCH});
+    }
+  }
+  return section;
+}
+
+}  // namespace mjc
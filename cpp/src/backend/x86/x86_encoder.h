@@ -0,0 +1,49 @@
+//
+// Encoding of x86 machine instructions
+//
+#ifndef MJC_BACKEND_X86ENCODER_H
+#define MJC_BACKEND_X86ENCODER_H
+
+#include <cstdint>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "backend/x86/x86_function.h"
+#include "intermediate/names.h"
+
+namespace mjc {
+
+// Contents of a section of an object file, with the labels defined in it
+// and the references to labels that the linker completes. The addend of a
+// reference is stored in the four bytes at its offset. A BRANCH is the
+// relative target of a call or jump, which on x86-64 may go through the
+// procedure linkage table.
+struct X86Section {
+  enum RelocationKind { ABSOLUTE, RELATIVE, BRANCH };
+  struct Relocation {
+    std::uint32_t offset;
+    Label label;
+    RelocationKind kind;
+  };
+
+  std::vector<std::uint8_t> bytes;
+  std::vector<std::pair<Label, std::uint32_t>> labels;  // in order
+  std::vector<Relocation> relocations;
+};
+
+// Encodes x86 functions into machine code, choosing the same encodings as
+// the GNU assembler does for the text of AssemFunction.
+class X86Encoder {
+ public:
+  // Encodes the functions one after the other into a section. Jumps and
+  // calls to labels of the section that are not in `globals` are resolved,
+  // and such jumps are made as short as possible. All other references to
+  // labels become relocations.
+  static X86Section Encode(const std::vector<const X86Function *> &functions,
+                           const std::unordered_set<Label> &globals);
+};
+
+}  // namespace mjc
+
+#endif
@@ -1,5 +1,6 @@
 #include "backend/x86/x86_function.h"
 
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <utility>
@@ -12,9 +13,18 @@ namespace mjc {
 
 using R = X86Register;  // TODO
 
+std::int32_t X86Frame::FrameMemory(std::int32_t offset) const {
+  auto saved_ebp = frame_pointer ? word_size : 0;
+  return offset - (std::int32_t)(saved_ebp + memory_size);
+}
+
 X86Function::X86Function(Label name,
-                         std::vector<std::unique_ptr<X86Instr>> body)
-    : name_(std::move(name)), body_(std::move(body)) {
+                         std::vector<std::unique_ptr<X86Instr>> body,
+                         X86Frame frame)
+    : name_(std::move(name)),
+      body_(std::move(body)),
+      frame_(std::move(frame)),
+      frame_size_(frame_.memory_size) {
   assert(
       std::all_of(body_.begin(), body_.end(), [](auto &x) { return (bool)x; }));
 }
@@ -23,8 +33,232 @@ const Label &X86Function::GetName() const { return name_; }
 const std::vector<std::unique_ptr<X86Instr>> &X86Function::GetBody() const {
   return body_;
 }
+std::vector<std::unique_ptr<X86Instr>> &X86Function::GetBody() { return body_; }
+
+unsigned X86Function::GetFrameSize() const {
+  auto size = frame_size_ + frame_.outgoing_size;
+  if (frame_.leaf) return size;
+  // return address and saved EBP are also on the stack
+  auto above = (frame_.frame_pointer ? 2 : 1) * frame_.word_size;
+  return (size + above + 15) / 16 * 16 - above;
+}
+
+bool X86Function::OmitsFramePointer() const { return !frame_.frame_pointer; }
+
+unsigned X86Function::GetWordSize() const { return frame_.word_size; }
+
+bool X86Function::IsCold() const { return cold_; }
+
+void X86Function::SetCold(bool cold) { cold_ = cold; }
+
+void X86Function::LayoutFrame() {
+  SaveCalleeSaves();
+  if (GetFrameSize() > 0) return;
+  auto is_frame_adjustment = [](auto &i) {
+    auto b = dynamic_cast<BinaryInstr *>(i.get());
+    return b && b->src.GetKind() == Operand::FRAMESIZE;
+  };
+  body_.erase(std::remove_if(body_.begin(), body_.end(), is_frame_adjustment),
+              body_.end());
+}
+
+// Shrink-wrapping: the callee-save registers are saved at the beginning of
+// the block that dominates all blocks using them (moved out of loops), and
+// restored at the returns that this block dominates. Paths that do not use
+// the registers do not pay for them.
+void X86Function::SaveCalleeSaves() {
+  auto callee_saves =
+      frame_.word_size == X8664Target::WORD_SIZE
+          ? std::vector<R>(std::begin(CALLEE_SAVE_64), std::end(CALLEE_SAVE_64))
+          : std::vector<R>(std::begin(CALLEE_SAVE), std::end(CALLEE_SAVE));
+  if (!frame_.frame_pointer) callee_saves.push_back(EBP);
 
-unsigned X86Function::GetFrameSize() const { return frame_size_; }
+  auto used = std::vector<R>{};
+  for (auto r : callee_saves) {
+    auto defines_r = [r](auto &i) {
+      auto defs = i->Defs();
+      return std::find(defs.begin(), defs.end(), r) != defs.end();
+    };
+    if (std::any_of(body_.begin(), body_.end(), defines_r)) {
+      used.push_back(r);
+    }
+  }
+  if (used.empty()) return;
+
+  // basic blocks
+  auto n = body_.size();
+  auto block_start = std::vector<std::size_t>{};
+  auto block_of = std::vector<std::size_t>(n);
+  auto labels = std::unordered_map<Label, std::size_t>{};
+  for (std::size_t i = 0; i < n; i++) {
+    auto starts_block = i == 0 || body_[i]->IsLabel() ||
+                        !body_[i - 1]->IsFallThrough() ||
+                        !body_[i - 1]->Jumps().empty();
+    if (starts_block) block_start.push_back(i);
+    block_of[i] = block_start.size() - 1;
+    if (auto l = body_[i]->IsLabel()) labels[*l] = block_of[i];
+  }
+  auto blocks = block_start.size();
+  auto block_end = [&](std::size_t b) {
+    return (b + 1 < blocks) ? block_start[b + 1] : n;
+  };
+
+  auto succ = std::vector<std::vector<std::size_t>>(blocks);
+  auto pred = std::vector<std::vector<std::size_t>>(blocks);
+  auto exits = std::vector<std::size_t>{};
+  for (std::size_t b = 0; b < blocks; b++) {
+    auto &last = body_[block_end(b) - 1];
+    if (last->IsFallThrough() && b + 1 < blocks) succ[b].push_back(b + 1);
+    for (auto &l : last->Jumps()) {
+      // jumps to L_raise_bounds leave the function for good
+      if (auto it = labels.find(l); it != labels.end()) {
+        succ[b].push_back(it->second);
+      }
+    }
+    // RET and tail calls
+    if (!last->IsFallThrough() && last->Jumps().empty()) exits.push_back(b);
+    for (auto s : succ[b]) pred[s].push_back(b);
+  }
+
+  // dominators by iteration over a reverse postorder of the blocks
+  auto order = std::vector<std::size_t>{};
+  {
+    auto visited = std::vector<bool>(blocks, false);
+    auto stack = std::vector<std::pair<std::size_t, std::size_t>>{{0, 0}};
+    visited[0] = true;
+    while (!stack.empty()) {
+      auto &[b, next] = stack.back();
+      if (next < succ[b].size()) {
+        auto s = succ[b][next++];
+        if (!visited[s]) {
+          visited[s] = true;
+          stack.push_back({s, 0});
+        }
+      } else {
+        order.push_back(b);
+        stack.pop_back();
+      }
+    }
+    std::reverse(order.begin(), order.end());
+  }
+  auto rpo_number = std::vector<std::size_t>(blocks, blocks);
+  for (std::size_t i = 0; i < order.size(); i++) rpo_number[order[i]] = i;
+
+  const auto undefined = blocks;
+  auto idom = std::vector<std::size_t>(blocks, undefined);
+  idom[0] = 0;
+  auto intersect = [&](std::size_t a, std::size_t b) {
+    while (a != b) {
+      while (rpo_number[a] > rpo_number[b]) a = idom[a];
+      while (rpo_number[b] > rpo_number[a]) b = idom[b];
+    }
+    return a;
+  };
+  for (auto changed = true; changed;) {
+    changed = false;
+    for (auto b : order) {
+      if (b == 0) continue;
+      auto new_idom = undefined;
+      for (auto p : pred[b]) {
+        if (idom[p] == undefined) continue;
+        new_idom = (new_idom == undefined) ? p : intersect(p, new_idom);
+      }
+      if (new_idom != idom[b]) {
+        idom[b] = new_idom;
+        changed = true;
+      }
+    }
+  }
+  auto dominates = [&](std::size_t a, std::size_t b) {
+    while (b != a && b != 0) b = idom[b];
+    return b == a;
+  };
+
+  auto reachable_from = [&](std::size_t from) {
+    auto reached = std::vector<bool>(blocks, false);
+    auto stack = succ[from];
+    while (!stack.empty()) {
+      auto b = stack.back();
+      stack.pop_back();
+      if (reached[b]) continue;
+      reached[b] = true;
+      stack.insert(stack.end(), succ[b].begin(), succ[b].end());
+    }
+    return reached;
+  };
+
+  // save point
+  auto save = undefined;
+  for (std::size_t i = 0; i < n; i++) {
+    auto defs = body_[i]->Defs();
+    auto b = block_of[i];
+    if (idom[b] == undefined && b != 0) continue;  // unreachable
+    if (std::any_of(defs.begin(), defs.end(), [&](auto r) {
+          return std::find(used.begin(), used.end(), r) != used.end();
+        })) {
+      save = (save == undefined) ? b : intersect(save, b);
+    }
+  }
+  if (save == undefined) return;
+  while (save != 0 && reachable_from(save)[save]) save = idom[save];
+
+  auto reached = reachable_from(save);
+  auto restores = std::vector<std::size_t>{};
+  for (auto e : exits) {
+    if (!reached[e] && e != save) continue;
+    if (!dominates(save, e)) {
+      save = 0;
+      break;
+    }
+    restores.push_back(e);
+  }
+  if (save == 0) {
+    reached = reachable_from(0);
+    restores.clear();
+    for (auto e : exits) {
+      if (reached[e] || e == 0) restores.push_back(e);
+    }
+  }
+
+  auto slots = std::vector<Operand>{};
+  for (std::size_t i = 0; i < used.size(); i++) {
+    slots.push_back(AddLocalOnStack());
+  }
+
+  // Positions of insertion: after the frame setup of the prologue or after
+  // the label of the block; before the frame removal of the epilogue.
+  auto frame_setup = frame_.frame_pointer ? 3 : 1;
+  auto frame_removal = frame_.frame_pointer ? 2 : 1;
+  auto save_position =
+      (save == 0) ? frame_setup
+                  : block_start[save] + (body_[block_start[save]]->IsLabel()
+                                             ? 1
+                                             : 0);
+  auto restore_positions = std::vector<std::size_t>{};
+  for (auto e : restores) {
+    restore_positions.push_back(block_end(e) - 1 - frame_removal);
+  }
+
+  std::vector<std::unique_ptr<X86Instr>> new_body;
+  new_body.reserve(body_.size() + used.size() * (1 + restores.size()));
+  for (std::size_t i = 0; i <= n; i++) {
+    if (i == save_position) {
+      for (std::size_t j = 0; j < used.size(); j++) {
+        new_body.push_back(
+            std::make_unique<BinaryInstr>(MOV, slots[j], used[j]));
+      }
+    }
+    if (std::find(restore_positions.begin(), restore_positions.end(), i) !=
+        restore_positions.end()) {
+      for (std::size_t j = 0; j < used.size(); j++) {
+        new_body.push_back(
+            std::make_unique<BinaryInstr>(MOV, used[j], slots[j]));
+      }
+    }
+    if (i < n) new_body.push_back(std::move(body_[i]));
+  }
+  std::exchange(body_, std::move(new_body));
+}
 
 void X86Function::rename(std::function<R(R)> &sigma) {
   std::vector<std::unique_ptr<X86Instr>> new_body;
@@ -40,8 +274,9 @@ void X86Function::rename(std::function<R(R)> &sigma) {
 };
 
 Operand X86Function::AddLocalOnStack() {
-  frame_size_ += X86Target::WORD_SIZE;
-  return Operand::Mem(EBP, -((int)frame_size_));
+  frame_size_ += frame_.word_size;
+  auto saved_ebp = frame_.frame_pointer ? frame_.word_size : 0;
+  return Operand::FrameSlot(-(std::int32_t)(saved_ebp + frame_size_));
 }
 
 void X86Function::spill(std::vector<R> &toSpill) {
@@ -52,7 +287,10 @@ void X86Function::spill(std::vector<R> &toSpill) {
   };
 
   for (auto t : toSpill) {
-    spills.insert({t, AddLocalOnStack()});
+    auto it = frame_.parameter_slots.find(t);
+    spills.insert({t, (it != frame_.parameter_slots.end())
+                          ? Operand::FrameSlot(it->second)
+                          : AddLocalOnStack()});
   }
 
   std::map<R, R> fresh_idents;
@@ -84,6 +322,14 @@ void X86Function::spill(std::vector<R> &toSpill) {
       continue;
     }
 
+    // the load of a parameter into its temp is not needed if the temp is
+    // spilled to the parameter slot
+    if (auto b = dynamic_cast<BinaryInstr *>(i.get());
+        b && b->kind == MOV && b->dst.IsReg()) {
+      auto it = spills.find(b->dst.GetReg());
+      if (it != spills.end() && it->second == b->src) continue;
+    }
+
     auto uses = i->Uses();
     auto defs = i->Defs();
 
@@ -103,7 +349,8 @@ void X86Function::spill(std::vector<R> &toSpill) {
     }
 
     new_body.push_back(std::move(i));
-    auto &j = new_body.back();
+    // the stores below may reallocate new_body
+    auto j = new_body.back().get();
 
     for (auto d : defs) {
       auto dit = spills.find(d);
@@ -6,6 +6,7 @@
 
 #include <functional>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "backend/x86/x86_registers.h"
@@ -16,9 +17,36 @@ namespace mjc {
 class Operand;
 class X86Instr;
 
+// Frame layout (from higher to lower addresses): parameters, return
+// address, saved EBP (if there is a frame pointer), locals and spills,
+// outgoing arguments of calls.
+struct X86Frame {
+  // Slot of the byte at the given offset in the memory for stack-allocated
+  // objects
+  std::int32_t FrameMemory(std::int32_t offset) const;
+
+  // 4 on x86, 8 on x86-64. Every slot of the frame is a word.
+  unsigned word_size = 4;
+  // If false, the frame is addressed relative to ESP and EBP is an
+  // ordinary register.
+  bool frame_pointer = true;
+  // The function makes no calls, so its frame needs no alignment.
+  bool leaf = false;
+  // Size of the outgoing-argument area, which is addressed relative to ESP.
+  unsigned outgoing_size = 0;
+  // Size of the memory for stack-allocated objects, which comes first among
+  // the locals (see FrameMemory).
+  unsigned memory_size = 0;
+  // Maps the temps that hold parameters passed on the stack to the offset
+  // of their slot (see Operand::FrameSlot). A spilled parameter temp is
+  // kept in its slot instead of a new local.
+  std::unordered_map<X86Register, std::int32_t> parameter_slots;
+};
+
 class X86Function {
  public:
-  X86Function(Label name, std::vector<std::unique_ptr<X86Instr>> body);
+  X86Function(Label name, std::vector<std::unique_ptr<X86Instr>> body,
+              X86Frame frame = {});
 
   virtual void rename(std::function<X86Register(X86Register)>& sigma);
 
@@ -26,16 +54,34 @@ class X86Function {
 
   const Label& GetName() const;
   const std::vector<std::unique_ptr<X86Instr>>& GetBody() const;
+  std::vector<std::unique_ptr<X86Instr>>& GetBody();
+  // Size of the frame below the saved EBP, or below the return address if
+  // there is no frame pointer. Unless the function is a leaf, it keeps ESP
+  // 16-byte aligned at calls, assuming that it was aligned at the call of
+  // this function.
   unsigned GetFrameSize() const;
+  bool OmitsFramePointer() const;
+  unsigned GetWordSize() const;
+  // Rarely executed functions are emitted to a separate section.
+  bool IsCold() const;
+  void SetCold(bool cold);
+
+  // To be called after register allocation. Saves and restores the
+  // callee-save registers that are used and removes the stack adjustments
+  // of an empty frame.
+  void LayoutFrame();
 
   virtual ~X86Function(){};
 
  private:
   Label name_;
   std::vector<std::unique_ptr<X86Instr>> body_;  // inv: contains no nullptr
-  unsigned frame_size_ = 0;
+  X86Frame frame_;
+  unsigned frame_size_ = 0;  // locals and spills
+  bool cold_ = false;
 
   Operand AddLocalOnStack();
+  void SaveCalleeSaves();
 };
 
 std::ostream& operator<<(std::ostream& os, X86Function& f);
@@ -0,0 +1,266 @@
+#include "backend/x86/x86_function_order.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "backend/x86/x86_instr.h"
+
+namespace mjc {
+
+namespace {
+
+// Bytes that a memory operand adds to ModRM: SIB and displacement,
+// assuming that displacements fit into a byte
+std::size_t MemoryBytes(const X86Function &f, const Operand &o) {
+  switch (o.GetKind()) {
+    case Operand::FRAME_SLOT:
+      return f.OmitsFramePointer() ? 2 : 1;
+    case Operand::MEM_BASE:
+      return 1;
+    case Operand::MEM_INDEX:
+      return 1 + 4;
+    case Operand::MEM_BASE_INDEX:
+      return 1 + 1;
+    case Operand::MEM_LABEL:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+std::size_t ImmediateBytes(const Operand &o) {
+  if (o.GetKind() == Operand::FRAMESIZE) return 4;
+  if (!o.IsImm()) return 0;
+  return (o.GetImm() >= -128 && o.GetImm() < 128) ? 1 : 4;
+}
+
+// Estimated size of the encoding of instructions
+class SizeEstimate : public X86InstrVisitor {
+ public:
+  SizeEstimate(const X86Function &f, const std::unordered_set<Label> &labels)
+      : f_(f), labels_(labels) {}
+
+  std::size_t size = 0;
+
+  void Visit(UnaryInstr &i) {
+    if ((i.kind == PUSH || i.kind == POP || i.kind == INC || i.kind == DEC) &&
+        i.src.IsReg()) {
+      size += 1;
+    } else if (i.src.IsImm()) {
+      size += 1 + ImmediateBytes(i.src);
+    } else {
+      size += 2 + MemoryBytes(f_, i.src);
+    }
+  }
+  void Visit(BinaryInstr &i) {
+    auto opcode = (i.kind == IMUL) ? 2 : 1;
+    size += opcode + 1 + MemoryBytes(f_, i.dst) + MemoryBytes(f_, i.src) +
+            ImmediateBytes(i.src);
+  }
+  void Visit(TernaryInstr &i) {
+    // VEX prefix and opcode, or the opcode of IMUL
+    auto opcode = (i.kind == IMUL3) ? 1 : 4;
+    size += opcode + 1 + MemoryBytes(f_, i.src) + ImmediateBytes(i.src2);
+  }
+  void Visit(LabelInstr &i) {}
+  void Visit(CallInstr &i) { size += 5; }
+  void Visit(TailCallInstr &i) { size += 5; }
+  void Visit(JmpInstr &i) { size += labels_.count(i.target) > 0 ? 2 : 5; }
+  void Visit(JInstr &i) { size += labels_.count(i.target) > 0 ? 2 : 6; }
+  void Visit(CondInstr &i) { size += 3 + MemoryBytes(f_, i.src); }
+  void Visit(RetInstr &i) { size += 1; }
+  void Visit(CountInstr &i) { size += 6; }
+  void Visit(VectorInstr &i) {
+    // prefixes, opcode, ModRM and an immediate
+    size += 5 + MemoryBytes(f_, i.op);
+  }
+
+ private:
+  const X86Function &f_;
+  const std::unordered_set<Label> &labels_;
+};
+
+std::size_t EstimateSize(X86Function &f) {
+  auto labels = std::unordered_set<Label>{};
+  for (auto &i : f.GetBody()) {
+    if (auto l = i->IsLabel()) labels.insert(*l);
+  }
+  auto estimate = SizeEstimate{f, labels};
+  for (auto &i : f.GetBody()) {
+    i->accept(estimate);
+  }
+  return estimate.size;
+}
+
+// Estimated number of executions of the instructions of a function per
+// call. Loops are taken to be the ranges between a label and a later jump
+// back to it, which holds for the layout of the tracer.
+std::vector<double> StaticFrequencies(const X86Function &f) {
+  auto &body = f.GetBody();
+  auto labels = std::unordered_map<Label, std::size_t>{};
+  for (std::size_t i = 0; i < body.size(); i++) {
+    if (auto l = body[i]->IsLabel()) labels[*l] = i;
+  }
+  auto depth_change = std::vector<int>(body.size() + 1, 0);
+  for (std::size_t i = 0; i < body.size(); i++) {
+    for (auto &t : body[i]->Jumps()) {
+      auto it = labels.find(t);
+      if (it != labels.end() && it->second <= i) {
+        depth_change[it->second]++;
+        depth_change[i + 1]--;
+      }
+    }
+  }
+  auto frequencies = std::vector<double>(body.size());
+  auto depth = 0;
+  for (std::size_t i = 0; i < body.size(); i++) {
+    depth += depth_change[i];
+    frequencies[i] = std::pow(10.0, std::min(depth, 6));
+  }
+  return frequencies;
+}
+
+std::optional<Label> CallTarget(X86Instr &i) {
+  if (auto call = dynamic_cast<CallInstr *>(&i)) return call->target;
+  if (auto call = dynamic_cast<TailCallInstr *>(&i)) return call->target;
+  return std::nullopt;
+}
+
+}  // namespace
+
+X86FunctionOrder::Result X86FunctionOrder::Process(X86Prg &prg,
+                                                   const Profile *profile) {
+  auto &functions = prg.functions;
+  auto n = functions.size();
+  auto index = std::unordered_map<Label, std::size_t>{};
+  for (std::size_t i = 0; i < n; i++) {
+    index[functions[i]->GetName()] = i;
+  }
+
+  // call graph, with the weights of the edges in both directions added up
+  auto callees = std::vector<std::set<std::size_t>>(n);
+  auto weights = std::map<std::pair<std::size_t, std::size_t>, double>{};
+  for (std::size_t i = 0; i < n; i++) {
+    auto &body = functions[i]->GetBody();
+    auto frequencies = StaticFrequencies(*functions[i]);
+    for (std::size_t k = 0; k < body.size(); k++) {
+      auto target = CallTarget(*body[k]);
+      if (!target) continue;
+      auto it = index.find(*target);
+      if (it == index.end()) continue;  // runtime
+      auto j = it->second;
+      if (!callees[i].insert(j).second && profile) continue;
+      if (i == j) continue;
+      weights[std::minmax(i, j)] +=
+          profile ? profile->CallCount(functions[i]->GetName(), *target)
+                  : frequencies[k];
+    }
+  }
+
+  auto cold = std::vector<bool>(n, false);
+  if (profile) {
+    for (std::size_t i = 0; i < n; i++) {
+      auto &name = functions[i]->GetName();
+      cold[i] = profile->BlockCount(name, name) == 0u;
+    }
+  } else if (auto main = index.find(Label("Lmain")); main != index.end()) {
+    auto reached = std::vector<bool>(n, false);
+    auto to_visit = std::vector<std::size_t>{main->second};
+    reached[main->second] = true;
+    while (!to_visit.empty()) {
+      auto i = to_visit.back();
+      to_visit.pop_back();
+      for (auto j : callees[i]) {
+        if (!reached[j]) {
+          reached[j] = true;
+          to_visit.push_back(j);
+        }
+      }
+    }
+    for (std::size_t i = 0; i < n; i++) cold[i] = !reached[i];
+  }
+
+  // merge chains along the heaviest edges first, such that the ends of
+  // the edge are as close as possible
+  auto edges = std::vector<std::tuple<double, std::size_t, std::size_t>>{};
+  for (auto &[e, w] : weights) {
+    if (w > 0 && !cold[e.first] && !cold[e.second]) {
+      edges.emplace_back(w, e.first, e.second);
+    }
+  }
+  std::stable_sort(edges.begin(), edges.end(), [](auto &a, auto &b) {
+    return std::get<0>(a) > std::get<0>(b);
+  });
+  auto chains = std::vector<std::vector<std::size_t>>(n);
+  auto chain_of = std::vector<std::size_t>(n);
+  auto heat = std::vector<double>(n, 0);  // total weight of merged edges
+  for (std::size_t i = 0; i < n; i++) {
+    chains[i] = {i};
+    chain_of[i] = i;
+  }
+  for (auto &[w, u, v] : edges) {
+    auto a = chain_of[u];
+    auto b = chain_of[v];
+    if (a == b) {
+      heat[a] += w;
+      continue;
+    }
+    auto &ca = chains[a];
+    auto &cb = chains[b];
+    auto pos_u = std::find(ca.begin(), ca.end(), u) - ca.begin();
+    auto pos_v = std::find(cb.begin(), cb.end(), v) - cb.begin();
+    if (2 * pos_u + 1 < static_cast<long>(ca.size())) {
+      std::reverse(ca.begin(), ca.end());
+    }
+    if (2 * pos_v + 1 > static_cast<long>(cb.size())) {
+      std::reverse(cb.begin(), cb.end());
+    }
+    for (auto f : cb) chain_of[f] = a;
+    ca.insert(ca.end(), cb.begin(), cb.end());
+    cb.clear();
+    heat[a] += heat[b] + w;
+  }
+
+  // hottest chains first, cold functions last
+  auto order = std::vector<std::size_t>{};
+  for (std::size_t i = 0; i < n; i++) {
+    if (!chains[i].empty()) order.push_back(i);
+  }
+  std::stable_sort(order.begin(), order.end(), [&](auto a, auto b) {
+    bool cold_a = cold[chains[a][0]];
+    bool cold_b = cold[chains[b][0]];
+    if (cold_a != cold_b) return cold_b;
+    return heat[a] > heat[b];
+  });
+
+  auto result = Result{};
+  auto ordered = std::vector<std::unique_ptr<X86Function>>{};
+  ordered.reserve(n);
+  for (auto c : order) {
+    for (auto i : chains[c]) {
+      auto &f = functions[i];
+      f->SetCold(cold[i]);
+      if (cold[i]) {
+        result.cold_functions++;
+        result.cold_size += EstimateSize(*f);
+      } else {
+        result.hot_functions++;
+        result.hot_size += EstimateSize(*f);
+      }
+      ordered.push_back(std::move(f));
+    }
+  }
+  functions = std::move(ordered);
+  return result;
+}
+
+}  // namespace mjc
@@ -0,0 +1,37 @@
+//
+// Ordering of the functions of x86 programs
+//
+#ifndef MJC_BACKEND_X86FUNCTIONORDER_H
+#define MJC_BACKEND_X86FUNCTIONORDER_H
+
+#include <cstddef>
+
+#include "backend/x86/x86_prg.h"
+#include "intermediate/profile.h"
+
+namespace mjc {
+
+// Orders the functions so that functions that call each other frequently
+// are adjacent, by merging chains of functions along the call graph edges
+// in order of decreasing weight (Pettis and Hansen, PLDI 1990). Rarely
+// executed functions are marked as cold and placed last.
+//
+// With a profile, the weights are the call counts and the functions that
+// never ran are cold. Otherwise, a call site weighs 10^d at loop depth d
+// and the functions that are not reachable from Lmain are cold.
+class X86FunctionOrder {
+ public:
+  struct Result {
+    unsigned hot_functions = 0;
+    unsigned cold_functions = 0;
+    // estimated size of the code in bytes
+    std::size_t hot_size = 0;
+    std::size_t cold_size = 0;
+  };
+
+  static Result Process(X86Prg &prg, const Profile *profile = nullptr);
+};
+
+}  // namespace mjc
+
+#endif
@@ -23,9 +23,15 @@ bool Operand::IsReg() const { return kind_ == REG; }
 X86Register Operand::GetReg() const { return regs_[0]; }
 
 bool Operand::IsMem() const {
-  return kind_ == MEM_BASE || kind_ == MEM_INDEX || kind_ == MEM_BASE_INDEX;
+  return kind_ == MEM_BASE || kind_ == MEM_INDEX || kind_ == MEM_BASE_INDEX ||
+         kind_ == FRAME_SLOT || kind_ == MEM_LABEL;
 }
 
+bool Operand::IsFrameSlot() const { return kind_ == FRAME_SLOT; }
+
+// defined only if IsFrameSlot
+std::int32_t Operand::GetFrameSlot() const { return imms_[0]; }
+
 std::optional<Operand::Scale> Operand::ToScale(int i) {
   switch (i) {
   case 1:
@@ -87,14 +93,61 @@ Operand Operand::Mem(X86Register base, Scale scale, X86Register index,
 
 Operand Operand::FrameSize() { return Operand(FRAMESIZE, {}, {}); }
 
+Operand Operand::FrameSlot(std::int32_t offset) {
+  return Operand(FRAME_SLOT, {}, {offset});
+}
+
+Operand Operand::Mem(Label label) {
+  auto o = Operand(MEM_LABEL, {}, {});
+  o.label_ = std::move(label);
+  return o;
+}
+
 Operand::Kind Operand::GetKind() const { return kind_; }
 
 const std::vector<X86Register> &Operand::GetRegs() const { return regs_; }
 
+const std::vector<std::int32_t> &Operand::GetImms() const { return imms_; }
+
+const Label &Operand::GetLabel() const { return *label_; }
+
+bool Operand::operator==(const Operand &other) const {
+  return kind_ == other.kind_ && regs_ == other.regs_ &&
+         imms_ == other.imms_ && label_ == other.label_;
+}
+
 void Operand::rename(std::function<X86Register(X86Register)> &sigma) {
   std::transform(regs_.begin(), regs_.end(), regs_.begin(), sigma);
 }
 
+JInstr::Kind JInstr::Negate(Kind cond) {
+  switch (cond) {
+  case E:
+  case Z:
+    return NE;
+  case NE:
+    return E;
+  case L:
+    return GE;
+  case LE:
+    return G;
+  case G:
+    return LE;
+  case GE:
+    return L;
+  case B:
+    return AE;
+  case BE:
+    return A;
+  case A:
+    return BE;
+  case AE:
+    return B;
+  }
+  assert(false);
+  abort();
+}
+
 void AddRegs(std::vector<X86Register> &target, const Operand &o) {
   auto src = o.GetRegs();
   target.insert(target.end(), src.begin(), src.end());
@@ -109,7 +162,8 @@ std::vector<X86Register> UnaryInstr::Uses() const {
   case PUSH:
     return src.GetRegs();
   case IDIV: {
-    std::vector<X86Register> uses(4);
+    std::vector<X86Register> uses;
+    uses.reserve(4);
     AddRegs(uses, src);
     uses.push_back(EAX);
     uses.push_back(EDX);
@@ -136,20 +190,38 @@ std::vector<X86Register> BinaryInstr::Uses() const {
   default:
     break;
   }
-  std::vector<X86Register> uses(4);
+  std::vector<X86Register> uses;
+  uses.reserve(4);
   AddRegs(uses, src);
   AddRegs(uses, dst);
   return uses;
 }
+std::vector<X86Register> TernaryInstr::Uses() const {
+  std::vector<X86Register> uses;
+  uses.reserve(3);
+  AddRegs(uses, src);
+  AddRegs(uses, src2);
+  return uses;
+}
 std::vector<X86Register> LabelInstr::Uses() const { return {}; }
-std::vector<X86Register> CallInstr::Uses() const { return {}; }
+std::vector<X86Register> CallInstr::Uses() const { return arguments; }
+std::vector<X86Register> TailCallInstr::Uses() const { return arguments; }
 std::vector<X86Register> JmpInstr::Uses() const { return {}; }
 std::vector<X86Register> JInstr::Uses() const { return {}; }
-std::vector<X86Register> RetInstr::Uses() const {
-  std::vector<X86Register> uses(std::begin(CALLEE_SAVE), std::end(CALLEE_SAVE));
-  uses.push_back(EAX);
+std::vector<X86Register> CondInstr::Uses() const {
+  // the destination keeps its value (or its upper bits for SET)
+  std::vector<X86Register> uses;
+  uses.reserve(3);
+  AddRegs(uses, src);
+  AddRegs(uses, dst);
   return uses;
 }
+std::vector<X86Register> RetInstr::Uses() const { return {EAX}; }
+std::vector<X86Register> CountInstr::Uses() const { return {}; }
+std::vector<X86Register> VectorInstr::Uses() const {
+  if (store && op.IsReg()) return {};
+  return op.GetRegs();
+}
 
 std::vector<X86Register> UnaryInstr::Defs() const {
   switch (kind) {
@@ -183,39 +255,68 @@ std::vector<X86Register> BinaryInstr::Defs() const {
     }
   };
 }
+std::vector<X86Register> TernaryInstr::Defs() const { return dst.GetRegs(); }
 std::vector<X86Register> LabelInstr::Defs() const { return {}; }
 std::vector<X86Register> CallInstr::Defs() const {
-  std::vector<X86Register> defs(std::begin(CALLER_SAVE), std::end(CALLER_SAVE));
+  std::vector<X86Register> defs = clobbered;
   defs.push_back(EAX);
   return defs;
 }
+std::vector<X86Register> TailCallInstr::Defs() const { return {}; }
 std::vector<X86Register> JmpInstr::Defs() const { return {}; }
 std::vector<X86Register> JInstr::Defs() const { return {}; }
+std::vector<X86Register> CondInstr::Defs() const {
+  if (dst.IsReg()) {
+    return {dst.GetReg()};
+  } else {
+    return {};
+  }
+}
 std::vector<X86Register> RetInstr::Defs() const { return {}; }
+std::vector<X86Register> CountInstr::Defs() const { return {}; }
+std::vector<X86Register> VectorInstr::Defs() const {
+  if (store && op.IsReg()) return op.GetRegs();
+  return {};
+}
 
 std::vector<Label> UnaryInstr::Jumps() const { return {}; }
 std::vector<Label> BinaryInstr::Jumps() const { return {}; }
+std::vector<Label> TernaryInstr::Jumps() const { return {}; }
 std::vector<Label> LabelInstr::Jumps() const { return {}; }
 std::vector<Label> CallInstr::Jumps() const { return {}; }
+std::vector<Label> TailCallInstr::Jumps() const { return {}; }
 std::vector<Label> JmpInstr::Jumps() const { return {target}; }
 std::vector<Label> JInstr::Jumps() const { return {target}; }
+std::vector<Label> CondInstr::Jumps() const { return {}; }
 std::vector<Label> RetInstr::Jumps() const { return {}; }
+std::vector<Label> CountInstr::Jumps() const { return {}; }
+std::vector<Label> VectorInstr::Jumps() const { return {}; }
 
 bool UnaryInstr::IsFallThrough() const { return true; }
 bool BinaryInstr::IsFallThrough() const { return true; }
+bool TernaryInstr::IsFallThrough() const { return true; }
 bool LabelInstr::IsFallThrough() const { return true; }
 bool CallInstr::IsFallThrough() const { return true; }
+bool TailCallInstr::IsFallThrough() const { return false; }
 bool JmpInstr::IsFallThrough() const { return false; }
 bool JInstr::IsFallThrough() const { return true; }
-bool RetInstr::IsFallThrough() const { return true; }
+bool CondInstr::IsFallThrough() const { return true; }
+bool RetInstr::IsFallThrough() const { return false; }
+bool CountInstr::IsFallThrough() const { return true; }
+bool VectorInstr::IsFallThrough() const { return true; }
 
 std::optional<Label> UnaryInstr::IsLabel() const { return std::nullopt; }
 std::optional<Label> BinaryInstr::IsLabel() const { return std::nullopt; }
+std::optional<Label> TernaryInstr::IsLabel() const { return std::nullopt; }
 std::optional<Label> LabelInstr::IsLabel() const { return label; }
 std::optional<Label> CallInstr::IsLabel() const { return std::nullopt; }
+std::optional<Label> TailCallInstr::IsLabel() const { return std::nullopt; }
 std::optional<Label> JmpInstr::IsLabel() const { return std::nullopt; }
 std::optional<Label> JInstr::IsLabel() const { return std::nullopt; }
+std::optional<Label> CondInstr::IsLabel() const { return std::nullopt; }
 std::optional<Label> RetInstr::IsLabel() const { return std::nullopt; }
+std::optional<Label> CountInstr::IsLabel() const { return std::nullopt; }
+std::optional<Label> VectorInstr::IsLabel() const { return std::nullopt; }
 
 std::optional<std::pair<X86Register, X86Register>>
 UnaryInstr::IsMoveBetweenTemps() const {
@@ -223,13 +324,19 @@ UnaryInstr::IsMoveBetweenTemps() const {
 }
 std::optional<std::pair<X86Register, X86Register>>
 BinaryInstr::IsMoveBetweenTemps() const {
-  if (kind == MOV && src.IsReg() && dst.IsReg()) {
+  // a move of the lower half of a register clears the upper half
+  if (kind == MOV && size == OperandSize::WORD && src.IsReg() &&
+      dst.IsReg()) {
     return {{dst.GetReg(), src.GetReg()}};
   }
   // TODO: LEA
   return std::nullopt;
 }
 std::optional<std::pair<X86Register, X86Register>>
+TernaryInstr::IsMoveBetweenTemps() const {
+  return std::nullopt;
+}
+std::optional<std::pair<X86Register, X86Register>>
 LabelInstr::IsMoveBetweenTemps() const {
   return std::nullopt;
 }
@@ -238,6 +345,10 @@ CallInstr::IsMoveBetweenTemps() const {
   return std::nullopt;
 }
 std::optional<std::pair<X86Register, X86Register>>
+TailCallInstr::IsMoveBetweenTemps() const {
+  return std::nullopt;
+}
+std::optional<std::pair<X86Register, X86Register>>
 JmpInstr::IsMoveBetweenTemps() const {
   return std::nullopt;
 }
@@ -246,9 +357,21 @@ JInstr::IsMoveBetweenTemps() const {
   return std::nullopt;
 }
 std::optional<std::pair<X86Register, X86Register>>
+CondInstr::IsMoveBetweenTemps() const {
+  return std::nullopt;
+}
+std::optional<std::pair<X86Register, X86Register>>
 RetInstr::IsMoveBetweenTemps() const {
   return std::nullopt;
 }
+std::optional<std::pair<X86Register, X86Register>>
+CountInstr::IsMoveBetweenTemps() const {
+  return std::nullopt;
+}
+std::optional<std::pair<X86Register, X86Register>>
+VectorInstr::IsMoveBetweenTemps() const {
+  return std::nullopt;
+}
 
 void UnaryInstr::rename(std::function<X86Register(X86Register)> &sigma) {
   src.rename(sigma);
@@ -257,18 +380,37 @@ void BinaryInstr::rename(std::function<X86Register(X86Register)> &sigma) {
   src.rename(sigma);
   dst.rename(sigma);
 }
+void TernaryInstr::rename(std::function<X86Register(X86Register)> &sigma) {
+  src.rename(sigma);
+  src2.rename(sigma);
+  dst.rename(sigma);
+}
 void LabelInstr::rename(std::function<X86Register(X86Register)> &sigma) {}
 void CallInstr::rename(std::function<X86Register(X86Register)> &sigma) {}
+void TailCallInstr::rename(std::function<X86Register(X86Register)> &sigma) {}
 void JmpInstr::rename(std::function<X86Register(X86Register)> &sigma) {}
 void JInstr::rename(std::function<X86Register(X86Register)> &sigma) {}
+void CondInstr::rename(std::function<X86Register(X86Register)> &sigma) {
+  src.rename(sigma);
+  dst.rename(sigma);
+}
 void RetInstr::rename(std::function<X86Register(X86Register)> &sigma) {}
+void CountInstr::rename(std::function<X86Register(X86Register)> &sigma) {}
+void VectorInstr::rename(std::function<X86Register(X86Register)> &sigma) {
+  op.rename(sigma);
+}
 
 void UnaryInstr::accept(X86InstrVisitor &visitor) { visitor.Visit(*this); }
 void BinaryInstr::accept(X86InstrVisitor &visitor) { visitor.Visit(*this); }
+void TernaryInstr::accept(X86InstrVisitor &visitor) { visitor.Visit(*this); }
 void LabelInstr::accept(X86InstrVisitor &visitor) { visitor.Visit(*this); }
 void CallInstr::accept(X86InstrVisitor &visitor) { visitor.Visit(*this); }
+void TailCallInstr::accept(X86InstrVisitor &visitor) { visitor.Visit(*this); }
 void JmpInstr::accept(X86InstrVisitor &visitor) { visitor.Visit(*this); }
 void JInstr::accept(X86InstrVisitor &visitor) { visitor.Visit(*this); }
+void CondInstr::accept(X86InstrVisitor &visitor) { visitor.Visit(*this); }
 void RetInstr::accept(X86InstrVisitor &visitor) { visitor.Visit(*this); }
+void CountInstr::accept(X86InstrVisitor &visitor) { visitor.Visit(*this); }
+void VectorInstr::accept(X86InstrVisitor &visitor) { visitor.Visit(*this); }
 
 } // namespace mjc
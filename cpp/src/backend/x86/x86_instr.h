@@ -20,9 +20,25 @@
 
 namespace mjc {
 
+// Size of the operands of an instruction. On x86, all instructions operate
+// on words. On x86-64, words have 64 bits, and the arithmetic on MiniJava
+// ints uses 32-bit instructions, which clear the upper half of a register
+// operand (see X8664Target). Vector instructions access 128 or 256 bits of
+// memory.
+enum class OperandSize { WORD, INT32, VECTOR128, VECTOR256 };
+
 class Operand {
  public:
-  enum Kind { IMM, MEM_BASE, MEM_INDEX, MEM_BASE_INDEX, REG, FRAMESIZE };
+  enum Kind {
+    IMM,
+    MEM_BASE,
+    MEM_INDEX,
+    MEM_BASE_INDEX,
+    REG,
+    FRAMESIZE,
+    FRAME_SLOT,
+    MEM_LABEL
+  };
   enum Scale { S1, S2, S4, S8 };
 
   Operand() = delete;
@@ -35,6 +51,9 @@ class Operand {
   // defined only if IsReg
   X86Register GetReg() const;
   bool IsMem() const;
+  bool IsFrameSlot() const;
+  // defined only if IsFrameSlot
+  std::int32_t GetFrameSlot() const;
 
   static std::optional<Scale> ToScale(int i);
   static int FromScale(Scale s);
@@ -50,13 +69,26 @@ class Operand {
   static Operand Mem(X86Register base, Scale scale, X86Register index,
                      std::int32_t disp);
   static Operand FrameSize();
+  // Memory in the stack frame at the given offset from the value of ESP at
+  // function entry. Addressed relative to EBP or ESP, depending on whether
+  // the function has a frame pointer.
+  static Operand FrameSlot(std::int32_t offset);
+  // Memory at the address of a label, such as a variable of the runtime
+  static Operand Mem(Label label);
 
   Kind GetKind() const;
   const std::vector<X86Register>& GetRegs() const;
+  // The value of IMM, or the scale (if there is an index register) followed
+  // by the displacement (if any) of the memory operands, or the offset of
+  // FRAME_SLOT
+  const std::vector<std::int32_t>& GetImms() const;
+  // defined only for MEM_LABEL
+  const Label& GetLabel() const;
+  bool operator==(const Operand& other) const;
   void rename(std::function<X86Register(X86Register)>& sigma);
 
   friend std::ostream& Assem(std::ostream& os, const X86Function& f,
-                             const Operand& op);
+                             const Operand& op, OperandSize size);
 
  private:
   explicit Operand(Kind kind, std::vector<X86Register> regs,
@@ -65,6 +97,7 @@ class Operand {
   Kind kind_;
   std::vector<X86Register> regs_;  // not const because of renaming
   std::vector<std::int32_t> imms_;
+  std::optional<Label> label_;
 };
 
 class X86InstrVisitor;
@@ -93,9 +126,11 @@ class UnaryInstr : public X86Instr {
  public:
   const UnaryInstrKind kind;
   Operand src;
+  const OperandSize size;  // always WORD for PUSH and POP
 
-  UnaryInstr(UnaryInstrKind kind, Operand src)
-      : kind(std::move(kind)), src(std::move(src)) {}
+  UnaryInstr(UnaryInstrKind kind, Operand src,
+             OperandSize size = OperandSize::WORD)
+      : kind(std::move(kind)), src(std::move(src)), size(size) {}
 
   virtual std::vector<X86Register> Uses() const;
   virtual std::vector<X86Register> Defs() const;
@@ -133,9 +168,47 @@ class BinaryInstr : public X86Instr {
   const BinaryInstrKind kind;
   Operand src;
   Operand dst;
+  const OperandSize size;
 
-  BinaryInstr(BinaryInstrKind kind, Operand dst, Operand src)
-      : kind(std::move(kind)), src(std::move(src)), dst(std::move(dst)) {}
+  BinaryInstr(BinaryInstrKind kind, Operand dst, Operand src,
+              OperandSize size = OperandSize::WORD)
+      : kind(std::move(kind)),
+        src(std::move(src)),
+        dst(std::move(dst)),
+        size(size) {}
+
+  virtual std::vector<X86Register> Uses() const;
+  virtual std::vector<X86Register> Defs() const;
+  virtual bool IsFallThrough() const;
+  virtual std::optional<Label> IsLabel() const;
+  virtual std::vector<Label> Jumps() const;
+  virtual std::optional<std::pair<X86Register, X86Register>>
+  IsMoveBetweenTemps() const;
+  virtual void rename(std::function<X86Register(X86Register)>& sigma);
+
+  virtual void accept(X86InstrVisitor& visitor);
+};
+
+// Instructions with a destination and two source operands:
+// IMUL dst, src, imm and the shifts of BMI2, which take the count from any
+// register (src2) and leave the flags unchanged.
+enum TernaryInstrKind { IMUL3, SHLX, SHRX, SARX };
+
+class TernaryInstr : public X86Instr {
+ public:
+  const TernaryInstrKind kind;
+  Operand dst;   // a register
+  Operand src;   // a register or memory
+  Operand src2;  // an immediate for IMUL3, else a register
+  const OperandSize size;
+
+  TernaryInstr(TernaryInstrKind kind, Operand dst, Operand src, Operand src2,
+               OperandSize size = OperandSize::WORD)
+      : kind(kind),
+        dst(std::move(dst)),
+        src(std::move(src)),
+        src2(std::move(src2)),
+        size(size) {}
 
   virtual std::vector<X86Register> Uses() const;
   virtual std::vector<X86Register> Defs() const;
@@ -169,8 +242,51 @@ class LabelInstr : public X86Instr {
 
 class CallInstr : public X86Instr {
  public:
+  // Frame slots (see Operand::FrameSlot) that hold the references that are
+  // live during the call. The return address is labelled so that the
+  // garbage collector can find the map (see StackMapData).
+  struct StackMap {
+    Label return_address;
+    std::vector<std::int32_t> roots;
+  };
+
   const Label target;
-  CallInstr(Label l) : target(std::move(l)){};
+  const std::vector<X86Register> arguments;  // registers with arguments
+  // caller-save registers of the calling convention, CALLER_SAVE on x86
+  const std::vector<X86Register> clobbered;
+  std::optional<StackMap> stack_map;  // if the callee may collect garbage
+
+  CallInstr(Label l) : CallInstr(std::move(l), {}){};
+  CallInstr(Label l, std::vector<X86Register> arguments)
+      : CallInstr(std::move(l), std::move(arguments),
+                  {std::begin(CALLER_SAVE), std::end(CALLER_SAVE)}){};
+  CallInstr(Label l, std::vector<X86Register> arguments,
+            std::vector<X86Register> clobbered)
+      : target(std::move(l)),
+        arguments(std::move(arguments)),
+        clobbered(std::move(clobbered)){};
+
+  virtual std::vector<X86Register> Uses() const;
+  virtual std::vector<X86Register> Defs() const;
+  virtual bool IsFallThrough() const;
+  virtual std::optional<Label> IsLabel() const;
+  virtual std::vector<Label> Jumps() const;
+  virtual std::optional<std::pair<X86Register, X86Register>>
+  IsMoveBetweenTemps() const;
+  virtual void rename(std::function<X86Register(X86Register)>& sigma);
+
+  virtual void accept(X86InstrVisitor& visitor);
+};
+
+// Jump to another function that reuses the stack frame of the caller
+// and returns directly to the caller's caller.
+class TailCallInstr : public X86Instr {
+ public:
+  const Label target;
+  const std::vector<X86Register> arguments;  // registers with arguments
+
+  TailCallInstr(Label l, std::vector<X86Register> arguments)
+      : target(std::move(l)), arguments(std::move(arguments)){};
 
   virtual std::vector<X86Register> Uses() const;
   virtual std::vector<X86Register> Defs() const;
@@ -204,12 +320,51 @@ class JmpInstr : public X86Instr {
 
 class JInstr : public X86Instr {
  public:
-  enum Kind { E, NE, L, LE, G, GE, Z };
+  // B, BE, A and AE are unsigned comparisons
+  enum Kind { E, NE, L, LE, G, GE, Z, B, BE, A, AE };
   const Kind cond;
   const Label target;
 
   JInstr(Kind cond, Label l) : cond(cond), target(std::move(l)){};
 
+  // the condition that holds if cond does not
+  static Kind Negate(Kind cond);
+
+  virtual std::vector<X86Register> Uses() const;
+  virtual std::vector<X86Register> Defs() const;
+  virtual bool IsFallThrough() const;
+  virtual std::optional<Label> IsLabel() const;
+  virtual std::vector<Label> Jumps() const;
+  virtual std::optional<std::pair<X86Register, X86Register>>
+  IsMoveBetweenTemps() const;
+  virtual void rename(std::function<X86Register(X86Register)>& sigma);
+
+  virtual void accept(X86InstrVisitor& visitor);
+};
+
+// Instructions that read the flags like a conditional jump:
+// SETcc sets the lowest byte of the register dst to 1 if the condition holds
+// and to 0 otherwise, and leaves the other bits unchanged. CMOVcc moves the
+// register src into dst if the condition holds.
+enum CondInstrKind { SET, CMOV };
+
+class CondInstr : public X86Instr {
+ public:
+  const CondInstrKind kind;
+  const JInstr::Kind cond;
+  Operand dst;
+  Operand src;  // unused for SET
+  const OperandSize size;  // of the move
+
+  CondInstr(CondInstrKind kind, JInstr::Kind cond, Operand dst,
+            Operand src = Operand::Imm(0),
+            OperandSize size = OperandSize::WORD)
+      : kind(kind),
+        cond(cond),
+        dst(std::move(dst)),
+        src(std::move(src)),
+        size(size) {}
+
   virtual std::vector<X86Register> Uses() const;
   virtual std::vector<X86Register> Defs() const;
   virtual bool IsFallThrough() const;
@@ -236,15 +391,97 @@ class RetInstr : public X86Instr {
   virtual void accept(X86InstrVisitor& visitor);
 };
 
+// Increments a counter of the execution profile (see X86Profile). Changes
+// the flags, but no registers.
+class CountInstr : public X86Instr {
+ public:
+  const unsigned counter;
+
+  explicit CountInstr(unsigned counter) : counter(counter){};
+
+  virtual std::vector<X86Register> Uses() const;
+  virtual std::vector<X86Register> Defs() const;
+  virtual bool IsFallThrough() const;
+  virtual std::optional<Label> IsLabel() const;
+  virtual std::vector<Label> Jumps() const;
+  virtual std::optional<std::pair<X86Register, X86Register>>
+  IsMoveBetweenTemps() const;
+  virtual void rename(std::function<X86Register(X86Register)>& sigma);
+
+  virtual void accept(X86InstrVisitor& visitor);
+};
+
+// Instructions on the vector registers XMM0 to XMM7, YMM0 to YMM7 with AVX2
+// (see Vector), which the register allocator does not know. The operand op
+// is the memory of MOVDQU, the general register of MOVD, the selection of
+// PSHUFD and unused otherwise.
+enum VectorInstrKind {
+  MOVDQA,        // dst <- src
+  MOVDQU,        // dst <- op, or op <- src if store
+  MOVD,          // dst <- op in the lowest lane, 0 in the others, or
+                 // op <- the lowest lane of src if store
+  PSHUFD,        // lane k of dst <- lane (op >> 2k) & 3 of src
+  PUNPCKLDQ,     // dst <- dst[0], src[0], dst[1], src[1]
+  PUNPCKLQDQ,    // dst <- dst[0], dst[1], src[0], src[1]
+  PADDD,         // dst <- dst + src, lane by lane
+  PSUBD,         // dst <- dst - src
+  PMULLD,        // dst <- dst * src (SSE4.1)
+  PXOR,          // dst <- dst ^ src
+  VPBROADCASTD,  // each lane of dst <- the lowest lane of src (AVX2)
+  VINSERTI128,   // upper half of dst <- lower half of src
+  VEXTRACTI128,  // dst <- upper half of src
+  VZEROUPPER,    // clears the upper halves, which SSE code would preserve
+};
+
+// The legacy SSE encoding, or the VEX encoding of AVX with 128 or 256-bit
+// vectors. SSE and VEX instructions are not mixed.
+enum class VectorEncoding { SSE, VEX128, VEX256 };
+
+class VectorInstr : public X86Instr {
+ public:
+  const VectorInstrKind kind;
+  const std::uint8_t dst;
+  const std::uint8_t src;
+  Operand op;
+  const bool store;
+  const VectorEncoding encoding;
+
+  VectorInstr(VectorInstrKind kind, VectorEncoding encoding,
+              std::uint8_t dst, std::uint8_t src,
+              Operand op = Operand::Imm(0), bool store = false)
+      : kind(kind),
+        dst(dst),
+        src(src),
+        op(std::move(op)),
+        store(store),
+        encoding(encoding) {}
+
+  virtual std::vector<X86Register> Uses() const;
+  virtual std::vector<X86Register> Defs() const;
+  virtual bool IsFallThrough() const;
+  virtual std::optional<Label> IsLabel() const;
+  virtual std::vector<Label> Jumps() const;
+  virtual std::optional<std::pair<X86Register, X86Register>>
+  IsMoveBetweenTemps() const;
+  virtual void rename(std::function<X86Register(X86Register)>& sigma);
+
+  virtual void accept(X86InstrVisitor& visitor);
+};
+
 class X86InstrVisitor {
  public:
   virtual void Visit(UnaryInstr& i) = 0;
   virtual void Visit(BinaryInstr& i) = 0;
+  virtual void Visit(TernaryInstr& i) = 0;
   virtual void Visit(LabelInstr& i) = 0;
   virtual void Visit(CallInstr& i) = 0;
+  virtual void Visit(TailCallInstr& i) = 0;
   virtual void Visit(JmpInstr& i) = 0;
   virtual void Visit(JInstr& i) = 0;
+  virtual void Visit(CondInstr& i) = 0;
   virtual void Visit(RetInstr& i) = 0;
+  virtual void Visit(CountInstr& i) = 0;
+  virtual void Visit(VectorInstr& i) = 0;
 };
 }  // namespace mjc
 
@@ -0,0 +1,352 @@
+#include "backend/x86/x86_peephole.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "backend/flow.h"
+#include "backend/liveness.h"
+#include "backend/x86/x86_instr.h"
+#include "backend/x86/x86_target.h"
+
+namespace mjc {
+
+namespace {
+
+using InstrVector = std::vector<std::unique_ptr<X86Instr>>;
+using Replacement = std::optional<InstrVector>;
+
+// View of the instructions starting at a position of the body
+class Window {
+ public:
+  Window(InstrVector &body, std::size_t pos,
+         const Liveness<X86Target> &liveness)
+      : body_(body), pos_(pos), liveness_(liveness) {}
+
+  // The k-th instruction of the window if it is of type T, else nullptr
+  template <typename T>
+  T *Get(std::size_t k) const {
+    if (pos_ + k >= body_.size()) return nullptr;
+    return dynamic_cast<T *>(body_[pos_ + k].get());
+  }
+
+  // Moves the k-th instruction of the window into a replacement
+  std::unique_ptr<X86Instr> Take(std::size_t k) {
+    return std::move(body_[pos_ + k]);
+  }
+
+  bool IsDeadAfter(std::size_t k, X86Register r) const {
+    return liveness_.GetLiveOut(pos_ + k).count(r) == 0;
+  }
+
+ private:
+  InstrVector &body_;
+  std::size_t pos_;
+  const Liveness<X86Target> &liveness_;
+};
+
+struct Pattern {
+  const char *name;
+  std::size_t length;  // number of instructions in the window
+  // Returns the replacement for the window, or nothing if the pattern does
+  // not match. Must not take instructions from the window if it does not
+  // match.
+  std::function<Replacement(Window &)> rewrite;
+};
+
+template <typename... Instrs>
+InstrVector Instructions(Instrs... instrs) {
+  InstrVector v;
+  (v.push_back(std::move(instrs)), ...);
+  return v;
+}
+
+bool Mentions(const Operand &o, X86Register r) {
+  auto &regs = o.GetRegs();
+  return std::find(regs.begin(), regs.end(), r) != regs.end();
+}
+
+bool IsBinary(const BinaryInstr *i, BinaryInstrKind kind) {
+  return i != nullptr && i->kind == kind;
+}
+
+bool IsImm(const Operand &o, std::int32_t value) {
+  return o.IsImm() && o.GetImm() == value;
+}
+
+// Whether a register that was assigned with the first size holds the same
+// value when it is read with the second one: a 32-bit move clears the upper
+// half of the register.
+bool Preserves(OperandSize assigned, OperandSize read) {
+  return assigned == OperandSize::WORD || read == OperandSize::INT32;
+}
+
+// condition for the operands of a comparison in swapped order
+JInstr::Kind Swap(JInstr::Kind cond) {
+  switch (cond) {
+    case JInstr::L:
+      return JInstr::G;
+    case JInstr::LE:
+      return JInstr::GE;
+    case JInstr::G:
+      return JInstr::L;
+    case JInstr::GE:
+      return JInstr::LE;
+    case JInstr::B:
+      return JInstr::A;
+    case JInstr::BE:
+      return JInstr::AE;
+    case JInstr::A:
+      return JInstr::B;
+    case JInstr::AE:
+      return JInstr::BE;
+    default:
+      return cond;
+  }
+}
+
+// Conditions that depend only on ZF (and not on OF, SF or CF)
+bool IsZeroTest(JInstr::Kind cond) {
+  return cond == JInstr::E || cond == JInstr::NE || cond == JInstr::Z;
+}
+
+// Conditions that read CF: the unsigned comparisons
+bool ReadsCarry(JInstr::Kind cond) {
+  return cond == JInstr::B || cond == JInstr::BE || cond == JInstr::A ||
+         cond == JInstr::AE;
+}
+
+// Whether CF is dead after the k-th instruction of the window: no
+// instruction reads it before the next one that sets it, a call or the end
+// of the block. The flags are never live into a block.
+bool IsCarryDeadAfter(const Window &w, std::size_t k) {
+  for (auto i = k + 1; w.Get<X86Instr>(i) != nullptr; i++) {
+    if (auto j = w.Get<JInstr>(i)) {
+      if (ReadsCarry(j->cond)) return false;
+      continue;
+    }
+    if (auto b = w.Get<BinaryInstr>(i)) {
+      // shifts by CL keep the flags if the count is 0
+      auto kind = b->kind;
+      if (kind == ADD || kind == SUB || kind == AND || kind == OR ||
+          kind == XOR || kind == TEST || kind == CMP || kind == IMUL)
+        return true;
+      continue;
+    }
+    if (auto u = w.Get<UnaryInstr>(i)) {
+      if (u->kind == NEG) return true;
+      continue;
+    }
+    if (auto c = w.Get<CondInstr>(i)) {
+      if (ReadsCarry(c->cond)) return false;
+      continue;
+    }
+    if (auto t = w.Get<TernaryInstr>(i)) {
+      // the BMI2 shifts leave the flags unchanged
+      if (t->kind == IMUL3) return true;
+      continue;
+    }
+    // none of the vector instructions changes the flags
+    if (w.Get<VectorInstr>(i)) continue;
+    // a label, jump, call or return
+    return true;
+  }
+  return true;
+}
+
+const std::vector<Pattern> PATTERNS = {
+    // MOV a, a  ==>
+    {"self-move", 1,
+     [](Window &w) -> Replacement {
+       auto m = w.Get<BinaryInstr>(0);
+       if (!IsBinary(m, MOV) || m->size != OperandSize::WORD ||
+           !(m->dst == m->src))
+         return std::nullopt;
+       return InstrVector{};
+     }},
+
+    // JMP l; l:  ==>  l:
+    {"jump-to-next", 2,
+     [](Window &w) -> Replacement {
+       auto j = w.Get<JmpInstr>(0);
+       auto l = w.Get<LabelInstr>(1);
+       if (!j || !l || !(j->target == l->label)) return std::nullopt;
+       return Instructions(w.Take(1));
+     }},
+
+    // MOV a, b; MOV b, a  ==>  MOV a, b
+    {"move-back", 2,
+     [](Window &w) -> Replacement {
+       auto m1 = w.Get<BinaryInstr>(0);
+       auto m2 = w.Get<BinaryInstr>(1);
+       if (!IsBinary(m1, MOV) || !IsBinary(m2, MOV) ||
+           m1->size != OperandSize::WORD || m2->size != OperandSize::WORD ||
+           !(m1->dst == m2->src) || !(m1->src == m2->dst))
+         return std::nullopt;
+       // b must not be addressed using a
+       if (m1->dst.IsReg() && Mentions(m1->src, m1->dst.GetReg()))
+         return std::nullopt;
+       return Instructions(w.Take(0));
+     }},
+
+    // MOV [m], r; MOV s, [m]  ==>  MOV [m], r; MOV s, r
+    {"store-load", 2,
+     [](Window &w) -> Replacement {
+       auto m1 = w.Get<BinaryInstr>(0);
+       auto m2 = w.Get<BinaryInstr>(1);
+       if (!IsBinary(m1, MOV) || !IsBinary(m2, MOV) || !m1->dst.IsMem() ||
+           !m1->src.IsReg() || !m2->dst.IsReg() || !(m1->dst == m2->src) ||
+           !Preserves(m1->size, m2->size))
+         return std::nullopt;
+       auto src = m1->src;
+       auto dst = m2->dst;
+       auto size = m2->size;
+       return Instructions(w.Take(0),
+                           std::make_unique<BinaryInstr>(MOV, dst, src, size));
+     }},
+
+    // MOV r, [m]; MOV s, [m]  ==>  MOV r, [m]; MOV s, r
+    {"load-load", 2,
+     [](Window &w) -> Replacement {
+       auto m1 = w.Get<BinaryInstr>(0);
+       auto m2 = w.Get<BinaryInstr>(1);
+       if (!IsBinary(m1, MOV) || !IsBinary(m2, MOV) || !m1->src.IsMem() ||
+           !m1->dst.IsReg() || !m2->dst.IsReg() || !(m1->src == m2->src) ||
+           Mentions(m1->src, m1->dst.GetReg()) ||
+           !Preserves(m1->size, m2->size))
+         return std::nullopt;
+       auto src = m1->dst;
+       auto dst = m2->dst;
+       auto size = m2->size;
+       return Instructions(w.Take(0),
+                           std::make_unique<BinaryInstr>(MOV, dst, src, size));
+     }},
+
+    // MOV r, imm; CMP r, x; Jcc l  ==>  CMP x, imm; Jcc' l  (r dead)
+    {"compare-immediate", 3,
+     [](Window &w) -> Replacement {
+       auto m = w.Get<BinaryInstr>(0);
+       auto c = w.Get<BinaryInstr>(1);
+       auto j = w.Get<JInstr>(2);
+       if (!IsBinary(m, MOV) || !IsBinary(c, CMP) || !j || !m->dst.IsReg() ||
+           !m->src.IsImm() || !(c->dst == m->dst) || c->src.IsImm() ||
+           Mentions(c->src, m->dst.GetReg()) ||
+           !w.IsDeadAfter(1, m->dst.GetReg()) ||
+           !(Preserves(m->size, c->size) || m->src.GetImm() >= 0))
+         return std::nullopt;
+       auto x = c->src;
+       auto imm = m->src;
+       auto size = c->size;
+       return Instructions(std::make_unique<BinaryInstr>(CMP, x, imm, size),
+                           std::make_unique<JInstr>(Swap(j->cond), j->target));
+     }},
+
+    // ADD a, 1  ==>  INC a    (and likewise for DEC)
+    // if CF is dead, since INC does not set it
+    {"increment", 1,
+     [](Window &w) -> Replacement {
+       auto a = w.Get<BinaryInstr>(0);
+       if (!a || (a->kind != ADD && a->kind != SUB) ||
+           !IsCarryDeadAfter(w, 0))
+         return std::nullopt;
+       auto one = (a->kind == ADD) ? 1 : -1;
+       if (IsImm(a->src, one)) {
+         return Instructions(
+             std::make_unique<UnaryInstr>(INC, a->dst, a->size));
+       } else if (IsImm(a->src, -one)) {
+         return Instructions(
+             std::make_unique<UnaryInstr>(DEC, a->dst, a->size));
+       }
+       return std::nullopt;
+     }},
+
+    // CMP r, 0  ==>  TEST r, r
+    {"compare-zero", 1,
+     [](Window &w) -> Replacement {
+       auto c = w.Get<BinaryInstr>(0);
+       if (!IsBinary(c, CMP) || !c->dst.IsReg() || !IsImm(c->src, 0))
+         return std::nullopt;
+       return Instructions(
+           std::make_unique<BinaryInstr>(TEST, c->dst, c->dst, c->size));
+     }},
+
+    // op r, x; TEST r, r; Jcc l  ==>  op r, x; Jcc l
+    // if op sets the flags read by Jcc like TEST
+    {"redundant-test", 3,
+     [](Window &w) -> Replacement {
+       auto t = w.Get<BinaryInstr>(1);
+       auto j = w.Get<JInstr>(2);
+       if (!IsBinary(t, TEST) || !t->dst.IsReg() || !(t->dst == t->src) || !j)
+         return std::nullopt;
+       auto r = t->dst.GetReg();
+       auto sets_flags = false;
+       if (auto b = w.Get<BinaryInstr>(0); b && b->dst.IsReg() &&
+                                            b->dst.GetReg() == r &&
+                                            b->size == t->size) {
+         // logical operations clear OF and CF, like TEST
+         sets_flags = b->kind == AND || b->kind == OR || b->kind == XOR ||
+                      ((b->kind == ADD || b->kind == SUB) &&
+                       IsZeroTest(j->cond));
+       } else if (auto u = w.Get<UnaryInstr>(0); u && u->src.IsReg() &&
+                                                   u->src.GetReg() == r &&
+                                                   u->size == t->size) {
+         sets_flags = (u->kind == INC || u->kind == DEC || u->kind == NEG) &&
+                      IsZeroTest(j->cond);
+       }
+       if (!sets_flags) return std::nullopt;
+       return Instructions(w.Take(0), w.Take(2));
+     }},
+};
+
+}  // namespace
+
+X86Peephole::Counts X86Peephole::Process(X86Prg &prg) {
+  auto counts = Counts{};
+  for (auto &f : prg.functions) {
+    for (auto &[name, n] : Process(*f)) {
+      counts[name] += n;
+    }
+  }
+  return counts;
+}
+
+X86Peephole::Counts X86Peephole::Process(X86Function &f) {
+  auto counts = Counts{};
+  auto &body = f.GetBody();
+
+  for (auto change = true; change;) {
+    change = false;
+    auto flow = FlowGraph<X86Target>(f);
+    auto liveness = Liveness<X86Target>(f, flow);
+
+    auto new_body = InstrVector{};
+    new_body.reserve(body.size());
+    for (std::size_t i = 0; i < body.size();) {
+      auto window = Window(body, i, liveness);
+      auto match = false;
+      for (auto &p : PATTERNS) {
+        if (i + p.length > body.size()) continue;
+        if (auto replacement = p.rewrite(window)) {
+          for (auto &r : *replacement) {
+            new_body.push_back(std::move(r));
+          }
+          counts[p.name]++;
+          i += p.length;
+          match = change = true;
+          break;
+        }
+      }
+      if (!match) {
+        new_body.push_back(std::move(body[i]));
+        i++;
+      }
+    }
+    std::exchange(body, std::move(new_body));
+  }
+  return counts;
+}
+
+}  // namespace mjc
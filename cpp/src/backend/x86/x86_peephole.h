@@ -0,0 +1,32 @@
+//
+// Peephole optimisation of x86 code after register allocation
+//
+#ifndef MJC_BACKEND_X86PEEPHOLE_H
+#define MJC_BACKEND_X86PEEPHOLE_H
+
+#include <map>
+#include <string>
+
+#include "backend/x86/x86_function.h"
+#include "backend/x86/x86_prg.h"
+
+namespace mjc {
+
+// Rewrites short instruction sequences using a table of patterns. The
+// patterns are applied in a window that slides over the function body,
+// until no pattern matches any more.
+//
+// Assumes, as generated by the Muncher, that flags set by an instruction
+// are only read by a conditional jump immediately following it.
+class X86Peephole {
+ public:
+  // number of rewrites per pattern name
+  using Counts = std::map<std::string, unsigned>;
+
+  static Counts Process(X86Prg &prg);
+  static Counts Process(X86Function &f);
+};
+
+}  // namespace mjc
+
+#endif
@@ -4,8 +4,13 @@
 #ifndef MJC_BACKEND_X86PRG_H
 #define MJC_BACKEND_X86PRG_H
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <iostream>
+#include <string>
+#include <variant>
+#include <vector>
 
 #include "backend/x86/x86_instr.h"
 #include "backend/x86/x86_function.h"
@@ -15,8 +20,31 @@ namespace mjc {
 // Represents an x86 machine program
 struct X86Prg {
   std::vector<std::unique_ptr<X86Function>> functions;
+  unsigned word_size = 4;  // 8 for x86-64, as in the frames of the functions
+  // Names of the counters of CountInstr and the file to which the program
+  // writes them at exit, if it is instrumented (see X86Profile)
+  std::vector<std::string> profile_keys;
+  std::string profile_file;
 };
 
+// Initialised data of a program. Each item is a word (of the word size of
+// the program) with a number or the address of a label, or a
+// null-terminated string.
+struct X86Data {
+  using Item = std::variant<std::int32_t, Label, std::string>;
+
+  Label label;
+  bool global;
+  std::vector<Item> items;
+};
+
+// The tables of the stack maps and of the profile counters (in this order)
+std::vector<X86Data> ProgramData(const X86Prg &p);
+
+// Label of the table of the profile counters and offset of a counter in it
+Label ProfileTable();
+std::size_t ProfileCounterOffset(unsigned counter, unsigned word_size);
+
 std::ostream& operator<<(std::ostream &os, X86Prg &p);
 
 }  // namespace mjc
@@ -0,0 +1,42 @@
+#include "backend/x86/x86_profile.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "backend/x86/x86_instr.h"
+#include "intermediate/profile.h"
+
+namespace mjc {
+
+void X86Profile::Instrument(X86Prg &prg, const std::string &file) {
+  prg.profile_file = file;
+  auto &keys = prg.profile_keys;
+  auto counter = [&keys](std::string key) {
+    keys.push_back(std::move(key));
+    return std::make_unique<CountInstr>(keys.size() - 1);
+  };
+
+  for (auto &f : prg.functions) {
+    auto &name = f->GetName();
+    auto &body = f->GetBody();
+    auto new_body = std::vector<std::unique_ptr<X86Instr>>{};
+    new_body.reserve(2 * body.size());
+    new_body.push_back(counter(Profile::BlockKey(name, name)));
+    for (auto &i : body) {
+      if (auto call = dynamic_cast<CallInstr *>(i.get())) {
+        new_body.push_back(counter(Profile::CallKey(name, call->target)));
+      } else if (auto call = dynamic_cast<TailCallInstr *>(i.get())) {
+        new_body.push_back(counter(Profile::CallKey(name, call->target)));
+      }
+      auto label = i->IsLabel();
+      new_body.push_back(std::move(i));
+      if (label) {
+        new_body.push_back(counter(Profile::BlockKey(name, *label)));
+      }
+    }
+    std::exchange(body, std::move(new_body));
+  }
+}
+
+}  // namespace mjc
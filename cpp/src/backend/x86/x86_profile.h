@@ -0,0 +1,26 @@
+//
+// Instrumentation of x86 code for execution profiles
+//
+#ifndef MJC_BACKEND_X86PROFILE_H
+#define MJC_BACKEND_X86PROFILE_H
+
+#include <string>
+
+#include "backend/x86/x86_prg.h"
+
+namespace mjc {
+
+// Inserts counters for the entries of the functions, for the blocks that
+// start at labels and for the calls. The instrumented program writes the
+// counts to the given file at exit, in the format read by Profile.
+//
+// To be run last, as the counters change the flags and must not be moved
+// or removed by other passes.
+class X86Profile {
+ public:
+  static void Instrument(X86Prg &prg, const std::string &file);
+};
+
+}  // namespace mjc
+
+#endif
@@ -18,7 +18,10 @@ class X86Register {
   bool operator<(const X86Register &r) const { return number < r.number; }
 };
 
-static const int NUMBER_OF_REGS = 8;
+// On x86-64, the registers EAX to ESP denote RAX to RSP, and R8 to R15
+// exist in addition. The names of a register depend on the size of the
+// operands (see OperandSize).
+static const int NUMBER_OF_REGS = 16;
 static const X86Register EAX = 0;
 static const X86Register EBX = 1;
 static const X86Register ECX = 2;
@@ -27,12 +30,38 @@ static const X86Register ESI = 4;
 static const X86Register EDI = 5;
 static const X86Register EBP = 6;
 static const X86Register ESP = 7;
+static const X86Register R8 = 8;
+static const X86Register R9 = 9;
+static const X86Register R10 = 10;
+static const X86Register R11 = 11;
+static const X86Register R12 = 12;
+static const X86Register R13 = 13;
+static const X86Register R14 = 14;
+static const X86Register R15 = 15;
 
 static const X86Register CALLER_SAVE[] = {EAX, ECX, EDX};
 static const X86Register CALLEE_SAVE[] = {EBX, ESI, EDI};
 
-static const char *const REG_NAMES[] = {"eax", "ebx", "ecx", "edx",
-                                        "esi", "edi", "ebp", "esp"};
+// Registers for the first arguments of calls between MiniJava methods
+// (in the order of gcc's regparm(3) convention)
+static const X86Register ARGUMENT_REGS[] = {EAX, EDX, ECX};
+
+// The same for x86-64, as in the System V ABI, which is used for all calls
+static const X86Register CALLER_SAVE_64[] = {EAX, ECX, EDX, ESI, EDI,
+                                             R8,  R9,  R10, R11};
+static const X86Register CALLEE_SAVE_64[] = {EBX, R12, R13, R14, R15};
+static const X86Register ARGUMENT_REGS_64[] = {EDI, ESI, EDX, ECX, R8, R9};
+
+static const char *const REG_NAMES[] = {
+    "eax", "ebx", "ecx", "edx", "esi", "edi", "ebp",  "esp",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+static const char *const REG_NAMES_64[] = {
+    "rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp", "rsp",
+    "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15"};
+// lowest bytes, for SETcc; ESI to ESP have them only on x86-64
+static const char *const REG_NAMES_8[] = {
+    "al",  "bl",  "cl",   "dl",   "sil",  "dil",  "bpl",  "spl",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
 
 }  // namespace mjc
 
@@ -5,6 +5,9 @@
 #include <map>
 #include <memory>
 #include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "backend/x86/x86_function.h"
@@ -15,13 +18,30 @@
 #include "intermediate/tree.h"
 #include "intermediate/tree_exp.h"
 #include "intermediate/tree_stm.h"
+#include "intermediate/vector.h"
 
 namespace mjc {
 const std::vector<X86Register> X86Target::MACHINE_REGS{EAX, EBX, ECX, EDX,
                                                        ESI, EDI, ESP, EBP};
 
-const std::vector<X86Register> X86Target::GENERAL_PURPOSE_REGS{EAX, EBX, ECX,
-                                                               EDX, ESI, EDI};
+// Caller-save registers come first, so that the register allocator prefers
+// them: callee-save registers must be saved and restored when they are used.
+const std::vector<X86Register> X86Target::GENERAL_PURPOSE_REGS{EAX, ECX, EDX,
+                                                               EBX, ESI, EDI};
+
+const std::vector<X86Register> X86Target::GENERAL_PURPOSE_REGS_WITH_EBP{
+    EAX, ECX, EDX, EBX, ESI, EDI, EBP};
+
+const std::vector<X86Register> X8664Target::MACHINE_REGS{
+    EAX, EBX, ECX, EDX, ESI, EDI, ESP, EBP,
+    R8,  R9,  R10, R11, R12, R13, R14, R15};
+
+const std::vector<X86Register> X8664Target::GENERAL_PURPOSE_REGS{
+    EAX, ECX, EDX, ESI, EDI, R8, R9, R10, R11, EBX, R12, R13, R14, R15};
+
+const std::vector<X86Register> X8664Target::GENERAL_PURPOSE_REGS_WITH_EBP{
+    EAX, ECX, EDX, ESI, EDI, R8,  R9, R10,
+    R11, EBX, R12, R13, R14, R15, EBP};
 
 class LinearCombination {
 public:
@@ -119,60 +139,487 @@ private:
   }
 };
 
+// Calling conventions on x86:
+// - Calls between the functions of the program, i.e. the translated
+//   MiniJava methods, pass the first arguments in ARGUMENT_REGS and the
+//   remaining ones on the stack, as in gcc's regparm(3).
+// - Lmain and the runtime functions use cdecl: all arguments on the stack.
+// On x86-64, all calls pass the first arguments in ARGUMENT_REGS_64.
+template <typename Target>
 class Muncher {
 public:
+  Muncher(const X86Options &options) : options_(options) {}
+
   X86Prg Process(Tracer::TracedTreeProgram &prg) {
+    internal_functions_.clear();
+    for (auto &f : prg.functions) {
+      if (!(f.name == Label("Lmain"))) {
+        internal_functions_.insert(f.name);
+      }
+    }
+
     std::vector<std::unique_ptr<X86Function>> functions;
     for (auto &f : prg.functions) {
       functions.push_back(function(f));
     }
-    return {.functions = std::move(functions)};
+    return {.functions = std::move(functions), .word_size = Target::WORD_SIZE};
   }
 
   using InstrVector = std::vector<std::unique_ptr<X86Instr>>;
   const InstrVector &GetCode() const { return code_; }
 
 private:
+  static constexpr bool x86_64_ = Target::WORD_SIZE == X8664Target::WORD_SIZE;
+
   std::unique_ptr<X86Function> function(TreeFunction &fun) {
     code_.clear();
-    emit(std::make_unique<UnaryInstr>(PUSH, EBP));
-    emit(std::make_unique<BinaryInstr>(MOV, EBP, ESP));
+    outgoing_arguments_ = 0;
+    leaf_ = true;
+    frame_ = X86Frame{
+        .word_size = Target::WORD_SIZE,
+        .frame_pointer = !options_.omit_frame_pointer,
+        .memory_size = (unsigned)fun.frame_memory_size};
+    pointers_.clear();
+    if (x86_64_) find_pointers(fun);
+    if (!options_.omit_frame_pointer) {
+      emit(std::make_unique<UnaryInstr>(PUSH, EBP));
+      emit(std::make_unique<BinaryInstr>(MOV, EBP, ESP));
+    }
     emit(std::make_unique<BinaryInstr>(SUB, ESP, Operand::FrameSize()));
 
-    auto ebx_save = Operand::Reg(Temp{});
-    auto esi_save = Operand::Reg(Temp{});
-    auto edi_save = Operand::Reg(Temp{});
-
-    emit(std::make_unique<BinaryInstr>(MOV, ebx_save, EBX));
-    emit(std::make_unique<BinaryInstr>(MOV, esi_save, ESI));
-    emit(std::make_unique<BinaryInstr>(MOV, edi_save, EDI));
-
-    for (auto &s : fun.body) {
-      stm(*s);
+    // All parameters are copied into temps, so that they can be kept in
+    // registers. A spilled stack parameter stays in its slot.
+    parameters_.clear();
+    auto parameter_slots = std::unordered_map<X86Register, std::int32_t>{};
+    auto k = register_arguments(fun.name, fun.parameter_count);
+    for (std::size_t i = 0; i < fun.parameter_count; i++) {
+      auto t = Temp{};
+      if (i < k) {
+        emit(std::make_unique<BinaryInstr>(MOV, Operand::Reg(t),
+                                           argument_reg(i)));
+      } else {
+        auto slot = stack_parameter_offset(i - k);
+        emit(std::make_unique<BinaryInstr>(MOV, Operand::Reg(t),
+                                           Operand::FrameSlot(slot)));
+        parameter_slots[t] = slot;
+      }
+      parameters_.push_back(t);
+    }
+    stack_parameter_count_ = fun.parameter_count - k;
+
+    find_labels(fun);
+    auto &body = fun.body;
+    auto skip = std::vector<bool>(body.size());
+    for (std::size_t i = 0; i < body.size(); i++) {
+      if (skip[i]) continue;
+      if (options_.cmov) {
+        if (auto n = if_convert(body, i, skip)) {
+          i += n - 1;
+          continue;
+        }
+      }
+      stm(*body[i]);
     }
 
     emit(
         std::make_unique<BinaryInstr>(MOV, EAX, Operand::Reg(fun.return_temp)));
-    emit(std::make_unique<BinaryInstr>(MOV, EBX, ebx_save));
-    emit(std::make_unique<BinaryInstr>(MOV, ESI, esi_save));
-    emit(std::make_unique<BinaryInstr>(MOV, EDI, edi_save));
-    emit(std::make_unique<BinaryInstr>(MOV, ESP, EBP));
-    emit(std::make_unique<UnaryInstr>(POP, EBP));
+    epilogue();
     emit(std::make_unique<RetInstr>());
 
-    return std::make_unique<X86Function>(fun.name, std::move(code_));
+    frame_.leaf = leaf_;
+    frame_.outgoing_size = Target::WORD_SIZE * (unsigned)outgoing_arguments_;
+    frame_.parameter_slots = std::move(parameter_slots);
+    return std::make_unique<X86Function>(fun.name, std::move(code_),
+                                         std::move(frame_));
+  }
+
+  // Removes the stack frame. The callee-save registers are saved and
+  // restored after register allocation (X86Function::LayoutFrame), which
+  // relies on the prologue and epilogue having exactly this form.
+  void epilogue() {
+    if (options_.omit_frame_pointer) {
+      emit(std::make_unique<BinaryInstr>(ADD, ESP, Operand::FrameSize()));
+    } else {
+      emit(std::make_unique<BinaryInstr>(MOV, ESP, EBP));
+      emit(std::make_unique<UnaryInstr>(POP, EBP));
+    }
+  }
+
+  // Emits a call in tail position as a jump that lets the callee reuse the
+  // stack frame. The callee finds its stack arguments in the parameter slots
+  // of the current function, so this works only if it has no more stack
+  // arguments than the current function has stack parameters. Returns false
+  // if the call cannot be emitted in this way.
+  bool tail_call(TreeExpCall &call) {
+    if (call.GetFun()->GetOp() != TreeExp::TreeExpNameOp) {
+      return false;
+    }
+    auto &f = static_cast<TreeExpName &>(*call.GetFun());
+    auto &args = call.GetArgs();
+    auto k = register_arguments(f.GetName(), args.size());
+    if (args.size() - k > stack_parameter_count_) {
+      return false;
+    }
+
+    // the arguments may refer to the parameters that are overwritten
+    auto temps = std::vector<Operand>{};
+    for (auto &arg : args) {
+      auto t = Operand::Reg(Temp{});
+      move(t, exp(*arg));
+      temps.push_back(t);
+    }
+    for (std::size_t i = k; i < temps.size(); i++) {
+      emit(std::make_unique<BinaryInstr>(MOV, stack_parameter(i - k),
+                                         temps[i]));
+    }
+    auto regs = std::vector<X86Register>{};
+    for (std::size_t i = 0; i < k; i++) {
+      emit(std::make_unique<BinaryInstr>(MOV, argument_reg(i), temps[i]));
+      regs.push_back(argument_reg(i));
+    }
+    epilogue();
+    emit(std::make_unique<TailCallInstr>(f.GetName(), std::move(regs)));
+    return true;
+  }
+
+  // Number of arguments that a call of f with the given number of arguments
+  // passes in registers.
+  std::size_t register_arguments(const Label &f, std::size_t args) const {
+    if (x86_64_) {
+      return std::min(args, std::size(ARGUMENT_REGS_64));
+    }
+    if (internal_functions_.count(f) == 0) {
+      return 0;
+    }
+    return std::min(args, std::size(ARGUMENT_REGS));
+  }
+
+  static X86Register argument_reg(std::size_t i) {
+    return x86_64_ ? ARGUMENT_REGS_64[i] : ARGUMENT_REGS[i];
+  }
+
+  static std::vector<X86Register> caller_save() {
+    if (x86_64_) {
+      return {std::begin(CALLER_SAVE_64), std::end(CALLER_SAVE_64)};
+    }
+    return {std::begin(CALLER_SAVE), std::end(CALLER_SAVE)};
+  }
+
+  // Collects the temps that are assigned pointers (see is_pointer).
+  void find_pointers(TreeFunction &fun) {
+    for (auto changed = true; changed;) {
+      changed = false;
+      for (auto &s : fun.body) {
+        if (s->GetOp() != TreeStm::TreeStmMoveOp) continue;
+        auto &m = static_cast<TreeStmMove &>(*s);
+        if (m.GetDst()->GetOp() != TreeExp::TreeExpTempOp) continue;
+        auto t = static_cast<TreeExpTemp &>(*m.GetDst()).GetTemp();
+        if (pointers_.count(t) == 0 && is_pointer(*m.GetSrc())) {
+          pointers_.insert(t);
+          changed = true;
+        }
+      }
+    }
+  }
+
+  // Whether the value of e is known to be a pointer: a reference loaded
+  // from memory, a variable of the runtime, a frame address, or the sum
+  // or difference of a pointer and another value
+  bool is_pointer(TreeExp &e) const {
+    switch (e.GetOp()) {
+    case TreeExp::TreeExpNameOp:
+    case TreeExp::TreeExpFrameAddrOp:
+      return true;
+    case TreeExp::TreeExpMemOp: {
+      auto &m = static_cast<TreeExpMem &>(e);
+      return m.IsReference() ||
+             m.GetAddr()->GetOp() == TreeExp::TreeExpNameOp;
+    }
+    case TreeExp::TreeExpTempOp:
+      return pointers_.count(static_cast<TreeExpTemp &>(e).GetTemp()) > 0;
+    case TreeExp::TreeExpBinOpOp: {
+      auto &b = static_cast<TreeExpBinOp &>(e);
+      return (b.GetBinOp() == TreeExpBinOp::PLUS ||
+              b.GetBinOp() == TreeExpBinOp::MINUS) &&
+             (is_pointer(*b.GetLeft()) || is_pointer(*b.GetRight()));
+    }
+    default:
+      return false;
+    }
+  }
+
+  // Whether e is an element of an int array, which is loaded and stored
+  // with 32-bit moves on x86-64
+  bool is_int_element(TreeExp &e) const {
+    return x86_64_ && e.GetOp() == TreeExp::TreeExpMemOp &&
+           static_cast<TreeExpMem &>(e).GetKind() == TreeExpMem::INT32;
+  }
+
+  // Size of the instructions that compute e: ints have 32 bits on x86-64
+  OperandSize size(TreeExp &e) const {
+    return (!x86_64_ || address_ || is_pointer(e)) ? OperandSize::WORD
+                                                   : OperandSize::INT32;
+  }
+
+  // Moves src into dst. On x86-64, a constant is moved into a register
+  // with a 32-bit move, which clears the upper half, and a negative one
+  // goes to memory through a register, so that an int in memory is also
+  // zero-extended.
+  void move(Operand dst, Operand src) {
+    if (x86_64_ && src.IsImm()) {
+      if (dst.IsReg()) {
+        emit(std::make_unique<BinaryInstr>(MOV, dst, src,
+                                           OperandSize::INT32));
+        return;
+      }
+      if (src.GetImm() < 0) {
+        auto t = Operand::Reg(Temp{});
+        emit(std::make_unique<BinaryInstr>(MOV, t, src, OperandSize::INT32));
+        src = t;
+      }
+    }
+    emit(std::make_unique<BinaryInstr>(MOV, dst, src));
+  }
+
+  // Counts the jumps to each label and finds the labels in the body.
+  void find_labels(TreeFunction &fun) {
+    label_uses_.clear();
+    label_positions_.clear();
+    auto use = [this](TreeExp &e) {
+      if (e.GetOp() == TreeExp::TreeExpNameOp) {
+        label_uses_[static_cast<TreeExpName &>(e).GetName()]++;
+      }
+    };
+    for (std::size_t i = 0; i < fun.body.size(); i++) {
+      auto &s = *fun.body[i];
+      if (s.GetOp() == TreeStm::TreeStmJumpOp) {
+        use(*static_cast<TreeStmJump &>(s).GetTarget());
+      } else if (s.GetOp() == TreeStm::TreeStmCJumpOp) {
+        auto &c = static_cast<TreeStmCJump &>(s);
+        label_uses_[c.GetLTrue()]++;
+        label_uses_[c.GetLFalse()]++;
+      } else if (s.GetOp() == TreeStm::TreeStmLabelOp) {
+        label_positions_[static_cast<TreeStmLabel &>(s).GetLabel()] = i;
+      }
+    }
+  }
+
+  bool is_label(TreeStm &s, const Label &l) const {
+    return s.GetOp() == TreeStm::TreeStmLabelOp &&
+           static_cast<TreeStmLabel &>(s).GetLabel() == l;
+  }
+
+  bool is_jump(TreeStm &s, const Label &l) const {
+    if (s.GetOp() != TreeStm::TreeStmJumpOp) return false;
+    auto &target = *static_cast<TreeStmJump &>(s).GetTarget();
+    return target.GetOp() == TreeExp::TreeExpNameOp &&
+           static_cast<TreeExpName &>(target).GetName() == l;
+  }
+
+  // The value that s moves to a temp, if it is a temp, a parameter or a
+  // constant, which need no instructions and cannot fault, so that the
+  // move can be made conditional.
+  struct CondMove {
+    Temp temp;
+    TreeExp *value;
+  };
+  std::optional<CondMove> cond_move(TreeStm &s) const {
+    if (s.GetOp() != TreeStm::TreeStmMoveOp) return std::nullopt;
+    auto &m = static_cast<TreeStmMove &>(s);
+    if (m.GetDst()->GetOp() != TreeExp::TreeExpTempOp) return std::nullopt;
+    auto op = m.GetSrc()->GetOp();
+    if (op != TreeExp::TreeExpTempOp && op != TreeExp::TreeExpParamOp &&
+        op != TreeExp::TreeExpConstOp) {
+      return std::nullopt;
+    }
+    return CondMove{static_cast<TreeExpTemp &>(*m.GetDst()).GetTemp(),
+                    m.GetSrc().get()};
+  }
+
+  static bool is_const(TreeExp *e, std::int32_t value) {
+    return e->GetOp() == TreeExp::TreeExpConstOp &&
+           static_cast<TreeExpConst &>(*e).GetValue() == value;
+  }
+
+  // Whether t is 0 before body[i]: assigned 0 earlier in the same block
+  bool is_zero_before(std::vector<std::unique_ptr<TreeStm>> &body,
+                      std::size_t i, Temp t) const {
+    while (i-- > 0) {
+      auto &s = *body[i];
+      if (s.GetOp() != TreeStm::TreeStmMoveOp) return false;
+      auto &m = static_cast<TreeStmMove &>(s);
+      if (m.GetDst()->GetOp() != TreeExp::TreeExpTempOp ||
+          !(static_cast<TreeExpTemp &>(*m.GetDst()).GetTemp() == t)) {
+        continue;
+      }
+      return is_const(m.GetSrc().get(), 0);
+    }
+    return false;
+  }
+
+  // If-conversion: a conditional jump around moves to a temp becomes a
+  // conditional move, or SETcc for the values 0 and 1 on x86-64. The forms
+  // of the traced code, with a block of the form (LABEL Lt; MOVE(t, v);
+  // JUMP L) that has no other predecessor moved out of line, are
+  //   CJUMP(c, Lt, Lf); LABEL Lf          t = c ? v : t
+  //   CJUMP(c, Lt, Lf); LABEL Lf; MOVE(t, u); JUMP L  (or LABEL L)
+  //                                       t = c ? v : u
+  // and, with the move in line,
+  //   CJUMP(c, Lt, Lf); LABEL Lf; MOVE(t, u); LABEL Lt  (or JUMP Lt)
+  //                                       t = !c ? u : t
+  // Returns the number of statements at body[i] that were translated, and
+  // marks those of the block out of line in skip.
+  std::size_t if_convert(std::vector<std::unique_ptr<TreeStm>> &body,
+                         std::size_t i, std::vector<bool> &skip) {
+    if (body[i]->GetOp() != TreeStm::TreeStmCJumpOp) return 0;
+    auto &c = static_cast<TreeStmCJump &>(*body[i]);
+    auto lt = c.GetLTrue();
+    auto lf = c.GetLFalse();
+    if (lt == lf || i + 1 >= body.size() || !is_label(*body[i + 1], lf)) {
+      return 0;
+    }
+    // the move after LABEL Lf, if Lf has no other predecessor
+    auto inline_move = std::optional<CondMove>{};
+    if (i + 3 < body.size() && label_uses_[lf] == 1) {
+      inline_move = cond_move(*body[i + 2]);
+    }
+
+    auto it = label_positions_.find(lt);
+    if (it != label_positions_.end() && label_uses_[lt] == 1) {
+      auto j = it->second;
+      if (j > i + 1 && j + 2 < body.size() &&
+          body[j - 1]->GetOp() == TreeStm::TreeStmJumpOp) {
+        auto arm = cond_move(*body[j + 1]);
+        auto &next = *body[j + 2];
+        if (arm && is_jump(next, lf)) {
+          select(compare(c), arm->temp, arm->value, nullptr,
+                 is_zero_before(body, i, arm->temp));
+          skip[j] = skip[j + 1] = skip[j + 2] = true;
+          return 1;
+        }
+        if (arm && inline_move && inline_move->temp == arm->temp &&
+            next.GetOp() == TreeStm::TreeStmJumpOp) {
+          auto &l = static_cast<TreeExpName &>(
+              *static_cast<TreeStmJump &>(next).GetTarget()).GetName();
+          if (is_jump(*body[i + 3], l) || is_label(*body[i + 3], l)) {
+            select(compare(c), arm->temp, arm->value, inline_move->value,
+                   false);
+            skip[j] = skip[j + 1] = skip[j + 2] = true;
+            return 3;
+          }
+        }
+      }
+    }
+
+    if (inline_move &&
+        (is_label(*body[i + 3], lt) || is_jump(*body[i + 3], lt))) {
+      select(JInstr::Negate(compare(c)), inline_move->temp,
+             inline_move->value, nullptr,
+             is_zero_before(body, i, inline_move->temp));
+      return 3;
+    }
+    return 0;
+  }
+
+  // Emits t = cond ? v : u after the comparison, or t = cond ? v : t without
+  // u, where t is known to be 0 if zero (see if_convert).
+  void select(JInstr::Kind cond, Temp t, TreeExp *v, TreeExp *u, bool zero) {
+    auto dst = Operand::Reg(t);
+    // the moves below keep the flags, unlike the XOR of a zero move
+    if (x86_64_ && u && is_const(v, 0) && is_const(u, 1)) {
+      std::swap(u, v);
+      cond = JInstr::Negate(cond);
+    }
+    if (x86_64_ && is_const(v, 1) && (zero || (u && is_const(u, 0)))) {
+      if (u) move(dst, Operand::Imm(0));
+      emit(std::make_unique<CondInstr>(SET, cond, dst));
+      return;
+    }
+    // v may be t itself, which u overwrites
+    auto src = Operand::Reg(Temp{});
+    move(src, exp(*v));
+    if (u) move(dst, exp(*u));
+    emit(std::make_unique<CondInstr>(CMOV, cond, dst, src));
+  }
+
+  Operand param(std::size_t n) const {
+    return Operand::Reg(parameters_[n]);
+  }
+
+  // offset of the n-th stack parameter above the return address
+  static std::int32_t stack_parameter_offset(std::size_t n) {
+    return (std::int32_t)(Target::WORD_SIZE * (n + 1));
+  }
+
+  static Operand stack_parameter(std::size_t n) {
+    return Operand::FrameSlot(stack_parameter_offset(n));
   }
 
   void stm(TreeStm &stm) { StmMuncher{*this}.Visit(stm); }
 
+  // Compares the operands of a conditional jump; returns the condition of
+  // the jump to its true label.
+  JInstr::Kind compare(TreeStmCJump &s) {
+    JInstr::Kind cond;
+    switch (s.GetRel()) {
+    case TreeStmCJump::EQ:
+      cond = JInstr::Kind::E;
+      break;
+    case TreeStmCJump::NE:
+      cond = JInstr::Kind::NE;
+      break;
+    case TreeStmCJump::LT:
+      cond = JInstr::Kind::L;
+      break;
+    case TreeStmCJump::GT:
+      cond = JInstr::Kind::G;
+      break;
+    case TreeStmCJump::LE:
+      cond = JInstr::Kind::LE;
+      break;
+    case TreeStmCJump::GE:
+      cond = JInstr::Kind::GE;
+      break;
+    case TreeStmCJump::ULT:
+      cond = JInstr::Kind::B;
+      break;
+    case TreeStmCJump::ULE:
+      cond = JInstr::Kind::BE;
+      break;
+    case TreeStmCJump::UGT:
+      cond = JInstr::Kind::A;
+      break;
+    case TreeStmCJump::UGE:
+      cond = JInstr::Kind::AE;
+      break;
+    default:
+      assert(false);
+      abort();
+    }
+    auto l = exp(*s.GetLeft());
+    auto r = exp(*s.GetRight());
+    auto operand_size = (size(*s.GetLeft()) == OperandSize::WORD ||
+                         size(*s.GetRight()) == OperandSize::WORD)
+                            ? OperandSize::WORD
+                            : OperandSize::INT32;
+    if (l.IsImm() || (l.IsMem() && r.IsMem())) {
+      auto t = Operand::Reg(Temp{});
+      move(t, l);
+      emit(std::make_unique<BinaryInstr>(CMP, t, r, operand_size));
+    } else {
+      emit(std::make_unique<BinaryInstr>(CMP, l, r, operand_size));
+    }
+    return cond;
+  }
+
   Operand exp(TreeExp &exp) {
-    auto lc = LCMuncher{}.Visit(exp);
+    auto lc = LCMuncher{*this}.Visit(exp);
     auto o = lc.AsOperand();
     if (o) {
       auto n = lc.NumberOfSummands();
       if (1 < n && n < 3) {
         auto t = Operand::Reg(Temp{});
-        emit(std::make_unique<BinaryInstr>(LEA, t, *o));
+        emit(std::make_unique<BinaryInstr>(LEA, t, *o, size(exp)));
         return t;
       }
     }
@@ -182,16 +629,116 @@ private:
   Operand lexp(TreeExp &exp) { return LExpMuncher{*this}.Visit(exp); }
 
   Operand effective_address(TreeExp &e) {
-    if (auto ea = LCMuncher{}.Visit(e).AsOperand()) {
+    if (e.GetOp() == TreeExp::TreeExpNameOp) {
+      return Operand::Mem(static_cast<TreeExpName &>(e).GetName());
+    }
+    if (e.GetOp() == TreeExp::TreeExpFrameAddrOp) {
+      auto offset = static_cast<TreeExpFrameAddr &>(e).GetOffset();
+      return Operand::FrameSlot(frame_.FrameMemory(offset));
+    }
+    if (auto ea = LCMuncher{*this}.Visit(e).AsOperand()) {
       return *ea;
     } else {
+      // addresses are computed with words
+      auto address = address_;
+      address_ = true;
       auto o = exp(e);
+      address_ = address;
       auto t = Temp{};
       emit(std::make_unique<BinaryInstr>(MOV, Operand::Reg(t), o));
       return Operand::Mem(t);
     }
   }
 
+  // Expands a vector operation (see Vector), whose result, if any, is moved
+  // to dst. XMM6 and XMM7 are scratch registers. With AVX2, vectors are
+  // YMM registers and all instructions use the VEX encoding, since the
+  // mix with SSE instructions is slow.
+  void vector(Vector::Op op, TreeExpCall &call, TreeExp &dst) {
+    auto &args = call.GetArgs();
+    auto number = [&args](std::size_t i) {
+      return static_cast<std::uint8_t>(
+          static_cast<TreeExpConst &>(*args[i]).GetValue());
+    };
+    auto v = number(0);
+    const std::uint8_t s = 7, s2 = 6;
+    auto wide = options_.avx2 ? VectorEncoding::VEX256 : VectorEncoding::SSE;
+    auto narrow = options_.avx2 ? VectorEncoding::VEX128 : VectorEncoding::SSE;
+    auto x = [this](VectorInstrKind kind, VectorEncoding encoding,
+                    std::uint8_t dst, std::uint8_t src,
+                    Operand op = Operand::Imm(0), bool store = false) {
+      emit(std::make_unique<VectorInstr>(kind, encoding, dst, src, op,
+                                         store));
+    };
+    // the int argument in a register
+    auto value = [this, &args]() {
+      auto t = Operand::Reg(Temp{});
+      move(t, exp(*args[1]));
+      return t;
+    };
+    // lanes v[0] = e + k and v[1] = e + k + 1 of a cleared register
+    auto pair = [&](std::uint8_t v, Operand e, std::int32_t k) {
+      for (auto j : {k, k + 1}) {
+        auto t = Operand::Reg(Temp{});
+        emit(std::make_unique<BinaryInstr>(LEA, t,
+                                           Operand::Mem(e.GetReg(), j)));
+        x(MOVD, narrow, j == k ? v : s, 0, t);
+      }
+      x(PUNPCKLDQ, narrow, v, s);
+    };
+    switch (op) {
+    case Vector::LOAD:
+      return x(MOVDQU, wide, v, 0, lexp(*args[1]));
+    case Vector::STORE:
+      return x(MOVDQU, wide, 0, v, lexp(*args[1]), true);
+    case Vector::SPLAT:
+      x(MOVD, narrow, v, 0, value());
+      if (options_.avx2) return x(VPBROADCASTD, wide, v, v);
+      return x(PSHUFD, wide, v, v, Operand::Imm(0));
+    case Vector::INDEX: {
+      auto e = value();
+      pair(v, e, 0);
+      pair(s2, e, 2);
+      x(PUNPCKLQDQ, narrow, v, s2);
+      if (!options_.avx2) return;
+      // the upper half is the lower one plus 4
+      auto four = Operand::Reg(Temp{});
+      move(four, Operand::Imm(4));
+      x(MOVD, narrow, s, 0, four);
+      x(PSHUFD, narrow, s, s, Operand::Imm(0));
+      x(PADDD, narrow, s, v);
+      return x(VINSERTI128, wide, v, s);
+    }
+    case Vector::COPY:
+      return x(MOVDQA, wide, v, number(1));
+    case Vector::ADD:
+      return x(PADDD, wide, v, number(1));
+    case Vector::SUB:
+      return x(PSUBD, wide, v, number(1));
+    case Vector::MUL:
+      return x(PMULLD, wide, v, number(1));
+    case Vector::ZERO:
+      return x(PXOR, wide, v, v);
+    case Vector::SUM: {
+      if (options_.avx2) {
+        x(VEXTRACTI128, wide, s, v);
+        x(PADDD, narrow, v, s);
+      }
+      // lanes 2, 3, 0, 1 and then 1, 0, 3, 2
+      x(PSHUFD, narrow, s, v, Operand::Imm(0x4e));
+      x(PADDD, narrow, v, s);
+      x(PSHUFD, narrow, s, v, Operand::Imm(0xb1));
+      x(PADDD, narrow, v, s);
+      auto t = Operand::Reg(Temp{});
+      x(MOVD, narrow, 0, v, t, true);
+      return move(lexp(dst), t);
+    }
+    case Vector::END:
+      if (options_.avx2) x(VZEROUPPER, narrow, 0, 0);
+      return;
+    }
+  }
+
   class StmMuncher : public TreeStmVisitor<void> {
   public:
     StmMuncher(Muncher &muncher) : muncher_(muncher) {}
@@ -202,16 +749,34 @@ private:
     void emit(std::unique_ptr<X86Instr> i) { muncher_.emit(std::move(i)); }
 
     virtual void VisitMove(TreeStmMove &s) {
+      if (s.GetSrc()->GetOp() == TreeExp::TreeExpCallOp) {
+        auto &call = static_cast<TreeExpCall &>(*s.GetSrc());
+        if (call.IsTailCall() && muncher_.tail_call(call)) {
+          return;
+        }
+        auto &f = *call.GetFun();
+        if (f.GetOp() == TreeExp::TreeExpNameOp) {
+          auto &name = static_cast<TreeExpName &>(f).GetName();
+          if (auto op = Vector::OfFunction(name)) {
+            return muncher_.vector(*op, call, *s.GetDst());
+          }
+        }
+      }
       auto l = muncher_.lexp(*s.GetDst());
       auto r = muncher_.exp(*s.GetSrc());
+      auto element = muncher_.is_int_element(*s.GetDst());
       if (l.IsReg() && r.IsImm() && r.GetImm() == 0) {
-        emit(std::make_unique<BinaryInstr>(XOR, l, l));
+        emit(std::make_unique<BinaryInstr>(
+            XOR, l, l, x86_64_ ? OperandSize::INT32 : OperandSize::WORD));
       } else if (l.IsMem() && r.IsMem()) {
         auto t = Operand::Reg(Temp{});
         emit(std::make_unique<BinaryInstr>(MOV, t, r));
-        emit(std::make_unique<BinaryInstr>(MOV, l, t));
+        emit(std::make_unique<BinaryInstr>(
+            MOV, l, t, element ? OperandSize::INT32 : OperandSize::WORD));
+      } else if (element) {
+        emit(std::make_unique<BinaryInstr>(MOV, l, r, OperandSize::INT32));
       } else {
-        emit(std::make_unique<BinaryInstr>(MOV, l, r));
+        muncher_.move(l, r);
       }
     };
 
@@ -225,43 +790,7 @@ private:
     };
 
     virtual void VisitCJump(TreeStmCJump &s) {
-      JInstr::Kind cond;
-      switch (s.GetRel()) {
-      case TreeStmCJump::EQ:
-        cond = JInstr::Kind::E;
-        break;
-      case TreeStmCJump::NE:
-        cond = JInstr::Kind::NE;
-        break;
-      case TreeStmCJump::LT:
-        cond = JInstr::Kind::L;
-        break;
-      case TreeStmCJump::GT:
-        cond = JInstr::Kind::G;
-        break;
-      case TreeStmCJump::LE:
-        cond = JInstr::Kind::LE;
-        break;
-      case TreeStmCJump::GE:
-        cond = JInstr::Kind::GE;
-        break;
-      default:
-        assert(false);
-        abort();
-      }
-      auto l = muncher_.exp(*s.GetLeft());
-      auto r = muncher_.exp(*s.GetRight());
-      if (l.IsImm()) {
-        auto t = Operand::Reg(Temp{});
-        emit(std::make_unique<BinaryInstr>(MOV, t, l));
-        emit(std::make_unique<BinaryInstr>(CMP, t, r));
-      } else if (l.IsMem() && r.IsMem()) {
-        auto t = Operand::Reg(Temp{});
-        emit(std::make_unique<BinaryInstr>(MOV, t, l));
-        emit(std::make_unique<BinaryInstr>(CMP, t, r));
-      } else {
-        emit(std::make_unique<BinaryInstr>(CMP, l, r));
-      }
+      auto cond = muncher_.compare(s);
       emit(std::make_unique<JInstr>(cond, s.GetLTrue()));
     };
 
@@ -299,20 +828,33 @@ private:
     };
 
     virtual Operand VisitParam(TreeExpParam &e) {
-      return Operand::Mem(EBP, (std::int32_t)(8 + 4 * e.GetNumber()));
+      return muncher_.param(e.GetNumber());
+    };
+
+    virtual Operand VisitFrameAddr(TreeExpFrameAddr &e) {
+      auto t = Operand::Reg(Temp{});
+      auto slot = muncher_.frame_.FrameMemory(e.GetOffset());
+      emit(std::make_unique<BinaryInstr>(LEA, t, Operand::FrameSlot(slot)));
+      return t;
     };
 
     virtual Operand VisitMem(TreeExpMem &e) {
-      return muncher_.effective_address(*e.GetAddr());
+      auto ea = muncher_.effective_address(*e.GetAddr());
+      if (!muncher_.is_int_element(e)) return ea;
+      // the 32-bit load clears the upper half of the register
+      auto t = Operand::Reg(Temp{});
+      emit(std::make_unique<BinaryInstr>(MOV, t, ea, OperandSize::INT32));
+      return t;
     };
 
     virtual Operand VisitBinOp(TreeExpBinOp &e) {
       auto l = muncher_.exp(*e.GetLeft());
       auto r = muncher_.exp(*e.GetRight());
-      auto generic = [this](auto o, auto l, auto r) {
+      auto size = muncher_.size(e);
+      auto generic = [this, size](auto o, auto l, auto r) {
         auto t = Operand::Reg(Temp{});
-        emit(std::make_unique<BinaryInstr>(MOV, t, l));
-        emit(std::make_unique<BinaryInstr>(o, t, r));
+        muncher_.move(t, l);
+        emit(std::make_unique<BinaryInstr>(o, t, r, size));
         return t;
       };
       switch (e.GetBinOp()) {
@@ -321,18 +863,43 @@ private:
       case TreeExpBinOp::MINUS:
         return generic(SUB, l, r);
       case TreeExpBinOp::MUL:
+        if (l.IsImm()) std::swap(l, r);
+        if (auto k = log2(r)) {
+          return generic(SHL, l, Operand::Imm(*k));
+        }
+        if (r.IsImm() && !l.IsImm()) {
+          auto t = Operand::Reg(Temp{});
+          emit(std::make_unique<TernaryInstr>(IMUL3, t, l, r, size));
+          return t;
+        }
         return generic(IMUL, l, r);
       case TreeExpBinOp::DIV: {
+        if (auto k = log2(r)) {
+          // rounds towards 0 by adding 2^k - 1 to a negative dividend
+          auto t = Operand::Reg(Temp{});
+          auto s = Operand::Reg(Temp{});
+          muncher_.move(t, l);
+          emit(std::make_unique<BinaryInstr>(MOV, s, t));
+          if (*k > 1) {
+            emit(std::make_unique<BinaryInstr>(SAR, s, Operand::Imm(31),
+                                               size));
+          }
+          emit(std::make_unique<BinaryInstr>(SHR, s, Operand::Imm(32 - *k),
+                                             size));
+          emit(std::make_unique<BinaryInstr>(ADD, t, s, size));
+          emit(std::make_unique<BinaryInstr>(SAR, t, Operand::Imm(*k), size));
+          return t;
+        }
         auto t = Operand::Reg(Temp{});
-        emit(std::make_unique<BinaryInstr>(MOV, EAX, l));
+        muncher_.move(EAX, l);
         emit(std::make_unique<BinaryInstr>(MOV, EDX, EAX));
-        emit(std::make_unique<BinaryInstr>(SAR, EDX, Operand::Imm(31)));
+        emit(std::make_unique<BinaryInstr>(SAR, EDX, Operand::Imm(31), size));
         if (r.IsImm()) {
           auto s = Operand::Reg(Temp{});
-          emit(std::make_unique<BinaryInstr>(MOV, s, r));
-          emit(std::make_unique<UnaryInstr>(IDIV, s));
+          muncher_.move(s, r);
+          emit(std::make_unique<UnaryInstr>(IDIV, s, size));
         } else {
-          emit(std::make_unique<UnaryInstr>(IDIV, r));
+          emit(std::make_unique<UnaryInstr>(IDIV, r, size));
         }
         emit(std::make_unique<BinaryInstr>(MOV, t, EAX));
         return t;
@@ -342,11 +909,11 @@ private:
       case TreeExpBinOp::OR:
         return generic(OR, l, r);
       case TreeExpBinOp::LSHIFT:
-        return generic(SHL, l, r);
+        return shift(SHL, SHLX, l, r, size);
       case TreeExpBinOp::RSHIFT:
-        return generic(SHR, l, r);
+        return shift(SHR, SHRX, l, r, size);
       case TreeExpBinOp::ARSHIFT:
-        return generic(SAR, l, r);
+        return shift(SAR, SARX, l, r, size);
       case TreeExpBinOp::XOR:
         return generic(XOR, l, r);
       default:
@@ -355,19 +922,84 @@ private:
       }
     };
 
+    // k if o is the constant 2^k for 0 < k < 31
+    static std::optional<std::int32_t> log2(const Operand &o) {
+      if (!o.IsImm()) return std::nullopt;
+      for (std::int32_t k = 1; k < 31; k++) {
+        if (o.GetImm() == (1 << k)) return k;
+      }
+      return std::nullopt;
+    }
+
+    // A shift by a variable count takes the count from CL, or from any
+    // register with BMI2.
+    Operand shift(BinaryInstrKind kind, TernaryInstrKind bmi2_kind,
+                  Operand l, Operand r, OperandSize size) {
+      auto t = Operand::Reg(Temp{});
+      if (r.IsImm()) {
+        muncher_.move(t, l);
+        emit(std::make_unique<BinaryInstr>(kind, t, r, size));
+      } else if (muncher_.options_.bmi2) {
+        for (auto o : {&l, &r}) {
+          if (o->IsImm() || (o == &r && !r.IsReg())) {
+            auto s = Operand::Reg(Temp{});
+            muncher_.move(s, *o);
+            *o = s;
+          }
+        }
+        emit(std::make_unique<TernaryInstr>(bmi2_kind, t, l, r, size));
+      } else {
+        muncher_.move(t, l);
+        muncher_.move(ECX, r);
+        emit(std::make_unique<BinaryInstr>(kind, t, ECX, size));
+      }
+      return t;
+    }
+
     virtual Operand VisitCall(TreeExpCall &e) {
       if (e.GetFun()->GetOp() == TreeExp::TreeExpNameOp) {
         auto f = static_cast<TreeExpName &>(*e.GetFun());
-        for (auto rit = e.GetArgs().rbegin(); rit != e.GetArgs().rend();
-             ++rit) {
-          auto o = muncher_.exp(**rit);
-          emit(std::make_unique<UnaryInstr>(PUSH, o));
+        auto &args = e.GetArgs();
+        auto k = muncher_.register_arguments(f.GetName(), args.size());
+        // Stack arguments go to the outgoing-argument area at the bottom of
+        // the frame, so ESP does not change around the call.
+        for (auto i = k; i < args.size(); i++) {
+          auto o = muncher_.exp(*args[i]);
+          auto slot =
+              Operand::Mem(ESP, (std::int32_t)(Target::WORD_SIZE * (i - k)));
+          if (o.IsMem()) {
+            auto t = Operand::Reg(Temp{});
+            emit(std::make_unique<BinaryInstr>(MOV, t, o));
+            o = t;
+          }
+          muncher_.move(slot, o);
+        }
+        muncher_.outgoing_arguments_ =
+            std::max(muncher_.outgoing_arguments_, args.size() - k);
+        muncher_.leaf_ = false;
+        // Compute all register arguments before the first one is assigned
+        auto ops = std::vector<Operand>{};
+        for (std::size_t i = 0; i < k; i++) {
+          ops.push_back(muncher_.exp(*args[i]));
         }
-        emit(std::make_unique<CallInstr>(f.GetName()));
+        auto regs = std::vector<X86Register>{};
+        for (std::size_t i = 0; i < k; i++) {
+          muncher_.move(argument_reg(i), ops[i]);
+          regs.push_back(argument_reg(i));
+        }
+        auto call = std::make_unique<CallInstr>(f.GetName(), std::move(regs),
+                                                caller_save());
+        if (auto &map = e.GetStackMap()) {
+          auto roots = std::vector<std::int32_t>{};
+          for (auto offset : *map) {
+            roots.push_back(muncher_.frame_.FrameMemory(offset));
+          }
+          call->stack_map = {.return_address = Label{},
+                             .roots = std::move(roots)};
+        }
+        emit(std::move(call));
         auto t = Operand::Reg(Temp{});
         emit(std::make_unique<BinaryInstr>(MOV, t, EAX));
-        emit(std::make_unique<BinaryInstr>(
-            ADD, ESP, Operand::Imm(X86Target::WORD_SIZE * e.GetArgs().size())));
         return t;
       } else {
         assert(false);
@@ -402,7 +1034,12 @@ private:
     };
 
     virtual Operand VisitParam(TreeExpParam &e) {
-      return Operand::Mem(EBP, (std::int32_t)(8 + 4 * e.GetNumber()));
+      return muncher_.param(e.GetNumber());
+    };
+
+    virtual Operand VisitFrameAddr(TreeExpFrameAddr &e) {
+      assert(false);
+      abort();
     };
 
     virtual Operand VisitMem(TreeExpMem &e) {
@@ -427,6 +1064,8 @@ private:
 
   class LCMuncher : public TreeExpVisitor<LinearCombination> {
   public:
+    LCMuncher(Muncher &muncher) : muncher_(muncher) {}
+
     virtual LinearCombination VisitConst(TreeExpConst &e) {
       return e.GetValue();
     }
@@ -438,6 +1077,10 @@ private:
     virtual LinearCombination VisitTemp(TreeExpTemp &e) { return e.GetTemp(); }
 
     virtual LinearCombination VisitParam(TreeExpParam &e) {
+      return muncher_.parameters_[e.GetNumber()];
+    };
+
+    virtual LinearCombination VisitFrameAddr(TreeExpFrameAddr &e) {
       return LinearCombination::illegal();
     };
 
@@ -467,15 +1110,88 @@ private:
       assert(false);
       abort();
     };
+
+  private:
+    Muncher &muncher_;
   };
 
+  const X86Options &options_;
   InstrVector code_;
+  std::unordered_set<Label> internal_functions_;
+  std::vector<Temp> parameters_;
+  X86Frame frame_;
+  std::size_t stack_parameter_count_;
+  std::size_t outgoing_arguments_;  // max. number of stack arguments of calls
+  bool leaf_;                       // no calls except tail calls
+  std::unordered_set<Temp> pointers_;  // see find_pointers
+  bool address_ = false;               // an address is being computed
+  std::unordered_map<Label, unsigned> label_uses_;  // see find_labels
+  std::unordered_map<Label, std::size_t> label_positions_;
 
   void emit(std::unique_ptr<X86Instr> i) { code_.push_back(std::move(i)); }
 };
 
-X86Prg X86Target::CodeGen(Tracer::TracedTreeProgram &prg) {
-  return Muncher{}.Process(prg);
+bool X86Options::SetArch(const std::string &arch, bool x86_64) {
+  if (arch == "i386") {
+    cmov = bmi2 = sse2 = sse41 = avx2 = false;
+    return !x86_64;
+  } else if (arch == "i686") {
+    cmov = true;
+    bmi2 = sse2 = sse41 = avx2 = false;
+    return !x86_64;
+  } else if (arch == "x86-64" || arch == "x86-64-v2") {
+    // POPCNT of x86-64-v2 has no use in the selection
+    cmov = sse2 = true;
+    sse41 = arch == "x86-64-v2";
+    bmi2 = avx2 = false;
+  } else if (arch == "x86-64-v3" || arch == "haswell") {
+    cmov = bmi2 = sse2 = sse41 = avx2 = true;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+X86Prg X86Target::CodeGen(Tracer::TracedTreeProgram &prg,
+                          const Options &options) {
+  return Muncher<X86Target>{options}.Process(prg);
+}
+
+const std::vector<X86Register> &X86Target::GeneralPurposeRegs(
+    const X86Function &f) {
+  return f.OmitsFramePointer() ? GENERAL_PURPOSE_REGS_WITH_EBP
+                               : GENERAL_PURPOSE_REGS;
+}
+
+void X86Target::LayoutFrames(X86Prg &prg) {
+  for (auto &f : prg.functions) {
+    f->LayoutFrame();
+  }
+}
+
+Vector::Support X86Target::Vectors(const Options &options) {
+  if (options.avx2) return {.lanes = 8, .registers = 6, .mul = true};
+  if (options.sse2) {
+    return {.lanes = 4, .registers = 6, .mul = options.sse41};
+  }
+  return {};
+}
+
+X86Prg X8664Target::CodeGen(Tracer::TracedTreeProgram &prg,
+                            const Options &options) {
+  return Muncher<X8664Target>{options}.Process(prg);
+}
+
+const std::vector<X86Register> &X8664Target::GeneralPurposeRegs(
+    const X86Function &f) {
+  return f.OmitsFramePointer() ? GENERAL_PURPOSE_REGS_WITH_EBP
+                               : GENERAL_PURPOSE_REGS;
+}
+
+void X8664Target::LayoutFrames(X86Prg &prg) { X86Target::LayoutFrames(prg); }
+
+Vector::Support X8664Target::Vectors(const Options &options) {
+  return X86Target::Vectors(options);
 }
 
 } // namespace mjc
@@ -4,24 +4,104 @@
 #ifndef MJC_BACKEND_X86TARGET_H
 #define MJC_BACKEND_X86TARGET_H
 
+#include <string>
+
 #include "backend/x86/x86_prg.h"
 #include "intermediate/names.h"
 #include "intermediate/tracer.h"
+#include "intermediate/vector.h"
 
 namespace mjc {
 
+struct X86Options {
+  // address the frame relative to ESP and use EBP as ordinary register
+  bool omit_frame_pointer = false;
+  // run the peephole optimiser after register allocation
+  bool peephole = true;
+  // order the functions by the call graph (see X86FunctionOrder)
+  bool reorder_functions = true;
+  // Instructions beyond those of the i386, selected with SetArch:
+  // CMOVcc (i686 and x86-64)
+  bool cmov = false;
+  // SHLX, SHRX and SARX (BMI2, x86-64-v3)
+  bool bmi2 = false;
+  // vectors of 4 ints in XMM registers (SSE2, x86-64), their multiplication
+  // (SSE4.1, x86-64-v2) and vectors of 8 ints in YMM registers (AVX2,
+  // x86-64-v3)
+  bool sse2 = false;
+  bool sse41 = false;
+  bool avx2 = false;
+
+  // Enables the instructions of a CPU named as in gcc's -march: i386, i686,
+  // x86-64, x86-64-v2, x86-64-v3 or haswell. Returns false if the CPU is
+  // unknown or, for x86-64 code, does not support it.
+  bool SetArch(const std::string &arch, bool x86_64);
+};
+
 class X86Target {
 public:
   using Reg = X86Register;
   using Instr = X86Instr;
   using Function = X86Function;
   using Prg = X86Prg;
+  using Options = X86Options;
 
   static const int WORD_SIZE = 4;
+  static const int INT_SIZE = 4;
   static const std::vector<Reg> MACHINE_REGS;
   static const std::vector<Reg> GENERAL_PURPOSE_REGS;
+  static const std::vector<Reg> GENERAL_PURPOSE_REGS_WITH_EBP;
+
+  // The registers available for allocation in the function
+  static const std::vector<Reg> &GeneralPurposeRegs(const Function &f);
+
+  static Prg CodeGen(Tracer::TracedTreeProgram &prg,
+                     const Options &options = {});
+
+  // Finishes the functions after register allocation
+  static void LayoutFrames(Prg &prg);
+
+  // The vector operations that the selection expands with the instructions
+  // of the options. XMM6 and XMM7 are left to the expansion.
+  static Vector::Support Vectors(const Options &options);
+};
+
+// The x86-64 backend, which shares the instructions and the later passes
+// with the x86 one. All calls use the System V ABI. Every field and stack
+// slot is a 64-bit word, while the elements of int arrays take 32 bits and
+// are loaded and stored with 32-bit moves. MiniJava ints keep 32 bits: they
+// are computed and compared with 32-bit instructions, and the upper half of
+// a word that holds an int is either zero or a copy of its sign bit, so
+// that an index that passed the bounds check can be used in an address.
+// Pointer arithmetic and comparisons, which the selection recognises by
+// the operands (references loaded from memory, the variables of the
+// runtime, frame addresses and the temps assigned from them), and all
+// address computations use 64-bit instructions. Labels are addressed
+// relative to RIP.
+class X8664Target {
+public:
+  using Reg = X86Register;
+  using Instr = X86Instr;
+  using Function = X86Function;
+  using Prg = X86Prg;
+  using Options = X86Options;
+
+  static const int WORD_SIZE = 8;
+  static const int INT_SIZE = 4;
+  static const std::vector<Reg> MACHINE_REGS;
+  // 14 registers, 15 without frame pointer
+  static const std::vector<Reg> GENERAL_PURPOSE_REGS;
+  static const std::vector<Reg> GENERAL_PURPOSE_REGS_WITH_EBP;
+
+  static const std::vector<Reg> &GeneralPurposeRegs(const Function &f);
+
+  static Prg CodeGen(Tracer::TracedTreeProgram &prg,
+                     const Options &options = {});
+
+  static void LayoutFrames(Prg &prg);
 
-  static Prg CodeGen(Tracer::TracedTreeProgram &prg);
+  // Those of the x86 backend
+  static Vector::Support Vectors(const Options &options);
 };
 
 } // namespace mjc
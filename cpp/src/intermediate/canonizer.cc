@@ -46,7 +46,8 @@ ESeq::ESeq(std::vector<upTreeStm> stms, upTreeExp exp)
 
 bool ESeq::Commutes(const TreeStm &stm, const TreeExp &exp) {
   return exp.GetOp() == TreeExp::TreeExpNameOp ||
-         exp.GetOp() == TreeExp::TreeExpConstOp;
+         exp.GetOp() == TreeExp::TreeExpConstOp ||
+         exp.GetOp() == TreeExp::TreeExpFrameAddrOp;
 }
 
 bool ESeq::Commute(const std::vector<upTreeStm> &stms, const TreeExp &exp) {
@@ -109,7 +110,8 @@ TreeFunction Canonize(TreeFunction fun) {
   return {.name = fun.name,
           .parameter_count = fun.parameter_count,
           .body = Canonize(std::move(fun.body)),
-          .return_temp = fun.return_temp};
+          .return_temp = fun.return_temp,
+          .frame_memory_size = fun.frame_memory_size};
 }
 
 std::vector<upTreeStm> Canonize(std::vector<upTreeStm> stms) {
@@ -159,14 +161,41 @@ std::vector<upTreeStm> Canonize(upTreeStm stm) {
           return std::move(b.stms_);
         }
 
+        virtual std::vector<upTreeStm> VisitFrameAddr(TreeExpFrameAddr &e) {
+          assert(false);
+          return {};
+        }
+
+        // If the source contains calls, the operands of the address are
+        // kept in temps rather than the address itself: the garbage
+        // collector does not update a pointer into an object.
         virtual std::vector<upTreeStm> VisitMem(TreeExpMem &e) {
-          auto b1 = CanonizeNoTopCall(std::move(e.GetAddr()));
-          auto b2 = Canonize(std::move(src_));
-          return ESeq::CombineToStm(
-              std::move(b1), std::move(b2), [](auto e1, auto e2) {
-                return std::make_unique<TreeStmMove>(
-                    std::make_unique<TreeExpMem>(std::move(e1)), std::move(e2));
-              });
+          auto kind = e.GetKind();
+          auto addr = std::move(e.GetAddr());
+          if (addr->GetOp() != TreeExp::TreeExpBinOpOp) {
+            auto b1 = CanonizeNoTopCall(std::move(addr));
+            auto b2 = CanonizeNoTopCall(std::move(src_));
+            return ESeq::CombineToStm(
+                std::move(b1), std::move(b2), [kind](auto e1, auto e2) {
+                  return std::make_unique<TreeStmMove>(
+                      std::make_unique<TreeExpMem>(std::move(e1), kind),
+                      std::move(e2));
+                });
+          }
+          auto &binop = static_cast<TreeExpBinOp &>(*addr);
+          auto o = binop.GetBinOp();
+          auto b1 = CanonizeNoTopCall(std::move(binop.GetLeft()));
+          auto b2 = CanonizeNoTopCall(std::move(binop.GetRight()));
+          auto b3 = CanonizeNoTopCall(std::move(src_));
+          b2.Extend(std::move(b3.stms_));
+          b1.Extend(std::move(b2.stms_));
+          b1.stms_.push_back(std::make_unique<TreeStmMove>(
+              std::make_unique<TreeExpMem>(
+                  std::make_unique<TreeExpBinOp>(o, std::move(b1.exp_),
+                                                 std::move(b2.exp_)),
+                  kind),
+              std::move(b3.exp_)));
+          return std::move(b1.stms_);
         }
 
         virtual std::vector<upTreeStm> VisitBinOp(TreeExpBinOp &e) {
@@ -250,9 +279,12 @@ ESeq Canonize(upTreeExp exp) {
     virtual ESeq VisitName(TreeExpName &e) { return ESeq(std::move(exp_)); }
     virtual ESeq VisitTemp(TreeExpTemp &e) { return ESeq(std::move(exp_)); }
     virtual ESeq VisitParam(TreeExpParam &e) { return ESeq(std::move(exp_)); }
+    virtual ESeq VisitFrameAddr(TreeExpFrameAddr &e) {
+      return ESeq(std::move(exp_));
+    }
     virtual ESeq VisitMem(TreeExpMem &e) {
       auto b = CanonizeNoTopCall(std::move(e.GetAddr()));
-      b.exp_ = std::make_unique<TreeExpMem>(std::move(b.exp_));
+      b.exp_ = std::make_unique<TreeExpMem>(std::move(b.exp_), e.GetKind());
       return b;
     }
 
@@ -272,8 +304,10 @@ ESeq Canonize(upTreeExp exp) {
       for (auto &arg : e.GetArgs()) {
         bs.push_back(CanonizeNoTopCall(std::move(arg)));
       }
-      b1.CombineWith(std::move(bs), [](auto e, auto es) {
-        return std::make_unique<TreeExpCall>(std::move(e), std::move(es));
+      auto tail_call = e.IsTailCall();
+      b1.CombineWith(std::move(bs), [tail_call](auto e, auto es) {
+        return std::make_unique<TreeExpCall>(std::move(e), std::move(es),
+                                             tail_call);
       });
       return b1;
     }
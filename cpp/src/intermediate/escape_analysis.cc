@@ -0,0 +1,643 @@
+#include "intermediate/escape_analysis.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "intermediate/gc_roots.h"
+#include "intermediate/tree.h"
+
+namespace mjc {
+
+namespace {
+
+using upTreeExp = std::unique_ptr<TreeExp>;
+using upTreeStm = std::unique_ptr<TreeStm>;
+
+// largest object that is placed in the stack frame, in words
+const std::int32_t MAX_STACK_OBJECT_WORDS = 32;
+// largest frame memory of a function, in words
+const std::int32_t MAX_FRAME_MEMORY_WORDS = 256;
+
+// Parameters of the functions of the program that may escape
+using Summaries = std::unordered_map<Label, std::vector<bool>>;
+
+// Value of an expression built from constants, if any
+std::optional<std::int32_t> ConstValue(TreeExp &e) {
+  if (e.GetOp() == TreeExp::TreeExpConstOp) {
+    return static_cast<TreeExpConst &>(e).GetValue();
+  }
+  if (e.GetOp() != TreeExp::TreeExpBinOpOp) return std::nullopt;
+  auto &b = static_cast<TreeExpBinOp &>(e);
+  auto l = ConstValue(*b.GetLeft());
+  auto r = ConstValue(*b.GetRight());
+  if (!l || !r) return std::nullopt;
+  switch (b.GetBinOp()) {
+    case TreeExpBinOp::PLUS:
+      return *l + *r;
+    case TreeExpBinOp::MINUS:
+      return *l - *r;
+    case TreeExpBinOp::MUL:
+      return *l * *r;
+    default:
+      return std::nullopt;
+  }
+}
+
+bool Mentions(TreeExp &e, const Temp &t) {
+  switch (e.GetOp()) {
+    case TreeExp::TreeExpTempOp:
+      return static_cast<TreeExpTemp &>(e).GetTemp() == t;
+    case TreeExp::TreeExpMemOp:
+      return Mentions(*static_cast<TreeExpMem &>(e).GetAddr(), t);
+    case TreeExp::TreeExpBinOpOp: {
+      auto &b = static_cast<TreeExpBinOp &>(e);
+      return Mentions(*b.GetLeft(), t) || Mentions(*b.GetRight(), t);
+    }
+    case TreeExp::TreeExpCallOp: {
+      auto &c = static_cast<TreeExpCall &>(e);
+      return Mentions(*c.GetFun(), t) ||
+             std::any_of(c.GetArgs().begin(), c.GetArgs().end(),
+                         [&t](auto &a) { return Mentions(*a, t); });
+    }
+    default:
+      return false;
+  }
+}
+
+// Whether a statement reads the temp t
+bool Uses(TreeStm &s, const Temp &t) {
+  switch (s.GetOp()) {
+    case TreeStm::TreeStmMoveOp: {
+      auto &m = static_cast<TreeStmMove &>(s);
+      auto &dst = *m.GetDst();
+      return Mentions(*m.GetSrc(), t) ||
+             (dst.GetOp() == TreeExp::TreeExpMemOp && Mentions(dst, t));
+    }
+    case TreeStm::TreeStmJumpOp:
+      return Mentions(*static_cast<TreeStmJump &>(s).GetTarget(), t);
+    case TreeStm::TreeStmCJumpOp: {
+      auto &c = static_cast<TreeStmCJump &>(s);
+      return Mentions(*c.GetLeft(), t) || Mentions(*c.GetRight(), t);
+    }
+    default:
+      return false;
+  }
+}
+
+bool IsMoveTo(TreeStm &s, const Temp &t) {
+  if (s.GetOp() != TreeStm::TreeStmMoveOp) return false;
+  auto &dst = *static_cast<TreeStmMove &>(s).GetDst();
+  return dst.GetOp() == TreeExp::TreeExpTempOp &&
+         static_cast<TreeExpTemp &>(dst).GetTemp() == t;
+}
+
+// Flow of addresses within one function. The nodes are the temps, the
+// parameters and the allocations; an address flows from a node to another
+// by moves, possibly adding an offset.
+class Flow {
+ public:
+  struct Source {
+    std::size_t node;
+    std::optional<std::int32_t> offset;  // none if not constant
+  };
+
+  struct Node {
+    std::vector<Source> sources;
+    bool escapes_directly = false;
+    bool mixed = false;    // assigned other values than those of nodes
+    bool indexed = false;  // addressed at a non-constant offset
+    std::set<std::int32_t> offsets;  // constant offsets of accesses
+    std::optional<Temp> temp;
+    // computed by Propagate
+    bool escapes = false;
+    bool passed = false;  // argument of a call in which it does not escape
+  };
+
+  struct Allocation {
+    std::size_t stm;
+    std::size_t node;
+    Temp dst;
+    std::int32_t size;
+  };
+
+  Flow(TreeFunction &fun, const Label &alloc) : alloc_(alloc) {
+    for (std::size_t i = 0; i < fun.parameter_count; i++) {
+      params_.push_back(NewNode());
+      nodes_.back().mixed = true;
+    }
+    nodes_[NodeOf(fun.return_temp)].escapes_directly = true;
+    for (std::size_t i = 0; i < fun.body.size(); i++) {
+      Scan(*fun.body[i], i);
+    }
+  }
+
+  // Computes the escaping nodes, given the summaries of the callees.
+  void Propagate(const Summaries &summaries) {
+    for (auto &n : nodes_) {
+      n.escapes = n.escapes_directly;
+      n.passed = false;
+    }
+    for (auto &c : calls_) {
+      auto it = summaries.find(c.callee);
+      if (c.tail || it == summaries.end() || c.index >= it->second.size() ||
+          it->second[c.index]) {
+        nodes_[c.node].escapes = true;
+      } else {
+        nodes_[c.node].passed = true;
+      }
+    }
+    auto worklist = std::vector<std::size_t>{};
+    for (std::size_t n = 0; n < nodes_.size(); n++) {
+      if (nodes_[n].escapes) worklist.push_back(n);
+    }
+    while (!worklist.empty()) {
+      auto n = worklist.back();
+      worklist.pop_back();
+      for (auto &s : nodes_[n].sources) {
+        if (!nodes_[s.node].escapes) {
+          nodes_[s.node].escapes = true;
+          worklist.push_back(s.node);
+        }
+      }
+    }
+  }
+
+  std::vector<bool> ParameterEscapes() const {
+    auto result = std::vector<bool>{};
+    for (auto p : params_) result.push_back(nodes_[p].escapes);
+    return result;
+  }
+
+  const std::vector<Allocation> &GetAllocations() const { return allocs_; }
+  const Node &GetNode(std::size_t n) const { return nodes_[n]; }
+
+  // Nodes to which the address of an allocation flows, with the offset
+  // into the object that they hold if it is unique and constant
+  std::map<std::size_t, std::optional<std::int32_t>> Holders(
+      const Allocation &a) const {
+    auto targets = std::vector<std::vector<std::size_t>>(nodes_.size());
+    for (std::size_t n = 0; n < nodes_.size(); n++) {
+      for (auto &s : nodes_[n].sources) targets[s.node].push_back(n);
+    }
+    auto holders = std::map<std::size_t, std::optional<std::int32_t>>{};
+    auto offset = [&](std::size_t n) -> std::optional<std::int32_t> {
+      if (n == a.node) return 0;
+      auto it = holders.find(n);
+      return it == holders.end() ? std::nullopt : it->second;
+    };
+    auto worklist = std::vector<std::size_t>{a.node};
+    while (!worklist.empty()) {
+      auto n = worklist.back();
+      worklist.pop_back();
+      for (auto t : targets[n]) {
+        auto o = std::optional<std::optional<std::int32_t>>{};
+        for (auto &s : nodes_[t].sources) {
+          if (s.node != n) continue;
+          auto so = (offset(n) && s.offset)
+                        ? std::optional<std::int32_t>(*offset(n) + *s.offset)
+                        : std::nullopt;
+          o = (!o || *o == so) ? so : std::nullopt;
+        }
+        auto [it, inserted] = holders.try_emplace(t, *o);
+        if (inserted) {
+          worklist.push_back(t);
+        } else if (it->second && it->second != *o) {
+          it->second = std::nullopt;
+          worklist.push_back(t);
+        }
+      }
+    }
+    return holders;
+  }
+
+ private:
+  struct CallArgument {
+    std::size_t node;
+    Label callee;
+    std::size_t index;
+    bool tail;
+  };
+
+  const Label &alloc_;
+  std::vector<Node> nodes_;
+  std::unordered_map<Temp, std::size_t> temps_;
+  std::vector<std::size_t> params_;
+  std::vector<Allocation> allocs_;
+  std::vector<CallArgument> calls_;
+
+  std::size_t NewNode() {
+    nodes_.push_back({});
+    return nodes_.size() - 1;
+  }
+
+  std::size_t NodeOf(const Temp &t) {
+    auto it = temps_.find(t);
+    if (it != temps_.end()) return it->second;
+    auto n = NewNode();
+    nodes_[n].temp = t;
+    temps_[t] = n;
+    return n;
+  }
+
+  // Node of an expression that is a temp or a parameter
+  std::optional<std::size_t> NodeOf(TreeExp &e) {
+    if (e.GetOp() == TreeExp::TreeExpTempOp) {
+      return NodeOf(static_cast<TreeExpTemp &>(e).GetTemp());
+    }
+    if (e.GetOp() == TreeExp::TreeExpParamOp) {
+      auto n = static_cast<TreeExpParam &>(e).GetNumber();
+      if (n >= 0 && (std::size_t)n < params_.size()) return params_[n];
+    }
+    return std::nullopt;
+  }
+
+  void Scan(TreeStm &s, std::size_t i) {
+    switch (s.GetOp()) {
+      case TreeStm::TreeStmMoveOp: {
+        auto &m = static_cast<TreeStmMove &>(s);
+        auto &dst = *m.GetDst();
+        auto &src = *m.GetSrc();
+        auto d = NodeOf(dst);
+        if (!d) {
+          Address(*static_cast<TreeExpMem &>(dst).GetAddr());
+          Value(src);
+        } else if (dst.GetOp() == TreeExp::TreeExpParamOp) {
+          // the function is entered again by a tail call of itself
+          Value(src);
+          nodes_[*d].mixed = true;
+        } else if (auto u = NodeOf(src)) {
+          nodes_[*d].sources.push_back({*u, 0});
+        } else if (auto [u, offset] = Derived(src); u) {
+          nodes_[*d].sources.push_back({*u, offset});
+        } else if (auto size = AllocationSize(src)) {
+          auto a = NewNode();
+          nodes_[*d].sources.push_back({a, 0});
+          allocs_.push_back({.stm = i,
+                             .node = a,
+                             .dst = static_cast<TreeExpTemp &>(dst).GetTemp(),
+                             .size = *size});
+        } else {
+          Value(src);
+          nodes_[*d].mixed = true;
+        }
+        return;
+      }
+      case TreeStm::TreeStmJumpOp:
+        Value(*static_cast<TreeStmJump &>(s).GetTarget());
+        return;
+      case TreeStm::TreeStmCJumpOp: {
+        auto &c = static_cast<TreeStmCJump &>(s);
+        Value(*c.GetLeft());
+        Value(*c.GetRight());
+        return;
+      }
+      default:
+        return;
+    }
+  }
+
+  // Node and offset of an address PLUS(node, offset)
+  std::pair<std::optional<std::size_t>, std::optional<std::int32_t>> Derived(
+      TreeExp &e) {
+    if (e.GetOp() != TreeExp::TreeExpBinOpOp) return {};
+    auto &b = static_cast<TreeExpBinOp &>(e);
+    if (b.GetBinOp() != TreeExpBinOp::PLUS) return {};
+    auto n = NodeOf(*b.GetLeft());
+    if (!n) return {};
+    auto k = ConstValue(*b.GetRight());
+    if (!k) Value(*b.GetRight());
+    return {n, k};
+  }
+
+  std::optional<std::int32_t> AllocationSize(TreeExp &e) {
+    if (e.GetOp() != TreeExp::TreeExpCallOp) return std::nullopt;
+    auto &c = static_cast<TreeExpCall &>(e);
+    if (c.GetFun()->GetOp() != TreeExp::TreeExpNameOp ||
+        !(static_cast<TreeExpName &>(*c.GetFun()).GetName() == alloc_) ||
+        c.GetArgs().size() != 1 ||
+        c.GetArgs()[0]->GetOp() != TreeExp::TreeExpConstOp)
+      return std::nullopt;
+    return static_cast<TreeExpConst &>(*c.GetArgs()[0]).GetValue();
+  }
+
+  // An expression whose value is used
+  void Value(TreeExp &e) {
+    if (auto n = NodeOf(e)) {
+      nodes_[*n].escapes_directly = true;
+      return;
+    }
+    switch (e.GetOp()) {
+      case TreeExp::TreeExpMemOp:
+        Address(*static_cast<TreeExpMem &>(e).GetAddr());
+        return;
+      case TreeExp::TreeExpBinOpOp: {
+        auto &b = static_cast<TreeExpBinOp &>(e);
+        Value(*b.GetLeft());
+        Value(*b.GetRight());
+        return;
+      }
+      case TreeExp::TreeExpCallOp: {
+        auto &c = static_cast<TreeExpCall &>(e);
+        auto callee = std::optional<Label>{};
+        if (c.GetFun()->GetOp() == TreeExp::TreeExpNameOp) {
+          callee = static_cast<TreeExpName &>(*c.GetFun()).GetName();
+        } else {
+          Value(*c.GetFun());
+        }
+        auto &args = c.GetArgs();
+        for (std::size_t i = 0; i < args.size(); i++) {
+          auto n = NodeOf(*args[i]);
+          if (n && callee) {
+            calls_.push_back({*n, *callee, i, c.IsTailCall()});
+          } else {
+            Value(*args[i]);
+          }
+        }
+        return;
+      }
+      default:
+        return;
+    }
+  }
+
+  // An expression that is used as an address
+  void Address(TreeExp &e) {
+    if (auto n = NodeOf(e)) {
+      nodes_[*n].offsets.insert(0);
+      return;
+    }
+    if (auto [n, k] = Derived(e); n) {
+      if (k) {
+        nodes_[*n].offsets.insert(*k);
+      } else {
+        nodes_[*n].indexed = true;
+      }
+      return;
+    }
+    Value(e);
+  }
+};
+
+// Whether the temp t may be read after the statement p before it is
+// assigned again
+bool LiveAfter(std::vector<upTreeStm> &body, std::size_t p, const Temp &t) {
+  auto labels = std::unordered_map<Label, std::size_t>{};
+  for (std::size_t i = 0; i < body.size(); i++) {
+    if (body[i]->GetOp() == TreeStm::TreeStmLabelOp) {
+      labels[static_cast<TreeStmLabel &>(*body[i]).GetLabel()] = i;
+    }
+  }
+  auto successors = [&](std::size_t i) {
+    auto result = std::vector<std::size_t>{};
+    auto add = [&](const Label &l) {
+      // labels outside of the function are left without return
+      auto it = labels.find(l);
+      if (it != labels.end()) result.push_back(it->second);
+    };
+    auto &s = *body[i];
+    if (s.GetOp() == TreeStm::TreeStmJumpOp) {
+      for (auto &l : static_cast<TreeStmJump &>(s).GetTargets()) add(l);
+    } else if (s.GetOp() == TreeStm::TreeStmCJumpOp) {
+      add(static_cast<TreeStmCJump &>(s).GetLTrue());
+      add(static_cast<TreeStmCJump &>(s).GetLFalse());
+    } else if (i + 1 < body.size()) {
+      result.push_back(i + 1);
+    }
+    return result;
+  };
+
+  auto visited = std::vector<bool>(body.size(), false);
+  auto worklist = successors(p);
+  while (!worklist.empty()) {
+    auto i = worklist.back();
+    worklist.pop_back();
+    if (visited[i]) continue;
+    visited[i] = true;
+    if (Uses(*body[i], t)) return true;
+    if (IsMoveTo(*body[i], t)) continue;
+    for (auto s : successors(i)) worklist.push_back(s);
+  }
+  return false;
+}
+
+// Whether the object allocated into t by the statement p has fields that
+// hold references, according to the header that is stored next
+bool HasReferences(std::vector<upTreeStm> &body, std::size_t p,
+                   const Temp &t) {
+  if (p + 1 >= body.size() || body[p + 1]->GetOp() != TreeStm::TreeStmMoveOp)
+    return false;
+  auto &m = static_cast<TreeStmMove &>(*body[p + 1]);
+  if (m.GetDst()->GetOp() != TreeExp::TreeExpMemOp ||
+      m.GetSrc()->GetOp() != TreeExp::TreeExpConstOp)
+    return false;
+  auto &addr = *static_cast<TreeExpMem &>(*m.GetDst()).GetAddr();
+  return addr.GetOp() == TreeExp::TreeExpTempOp &&
+         static_cast<TreeExpTemp &>(addr).GetTemp() == t &&
+         GcRoots::HeaderReferences(
+             static_cast<TreeExpConst &>(*m.GetSrc()).GetValue()) > 0;
+}
+
+// Replaces the memory accesses through the given temps at constant offsets
+// by temps
+class ScalarReplacement {
+ public:
+  // The holders are given with the offset into the object that they hold.
+  ScalarReplacement(std::unordered_map<Temp, std::int32_t> holders)
+      : holders_(std::move(holders)) {}
+
+  void Rewrite(TreeStm &s) {
+    switch (s.GetOp()) {
+      case TreeStm::TreeStmMoveOp: {
+        auto &m = static_cast<TreeStmMove &>(s);
+        Rewrite(m.GetDst());
+        Rewrite(m.GetSrc());
+        return;
+      }
+      case TreeStm::TreeStmJumpOp:
+        Rewrite(static_cast<TreeStmJump &>(s).GetTarget());
+        return;
+      case TreeStm::TreeStmCJumpOp: {
+        auto &c = static_cast<TreeStmCJump &>(s);
+        Rewrite(c.GetLeft());
+        Rewrite(c.GetRight());
+        return;
+      }
+      default:
+        return;
+    }
+  }
+
+  // temps that replace the words of the object
+  const std::map<std::int32_t, Temp> &GetFields() const { return fields_; }
+
+ private:
+  std::unordered_map<Temp, std::int32_t> holders_;
+  std::map<std::int32_t, Temp> fields_;
+
+  std::optional<std::int32_t> HolderOffset(TreeExp &e) const {
+    if (e.GetOp() != TreeExp::TreeExpTempOp) return std::nullopt;
+    auto it = holders_.find(static_cast<TreeExpTemp &>(e).GetTemp());
+    if (it == holders_.end()) return std::nullopt;
+    return it->second;
+  }
+
+  void Rewrite(upTreeExp &e) {
+    switch (e->GetOp()) {
+      case TreeExp::TreeExpMemOp: {
+        auto &addr = *static_cast<TreeExpMem &>(*e).GetAddr();
+        auto offset = HolderOffset(addr);
+        if (addr.GetOp() == TreeExp::TreeExpBinOpOp) {
+          auto &b = static_cast<TreeExpBinOp &>(addr);
+          if (b.GetBinOp() == TreeExpBinOp::PLUS) {
+            if (auto base = HolderOffset(*b.GetLeft())) {
+              offset = *base + *ConstValue(*b.GetRight());
+            }
+          }
+        }
+        if (offset) {
+          auto it = fields_.try_emplace(*offset).first;
+          e = std::make_unique<TreeExpTemp>(it->second);
+        } else {
+          Rewrite(static_cast<TreeExpMem &>(*e).GetAddr());
+        }
+        return;
+      }
+      case TreeExp::TreeExpBinOpOp: {
+        auto &b = static_cast<TreeExpBinOp &>(*e);
+        Rewrite(b.GetLeft());
+        Rewrite(b.GetRight());
+        return;
+      }
+      case TreeExp::TreeExpCallOp: {
+        auto &c = static_cast<TreeExpCall &>(*e);
+        Rewrite(c.GetFun());
+        for (auto &a : c.GetArgs()) Rewrite(a);
+        return;
+      }
+      default:
+        return;
+    }
+  }
+};
+
+// Replaces the non-escaping allocations of a function, given the escaping
+// nodes of its flow. The int elements of arrays, the narrowest accesses of
+// an object (see TreeExpMem), take int_size bytes.
+void Replace(TreeFunction &fun, const Flow &flow, std::int32_t word_size,
+             std::int32_t int_size, EscapeAnalysis::Stats &stats) {
+  auto replacements = std::map<std::size_t, std::vector<upTreeStm>>{};
+  for (auto &a : flow.GetAllocations()) {
+    if (flow.GetNode(a.node).escapes || a.size <= 0 || a.size % word_size != 0)
+      continue;
+    auto holders = flow.Holders(a);
+    auto temps = std::unordered_map<Temp, std::int32_t>{};
+    auto scalar = true;
+    for (auto &[h, base] : holders) {
+      auto &n = flow.GetNode(h);
+      assert(n.temp);
+      temps[*n.temp] = base.value_or(0);
+      scalar = scalar && base && !n.mixed && !n.passed && !n.indexed &&
+               std::all_of(n.sources.begin(), n.sources.end(), [&](auto &s) {
+                 return s.node == a.node || holders.count(s.node) > 0;
+               }) &&
+               std::all_of(n.offsets.begin(), n.offsets.end(), [&](auto k) {
+                 auto o = *base + k;
+                 return 0 <= o && o < a.size && o % int_size == 0;
+               });
+    }
+    // The object must be dead when the allocation is executed again.
+    if (std::any_of(temps.begin(), temps.end(), [&](auto &t) {
+          return !(t.first == a.dst) && LiveAfter(fun.body, a.stm, t.first);
+        }))
+      continue;
+
+    auto stms = std::vector<upTreeStm>{};
+    if (scalar) {
+      auto replacement = ScalarReplacement(temps);
+      for (auto &s : fun.body) replacement.Rewrite(*s);
+      for (auto &[k, t] : replacement.GetFields()) {
+        stms.push_back(std::make_unique<TreeStmMove>(
+            std::make_unique<TreeExpTemp>(t),
+            std::make_unique<TreeExpConst>(0)));
+      }
+      stms.push_back(
+          std::make_unique<TreeStmMove>(std::make_unique<TreeExpTemp>(a.dst),
+                                        std::make_unique<TreeExpConst>(0)));
+      stats.scalar_replaced++;
+    } else if (a.size <= MAX_STACK_OBJECT_WORDS * word_size &&
+               !HasReferences(fun.body, a.stm, a.dst) &&
+               fun.frame_memory_size + a.size <=
+                   (std::size_t)(MAX_FRAME_MEMORY_WORDS * word_size)) {
+      stms.push_back(std::make_unique<TreeStmMove>(
+          std::make_unique<TreeExpTemp>(a.dst),
+          std::make_unique<TreeExpFrameAddr>(fun.frame_memory_size)));
+      for (std::int32_t k = 0; k < a.size; k += word_size) {
+        stms.push_back(std::make_unique<TreeStmMove>(
+            std::make_unique<TreeExpMem>(std::make_unique<TreeExpBinOp>(
+                TreeExpBinOp::PLUS, std::make_unique<TreeExpTemp>(a.dst),
+                std::make_unique<TreeExpConst>(k))),
+            std::make_unique<TreeExpConst>(0)));
+      }
+      fun.frame_memory_size += a.size;
+      stats.stack_allocated++;
+    } else {
+      continue;
+    }
+    replacements[a.stm] = std::move(stms);
+  }
+
+  if (replacements.empty()) return;
+  auto body = std::vector<upTreeStm>{};
+  for (std::size_t i = 0; i < fun.body.size(); i++) {
+    auto it = replacements.find(i);
+    if (it == replacements.end()) {
+      body.push_back(std::move(fun.body[i]));
+    } else {
+      std::move(it->second.begin(), it->second.end(),
+                std::back_inserter(body));
+    }
+  }
+  fun.body = std::move(body);
+}
+
+}  // namespace
+
+EscapeAnalysis::Stats EscapeAnalysis::Process(
+    Canonizer::CanonizedTreeProgram &prg, const Label &alloc,
+    std::int32_t word_size, std::int32_t int_size) {
+  auto flows = std::vector<Flow>{};
+  auto summaries = Summaries{};
+  for (auto &fun : prg.functions) {
+    flows.emplace_back(fun, alloc);
+    summaries[fun.name] = std::vector<bool>(fun.parameter_count, false);
+  }
+
+  // Starting from no escaping parameters, propagate until the summaries
+  // are stable.
+  for (auto change = true; change;) {
+    change = false;
+    for (std::size_t i = 0; i < flows.size(); i++) {
+      flows[i].Propagate(summaries);
+      auto escapes = flows[i].ParameterEscapes();
+      auto &summary = summaries[prg.functions[i].name];
+      if (escapes != summary) {
+        summary = std::move(escapes);
+        change = true;
+      }
+    }
+  }
+
+  auto stats = Stats{};
+  for (std::size_t i = 0; i < flows.size(); i++) {
+    Replace(prg.functions[i], flows[i], word_size, int_size, stats);
+  }
+  return stats;
+}
+
+}  // namespace mjc
@@ -0,0 +1,50 @@
+//
+// Escape analysis
+//
+
+#ifndef MJC_INTERMEDIATE_ESCAPE_ANALYSIS_H
+#define MJC_INTERMEDIATE_ESCAPE_ANALYSIS_H
+
+#include <cstdint>
+
+#include "intermediate/canonizer.h"
+#include "intermediate/names.h"
+
+namespace mjc {
+
+// Finds heap allocations of a fixed size whose address does not escape the
+// allocating function and replaces them:
+// - An object whose memory is only accessed at constant offsets through
+//   temps that hold no other address is replaced by one temp per accessed
+//   word or array element (scalar replacement).
+// - Otherwise, the object is placed in the memory of the stack frame
+//   (FRAMEADDR) and zeroed at each allocation. The garbage collector does
+//   not scan this memory, so objects with fields that hold references (see
+//   GcRoots::ObjectHeader) stay on the heap.
+//
+// An address escapes if it is stored in memory, returned, compared,
+// computed with or passed to a function that may let it escape. Whether the
+// parameters of the functions of the program escape is computed for the
+// whole program; arguments of tail calls always escape, since the callee
+// reuses the frame. An allocation that may be executed again while the
+// previous object is still live in a temp is not replaced.
+//
+// Allocations are the statements MOVE(TEMP t, CALL(NAME alloc, CONST size))
+// where alloc returns zeroed memory of the given size in bytes. Memory
+// holds words of word_size bytes, except for the int elements of arrays,
+// which take int_size bytes.
+class EscapeAnalysis {
+ public:
+  struct Stats {
+    unsigned scalar_replaced = 0;
+    unsigned stack_allocated = 0;
+  };
+
+  static Stats Process(Canonizer::CanonizedTreeProgram &prg,
+                       const Label &alloc, std::int32_t word_size,
+                       std::int32_t int_size);
+};
+
+}  // namespace mjc
+
+#endif
@@ -0,0 +1,437 @@
+#include "intermediate/gc_roots.h"
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "intermediate/tree.h"
+
+namespace mjc {
+
+namespace {
+
+using upTreeExp = std::unique_ptr<TreeExp>;
+using upTreeStm = std::unique_ptr<TreeStm>;
+
+// The call of a statement MOVE(lexp, CALL), if any
+TreeExpCall *CallOf(TreeStm &s) {
+  if (s.GetOp() != TreeStm::TreeStmMoveOp) return nullptr;
+  auto &src = *static_cast<TreeStmMove &>(s).GetSrc();
+  if (src.GetOp() != TreeExp::TreeExpCallOp) return nullptr;
+  return &static_cast<TreeExpCall &>(src);
+}
+
+std::optional<Label> Callee(TreeExpCall &c) {
+  if (c.GetFun()->GetOp() != TreeExp::TreeExpNameOp) return std::nullopt;
+  return static_cast<TreeExpName &>(*c.GetFun()).GetName();
+}
+
+// The temps and parameters of a function. Each parameter is represented by
+// a temp of its own.
+class Vars {
+ public:
+  explicit Vars(const TreeFunction &fun) {
+    for (std::size_t i = 0; i < fun.parameter_count; i++) {
+      params_.push_back(Temp{});
+      numbers_[params_.back()] = (std::int32_t)i;
+    }
+  }
+
+  // The variable of a TEMP or PARAM expression
+  std::optional<Temp> Of(TreeExp &e) const {
+    if (e.GetOp() == TreeExp::TreeExpTempOp) {
+      return static_cast<TreeExpTemp &>(e).GetTemp();
+    }
+    if (e.GetOp() == TreeExp::TreeExpParamOp) {
+      auto n = static_cast<TreeExpParam &>(e).GetNumber();
+      if (n >= 0 && (std::size_t)n < params_.size()) return params_[n];
+    }
+    return std::nullopt;
+  }
+
+  const Temp &Param(std::size_t n) const { return params_[n]; }
+  bool IsParam(const Temp &v) const { return numbers_.count(v) > 0; }
+
+  upTreeExp Exp(const Temp &v) const {
+    auto it = numbers_.find(v);
+    if (it != numbers_.end()) return std::make_unique<TreeExpParam>(it->second);
+    return std::make_unique<TreeExpTemp>(v);
+  }
+
+  // Appends the variables read by e to vars.
+  void Mentioned(TreeExp &e, std::vector<Temp> &vars) const {
+    if (auto v = Of(e)) {
+      vars.push_back(*v);
+      return;
+    }
+    switch (e.GetOp()) {
+      case TreeExp::TreeExpMemOp:
+        Mentioned(*static_cast<TreeExpMem &>(e).GetAddr(), vars);
+        return;
+      case TreeExp::TreeExpBinOpOp: {
+        auto &b = static_cast<TreeExpBinOp &>(e);
+        Mentioned(*b.GetLeft(), vars);
+        Mentioned(*b.GetRight(), vars);
+        return;
+      }
+      case TreeExp::TreeExpCallOp: {
+        auto &c = static_cast<TreeExpCall &>(e);
+        Mentioned(*c.GetFun(), vars);
+        for (auto &a : c.GetArgs()) Mentioned(*a, vars);
+        return;
+      }
+      default:
+        return;
+    }
+  }
+
+ private:
+  std::vector<Temp> params_;
+  std::unordered_map<Temp, std::int32_t> numbers_;
+};
+
+struct FunctionInfo {
+  Vars vars;
+  std::unordered_map<Temp, bool> references;
+  bool may_collect = false;
+};
+
+class Analysis {
+ public:
+  Analysis(Canonizer::CanonizedTreeProgram &prg, const Label &alloc)
+      : prg_(prg), alloc_(alloc) {
+    for (std::size_t i = 0; i < prg.functions.size(); i++) {
+      infos_.push_back({.vars = Vars(prg.functions[i])});
+      index_[prg.functions[i].name] = i;
+    }
+    InferReferences();
+    InferMayCollect();
+  }
+
+  const FunctionInfo &Info(std::size_t i) const { return infos_[i]; }
+
+  bool MayCollect(TreeExpCall &c) const {
+    auto f = Callee(c);
+    if (!f) return true;
+    if (*f == alloc_) return true;
+    auto it = index_.find(*f);
+    return it != index_.end() && infos_[it->second].may_collect;
+  }
+
+ private:
+  Canonizer::CanonizedTreeProgram &prg_;
+  const Label &alloc_;
+  std::vector<FunctionInfo> infos_;
+  std::unordered_map<Label, std::size_t> index_;
+
+  bool IsReference(TreeExp &e, const FunctionInfo &info) const {
+    if (auto v = info.vars.Of(e)) {
+      auto it = info.references.find(*v);
+      return it != info.references.end() && it->second;
+    }
+    switch (e.GetOp()) {
+      case TreeExp::TreeExpMemOp:
+        return static_cast<TreeExpMem &>(e).IsReference();
+      case TreeExp::TreeExpCallOp: {
+        auto f = Callee(static_cast<TreeExpCall &>(e));
+        if (!f) return false;
+        if (*f == alloc_) return true;
+        auto it = index_.find(*f);
+        if (it == index_.end()) return false;
+        auto &callee = infos_[it->second];
+        auto r = callee.references.find(prg_.functions[it->second].return_temp);
+        return r != callee.references.end() && r->second;
+      }
+      default:
+        return false;
+    }
+  }
+
+  static bool Mark(FunctionInfo &info, const Temp &v) {
+    auto &r = info.references[v];
+    if (r) return false;
+    r = true;
+    return true;
+  }
+
+  // A variable holds references if a reference is assigned to it.
+  void InferReferences() {
+    for (auto change = true; change;) {
+      change = false;
+      for (std::size_t i = 0; i < prg_.functions.size(); i++) {
+        auto &info = infos_[i];
+        for (auto &s : prg_.functions[i].body) {
+          if (s->GetOp() != TreeStm::TreeStmMoveOp) continue;
+          auto &m = static_cast<TreeStmMove &>(*s);
+          auto dst = info.vars.Of(*m.GetDst());
+          if (dst && IsReference(*m.GetSrc(), info)) {
+            change = Mark(info, *dst) || change;
+          }
+          auto c = CallOf(*s);
+          auto f = c ? Callee(*c) : std::nullopt;
+          auto it = f ? index_.find(*f) : index_.end();
+          if (it == index_.end()) continue;
+          auto &callee = infos_[it->second];
+          auto &args = c->GetArgs();
+          for (std::size_t k = 0; k < args.size(); k++) {
+            if (k < prg_.functions[it->second].parameter_count &&
+                IsReference(*args[k], info)) {
+              change = Mark(callee, callee.vars.Param(k)) || change;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // A function may collect garbage if it calls a function that may.
+  void InferMayCollect() {
+    for (auto change = true; change;) {
+      change = false;
+      for (std::size_t i = 0; i < prg_.functions.size(); i++) {
+        if (infos_[i].may_collect) continue;
+        for (auto &s : prg_.functions[i].body) {
+          auto c = CallOf(*s);
+          if (c && MayCollect(*c)) {
+            infos_[i].may_collect = true;
+            change = true;
+            break;
+          }
+        }
+      }
+    }
+  }
+};
+
+// Inserts the stores and loads of the roots into the body of a function.
+class Roots {
+ public:
+  Roots(TreeFunction &fun, const FunctionInfo &info, const Analysis &analysis,
+        std::int32_t word_size)
+      : fun_(fun), info_(info), analysis_(analysis), word_size_(word_size) {
+    for (auto &[v, r] : info.references) {
+      if (!r) continue;
+      index_[v] = vars_.size();
+      vars_.push_back(v);
+    }
+  }
+
+  void Process(GcRoots::Stats &stats) {
+    auto &body = fun_.body;
+    auto n = body.size();
+    ComputeSuccessors();
+    auto uses = std::vector<std::vector<std::size_t>>(n);
+    auto defs = std::vector<std::optional<std::size_t>>(n);
+    for (std::size_t i = 0; i < n; i++) {
+      auto mentioned = std::vector<Temp>{};
+      auto &s = *body[i];
+      if (s.GetOp() == TreeStm::TreeStmMoveOp) {
+        auto &m = static_cast<TreeStmMove &>(s);
+        if (auto d = info_.vars.Of(*m.GetDst())) {
+          defs[i] = Index(*d);
+        } else {
+          info_.vars.Mentioned(*m.GetDst(), mentioned);
+        }
+        info_.vars.Mentioned(*m.GetSrc(), mentioned);
+      } else if (s.GetOp() == TreeStm::TreeStmJumpOp) {
+        info_.vars.Mentioned(*static_cast<TreeStmJump &>(s).GetTarget(),
+                             mentioned);
+      } else if (s.GetOp() == TreeStm::TreeStmCJumpOp) {
+        auto &c = static_cast<TreeStmCJump &>(s);
+        info_.vars.Mentioned(*c.GetLeft(), mentioned);
+        info_.vars.Mentioned(*c.GetRight(), mentioned);
+      }
+      for (auto &v : mentioned) {
+        if (auto k = Index(v)) uses[i].push_back(*k);
+      }
+    }
+
+    // live references, backwards until stable
+    auto live_in = std::vector<std::vector<bool>>(n, Empty());
+    auto live_out = std::vector<std::vector<bool>>(n, Empty());
+    for (auto change = true; change;) {
+      change = false;
+      for (std::size_t i = n; i-- > 0;) {
+        auto out = Empty();
+        if (successors_[i].empty()) {
+          if (auto r = Index(fun_.return_temp)) out[*r] = true;
+        }
+        for (auto j : successors_[i]) Union(out, live_in[j]);
+        auto in = out;
+        if (defs[i]) in[*defs[i]] = false;
+        for (auto k : uses[i]) in[k] = true;
+        if (in != live_in[i] || out != live_out[i]) {
+          live_in[i] = std::move(in);
+          live_out[i] = std::move(out);
+          change = true;
+        }
+      }
+    }
+
+    // roots of the calls that may collect
+    auto roots = std::vector<std::optional<std::vector<bool>>>(n);
+    for (std::size_t i = 0; i < n; i++) {
+      auto c = CallOf(*body[i]);
+      if (!c || !analysis_.MayCollect(*c)) continue;
+      roots[i] = live_out[i];
+      if (defs[i]) (*roots[i])[*defs[i]] = false;
+    }
+
+    // References whose slot holds their current value, forwards until
+    // stable. The slot is reloaded after a call, so it stays current.
+    auto predecessors = std::vector<std::vector<std::size_t>>(n);
+    for (std::size_t i = 0; i < n; i++) {
+      for (auto j : successors_[i]) predecessors[j].push_back(i);
+    }
+    auto saved_in = std::vector<std::vector<bool>>(n, Full());
+    auto saved_out = std::vector<std::vector<bool>>(n, Full());
+    for (auto change = true; change;) {
+      change = false;
+      for (std::size_t i = 0; i < n; i++) {
+        auto in = i == 0 ? Empty() : Full();
+        if (predecessors[i].empty()) in = Empty();
+        for (auto j : predecessors[i]) Intersect(in, saved_out[j]);
+        auto out = in;
+        if (roots[i]) Union(out, *roots[i]);
+        if (defs[i]) out[*defs[i]] = false;
+        if (in != saved_in[i] || out != saved_out[i]) {
+          saved_in[i] = std::move(in);
+          saved_out[i] = std::move(out);
+          change = true;
+        }
+      }
+    }
+
+    auto result = std::vector<upTreeStm>{};
+    // A reference that may be read before it is assigned starts as null.
+    for (std::size_t k = 0; n > 0 && k < vars_.size(); k++) {
+      if (live_in[0][k] && !info_.vars.IsParam(vars_[k])) {
+        result.push_back(std::make_unique<TreeStmMove>(
+            info_.vars.Exp(vars_[k]), std::make_unique<TreeExpConst>(0)));
+      }
+    }
+    for (std::size_t i = 0; i < n; i++) {
+      if (!roots[i]) {
+        result.push_back(std::move(body[i]));
+        continue;
+      }
+      auto map = std::vector<std::int32_t>{};
+      auto loads = std::vector<upTreeStm>{};
+      for (std::size_t k = 0; k < vars_.size(); k++) {
+        if (!(*roots[i])[k]) continue;
+        auto slot = Slot(k);
+        map.push_back(slot);
+        if (!saved_in[i][k]) {
+          result.push_back(std::make_unique<TreeStmMove>(
+              Word(slot), info_.vars.Exp(vars_[k])));
+        }
+        loads.push_back(std::make_unique<TreeStmMove>(
+            info_.vars.Exp(vars_[k]), Word(slot)));
+      }
+      CallOf(*body[i])->SetStackMap(std::move(map));
+      result.push_back(std::move(body[i]));
+      std::move(loads.begin(), loads.end(), std::back_inserter(result));
+      stats.calls++;
+    }
+    body = std::move(result);
+    stats.roots += slots_.size();
+  }
+
+ private:
+  TreeFunction &fun_;
+  const FunctionInfo &info_;
+  const Analysis &analysis_;
+  std::int32_t word_size_;
+  std::vector<Temp> vars_;  // the variables that hold references
+  std::unordered_map<Temp, std::size_t> index_;
+  std::unordered_map<std::size_t, std::int32_t> slots_;
+  std::vector<std::vector<std::size_t>> successors_;
+
+  std::optional<std::size_t> Index(const Temp &v) const {
+    auto it = index_.find(v);
+    if (it == index_.end()) return std::nullopt;
+    return it->second;
+  }
+
+  std::vector<bool> Empty() const { return std::vector<bool>(vars_.size()); }
+  std::vector<bool> Full() const {
+    return std::vector<bool>(vars_.size(), true);
+  }
+  static void Union(std::vector<bool> &a, const std::vector<bool> &b) {
+    for (std::size_t k = 0; k < a.size(); k++) a[k] = a[k] || b[k];
+  }
+  static void Intersect(std::vector<bool> &a, const std::vector<bool> &b) {
+    for (std::size_t k = 0; k < a.size(); k++) a[k] = a[k] && b[k];
+  }
+
+  // offset of the word in the frame memory that holds the k-th variable
+  std::int32_t Slot(std::size_t k) {
+    auto it = slots_.find(k);
+    if (it != slots_.end()) return it->second;
+    auto slot = (std::int32_t)fun_.frame_memory_size;
+    fun_.frame_memory_size += word_size_;
+    slots_[k] = slot;
+    return slot;
+  }
+
+  static upTreeExp Word(std::int32_t slot) {
+    return std::make_unique<TreeExpMem>(
+        std::make_unique<TreeExpFrameAddr>(slot), TreeExpMem::REFERENCE);
+  }
+
+  void ComputeSuccessors() {
+    auto &body = fun_.body;
+    auto labels = std::unordered_map<Label, std::size_t>{};
+    for (std::size_t i = 0; i < body.size(); i++) {
+      if (body[i]->GetOp() == TreeStm::TreeStmLabelOp) {
+        labels[static_cast<TreeStmLabel &>(*body[i]).GetLabel()] = i;
+      }
+    }
+    successors_.assign(body.size(), {});
+    for (std::size_t i = 0; i < body.size(); i++) {
+      auto add = [&](const Label &l) {
+        auto it = labels.find(l);
+        if (it != labels.end()) successors_[i].push_back(it->second);
+      };
+      auto &s = *body[i];
+      if (s.GetOp() == TreeStm::TreeStmJumpOp) {
+        for (auto &l : static_cast<TreeStmJump &>(s).GetTargets()) add(l);
+      } else if (s.GetOp() == TreeStm::TreeStmCJumpOp) {
+        add(static_cast<TreeStmCJump &>(s).GetLTrue());
+        add(static_cast<TreeStmCJump &>(s).GetLFalse());
+      } else if (i + 1 < body.size()) {
+        successors_[i].push_back(i + 1);
+      }
+    }
+  }
+};
+
+}  // namespace
+
+GcRoots::Stats GcRoots::Process(Canonizer::CanonizedTreeProgram &prg,
+                                const Label &alloc, std::int32_t word_size) {
+  auto analysis = Analysis(prg, alloc);
+  auto stats = Stats{};
+  for (std::size_t i = 0; i < prg.functions.size(); i++) {
+    Roots(prg.functions[i], analysis.Info(i), analysis, word_size)
+        .Process(stats);
+  }
+  return stats;
+}
+
+std::int32_t GcRoots::ObjectHeader(std::uint32_t references,
+                                   std::uint32_t fields) {
+  assert(references <= fields && fields < (1u << 15));
+  return (std::int32_t)((1u << 31) | (references << 15) | fields);
+}
+
+std::uint32_t GcRoots::HeaderReferences(std::int32_t header) {
+  if (header >= 0) return 0;
+  return ((std::uint32_t)header >> 15) & 0x7fff;
+}
+
+}  // namespace mjc
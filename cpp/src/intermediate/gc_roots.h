@@ -0,0 +1,52 @@
+//
+// Roots for the garbage collector
+//
+
+#ifndef MJC_INTERMEDIATE_GC_ROOTS_H
+#define MJC_INTERMEDIATE_GC_ROOTS_H
+
+#include <cstdint>
+
+#include "intermediate/canonizer.h"
+#include "intermediate/names.h"
+
+namespace mjc {
+
+// Makes the references on the stack visible to a moving garbage collector,
+// which runs only in calls of the allocation function.
+//
+// The temps and parameters that hold references are inferred from the
+// values assigned to them: results of the allocation function, loads from
+// memory that is marked as a reference (see TreeExpMem) and references
+// passed or returned by the functions of the program.
+//
+// Around each call of a function that may allocate, the references that
+// are live after the call are stored into words of the frame memory
+// (FRAMEADDR) and loaded again afterwards, since the collector may move the
+// objects. The call gets the offsets of these words as its stack map.
+// No temp that holds a reference is live across such a call, so no
+// callee-save register needs to be described.
+class GcRoots {
+ public:
+  struct Stats {
+    unsigned calls = 0;  // calls with a stack map
+    unsigned roots = 0;  // words of frame memory for roots
+  };
+
+  static Stats Process(Canonizer::CanonizedTreeProgram &prg,
+                       const Label &alloc, std::int32_t word_size);
+
+  // The first word of an array is its length. The first word of an object
+  // has bit 31 set, the number of fields that hold references in bits 15
+  // to 29 and the number of fields in bits 0 to 14. The fields that hold
+  // references come first.
+  static std::int32_t ObjectHeader(std::uint32_t references,
+                                   std::uint32_t fields);
+  // Number of fields that hold references of an object with the given
+  // header, 0 for an array
+  static std::uint32_t HeaderReferences(std::int32_t header);
+};
+
+}  // namespace mjc
+
+#endif
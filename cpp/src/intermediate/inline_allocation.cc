@@ -0,0 +1,119 @@
+#include "intermediate/inline_allocation.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "intermediate/tree.h"
+
+namespace mjc {
+
+namespace {
+
+using upTreeExp = std::unique_ptr<TreeExp>;
+using upTreeStm = std::unique_ptr<TreeStm>;
+
+// Largest constant size for which the new pointer is compared with the
+// limit. The heap does not reach the end of the address space, which holds
+// the stack, so that pointer + size does not wrap around.
+const std::int32_t MAX_COMPARED_SIZE = 4096;
+
+// The size argument of an allocation, nullptr for other statements
+upTreeExp *AllocationSize(TreeStm &s, const Label &alloc) {
+  if (s.GetOp() != TreeStm::TreeStmMoveOp) return nullptr;
+  auto &m = static_cast<TreeStmMove &>(s);
+  if (m.GetDst()->GetOp() != TreeExp::TreeExpTempOp ||
+      m.GetSrc()->GetOp() != TreeExp::TreeExpCallOp)
+    return nullptr;
+  auto &c = static_cast<TreeExpCall &>(*m.GetSrc());
+  if (c.IsTailCall() || c.GetFun()->GetOp() != TreeExp::TreeExpNameOp ||
+      !(static_cast<TreeExpName &>(*c.GetFun()).GetName() == alloc) ||
+      c.GetArgs().size() != 1)
+    return nullptr;
+  return &c.GetArgs()[0];
+}
+
+upTreeExp Var(const Label &l) {
+  return std::make_unique<TreeExpMem>(std::make_unique<TreeExpName>(l));
+}
+
+upTreeExp Plus(const Temp &t, upTreeExp e) {
+  return std::make_unique<TreeExpBinOp>(
+      TreeExpBinOp::PLUS, std::make_unique<TreeExpTemp>(t), std::move(e));
+}
+
+// Appends the inline allocation of `size` bytes into t to stms.
+void Allocate(const Temp &t, upTreeExp size,
+              const InlineAllocation::Heap &heap,
+              std::vector<upTreeStm> &stms) {
+  auto l_fast = Label{};
+  auto l_slow = Label{};
+  auto l_done = Label{};
+  auto next = Temp{};
+  if (size->GetOp() == TreeExp::TreeExpConstOp &&
+      static_cast<TreeExpConst &>(*size).GetValue() > 0 &&
+      static_cast<TreeExpConst &>(*size).GetValue() <= MAX_COMPARED_SIZE) {
+    // next := t + size; if next > limit then slow
+    auto c = static_cast<TreeExpConst &>(*size).GetValue();
+    stms.push_back(std::make_unique<TreeStmMove>(
+        std::make_unique<TreeExpTemp>(t), Var(heap.pointer)));
+    stms.push_back(std::make_unique<TreeStmMove>(
+        std::make_unique<TreeExpTemp>(next),
+        Plus(t, std::make_unique<TreeExpConst>(c))));
+    stms.push_back(std::make_unique<TreeStmCJump>(
+        TreeStmCJump::UGT, std::make_unique<TreeExpTemp>(next),
+        Var(heap.limit), l_slow, l_fast));
+  } else {
+    // if size - 1 >= limit - t then slow
+    // A size of 0 or a negative one (as unsigned) is left to the runtime.
+    auto s = Temp{};
+    stms.push_back(std::make_unique<TreeStmMove>(
+        std::make_unique<TreeExpTemp>(s), std::move(size)));
+    stms.push_back(std::make_unique<TreeStmMove>(
+        std::make_unique<TreeExpTemp>(t), Var(heap.pointer)));
+    stms.push_back(std::make_unique<TreeStmMove>(
+        std::make_unique<TreeExpTemp>(next),
+        Plus(t, std::make_unique<TreeExpTemp>(s))));
+    stms.push_back(std::make_unique<TreeStmCJump>(
+        TreeStmCJump::UGE, Plus(s, std::make_unique<TreeExpConst>(-1)),
+        std::make_unique<TreeExpBinOp>(TreeExpBinOp::MINUS, Var(heap.limit),
+                                       std::make_unique<TreeExpTemp>(t)),
+        l_slow, l_fast));
+    size = std::make_unique<TreeExpTemp>(s);
+  }
+  stms.push_back(std::make_unique<TreeStmLabel>(l_fast));
+  stms.push_back(std::make_unique<TreeStmMove>(
+      Var(heap.pointer), std::make_unique<TreeExpTemp>(next)));
+  stms.push_back(std::make_unique<TreeStmJump>(l_done));
+  stms.push_back(std::make_unique<TreeStmLabel>(l_slow));
+  stms.push_back(std::make_unique<TreeStmMove>(
+      std::make_unique<TreeExpTemp>(t),
+      std::make_unique<TreeExpCall>(heap.alloc, std::move(size))));
+  stms.push_back(std::make_unique<TreeStmLabel>(l_done));
+}
+
+}  // namespace
+
+unsigned InlineAllocation::Process(Canonizer::CanonizedTreeProgram &prg,
+                                   const Heap &heap) {
+  auto inlined = 0u;
+  for (auto &fun : prg.functions) {
+    auto body = std::vector<upTreeStm>{};
+    body.reserve(fun.body.size());
+    for (auto &s : fun.body) {
+      auto size = AllocationSize(*s, heap.alloc);
+      if (!size) {
+        body.push_back(std::move(s));
+        continue;
+      }
+      auto &dst = *static_cast<TreeStmMove &>(*s).GetDst();
+      Allocate(static_cast<TreeExpTemp &>(dst).GetTemp(), std::move(*size),
+               heap, body);
+      inlined++;
+    }
+    fun.body = std::move(body);
+  }
+  return inlined;
+}
+
+}  // namespace mjc
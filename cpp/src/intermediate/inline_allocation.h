@@ -0,0 +1,36 @@
+//
+// Inline heap allocation
+//
+
+#ifndef MJC_INTERMEDIATE_INLINE_ALLOCATION_H
+#define MJC_INTERMEDIATE_INLINE_ALLOCATION_H
+
+#include "intermediate/canonizer.h"
+#include "intermediate/names.h"
+
+namespace mjc {
+
+// Replaces the calls of the allocation function of the runtime by a bump
+// pointer increment. The runtime hands out zeroed memory from a chunk
+// between the variables `pointer` and `limit`. If the requested size fits,
+// the allocation takes it from there and advances `pointer`; otherwise it
+// calls the allocation function, which starts a new chunk.
+//
+// Allocations are the statements MOVE(TEMP t, CALL(NAME alloc, size)) where
+// size is in bytes and a multiple of the word size.
+class InlineAllocation {
+ public:
+  struct Heap {
+    Label alloc;
+    Label pointer;
+    Label limit;
+  };
+
+  // returns the number of inlined allocations
+  static unsigned Process(Canonizer::CanonizedTreeProgram &prg,
+                          const Heap &heap);
+};
+
+}  // namespace mjc
+
+#endif
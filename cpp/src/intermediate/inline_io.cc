@@ -0,0 +1,127 @@
+#include "intermediate/inline_io.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "intermediate/tree.h"
+
+namespace mjc {
+
+namespace {
+
+using upTreeExp = std::unique_ptr<TreeExp>;
+using upTreeStm = std::unique_ptr<TreeStm>;
+
+// The call of the given runtime function in a statement MOVE(TEMP t, CALL)
+TreeExpCall *RuntimeCall(TreeStm &s, const Label &f) {
+  if (s.GetOp() != TreeStm::TreeStmMoveOp) return nullptr;
+  auto &m = static_cast<TreeStmMove &>(s);
+  if (m.GetDst()->GetOp() != TreeExp::TreeExpTempOp ||
+      m.GetSrc()->GetOp() != TreeExp::TreeExpCallOp)
+    return nullptr;
+  auto &c = static_cast<TreeExpCall &>(*m.GetSrc());
+  if (c.IsTailCall() || c.GetFun()->GetOp() != TreeExp::TreeExpNameOp ||
+      !(static_cast<TreeExpName &>(*c.GetFun()).GetName() == f))
+    return nullptr;
+  return &c;
+}
+
+upTreeExp Var(const Label &l) {
+  return std::make_unique<TreeExpMem>(std::make_unique<TreeExpName>(l));
+}
+
+upTreeExp TempExp(const Temp &t) { return std::make_unique<TreeExpTemp>(t); }
+
+upTreeStm Move(upTreeExp dst, upTreeExp src) {
+  return std::make_unique<TreeStmMove>(std::move(dst), std::move(src));
+}
+
+// Appends the statements that load the pointer of a buffer into p and
+// continue at l_slow if it has reached the limit, at l_fast otherwise.
+void CheckBuffer(const Temp &p, const Label &pointer, const Label &limit,
+                 const Label &l_slow, const Label &l_fast,
+                 std::vector<upTreeStm> &stms) {
+  stms.push_back(Move(TempExp(p), Var(pointer)));
+  stms.push_back(std::make_unique<TreeStmCJump>(
+      TreeStmCJump::UGE, TempExp(p), Var(limit), l_slow, l_fast));
+  stms.push_back(std::make_unique<TreeStmLabel>(l_fast));
+}
+
+void Advance(const Temp &p, const Label &pointer, std::int32_t word_size,
+             std::vector<upTreeStm> &stms) {
+  auto next = std::make_unique<TreeExpBinOp>(
+      TreeExpBinOp::PLUS, TempExp(p),
+      std::make_unique<TreeExpConst>(word_size));
+  stms.push_back(Move(Var(pointer), std::move(next)));
+}
+
+// Appends the buffered write of the argument of the call into t to stms.
+void Write(const Temp &t, upTreeExp arg, const InlineIo::Buffers &buffers,
+           std::int32_t word_size, std::vector<upTreeStm> &stms) {
+  auto l_fast = Label{};
+  auto l_slow = Label{};
+  auto l_done = Label{};
+  auto v = Temp{};
+  auto p = Temp{};
+  stms.push_back(Move(TempExp(v), std::move(arg)));
+  CheckBuffer(p, buffers.out_pointer, buffers.out_limit, l_slow, l_fast, stms);
+  stms.push_back(Move(std::make_unique<TreeExpMem>(TempExp(p)), TempExp(v)));
+  Advance(p, buffers.out_pointer, word_size, stms);
+  stms.push_back(Move(TempExp(t), std::make_unique<TreeExpConst>(0)));
+  stms.push_back(std::make_unique<TreeStmJump>(l_done));
+  stms.push_back(std::make_unique<TreeStmLabel>(l_slow));
+  auto call = std::make_unique<TreeExpCall>(buffers.write, TempExp(v));
+  stms.push_back(Move(TempExp(t), std::move(call)));
+  stms.push_back(std::make_unique<TreeStmLabel>(l_done));
+}
+
+// Appends the buffered read into t to stms.
+void Read(const Temp &t, const InlineIo::Buffers &buffers,
+          std::int32_t word_size, std::vector<upTreeStm> &stms) {
+  auto l_fast = Label{};
+  auto l_slow = Label{};
+  auto l_done = Label{};
+  auto p = Temp{};
+  CheckBuffer(p, buffers.in_pointer, buffers.in_limit, l_slow, l_fast, stms);
+  stms.push_back(Move(TempExp(t), std::make_unique<TreeExpMem>(TempExp(p))));
+  Advance(p, buffers.in_pointer, word_size, stms);
+  stms.push_back(std::make_unique<TreeStmJump>(l_done));
+  stms.push_back(std::make_unique<TreeStmLabel>(l_slow));
+  auto call = std::make_unique<TreeExpCall>(
+      std::make_unique<TreeExpName>(buffers.read), std::vector<upTreeExp>{});
+  stms.push_back(Move(TempExp(t), std::move(call)));
+  stms.push_back(std::make_unique<TreeStmLabel>(l_done));
+}
+
+}  // namespace
+
+unsigned InlineIo::Process(Canonizer::CanonizedTreeProgram &prg,
+                           const Buffers &buffers, std::int32_t word_size) {
+  auto inlined = 0u;
+  for (auto &fun : prg.functions) {
+    auto body = std::vector<upTreeStm>{};
+    body.reserve(fun.body.size());
+    for (auto &s : fun.body) {
+      auto write = RuntimeCall(*s, buffers.write);
+      auto read = RuntimeCall(*s, buffers.read);
+      if ((!write || write->GetArgs().size() != 1) &&
+          (!read || !read->GetArgs().empty())) {
+        body.push_back(std::move(s));
+        continue;
+      }
+      auto &dst = *static_cast<TreeStmMove &>(*s).GetDst();
+      auto t = static_cast<TreeExpTemp &>(dst).GetTemp();
+      if (write) {
+        Write(t, std::move(write->GetArgs()[0]), buffers, word_size, body);
+      } else {
+        Read(t, buffers, word_size, body);
+      }
+      inlined++;
+    }
+    fun.body = std::move(body);
+  }
+  return inlined;
+}
+
+}  // namespace mjc
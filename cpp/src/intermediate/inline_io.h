@@ -0,0 +1,43 @@
+//
+// Inline input and output
+//
+
+#ifndef MJC_INTERMEDIATE_INLINE_IO_H
+#define MJC_INTERMEDIATE_INLINE_IO_H
+
+#include <cstdint>
+
+#include "intermediate/canonizer.h"
+#include "intermediate/names.h"
+
+namespace mjc {
+
+// Replaces the calls of the runtime functions that write and read a byte by
+// accesses to the buffers of the runtime. The runtime keeps the free part
+// of its output buffer between the variables `out_pointer` and `out_limit`
+// and the unread part of its input buffer between `in_pointer` and
+// `in_limit`, one byte per word. If the output buffer is full or the input
+// buffer is empty, the runtime function is called; it writes or reads the
+// buffer with a system call.
+//
+// The calls are the statements MOVE(TEMP t, CALL(NAME write, e)) and
+// MOVE(TEMP t, CALL(NAME read)).
+class InlineIo {
+ public:
+  struct Buffers {
+    Label write;
+    Label out_pointer;
+    Label out_limit;
+    Label read;
+    Label in_pointer;
+    Label in_limit;
+  };
+
+  // returns the number of inlined calls
+  static unsigned Process(Canonizer::CanonizedTreeProgram &prg,
+                          const Buffers &buffers, std::int32_t word_size);
+};
+
+}  // namespace mjc
+
+#endif
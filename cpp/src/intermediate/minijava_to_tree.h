@@ -1,8 +1,19 @@
 #ifndef MJC_INTERMEDIATE_MINIJAVA_TO_TREE_H
 #define MJC_INTERMEDIATE_MINIJAVA_TO_TREE_H
 
+#include <limits>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+
+#include "intermediate/gc_roots.h"
+#include "intermediate/runtime_names.h"
 #include "intermediate/tree.h"
+#include "intermediate/vector.h"
 #include "minijava/ast.h"
+#include "minijava/loops.h"
+#include "minijava/reachability.h"
 #include "minijava/symbol.h"
 #include "minijava/typecheck.h"
 
@@ -19,6 +30,10 @@ namespace mjc {
 // - Object -> int32: address of a memort block containing
 //                    class-id, field1, field2, ..., fieldn
 //                    (all int32 values)
+// On targets whose WORD_SIZE exceeds 4, addresses, the length and the
+// fields are words of that size, and an int in a word is its lower 32 bits.
+// The elements of an array take INT_SIZE bytes, rounded up to whole words
+// at the end of the array.
 //
 // Translation of methods:
 // - A f(B x, C y) in class D becomes
@@ -26,15 +41,53 @@ namespace mjc {
 //
 // Translation of classes:
 // - gather all translated methods
+//
+// Calls in tail position, i.e. 'return o.m(...)' or an assignment
+// 'x = o.m(...)' to the returned variable after which the method returns
+// immediately, are marked as tail calls. A tail call of the method itself
+// is translated into a reassignment of the parameters followed by a jump
+// to the beginning of the method body.
+//
+// If a set of methods is given, only the methods in it are translated.
+//
+// If the target has vector registers, simple counted loops over int arrays
+// are vectorised (see TranslateVectorLoop). If unrolling is enabled, other
+// small counted loops are unrolled (see UnrolledLoop). If unswitching is
+// enabled, loops that test an invariant condition are duplicated for both
+// of its values (see UnswitchedLoop).
 template <typename TargetMachine>
 class MinijavaToTree {
  public:
-  MinijavaToTree(const SymbolTable &symbols) : symbols_(symbols) {}
+  MinijavaToTree(const SymbolTable &symbols,
+                 const MethodSet *methods = nullptr,
+                 Vector::Support vectors = {}, bool unroll = false,
+                 bool unswitch = false)
+      : symbols_(symbols),
+        methods_(methods),
+        vectors_(vectors),
+        unroll_(unroll),
+        unswitch_(unswitch) {}
 
   TreeProgram Process(const Program &prg) { return Translate(prg); }
 
+  // Number of loops that the last Process vectorised
+  unsigned VectorisedLoops() const { return vectorised_loops_; }
+
+  // Number of loops that the last Process unrolled
+  unsigned UnrolledLoops() const { return unrolled_loops_; }
+
+  // Number of loops that the last Process unswitched
+  unsigned UnswitchedLoops() const { return unswitched_loops_; }
+
  private:
   const SymbolTable &symbols_;
+  const MethodSet *methods_;
+  const Vector::Support vectors_;
+  const bool unroll_;
+  const bool unswitch_;
+  mutable unsigned vectorised_loops_ = 0;
+  mutable unsigned unrolled_loops_ = 0;
+  mutable unsigned unswitched_loops_ = 0;
 
   using upTreeExp = std::unique_ptr<TreeExp>;
   using upTreeStm = std::unique_ptr<TreeStm>;
@@ -43,17 +96,40 @@ class MinijavaToTree {
   const ClassSymbol *class_symbol_;
   const MethodSymbol *method_symbol_;
   std::unordered_map<std::string, Temp> local_temps_;
+  Label entry_;                         // beginning of method body
+  std::optional<std::string> tail_var_;  // local variable that is returned
+
+  // A copy of the body of an unrolled loop that is being translated: reads
+  // of the index are replaced by its value in the copy, and the accesses
+  // a[index + c] of the checked arrays are known to be within the bounds.
+  // The arrays are held in temps.
+  struct Copy {
+    Ident index;
+    std::int32_t offset = 0;            // of the index in the copy
+    std::optional<std::int32_t> value;  // of the index, if constant
+    std::map<Ident, Temp> checked;
+  };
+  mutable const Copy *copy_ = nullptr;
+
+  // The if statements of the unswitched loops that are being translated
+  // and the branches that they take in these copies of the loops
+  mutable std::map<const StmIf *, bool> unswitched_;
 
   ///////////////////////////////////////////////////////////////////
   // Program
   ///////////////////////////////////////////////////////////////////
 
   TreeProgram Translate(const Program &prg) {
+    vectorised_loops_ = 0;
+    unrolled_loops_ = 0;
+    unswitched_loops_ = 0;
     std::vector<TreeFunction> functions;
     // classes
     for (auto &cd : prg.classes) {
       class_symbol_ = &symbols_.GetClasses().find(cd.class_name)->second;
       for (auto &md : cd.methods) {
+        if (methods_ && methods_->count({cd.class_name, md.method_name}) == 0)
+          continue;
         functions.push_back(Translate(md));
       }
     }
@@ -69,13 +145,13 @@ class MinijavaToTree {
     method_symbol_ = &it->second;
 
     local_temps_.clear();
+    tail_var_ = std::nullopt;
 
     Temp ret;
     std::vector<upTreeStm> body;
     body.push_back(std::move(TranslateStm(*this).Visit(*mcd.main_body)));
     body.push_back(std::make_unique<TreeStmMove>(
         std::make_unique<TreeExpTemp>(ret), std::make_unique<TreeExpConst>(0)));
-    AppendRaiseBlock(body);
 
     return {.name = Label("Lmain"),
             .parameter_count = 1,
@@ -95,14 +171,28 @@ class MinijavaToTree {
     for (auto &p : md.locals) {
       local_temps_[p.var_name] = Temp{};
     }
+    entry_ = Label{};
+    tail_var_ = std::nullopt;
+    if (md.return_exp->GetOp() == Exp::ExpIdOp) {
+      auto &id = static_cast<const ExpId &>(*md.return_exp).GetId();
+      if (VarLExp(id)->GetOp() != TreeExp::TreeExpMemOp) {
+        tail_var_ = id;
+      }
+    }
 
     Temp ret;
     std::vector<upTreeStm> body;
-    body.push_back(TranslateStm(*this).Visit(*md.body));
-    body.push_back(std::make_unique<TreeStmMove>(
-        std::make_unique<TreeExpTemp>(ret),
-        TranslateExp(*this).Visit(*md.return_exp)));
-    AppendRaiseBlock(body);
+    body.push_back(std::make_unique<TreeStmLabel>(entry_));
+    body.push_back(TranslateStm(*this, true).Visit(*md.body));
+    if (md.return_exp->GetOp() == Exp::ExpInvokeOp) {
+      body.push_back(TranslateTailCall(
+          std::make_unique<TreeExpTemp>(ret),
+          static_cast<const ExpInvoke &>(*md.return_exp)));
+    } else {
+      body.push_back(std::make_unique<TreeStmMove>(
+          std::make_unique<TreeExpTemp>(ret),
+          TranslateExp(*this).Visit(*md.return_exp)));
+    }
 
     return {.name = Runtime::FunctionName(class_symbol_->GetName(),
                                           method_symbol_->GetName()),
@@ -117,9 +207,18 @@ class MinijavaToTree {
 
   class TranslateStm : public StmVisitor<upTreeStm> {
    public:
-    explicit TranslateStm(const MinijavaToTree &outer) : outer_(outer){};
+    // The flag tail indicates that the method returns directly after the
+    // translated statement.
+    explicit TranslateStm(const MinijavaToTree &outer, bool tail = false)
+        : outer_(outer), tail_(tail){};
 
     virtual upTreeStm VisitAssignment(const StmAssignment &s) {
+      if (tail_ && s.GetId() == outer_.tail_var_ &&
+          s.GetExp().GetOp() == Exp::ExpInvokeOp) {
+        return outer_.TranslateTailCall(
+            outer_.VarLExp(s.GetId()),
+            static_cast<const ExpInvoke &>(s.GetExp()));
+      }
       auto x = outer_.VarLExp(s.GetId());
       auto e = TranslateExp(outer_).Visit(s.GetExp());
       return std::make_unique<TreeStmMove>(std::move(x), std::move(e));
@@ -127,8 +226,11 @@ class MinijavaToTree {
 
     virtual upTreeStm VisitArrayAssignment(const StmArrayAssignment &s) {
       auto translate_exp = TranslateExp(outer_);
-      auto raise = Runtime::RaiseBlockName(outer_.class_symbol_->GetName(),
-                                           outer_.method_symbol_->GetName());
+      if (auto element = outer_.CheckedElement(s.GetId(), s.GetIndex())) {
+        return std::make_unique<TreeStmMove>(std::move(element),
+                                             translate_exp.Visit(s.GetExp()));
+      }
+      auto raise = RuntimeNames::BoundsErrorFunction();
       auto d = Runtime::ArrayDeref(outer_.VarLExp(s.GetId()),
                                    translate_exp.Visit(s.GetIndex()), raise);
       auto &stms = d.first;
@@ -139,6 +241,10 @@ class MinijavaToTree {
     }
 
     virtual upTreeStm VisitIf(const StmIf &s) {
+      if (auto it = outer_.unswitched_.find(&s);
+          it != outer_.unswitched_.end()) {
+        return Visit(it->second ? s.GetTrueBranch() : s.GetFalseBranch());
+      }
       auto l_true = Label{};
       auto l_false = Label{};
       auto l_end = Label{};
@@ -153,16 +259,27 @@ class MinijavaToTree {
       return std::make_unique<TreeStmSeq>(std::move(stms));
     }
 
+    // Loops are rotated: the condition is tested once before the loop and
+    // again at the end of the body, so that an iteration needs only the
+    // conditional jump back to the body. A vectorised or unrolled loop
+    // falls through to the original loop, which executes the remaining
+    // iterations.
     virtual upTreeStm VisitWhile(const StmWhile &s) {
-      auto l_loop = Label{};
-      auto l_true = Label{};
+      if (auto unswitched_loop = outer_.UnswitchedLoop(s)) {
+        return unswitched_loop;
+      }
+      auto l_body = Label{};
       auto l_end = Label{};
       auto stms = std::vector<upTreeStm>{};
-      stms.push_back(std::make_unique<TreeStmLabel>(l_loop));
-      stms.push_back(TranslateCond(outer_, l_true, l_end).Visit(s.GetCond()));
-      stms.push_back(std::make_unique<TreeStmLabel>(l_true));
-      stms.push_back(Visit(s.GetBody()));
-      stms.push_back(std::make_unique<TreeStmJump>(l_loop));
+      if (auto vector_loop = outer_.VectorLoop(s)) {
+        stms.push_back(std::move(vector_loop));
+      } else if (auto unrolled_loop = outer_.UnrolledLoop(s)) {
+        stms.push_back(std::move(unrolled_loop));
+      }
+      stms.push_back(TranslateCond(outer_, l_body, l_end).Visit(s.GetCond()));
+      stms.push_back(std::make_unique<TreeStmLabel>(l_body));
+      stms.push_back(TranslateStm(outer_).Visit(s.GetBody()));
+      stms.push_back(TranslateCond(outer_, l_body, l_end).Visit(s.GetCond()));
       stms.push_back(std::make_unique<TreeStmLabel>(l_end));
       return std::make_unique<TreeStmSeq>(std::move(stms));
     }
@@ -171,7 +288,7 @@ class MinijavaToTree {
       return std::make_unique<TreeStmMove>(
           std::make_unique<TreeExpTemp>(Temp{}),
           std::make_unique<TreeExpCall>(
-              Runtime::PrintFunction(),
+              RuntimeNames::PrintFunction(),
               TranslateExp(outer_).Visit(s.GetExp())));
     }
 
@@ -179,20 +296,33 @@ class MinijavaToTree {
       return std::make_unique<TreeStmMove>(
           std::make_unique<TreeExpTemp>(Temp{}),
           std::make_unique<TreeExpCall>(
-              Runtime::WriteFunction(),
+              RuntimeNames::WriteFunction(),
               TranslateExp(outer_).Visit(s.GetExp())));
     }
 
     virtual upTreeStm VisitSeq(const StmSeq &s) {
       auto ts = std::vector<upTreeStm>{};
-      for (auto &si : s.GetStms()) {
-        ts.push_back(Visit(*si));
+      auto &stms = s.GetStms();
+      for (auto it = stms.begin(); it != stms.end(); ++it) {
+        if (std::next(it) != stms.end()) {
+          if (auto loop = outer_.FullyUnrolledLoop(**it, **std::next(it))) {
+            ts.push_back(std::move(loop));
+            ++it;
+            continue;
+          }
+        }
+        if (std::next(it) == stms.end()) {
+          ts.push_back(Visit(**it));
+        } else {
+          ts.push_back(TranslateStm(outer_).Visit(**it));
+        }
       }
       return std::make_unique<TreeStmSeq>(std::move(ts));
     }
 
    private:
     const MinijavaToTree &outer_;
+    const bool tail_;
   };
 
   ///////////////////////////////////////////////////////////////////
@@ -208,7 +338,7 @@ class MinijavaToTree {
     };
 
     virtual upTreeExp VisitId(const ExpId &e) {
-      return outer_.VarLExp(e.GetId());
+      return outer_.VarExp(e.GetId());
     }
 
     virtual upTreeExp VisitBinOp(const ExpBinOp &e) {
@@ -250,26 +380,17 @@ class MinijavaToTree {
     };
 
     virtual upTreeExp VisitInvoke(const ExpInvoke &e) {
-      std::shared_ptr<Type> ty = TypeOf(outer_.symbols_, *outer_.class_symbol_,
-                                        *outer_.method_symbol_, e.GetObj());
-      assert(ty->GetOp() == Type::TypeClassOp);
-      auto tyclass = static_cast<TypeClass &>(*ty);
-      auto cls = tyclass.GetName();
-
-      auto args = std::vector<upTreeExp>{};
-      args.push_back(Visit(e.GetObj()));
-      for (auto &a : e.GetArgs()) {
-        args.push_back(Visit(*a));
-      }
-      return std::make_unique<TreeExpCall>(
-          std::make_unique<TreeExpName>(
-              Runtime::FunctionName(cls, e.GetMethod())),
-          std::move(args));
+      return outer_.TranslateInvoke(e, false);
     }
 
     virtual upTreeExp VisitArrayGet(const ExpArrayGet &e) {
-      auto raise = Runtime::RaiseBlockName(outer_.class_symbol_->GetName(),
-                                           outer_.method_symbol_->GetName());
+      if (e.GetArray().GetOp() == Exp::ExpIdOp) {
+        auto &id = static_cast<const ExpId &>(e.GetArray()).GetId();
+        if (auto element = outer_.CheckedElement(id, e.GetIndex())) {
+          return element;
+        }
+      }
+      auto raise = RuntimeNames::BoundsErrorFunction();
       auto d =
           Runtime::ArrayDeref(Visit(e.GetArray()), Visit(e.GetIndex()), raise);
       return std::make_unique<TreeExpESeq>(std::move(d.first),
@@ -308,7 +429,7 @@ class MinijavaToTree {
 
     virtual upTreeExp VisitRead(const ExpRead &e) {
       return std::make_unique<TreeExpCall>(
-          std::make_unique<TreeExpName>(Runtime::ReadFunction()),
+          std::make_unique<TreeExpName>(RuntimeNames::ReadFunction()),
           std::vector<upTreeExp>{});
     }
 
@@ -427,10 +548,686 @@ class MinijavaToTree {
     const Label l_false_;
   };
 
+  ///////////////////////////////////////////////////////////////////
+  // Calls
+  ///////////////////////////////////////////////////////////////////
+
+  std::unique_ptr<TreeExpCall> TranslateInvoke(const ExpInvoke &e,
+                                               bool tail_call) const {
+    std::shared_ptr<Type> ty =
+        TypeOf(symbols_, *class_symbol_, *method_symbol_, e.GetObj());
+    assert(ty->GetOp() == Type::TypeClassOp);
+    auto tyclass = static_cast<TypeClass &>(*ty);
+    auto cls = tyclass.GetName();
+
+    auto args = std::vector<upTreeExp>{};
+    args.push_back(TranslateExp(*this).Visit(e.GetObj()));
+    for (auto &a : e.GetArgs()) {
+      args.push_back(TranslateExp(*this).Visit(*a));
+    }
+    return std::make_unique<TreeExpCall>(
+        std::make_unique<TreeExpName>(
+            Runtime::FunctionName(cls, e.GetMethod())),
+        std::move(args), tail_call);
+  }
+
+  // Translates the assignment of a call in tail position to dst.
+  upTreeStm TranslateTailCall(upTreeExp dst, const ExpInvoke &e) const {
+    auto call = TranslateInvoke(e, true);
+    auto &fun = static_cast<TreeExpName &>(*call->GetFun());
+    if (!(fun.GetName() == Runtime::FunctionName(class_symbol_->GetName(),
+                                                 method_symbol_->GetName()))) {
+      return std::make_unique<TreeStmMove>(std::move(dst), std::move(call));
+    }
+
+    // Recursive call: evaluate all arguments before assigning any parameter
+    auto stms = std::vector<upTreeStm>{};
+    auto temps = std::vector<Temp>{};
+    for (auto &arg : call->GetArgs()) {
+      auto t = Temp{};
+      stms.push_back(std::make_unique<TreeStmMove>(
+          std::make_unique<TreeExpTemp>(t), std::move(arg)));
+      temps.push_back(t);
+    }
+    for (std::size_t i = 0; i < temps.size(); i++) {
+      stms.push_back(
+          std::make_unique<TreeStmMove>(std::make_unique<TreeExpParam>(i),
+                                        std::make_unique<TreeExpTemp>(temps[i])));
+    }
+    stms.push_back(std::make_unique<TreeStmJump>(entry_));
+    return std::make_unique<TreeStmSeq>(std::move(stms));
+  }
+
+  ///////////////////////////////////////////////////////////////////
+  // Counted loops
+  ///////////////////////////////////////////////////////////////////
+
+  // offsets and steps beyond this limit are not worth the overflow checks
+  static constexpr std::int32_t MAX_OFFSET = 1 << 20;
+
+  // An array that a counted loop accesses as a[i + c] with offsets c in
+  // [min, max], held in temp after the checks before a transformed loop
+  struct CheckedArray {
+    Ident name;
+    Temp temp;
+    std::int32_t min = 0;
+    std::int32_t max = 0;
+  };
+
+  // Jumps to l_fail if l op r.
+  static void Check(std::vector<upTreeStm> &stms, TreeStmCJump::RelOp op,
+                    upTreeExp l, upTreeExp r, const Label &l_fail) {
+    auto l_ok = Label{};
+    stms.push_back(std::make_unique<TreeStmCJump>(op, std::move(l),
+                                                  std::move(r), l_fail, l_ok));
+    stms.push_back(std::make_unique<TreeStmLabel>(l_ok));
+  }
+
+  // Checks before a loop that executes the iterations of a counted loop in
+  // groups with the indices i, ..., i + span, while i < n - span. Jumps to
+  // l_fail unless
+  // - neither n - span nor i + span + step overflows,
+  // - at least one group remains,
+  // - the accesses of the arrays are within the bounds for all indices
+  //   from i to n - 1, and the arrays are not null, so that a null array
+  //   fails in the original loop, after the effects that precede the access.
+  // The arrays are loaded into their temps. Returns the temp with n - span.
+  Temp CheckCountedLoop(std::vector<upTreeStm> &stms, const CountedLoop &loop,
+                        std::int32_t span,
+                        const std::vector<CheckedArray> &arrays,
+                        const Label &l_fail) const {
+    auto index = [&] { return VarLExp(loop.index); };
+    auto tn = Temp{};
+    auto tlast = Temp{};
+    stms.push_back(std::make_unique<TreeStmMove>(
+        std::make_unique<TreeExpTemp>(tn),
+        TranslateExp(*this).Visit(*loop.bound)));
+    Check(stms, TreeStmCJump::LT, std::make_unique<TreeExpTemp>(tn),
+          std::make_unique<TreeExpConst>(
+              std::numeric_limits<std::int32_t>::min() + span),
+          l_fail);
+    if (loop.step > 1) {
+      Check(stms, TreeStmCJump::LT,
+            std::make_unique<TreeExpConst>(
+                std::numeric_limits<std::int32_t>::max() - loop.step + 1),
+            std::make_unique<TreeExpTemp>(tn), l_fail);
+    }
+    stms.push_back(std::make_unique<TreeStmMove>(
+        std::make_unique<TreeExpTemp>(tlast),
+        std::make_unique<TreeExpBinOp>(TreeExpBinOp::MINUS,
+                                       std::make_unique<TreeExpTemp>(tn),
+                                       std::make_unique<TreeExpConst>(span))));
+    Check(stms, TreeStmCJump::LE, std::make_unique<TreeExpTemp>(tlast),
+          index(), l_fail);
+    if (!arrays.empty()) {
+      auto min = std::int32_t{0};
+      for (auto &a : arrays) min = std::min(min, a.min);
+      Check(stms, TreeStmCJump::LT, index(),
+            std::make_unique<TreeExpConst>(-min), l_fail);
+    }
+    // a[i + max] is the last element accessed if n - 1 + max < length
+    for (auto &a : arrays) {
+      stms.push_back(std::make_unique<TreeStmMove>(
+          std::make_unique<TreeExpTemp>(a.temp), VarLExp(a.name)));
+      Check(stms, TreeStmCJump::EQ, std::make_unique<TreeExpTemp>(a.temp),
+            std::make_unique<TreeExpConst>(0), l_fail);
+      auto length = Runtime::ArrayLength(std::make_unique<TreeExpTemp>(a.temp));
+      if (a.max != 0) {
+        length = std::make_unique<TreeExpBinOp>(
+            TreeExpBinOp::MINUS, std::move(length),
+            std::make_unique<TreeExpConst>(a.max));
+      }
+      Check(stms, TreeStmCJump::LT, std::move(length),
+            std::make_unique<TreeExpTemp>(tn), l_fail);
+    }
+    return tlast;
+  }
+
+  ///////////////////////////////////////////////////////////////////
+  // Vectorisation
+  ///////////////////////////////////////////////////////////////////
+
+  // The vectorised loop that precedes the translation of a loop, or nullptr
+  upTreeStm VectorLoop(const StmWhile &s) const {
+    if (vectors_.lanes == 0) return nullptr;
+    auto loop = AnalyseCountedLoop(s, *method_symbol_);
+    if (!loop || loop->step != 1) return nullptr;
+    auto vector_loop = TranslateVectorLoop(*this, *loop).Translate();
+    if (vector_loop) vectorised_loops_++;
+    return vector_loop;
+  }
+
+  // A counted loop with step 1 whose body consists of
+  // - assignments a[i] = e and
+  // - reductions s = s + e, s = e + s and s = s - e to variables s that the
+  //   body reads nowhere else,
+  // where the expressions e combine the index i, elements b[i + c] and
+  // invariant ints that cannot fail by +, - and *, is vectorised: a loop
+  // before it executes the iterations in groups of the lanes of a vector,
+  // one statement for all lanes at a time, while a whole group remains. The
+  // loop itself executes the remaining iterations, and all of them if the
+  // checks before the vectorised loop fail:
+  // - at least one group remains,
+  // - the arrays are not null and the indices of all accesses of the
+  //   groups are within the bounds,
+  // - arrays that are read at an offset c != 0 are not assigned, by the
+  //   same or another name. Reading b[i] while assigning a[i] is fine.
+  // A failing access of the original loop thus fails in the scalar loop.
+  class TranslateVectorLoop {
+   public:
+    TranslateVectorLoop(const MinijavaToTree &outer, const CountedLoop &loop)
+        : outer_(outer), vectors_(outer.vectors_), loop_(loop) {}
+
+    upTreeStm Translate() {
+      for (auto stm : loop_.body) {
+        if (!Statement(*stm)) return nullptr;
+      }
+      if (fixed_ + temps_ > vectors_.registers) return nullptr;
+      for (auto &[name, a] : arrays_) {
+        if (a.stored && a.shifted) return nullptr;
+      }
+
+      auto l_loop = Label{};
+      auto l_done = Label{};
+      auto lanes = static_cast<std::int32_t>(vectors_.lanes);
+      auto stms = std::vector<upTreeStm>{};
+      auto checked = std::vector<CheckedArray>{};
+      for (auto &name : order_) {
+        auto &a = arrays_[name];
+        checked.push_back({name, a.temp, a.min, a.max});
+      }
+      auto tlast = outer_.CheckCountedLoop(stms, loop_, lanes - 1, checked,
+                                           l_scalar_);
+      for (auto &shifted : order_) {
+        if (!arrays_[shifted].shifted) continue;
+        for (auto &stored : order_) {
+          if (!arrays_[stored].stored) continue;
+          Check(stms, TreeStmCJump::EQ,
+                std::make_unique<TreeExpTemp>(arrays_[shifted].temp),
+                std::make_unique<TreeExpTemp>(arrays_[stored].temp),
+                l_scalar_);
+        }
+      }
+      for (auto &s : setup_) stms.push_back(std::move(s));
+
+      stms.push_back(std::make_unique<TreeStmLabel>(l_loop));
+      for (auto &s : body_) stms.push_back(std::move(s));
+      stms.push_back(std::make_unique<TreeStmMove>(
+          Index(),
+          std::make_unique<TreeExpBinOp>(
+              TreeExpBinOp::PLUS, Index(),
+              std::make_unique<TreeExpConst>(lanes))));
+      if (index_) {
+        stms.push_back(Op(Vector::ADD, *index_, Register(*index_ + 1)));
+      }
+      stms.push_back(std::make_unique<TreeStmCJump>(
+          TreeStmCJump::LT, Index(), std::make_unique<TreeExpTemp>(tlast),
+          l_loop, l_done));
+      stms.push_back(std::make_unique<TreeStmLabel>(l_done));
+
+      for (auto &[name, v] : accumulators_) {
+        auto t = Temp{};
+        stms.push_back(Op(Vector::SUM, v, nullptr, t));
+        stms.push_back(std::make_unique<TreeStmMove>(
+            outer_.VarLExp(name),
+            std::make_unique<TreeExpBinOp>(TreeExpBinOp::PLUS,
+                                           outer_.VarLExp(name),
+                                           std::make_unique<TreeExpTemp>(t))));
+      }
+      stms.push_back(Op(Vector::END, 0));
+      stms.push_back(std::make_unique<TreeStmLabel>(l_scalar_));
+      return std::make_unique<TreeStmSeq>(std::move(stms));
+    }
+
+   private:
+    // An array of the loop, held in temp during the vectorised loop
+    struct Array {
+      Temp temp;
+      std::int32_t min = 0;  // range of the offsets of the accesses
+      std::int32_t max = 0;
+      bool stored = false;   // assigned to
+      bool shifted = false;  // read at an offset != 0
+    };
+
+    // A vector register: fixed registers hold the same value throughout
+    // the vectorised loop, the others are computed in each group.
+    struct Reg {
+      unsigned number;
+      bool fixed;
+    };
+
+    const MinijavaToTree &outer_;
+    const Vector::Support &vectors_;
+    const CountedLoop &loop_;
+    Label l_scalar_;
+    std::vector<upTreeStm> setup_;  // before the vectorised loop
+    std::vector<upTreeStm> body_;
+    std::map<Ident, Array> arrays_;
+    std::vector<Ident> order_;  // of the arrays
+    std::map<Ident, unsigned> accumulators_;
+    std::map<std::string, unsigned> splats_;
+    std::optional<unsigned> index_;  // lanes i, ..., i + lanes - 1;
+                                     // followed by lanes, ..., lanes
+    // Fixed registers are numbered from 0, the others from the last down
+    unsigned fixed_ = 0;
+    unsigned temps_ = 0;
+
+    bool Statement(const Stm &s) {
+      if (s.GetOp() == Stm::StmArrayAssignmentOp) {
+        auto &as = static_cast<const StmArrayAssignment &>(s);
+        auto offset = IndexOffset(as.GetIndex(), loop_.index);
+        if (offset != 0 || !Touch(as.GetId(), 0, true)) return false;
+        auto v = Vectorise(as.GetExp(), 0);
+        if (!v) return false;
+        body_.push_back(Op(Vector::STORE, v->number, Element(as.GetId(), 0)));
+        return true;
+      }
+      if (s.GetOp() != Stm::StmAssignmentOp) return false;
+      auto &a = static_cast<const StmAssignment &>(s);
+      if (a.GetExp().GetOp() != Exp::ExpBinOpOp) return false;
+      auto &b = static_cast<const ExpBinOp &>(a.GetExp());
+      auto is_s = [&a](const Exp &e) {
+        return e.GetOp() == Exp::ExpIdOp &&
+               static_cast<const ExpId &>(e).GetId() == a.GetId();
+      };
+      auto op = Vector::ADD;
+      const Exp *e;
+      if (b.GetBinOp() == ExpBinOp::PLUS && is_s(b.GetLeft())) {
+        e = &b.GetRight();
+      } else if (b.GetBinOp() == ExpBinOp::PLUS && is_s(b.GetRight())) {
+        e = &b.GetLeft();
+      } else if (b.GetBinOp() == ExpBinOp::MINUS && is_s(b.GetLeft())) {
+        op = Vector::SUB;
+        e = &b.GetRight();
+      } else {
+        return false;
+      }
+      // e cannot read s, which is not invariant
+      auto v = Vectorise(*e, 0);
+      if (!v) return false;
+      auto it = accumulators_.find(a.GetId());
+      if (it == accumulators_.end()) {
+        it = accumulators_.emplace(a.GetId(), fixed_++).first;
+        setup_.push_back(Op(Vector::ZERO, it->second));
+      }
+      body_.push_back(Op(op, it->second, Register(v->number)));
+      return true;
+    }
+
+    std::optional<Reg> Vectorise(const Exp &e, unsigned depth) {
+      if (IsInvariant(e, loop_.effects, *outer_.method_symbol_) &&
+          !MayFail(e)) {
+        return Splat(e);
+      }
+      switch (e.GetOp()) {
+        case Exp::ExpIdOp:
+          if (static_cast<const ExpId &>(e).GetId() != loop_.index)
+            return std::nullopt;
+          if (!index_) {
+            index_ = fixed_;
+            fixed_ += 2;
+            setup_.push_back(Op(Vector::INDEX, *index_, Index()));
+            setup_.push_back(
+                Op(Vector::SPLAT, *index_ + 1,
+                   std::make_unique<TreeExpConst>(vectors_.lanes)));
+          }
+          return Reg{*index_, true};
+        case Exp::ExpArrayGetOp: {
+          auto &g = static_cast<const ExpArrayGet &>(e);
+          if (g.GetArray().GetOp() != Exp::ExpIdOp) return std::nullopt;
+          auto &name = static_cast<const ExpId &>(g.GetArray()).GetId();
+          auto offset = IndexOffset(g.GetIndex(), loop_.index);
+          if (!offset || !Touch(name, *offset, false)) return std::nullopt;
+          auto v = Temporary(depth);
+          if (!v) return std::nullopt;
+          body_.push_back(Op(Vector::LOAD, v->number, Element(name, *offset)));
+          return v;
+        }
+        case Exp::ExpBinOpOp: {
+          auto &b = static_cast<const ExpBinOp &>(e);
+          auto op = Vector::ADD;
+          switch (b.GetBinOp()) {
+            case ExpBinOp::PLUS:
+              break;
+            case ExpBinOp::MINUS:
+              op = Vector::SUB;
+              break;
+            case ExpBinOp::MUL:
+              if (!vectors_.mul) return std::nullopt;
+              op = Vector::MUL;
+              break;
+            default:
+              return std::nullopt;
+          }
+          auto l = Vectorise(b.GetLeft(), depth);
+          if (!l) return std::nullopt;
+          if (!l->fixed) {
+            auto r = Vectorise(b.GetRight(), depth + 1);
+            if (!r) return std::nullopt;
+            body_.push_back(Op(op, l->number, Register(r->number)));
+            return l;
+          }
+          auto v = std::optional<Reg>{};
+          if (op != Vector::SUB) {
+            // commutative: the right operand may hold the result
+            auto r = Vectorise(b.GetRight(), depth);
+            if (!r) return std::nullopt;
+            if (!r->fixed) {
+              body_.push_back(Op(op, r->number, Register(l->number)));
+              return r;
+            }
+            v = Temporary(depth);
+            if (!v) return std::nullopt;
+            body_.push_back(Op(Vector::COPY, v->number, Register(l->number)));
+            body_.push_back(Op(op, v->number, Register(r->number)));
+            return v;
+          }
+          v = Temporary(depth);
+          if (!v) return std::nullopt;
+          body_.push_back(Op(Vector::COPY, v->number, Register(l->number)));
+          auto r = Vectorise(b.GetRight(), depth + 1);
+          if (!r) return std::nullopt;
+          body_.push_back(Op(op, v->number, Register(r->number)));
+          return v;
+        }
+        default:
+          return std::nullopt;
+      }
+    }
+
+    // A fixed register with each lane the value of an invariant e
+    Reg Splat(const Exp &e) {
+      auto key = std::optional<std::string>{};
+      if (e.GetOp() == Exp::ExpIdOp) {
+        key = static_cast<const ExpId &>(e).GetId();
+      } else if (e.GetOp() == Exp::ExpNumOp) {
+        key = std::to_string(static_cast<const ExpNum &>(e).GetNum());
+      }
+      if (key) {
+        auto it = splats_.find(*key);
+        if (it != splats_.end()) return {it->second, true};
+      }
+      auto v = fixed_++;
+      if (key) splats_[*key] = v;
+      setup_.push_back(Op(Vector::SPLAT, v, TranslateExp(outer_).Visit(e)));
+      return {v, true};
+    }
+
+    // The register for intermediate results at the given depth
+    std::optional<Reg> Temporary(unsigned depth) {
+      if (depth >= vectors_.registers) return std::nullopt;
+      temps_ = std::max(temps_, depth + 1);
+      return Reg{vectors_.registers - 1 - depth, false};
+    }
+
+    // Records an access of the array name at the given offset.
+    bool Touch(const Ident &name, std::int32_t offset, bool store) {
+      if (loop_.effects.assigned.count(name) > 0 || offset < -MAX_OFFSET ||
+          offset > MAX_OFFSET)
+        return false;
+      auto it = arrays_.find(name);
+      if (it == arrays_.end()) {
+        it = arrays_.emplace(name, Array{}).first;
+        it->second.min = it->second.max = offset;
+        order_.push_back(name);
+      }
+      auto &a = it->second;
+      a.min = std::min(a.min, offset);
+      a.max = std::max(a.max, offset);
+      a.stored |= store;
+      a.shifted |= offset != 0;
+      return true;
+    }
+
+    upTreeExp Index() const { return outer_.VarLExp(loop_.index); }
+
+    // MEM(address of name[i + offset])
+    upTreeExp Element(const Ident &name, std::int32_t offset) const {
+      auto i = Index();
+      if (offset != 0) {
+        i = std::make_unique<TreeExpBinOp>(
+            TreeExpBinOp::PLUS, std::move(i),
+            std::make_unique<TreeExpConst>(offset));
+      }
+      return Runtime::ArrayElement(
+          std::make_unique<TreeExpTemp>(arrays_.at(name).temp), std::move(i));
+    }
+
+    static upTreeExp Register(unsigned v) {
+      return std::make_unique<TreeExpConst>(v);
+    }
+
+    // The vector operation op on register v (see Vector)
+    static upTreeStm Op(Vector::Op op, unsigned v, upTreeExp arg = nullptr,
+                        Temp t = Temp{}) {
+      auto args = std::vector<upTreeExp>{};
+      args.push_back(Register(v));
+      if (arg) args.push_back(std::move(arg));
+      return std::make_unique<TreeStmMove>(
+          std::make_unique<TreeExpTemp>(t),
+          std::make_unique<TreeExpCall>(
+              std::make_unique<TreeExpName>(Vector::Function(op)),
+              std::move(args)));
+    }
+  };
+
+  ///////////////////////////////////////////////////////////////////
+  // Unrolling
+  ///////////////////////////////////////////////////////////////////
+
+  // Unrolled loops and their copies of the body are limited to this size
+  // (see Size)
+  static constexpr unsigned UNROLL_BUDGET = 64;
+  static constexpr unsigned MAX_UNROLL_FACTOR = 4;
+  static constexpr std::int64_t MAX_FULL_UNROLL = 16;  // iterations
+
+  // A counted loop whose body has no loops is unrolled by a factor f that
+  // keeps the copies of the body within the budget: the unrolled loop
+  // before it executes f iterations at a time while i + (f - 1) * step < n,
+  // with i replaced by i + k * step in the k-th copy and a single increment
+  // of i by f * step. The loop itself executes the remaining iterations.
+  // The accesses a[i + c] of arrays a that keep their value are not
+  // checked in the copies; instead, the unrolled loop is skipped unless all
+  // of them are within the bounds for all i up to n - 1. Returns nullptr if
+  // the loop is not unrolled.
+  upTreeStm UnrolledLoop(const StmWhile &s) const {
+    if (!unroll_) return nullptr;
+    auto loop = AnalyseCountedLoop(s, *method_symbol_);
+    if (!loop || loop->effects.loops || loop->step > MAX_OFFSET)
+      return nullptr;
+    auto size = 0u;
+    for (auto stm : loop->body) size += Size(*stm);
+    auto factor =
+        std::min(MAX_UNROLL_FACTOR, UNROLL_BUDGET / std::max(size, 1u));
+    if (factor < 2) return nullptr;
+
+    // the arrays whose accesses are checked before the loop, with the range
+    // of their offsets
+    auto copy = Copy{.index = loop->index};
+    auto ranges = std::map<Ident, std::pair<std::int32_t, std::int32_t>>{};
+    auto unchecked = std::set<Ident>{};
+    auto order = std::vector<Ident>{};
+    for (auto stm : loop->body) {
+      for (auto &[array, offset] : IndexedAccesses(*stm, loop->index)) {
+        if (!IsInvariant(array, loop->effects, *method_symbol_) ||
+            offset < -MAX_OFFSET || offset > MAX_OFFSET) {
+          unchecked.insert(array);
+        }
+        auto it = ranges.find(array);
+        if (it == ranges.end()) {
+          ranges.emplace(array, std::make_pair(offset, offset));
+          order.push_back(array);
+        } else {
+          it->second.first = std::min(it->second.first, offset);
+          it->second.second = std::max(it->second.second, offset);
+        }
+      }
+    }
+
+    auto checked = std::vector<CheckedArray>{};
+    for (auto &array : order) {
+      if (unchecked.count(array) > 0) continue;
+      auto [min, max] = ranges[array];
+      checked.push_back({array, Temp{}, min, max});
+      copy.checked[array] = checked.back().temp;
+    }
+
+    auto l_loop = Label{};
+    auto l_rest = Label{};
+    auto index = [&] { return VarLExp(loop->index); };
+    auto step = loop->step;
+    auto span = static_cast<std::int32_t>(factor - 1) * step;
+    auto stms = std::vector<upTreeStm>{};
+    auto tlast = CheckCountedLoop(stms, *loop, span, checked, l_rest);
+
+    stms.push_back(std::make_unique<TreeStmLabel>(l_loop));
+    for (auto k = 0u; k < factor; k++) {
+      copy.offset = static_cast<std::int32_t>(k) * step;
+      stms.push_back(TranslateCopy(copy, loop->body));
+    }
+    stms.push_back(std::make_unique<TreeStmMove>(
+        index(), std::make_unique<TreeExpBinOp>(
+                     TreeExpBinOp::PLUS, index(),
+                     std::make_unique<TreeExpConst>(
+                         static_cast<std::int32_t>(factor) * step))));
+    stms.push_back(std::make_unique<TreeStmCJump>(
+        TreeStmCJump::LT, index(), std::make_unique<TreeExpTemp>(tlast),
+        l_loop, l_rest));
+    stms.push_back(std::make_unique<TreeStmLabel>(l_rest));
+    unrolled_loops_++;
+    return std::make_unique<TreeStmSeq>(std::move(stms));
+  }
+
+  // A loop
+  //   i = c; while (i < n) { ...; i = i + step; }
+  // with constants c and n and few iterations is replaced by a copy of its
+  // body for each iteration, in which i is a constant, and the assignment
+  // of the final value to i. Returns nullptr if the statements are not
+  // such a loop.
+  upTreeStm FullyUnrolledLoop(const Stm &init, const Stm &s) const {
+    if (!unroll_ || init.GetOp() != Stm::StmAssignmentOp ||
+        s.GetOp() != Stm::StmWhileOp)
+      return nullptr;
+    auto &assignment = static_cast<const StmAssignment &>(init);
+    auto loop = AnalyseCountedLoop(static_cast<const StmWhile &>(s),
+                                   *method_symbol_);
+    if (!loop || loop->effects.loops || loop->index != assignment.GetId() ||
+        assignment.GetExp().GetOp() != Exp::ExpNumOp ||
+        loop->bound->GetOp() != Exp::ExpNumOp)
+      return nullptr;
+    auto first = std::int64_t{
+        static_cast<const ExpNum &>(assignment.GetExp()).GetNum()};
+    auto n = std::int64_t{static_cast<const ExpNum &>(*loop->bound).GetNum()};
+    auto step = std::int64_t{loop->step};
+    auto iterations = first < n ? (n - first + step - 1) / step : 0;
+    auto last = first + iterations * step;
+    auto size = 0u;
+    for (auto stm : loop->body) size += Size(*stm);
+    // if i overflows, the loop does not end at n
+    if (iterations > MAX_FULL_UNROLL || iterations * size > UNROLL_BUDGET ||
+        last > std::numeric_limits<std::int32_t>::max())
+      return nullptr;
+
+    auto copy = Copy{.index = loop->index};
+    auto stms = std::vector<upTreeStm>{};
+    for (auto i = first; i < last; i += step) {
+      copy.value = static_cast<std::int32_t>(i);
+      stms.push_back(TranslateCopy(copy, loop->body));
+    }
+    stms.push_back(std::make_unique<TreeStmMove>(
+        VarLExp(loop->index),
+        std::make_unique<TreeExpConst>(static_cast<std::int32_t>(last))));
+    unrolled_loops_++;
+    return std::make_unique<TreeStmSeq>(std::move(stms));
+  }
+
+  upTreeStm TranslateCopy(const Copy &copy,
+                          const std::vector<const Stm *> &body) const {
+    copy_ = &copy;
+    auto stms = std::vector<upTreeStm>{};
+    for (auto stm : body) stms.push_back(TranslateStm(*this).Visit(*stm));
+    copy_ = nullptr;
+    return std::make_unique<TreeStmSeq>(std::move(stms));
+  }
+
+  ///////////////////////////////////////////////////////////////////
+  // Unswitching
+  ///////////////////////////////////////////////////////////////////
+
+  // Unswitching stops when the copies of a loop would exceed this size
+  // (see Size)
+  static constexpr unsigned UNSWITCH_BUDGET = 128;
+
+  // A loop with an if statement whose condition c is invariant and cannot
+  // fail is unswitched: c is tested once before the loop, which is
+  // translated twice, with the if statement replaced by its true branch
+  // and by its false branch. The copies may be unswitched again for
+  // other if statements, and loops nested in them likewise, as long as all
+  // copies of the loop together stay within the budget. Returns nullptr if
+  // the loop is not unswitched.
+  upTreeStm UnswitchedLoop(const StmWhile &s) const {
+    if (!unswitch_ ||
+        (Size(s) << (unswitched_.size() + 1)) > UNSWITCH_BUDGET)
+      return nullptr;
+    const StmIf *stm = nullptr;
+    for (auto i : InvariantIfs(s.GetBody(), EffectsOf(s), *method_symbol_)) {
+      if (unswitched_.count(i) == 0) {
+        stm = i;
+        break;
+      }
+    }
+    if (!stm) return nullptr;
+
+    auto l_true = Label{};
+    auto l_false = Label{};
+    auto l_end = Label{};
+    auto stms = std::vector<upTreeStm>{};
+    stms.push_back(TranslateCond(*this, l_true, l_false).Visit(stm->GetCond()));
+    stms.push_back(std::make_unique<TreeStmLabel>(l_true));
+    unswitched_[stm] = true;
+    stms.push_back(TranslateStm(*this).Visit(s));
+    stms.push_back(std::make_unique<TreeStmJump>(l_end));
+    stms.push_back(std::make_unique<TreeStmLabel>(l_false));
+    unswitched_[stm] = false;
+    stms.push_back(TranslateStm(*this).Visit(s));
+    unswitched_.erase(stm);
+    stms.push_back(std::make_unique<TreeStmLabel>(l_end));
+    unswitched_loops_++;
+    return std::make_unique<TreeStmSeq>(std::move(stms));
+  }
+
   ///////////////////////////////////////////////////////////////////
   // Helpers
   ///////////////////////////////////////////////////////////////////
 
+  // The value of a variable, which differs from VarLExp for the index of
+  // a copy of an unrolled loop body
+  upTreeExp VarExp(const std::string &id) const {
+    if (!copy_ || id != copy_->index) return VarLExp(id);
+    if (copy_->value) return std::make_unique<TreeExpConst>(*copy_->value);
+    if (copy_->offset == 0) return VarLExp(id);
+    return std::make_unique<TreeExpBinOp>(
+        TreeExpBinOp::PLUS, VarLExp(id),
+        std::make_unique<TreeExpConst>(copy_->offset));
+  }
+
+  // The element array[index] without a bounds check if the access is
+  // checked before an unrolled loop, or nullptr
+  upTreeExp CheckedElement(const Ident &array, const Exp &index) const {
+    if (!copy_) return nullptr;
+    auto it = copy_->checked.find(array);
+    auto offset = IndexOffset(index, copy_->index);
+    if (it == copy_->checked.end() || !offset) return nullptr;
+    auto i = VarLExp(copy_->index);
+    if (copy_->offset + *offset != 0) {
+      i = std::make_unique<TreeExpBinOp>(
+          TreeExpBinOp::PLUS, std::move(i),
+          std::make_unique<TreeExpConst>(copy_->offset + *offset));
+    }
+    return Runtime::ArrayElement(std::make_unique<TreeExpTemp>(it->second),
+                                 std::move(i));
+  }
+
   upTreeExp VarLExp(const std::string &id) const {
     assert(class_symbol_);
     assert(method_symbol_);
@@ -444,13 +1241,17 @@ class MinijavaToTree {
         int n = std::distance(params.begin(), pi) + 1 /* 0 is 'this' */;
         return std::make_unique<TreeExpParam>(n);
       } else {
-        const auto &fields = class_symbol_->GetFields().keys();
+        const auto &fields = Runtime::FieldLayout(*class_symbol_);
         const auto fi = std::find(fields.begin(), fields.end(), id);
         if (fi != fields.end()) {
           int n = std::distance(fields.begin(), fi);
           auto this_addr = Runtime::ThisAddress();
           auto field_addr = Runtime::FieldAddress(std::move(this_addr), n);
-          return std::make_unique<TreeExpMem>(std::move(field_addr));
+          auto &type = *class_symbol_->GetFields().find(id)->second;
+          return std::make_unique<TreeExpMem>(
+              std::move(field_addr), Runtime::IsReference(type)
+                                         ? TreeExpMem::REFERENCE
+                                         : TreeExpMem::WORD);
         } else {
           assert(false);  // type-correctness
           return nullptr;
@@ -459,24 +1260,6 @@ class MinijavaToTree {
     }
   }
 
-  void AppendRaiseBlock(std::vector<upTreeStm> &stms) {
-    assert(class_symbol_);
-    assert(method_symbol_);
-
-    auto end = Label{};
-    auto raise = Runtime::RaiseBlockName(class_symbol_->GetName(),
-                                         method_symbol_->GetName());
-
-    stms.push_back(std::make_unique<TreeStmJump>(end));
-    stms.push_back(std::make_unique<TreeStmLabel>(raise));
-    stms.push_back(std::make_unique<TreeStmMove>(
-        std::make_unique<TreeExpTemp>(Temp{}),
-        std::make_unique<TreeExpCall>(Runtime::RaiseFunction(),
-                                      std::make_unique<TreeExpConst>(1))));
-    stms.push_back(std::make_unique<TreeStmJump>(raise));
-    stms.push_back(std::make_unique<TreeStmLabel>(end));
-  }
-
   ///////////////////////////////////////////////////////////////////
   // Runtime
   ///////////////////////////////////////////////////////////////////
@@ -487,9 +1270,32 @@ class MinijavaToTree {
       return Label{"L" + class_name + "$" + method_name};
     }
 
-    static Label RaiseBlockName(const std::string &class_name,
-                                const std::string &method_name) {
-      return {"L" + class_name + "$" + method_name + "$raise"};
+    static bool IsReference(const Type &type) {
+      return type.GetOp() == Type::TypeArrayOp ||
+             type.GetOp() == Type::TypeClassOp;
+    }
+
+    // Order of the fields in an object: the fields that hold references
+    // come first, so that the header can describe them by their number.
+    static std::vector<Ident> FieldLayout(const ClassSymbol &cls) {
+      auto &fields = cls.GetFields();
+      auto layout = std::vector<Ident>{};
+      for (auto &f : fields.keys()) {
+        if (IsReference(*fields.find(f)->second)) layout.push_back(f);
+      }
+      for (auto &f : fields.keys()) {
+        if (!IsReference(*fields.find(f)->second)) layout.push_back(f);
+      }
+      return layout;
+    }
+
+    // See GcRoots::ObjectHeader
+    static std::int32_t ObjectHeader(const ClassSymbol &cls) {
+      auto &fields = cls.GetFields();
+      auto references = std::count_if(
+          fields.keys().begin(), fields.keys().end(),
+          [&](auto &f) { return IsReference(*fields.find(f)->second); });
+      return GcRoots::ObjectHeader(references, fields.keys().size());
     }
 
     static upTreeExp FieldAddress(upTreeExp obj, int n) {
@@ -500,25 +1306,19 @@ class MinijavaToTree {
 
     static upTreeExp ThisAddress() { return std::make_unique<TreeExpParam>(0); }
 
-    static Label ReadFunction() { return {"L_read"}; }
-
-    static Label WriteFunction() { return {"L_write"}; }
-
-    static Label PrintFunction() { return {"L_println_int"}; }
-
-    static Label RaiseFunction() { return {"L_raise"}; }
-
-    static upTreeExp ArrayAddr(upTreeExp ea, upTreeExp ei) {
-      auto len1 = std::make_unique<TreeExpBinOp>(
+    // The elements follow the length word
+    static upTreeExp ArrayElement(upTreeExp ea, upTreeExp ei) {
+      auto slot = std::make_unique<TreeExpBinOp>(
           TreeExpBinOp::BinOp::PLUS, std::move(ei),
-          std::make_unique<TreeExpConst>(1));
+          std::make_unique<TreeExpConst>(static_cast<int32_t>(
+              TargetMachine::WORD_SIZE / TargetMachine::INT_SIZE)));
       auto offset = std::make_unique<TreeExpBinOp>(
-          TreeExpBinOp::BinOp::MUL, std::move(len1),
+          TreeExpBinOp::BinOp::MUL, std::move(slot),
           std::make_unique<TreeExpConst>(
-              static_cast<int32_t>(TargetMachine::WORD_SIZE)));
+              static_cast<int32_t>(TargetMachine::INT_SIZE)));
       auto addr = std::make_unique<TreeExpBinOp>(
           TreeExpBinOp::BinOp::PLUS, std::move(ea), std::move(offset));
-      return addr;
+      return std::make_unique<TreeExpMem>(std::move(addr), TreeExpMem::INT32);
     }
 
     static upTreeExp ArrayLength(upTreeExp ea) {
@@ -543,64 +1343,93 @@ class MinijavaToTree {
               TreeStmCJump::RelOp::LT, std::make_unique<TreeExpConst>(c),
               ArrayLength(std::make_unique<TreeExpTemp>(ta)), l_ok, l_raise));
           stms.push_back(std::make_unique<TreeStmLabel>(l_ok));
-          auto exp = std::make_unique<TreeExpMem>(
-              ArrayAddr(std::make_unique<TreeExpTemp>(ta),
-                        std::make_unique<TreeExpConst>(c)));
+          auto exp = ArrayElement(std::make_unique<TreeExpTemp>(ta),
+                                  std::make_unique<TreeExpConst>(c));
           return {std::move(stms), std::move(exp)};
         }
       } else {
         auto ta = Temp{};
         auto ti = Temp{};
-        auto l_check_upper = Label{};
         auto l_ok = Label{};
         auto stms = std::vector<upTreeStm>{};
         stms.push_back(std::make_unique<TreeStmMove>(
             std::make_unique<TreeExpTemp>(ta), std::move(ea)));
         stms.push_back(std::make_unique<TreeStmMove>(
             std::make_unique<TreeExpTemp>(ti), std::move(ei)));
+        // a negative index is a large unsigned one
         stms.push_back(std::make_unique<TreeStmCJump>(
-            TreeStmCJump::RelOp::GE, std::make_unique<TreeExpTemp>(ti),
-            std::make_unique<TreeExpConst>(0), l_check_upper, l_raise));
-        stms.push_back(std::make_unique<TreeStmLabel>(l_check_upper));
-        stms.push_back(std::make_unique<TreeStmCJump>(
-            TreeStmCJump::RelOp::LT, std::make_unique<TreeExpTemp>(ti),
+            TreeStmCJump::RelOp::ULT, std::make_unique<TreeExpTemp>(ti),
             ArrayLength(std::make_unique<TreeExpTemp>(ta)), l_ok, l_raise));
         stms.push_back(std::make_unique<TreeStmLabel>(l_ok));
-        auto exp = std::make_unique<TreeExpMem>(
-            ArrayAddr(std::make_unique<TreeExpTemp>(ta),
-                      std::make_unique<TreeExpTemp>(ti)));
+        auto exp = ArrayElement(std::make_unique<TreeExpTemp>(ta),
+                                std::make_unique<TreeExpTemp>(ti));
         return {std::move(stms), std::move(exp)};
       }
     }
 
     static upTreeExp NewObject(const SymbolTable &symbols,
                                const std::string &cls) {
-      auto alloc = Label{"L_halloc"};
-      auto clsit = symbols.GetClasses().find(cls);
-      auto size = 1 + clsit->second.GetFields().keys().size();
-      return std::make_unique<TreeExpCall>(
-          alloc,
-          std::make_unique<TreeExpConst>(size * TargetMachine::WORD_SIZE));
+      auto alloc = RuntimeNames::AllocFunction();
+      auto &cls_symbol = symbols.GetClasses().find(cls)->second;
+      auto size = 1 + cls_symbol.GetFields().keys().size();
+      auto taddr = Temp{};
+      auto stms = std::vector<upTreeStm>{};
+      stms.push_back(std::make_unique<TreeStmMove>(
+          std::make_unique<TreeExpTemp>(taddr),
+          std::make_unique<TreeExpCall>(
+              alloc, std::make_unique<TreeExpConst>(
+                         size * TargetMachine::WORD_SIZE))));
+      stms.push_back(std::make_unique<TreeStmMove>(
+          std::make_unique<TreeExpMem>(std::make_unique<TreeExpTemp>(taddr)),
+          std::make_unique<TreeExpConst>(ObjectHeader(cls_symbol))));
+      return std::make_unique<TreeExpESeq>(
+          std::move(stms), std::make_unique<TreeExpTemp>(taddr));
     }
 
     static upTreeExp NewIntArray(upTreeExp len) {
-      auto alloc = Label{"L_halloc"};
+      auto alloc = RuntimeNames::AllocFunction();
       auto tlen = Temp{};
       auto taddr = Temp{};
+      const auto word = static_cast<int32_t>(TargetMachine::WORD_SIZE);
+      const auto element = static_cast<int32_t>(TargetMachine::INT_SIZE);
+      // a constant size makes the allocation visible to escape analysis
+      auto size = upTreeExp{};
+      if (len->GetOp() == TreeExp::TreeExpConstOp &&
+          static_cast<TreeExpConst &>(*len).GetValue() >= 0) {
+        auto n = static_cast<TreeExpConst &>(*len).GetValue();
+        size = std::make_unique<TreeExpConst>(
+            word + (n * element + word - 1) / word * word);
+      } else if (element == word) {
+        size = std::make_unique<TreeExpBinOp>(
+            TreeExpBinOp::BinOp::MUL, std::make_unique<TreeExpConst>(word),
+            std::make_unique<TreeExpBinOp>(TreeExpBinOp::BinOp::PLUS,
+                                           std::make_unique<TreeExpTemp>(tlen),
+                                           std::make_unique<TreeExpConst>(1)));
+      } else {
+        // (len * element + 2 * word - 1) & -word, rounded up to whole words,
+        // with the sign bit of a negative length, which the runtime rejects
+        auto bytes = std::make_unique<TreeExpBinOp>(
+            TreeExpBinOp::BinOp::PLUS,
+            std::make_unique<TreeExpBinOp>(
+                TreeExpBinOp::BinOp::MUL, std::make_unique<TreeExpTemp>(tlen),
+                std::make_unique<TreeExpConst>(element)),
+            std::make_unique<TreeExpConst>(2 * word - 1));
+        size = std::make_unique<TreeExpBinOp>(
+            TreeExpBinOp::BinOp::OR,
+            std::make_unique<TreeExpBinOp>(
+                TreeExpBinOp::BinOp::AND, std::move(bytes),
+                std::make_unique<TreeExpConst>(-word)),
+            std::make_unique<TreeExpBinOp>(
+                TreeExpBinOp::BinOp::AND, std::make_unique<TreeExpTemp>(tlen),
+                std::make_unique<TreeExpConst>(
+                    std::numeric_limits<int32_t>::min())));
+      }
       auto stms = std::vector<upTreeStm>{};
       stms.push_back(std::make_unique<TreeStmMove>(
           std::make_unique<TreeExpTemp>(tlen), std::move(len)));
       stms.push_back(std::make_unique<TreeStmMove>(
           std::make_unique<TreeExpTemp>(taddr),
-          std::make_unique<TreeExpCall>(
-              alloc, std::make_unique<TreeExpBinOp>(
-                         TreeExpBinOp::BinOp::MUL,
-                         std::make_unique<TreeExpConst>(
-                             static_cast<int32_t>(TargetMachine::WORD_SIZE)),
-                         std::make_unique<TreeExpBinOp>(
-                             TreeExpBinOp::BinOp::PLUS,
-                             std::make_unique<TreeExpTemp>(tlen),
-                             std::make_unique<TreeExpConst>(1))))));
+          std::make_unique<TreeExpCall>(alloc, std::move(size))));
       stms.push_back(std::make_unique<TreeStmMove>(
           std::make_unique<TreeExpMem>(std::make_unique<TreeExpTemp>(taddr)),
           std::make_unique<TreeExpTemp>(tlen)));
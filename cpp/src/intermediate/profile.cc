@@ -0,0 +1,73 @@
+#include "intermediate/profile.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace mjc {
+
+namespace {
+
+std::string ToString(const Label &l) {
+  auto s = std::stringstream{};
+  s << l;
+  return s.str();
+}
+
+}  // namespace
+
+std::optional<Profile> Profile::Read(const std::filesystem::path &file) {
+  auto in = std::ifstream{file};
+  if (!in) return std::nullopt;
+
+  // lines of the form "block <function> <label> <count>" or
+  // "call <caller> <callee> <count>"
+  auto profile = Profile{};
+  auto number = 0u;
+  for (std::string line; std::getline(in, line);) {
+    number++;
+    if (line.empty()) continue;
+    auto s = std::istringstream{line};
+    std::string kind, a, b, rest;
+    std::uint64_t count;
+    if (s >> kind >> a >> b >> count && !(s >> rest)) {
+      if (kind == "block") {
+        profile.blocks_[a + " " + b] += count;
+        continue;
+      } else if (kind == "call") {
+        profile.calls_[{a, b}] += count;
+        continue;
+      }
+    }
+    std::cerr << "Warning: " << file.string() << ":" << number
+              << ": malformed profile line ignored" << std::endl;
+  }
+  return profile;
+}
+
+bool Profile::HasFunction(const Label &function) const {
+  return BlockCount(function, function).has_value();
+}
+
+std::string Profile::BlockKey(const Label &function, const Label &block) {
+  return "block " + ToString(function) + " " + ToString(block);
+}
+
+std::string Profile::CallKey(const Label &caller, const Label &callee) {
+  return "call " + ToString(caller) + " " + ToString(callee);
+}
+
+std::optional<std::uint64_t> Profile::BlockCount(const Label &function,
+                                                 const Label &block) const {
+  auto it = blocks_.find(ToString(function) + " " + ToString(block));
+  if (it == blocks_.end()) return std::nullopt;
+  return it->second;
+}
+
+std::uint64_t Profile::CallCount(const Label &caller,
+                                 const Label &callee) const {
+  auto it = calls_.find({ToString(caller), ToString(callee)});
+  return (it == calls_.end()) ? 0 : it->second;
+}
+
+}  // namespace mjc
@@ -0,0 +1,56 @@
+//
+// Execution profiles
+//
+#ifndef MJC_INTERMEDIATE_PROFILE_H
+#define MJC_INTERMEDIATE_PROFILE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "intermediate/names.h"
+
+namespace mjc {
+
+// Execution counts of basic blocks and calls, as written at exit by a
+// program compiled with -fprofile-generate. A block is identified by the
+// label of its function and its own label; the entry of a function is
+// counted under the function label.
+//
+// Labels are numbered during translation, so a profile only applies to the
+// program from which it was generated.
+class Profile {
+ public:
+  // Returns nothing if the file cannot be read. Lines that are not of the
+  // form of the counters are skipped with a warning.
+  static std::optional<Profile> Read(const std::filesystem::path &file);
+
+  // Names of the counters in the profile file
+  static std::string BlockKey(const Label &function, const Label &block);
+  static std::string CallKey(const Label &caller, const Label &callee);
+
+  // Nothing if the profile has no count for the block
+  std::optional<std::uint64_t> BlockCount(const Label &function,
+                                          const Label &block) const;
+  std::uint64_t CallCount(const Label &caller, const Label &callee) const;
+
+  // Whether the profile counts the entries of the function, i.e. was
+  // generated from a program that contains it
+  bool HasFunction(const Label &function) const;
+
+  // (caller, callee) -> number of calls
+  using Calls = std::map<std::pair<std::string, std::string>, std::uint64_t>;
+  const Calls &GetCalls() const { return calls_; }
+
+ private:
+  std::unordered_map<std::string, std::uint64_t> blocks_;
+  Calls calls_;
+};
+
+}  // namespace mjc
+
+#endif
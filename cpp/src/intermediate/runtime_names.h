@@ -0,0 +1,38 @@
+#ifndef MJC_INTERMEDIATE_RUNTIME_NAMES_H
+#define MJC_INTERMEDIATE_RUNTIME_NAMES_H
+
+#include "intermediate/names.h"
+
+namespace mjc {
+
+// Labels of the functions and variables of the runtime (runtime.c) that
+// the translated program refers to. They are the same for all targets.
+struct RuntimeNames {
+  // Function that allocates zeroed heap memory. Its argument is the size in
+  // bytes.
+  static Label AllocFunction() { return {"L_halloc"}; }
+
+  // Variables with the free memory of the current heap chunk
+  static Label HeapPointer() { return {"L_heap_ptr"}; }
+  static Label HeapLimit() { return {"L_heap_limit"}; }
+
+  // Functions that write and read a byte (-1 at the end of the input), and
+  // variables with the free part of the output buffer and the unread part
+  // of the input buffer. The buffers hold one byte per word.
+  static Label WriteFunction() { return {"L_write"}; }
+  static Label OutputPointer() { return {"L_out_ptr"}; }
+  static Label OutputLimit() { return {"L_out_limit"}; }
+  static Label ReadFunction() { return {"L_read"}; }
+  static Label InputPointer() { return {"L_in_ptr"}; }
+  static Label InputLimit() { return {"L_in_limit"}; }
+
+  static Label PrintFunction() { return {"L_println_int"}; }
+
+  // Shared by all array accesses of the program. It is jumped to rather
+  // than called, which keeps the failing path out of the functions.
+  static Label BoundsErrorFunction() { return {"L_raise_bounds"}; }
+};
+
+} // namespace mjc
+
+#endif
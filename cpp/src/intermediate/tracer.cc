@@ -1,7 +1,9 @@
 #include "intermediate/tracer.h"
 
+#include <cstdint>
+#include <functional>
+#include <iterator>
 #include <optional>
-#include <stack>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -104,29 +106,322 @@ class BlockBuilder {
   }
 };
 
+using Blocks = std::unordered_map<Label, std::unique_ptr<BasicBlock>>;
+
+// Labels to which a transfer statement may jump
+std::vector<Label> Targets(TreeStm &transfer) {
+  if (transfer.GetOp() == TreeStm::TreeStmCJumpOp) {
+    auto &cjump = static_cast<TreeStmCJump &>(transfer);
+    return {cjump.GetLTrue(), cjump.GetLFalse()};
+  }
+  return static_cast<TreeStmJump &>(transfer).GetTargets();
+}
+
+// Replaces the targets of a transfer statement.
+void Retarget(std::unique_ptr<TreeStm> &transfer,
+              const std::function<Label(const Label &)> &sigma) {
+  if (transfer->GetOp() == TreeStm::TreeStmCJumpOp) {
+    auto &cjump = static_cast<TreeStmCJump &>(*transfer);
+    auto t = sigma(cjump.GetLTrue());
+    auto f = sigma(cjump.GetLFalse());
+    if (t == cjump.GetLTrue() && f == cjump.GetLFalse()) return;
+    transfer = std::make_unique<TreeStmCJump>(
+        cjump.GetRel(), std::move(cjump.GetLeft()),
+        std::move(cjump.GetRight()), t, f);
+  } else {
+    auto &jump = static_cast<TreeStmJump &>(*transfer);
+    if (jump.GetTarget()->GetOp() != TreeExp::TreeExpNameOp) return;
+    auto l = static_cast<TreeExpName &>(*jump.GetTarget()).GetName();
+    if (sigma(l) == l) return;
+    transfer = std::make_unique<TreeStmJump>(sigma(l));
+  }
+}
+
+std::optional<bool> Evaluate(TreeStmCJump &cjump) {
+  if (cjump.GetLeft()->GetOp() != TreeExp::TreeExpConstOp ||
+      cjump.GetRight()->GetOp() != TreeExp::TreeExpConstOp) {
+    return std::nullopt;
+  }
+  std::int32_t l = static_cast<TreeExpConst &>(*cjump.GetLeft()).GetValue();
+  std::int32_t r = static_cast<TreeExpConst &>(*cjump.GetRight()).GetValue();
+  auto ul = static_cast<std::uint32_t>(l);
+  auto ur = static_cast<std::uint32_t>(r);
+  switch (cjump.GetRel()) {
+    case TreeStmCJump::EQ:
+      return l == r;
+    case TreeStmCJump::NE:
+      return l != r;
+    case TreeStmCJump::LT:
+      return l < r;
+    case TreeStmCJump::GT:
+      return l > r;
+    case TreeStmCJump::LE:
+      return l <= r;
+    case TreeStmCJump::GE:
+      return l >= r;
+    case TreeStmCJump::ULT:
+      return ul < ur;
+    case TreeStmCJump::ULE:
+      return ul <= ur;
+    case TreeStmCJump::UGT:
+      return ul > ur;
+    case TreeStmCJump::UGE:
+      return ul >= ur;
+  }
+  return std::nullopt;
+}
+
+// Simplifies the control flow graph of the basic blocks:
+// - CJUMPs with constant operands or equal targets become JUMPs
+// - jumps to blocks that consist of just a jump are threaded through them
+// - blocks that are unreachable from the start are removed
+// - a block that is the only predecessor of the block it jumps to is merged
+//   with it
+// Returns the number of removed branches.
+unsigned Simplify(Blocks &blocks, Label &start_label) {
+  auto removed = 0u;
+  for (auto change = true; change;) {
+    change = false;
+
+    // constant branches
+    for (auto &[l, block] : blocks) {
+      auto &transfer = block->GetTransfer();
+      if (transfer->GetOp() != TreeStm::TreeStmCJumpOp) continue;
+      auto &cjump = static_cast<TreeStmCJump &>(*transfer);
+      std::optional<Label> target;
+      if (cjump.GetLTrue() == cjump.GetLFalse()) {
+        target = cjump.GetLTrue();
+      } else if (auto b = Evaluate(cjump)) {
+        target = *b ? cjump.GetLTrue() : cjump.GetLFalse();
+      }
+      if (target) {
+        transfer = std::make_unique<TreeStmJump>(*target);
+        removed++;
+        change = true;
+      }
+    }
+
+    // jump threading
+    auto forward = std::unordered_map<Label, Label>{};
+    for (auto &[l, block] : blocks) {
+      auto &transfer = *block->GetTransfer();
+      if (block->GetBody().size() == 1 &&
+          transfer.GetOp() == TreeStm::TreeStmJumpOp &&
+          static_cast<TreeStmJump &>(transfer).GetTarget()->GetOp() ==
+              TreeExp::TreeExpNameOp) {
+        forward[l] = Targets(transfer)[0];
+      }
+    }
+    auto resolve = [&forward](const Label &l) {
+      auto visited = std::unordered_set<Label>{};
+      auto r = l;
+      for (auto it = forward.find(r);
+           it != forward.end() && visited.insert(r).second;
+           it = forward.find(r)) {
+        r = it->second;
+      }
+      return r;
+    };
+    for (auto &[l, block] : blocks) {
+      auto &transfer = block->GetTransfer();
+      auto targets = Targets(*transfer);
+      Retarget(transfer, resolve);
+      if (Targets(*transfer) != targets) change = true;
+    }
+    start_label = resolve(start_label);
+
+    // unreachable blocks
+    auto predecessors = std::unordered_map<Label, unsigned>{};
+    auto reachable = std::unordered_set<Label>{start_label};
+    auto to_visit = std::vector<Label>{start_label};
+    predecessors[start_label]++;  // entry
+    while (!to_visit.empty()) {
+      auto it = blocks.find(to_visit.back());
+      to_visit.pop_back();
+      if (it == blocks.end()) continue;  // end label
+      for (auto &t : Targets(*it->second->GetTransfer())) {
+        predecessors[t]++;
+        if (reachable.insert(t).second) to_visit.push_back(t);
+      }
+    }
+    for (auto it = blocks.begin(); it != blocks.end();) {
+      if (reachable.count(it->first) == 0) {
+        it = blocks.erase(it);
+        removed++;
+        change = true;
+      } else {
+        ++it;
+      }
+    }
+
+    // block merging
+    for (auto &[l, block] : blocks) {
+      if (!block) continue;  // already merged
+      for (;;) {
+        auto &transfer = *block->GetTransfer();
+        if (transfer.GetOp() != TreeStm::TreeStmJumpOp ||
+            static_cast<TreeStmJump &>(transfer).GetTarget()->GetOp() !=
+                TreeExp::TreeExpNameOp)
+          break;
+        auto next = Targets(transfer)[0];
+        auto it = blocks.find(next);
+        if (next == l || it == blocks.end() || !it->second ||
+            predecessors[next] != 1)
+          break;
+        auto &body = block->GetBody();
+        auto &next_body = it->second->GetBody();
+        // skip the label of the merged block
+        for (auto s = std::next(next_body.begin()); s != next_body.end(); ++s) {
+          body.push_back(std::move(*s));
+        }
+        block->GetTransfer() = std::move(it->second->GetTransfer());
+        it->second = nullptr;  // erased below
+        removed++;
+        change = true;
+      }
+    }
+    for (auto it = blocks.begin(); it != blocks.end();) {
+      it = it->second ? std::next(it) : blocks.erase(it);
+    }
+  }
+  return removed;
+}
+
+// Natural loops of the control flow graph of the basic blocks
+class Loops {
+ public:
+  Loops(Blocks &blocks, const Label &start_label) {
+    auto predecessors = std::unordered_map<Label, std::vector<Label>>{};
+    auto back_edges = std::vector<std::pair<Label, Label>>{};
+
+    // depth-first search for back edges, i.e. edges to a block on the stack
+    auto visited = std::unordered_set<Label>{start_label};
+    auto on_stack = std::unordered_set<Label>{start_label};
+    auto stack = std::vector<std::pair<Label, std::vector<Label>>>{};
+    auto successors = [&blocks](const Label &l) {
+      auto it = blocks.find(l);
+      if (it == blocks.end()) return std::vector<Label>{};  // end label
+      return Targets(*it->second->GetTransfer());
+    };
+    stack.emplace_back(start_label, successors(start_label));
+    while (!stack.empty()) {
+      auto &[l, targets] = stack.back();
+      if (targets.empty()) {
+        on_stack.erase(l);
+        stack.pop_back();
+        continue;
+      }
+      auto t = targets.back();
+      targets.pop_back();
+      predecessors[t].push_back(l);
+      if (on_stack.count(t) > 0) {
+        back_edges.emplace_back(l, t);
+      } else if (visited.insert(t).second) {
+        on_stack.insert(t);
+        stack.emplace_back(t, successors(t));
+      }
+    }
+
+    // the loop of a back edge l -> h consists of h and all blocks that
+    // reach l without passing through h
+    for (auto &[l, h] : back_edges) {
+      auto &body = loops_[h];
+      body.insert(h);
+      auto to_visit = std::vector<Label>{};
+      if (body.insert(l).second) to_visit.push_back(l);
+      while (!to_visit.empty()) {
+        auto b = to_visit.back();
+        to_visit.pop_back();
+        for (auto &p : predecessors[b]) {
+          if (body.insert(p).second) to_visit.push_back(p);
+        }
+      }
+    }
+  }
+
+  // Number of loops containing the block
+  unsigned Depth(const Label &l) const {
+    auto depth = 0u;
+    for (auto &[h, body] : loops_) {
+      depth += body.count(l);
+    }
+    return depth;
+  }
+
+  // Whether b lies in the innermost loop containing a. Blocks that are
+  // not in any loop are considered to be in a loop around the function.
+  bool InInnermostLoop(const Label &a, const Label &b) const {
+    const std::unordered_set<Label> *innermost = nullptr;
+    for (auto &[h, body] : loops_) {
+      if (body.count(a) > 0 &&
+          (innermost == nullptr || body.size() < innermost->size())) {
+        innermost = &body;
+      }
+    }
+    return innermost == nullptr || innermost->count(b) > 0;
+  }
+
+ private:
+  // loop header -> blocks of the loop
+  std::unordered_map<Label, std::unordered_set<Label>> loops_;
+};
+
 // Tracing rearranges the basic blocks into a linear program while establishing
 // the tracing invariant (see beginning of file).
-TreeFunction Trace(TreeFunction fun) {
+//
+// Traces are selected so that loops are laid out contiguously: a conditional
+// jump falls through to the successor with the deeper loop nesting (or the
+// higher count in the profile), a trace does not leave a loop while blocks
+// of the loop remain to be placed, and the next trace starts at the
+// innermost remaining block. Blocks that the profile shows to be cold are
+// placed after all others.
+TreeFunction Trace(TreeFunction fun, unsigned &removed_branches,
+                   const Profile *profile) {
   TreeFunction result{.name = fun.name,
                       .parameter_count = fun.parameter_count,
                       .body = {},
-                      .return_temp = fun.return_temp};
+                      .return_temp = fun.return_temp,
+                      .frame_memory_size = fun.frame_memory_size};
   BlockBuilder builder(std::move(fun));
   auto start_label = builder.start_label;
   auto blocks = std::move(builder.blocks);
   auto end_label = builder.end_label;
+  removed_branches += Simplify(blocks, start_label);
+  auto loops = Loops(blocks, start_label);
 
-  std::stack<Label> to_trace;
+  std::vector<Label> to_trace{start_label};
   std::unordered_set<Label> added{end_label};
+  // labels outside of the function, such as L_raise_bounds, count as placed
+  auto placed = [&](const Label &l) {
+    return added.count(l) > 0 || blocks.count(l) == 0;
+  };
+  auto count = [&](const Label &l) -> std::optional<std::uint64_t> {
+    if (!profile) return std::nullopt;
+    return profile->BlockCount(result.name, l);
+  };
+  auto cold = [&](const Label &l) { return count(l) == 0u; };
+  // block that must be placed next, as it is the false branch of a CJUMP
+  std::optional<Label> fall_through;
 
-  to_trace.push(start_label);
-
-  while (to_trace.size() > 0) {
-    Label l = to_trace.top();
-    to_trace.pop();
+  while (fall_through || !to_trace.empty()) {
+    Label l;
+    if (fall_through) {
+      l = *fall_through;
+      fall_through = std::nullopt;
+    } else {
+      // innermost non-cold block, the most recently added one among equals
+      auto rank = [&](const Label &l) {
+        return std::make_pair(!cold(l), loops.Depth(l));
+      };
+      auto next = std::prev(to_trace.end());
+      for (auto it = to_trace.begin(); it != to_trace.end(); ++it) {
+        if (rank(*it) > rank(*next)) next = it;
+      }
+      l = *next;
+      to_trace.erase(next);
+    }
 
-    if (added.count(l) == 0) {
-      // block with label l must exist
+    if (!placed(l)) {
       auto block = std::move(blocks[l]);
 
       // if ordered ends with JMP l then remove the jump
@@ -144,37 +439,64 @@ TreeFunction Trace(TreeFunction fun) {
       for (auto &s : block->GetBody()) {
         result.body.push_back(std::move(s));
       }
+      added.insert(l);
 
       switch (block->GetTransfer()->GetOp()) {
         case TreeStm::TreeStmJumpOp: {
           TreeStmJump &jump = static_cast<TreeStmJump &>(*block->GetTransfer());
           for (auto &target : jump.GetTargets()) {
-            to_trace.push(target);
+            to_trace.push_back(target);
           }
           result.body.push_back(std::move(block->GetTransfer()));
           break;
         }
         case TreeStm::TreeStmCJumpOp: {
           auto &cjump = static_cast<TreeStmCJump &>(*block->GetTransfer());
-          if (added.count(cjump.GetLFalse()) == 0) {
-            to_trace.push(cjump.GetLTrue());
-            to_trace.push(cjump.GetLFalse());
+          auto t = cjump.GetLTrue();
+          auto f = cjump.GetLFalse();
+          auto t_open = !placed(t);
+          auto f_open = !placed(f);
+          // Continuing at the target would leave blocks of the loop
+          // behind, or would place a cold block before hotter ones.
+          auto defer = [&](const Label &target) {
+            auto leaves_loop = !loops.InInnermostLoop(l, target);
+            for (auto &p : to_trace) {
+              if (placed(p)) continue;
+              if (leaves_loop && loops.InInnermostLoop(l, p)) return true;
+              if (cold(target) && !cold(p)) return true;
+            }
+            return false;
+          };
+          if (t_open && f_open) {
+            auto ct = count(t);
+            auto cf = count(f);
+            if ((ct && cf) ? *ct > *cf : loops.Depth(t) > loops.Depth(f)) {
+              f_open = false;
+            }
+          }
+          if (f_open && defer(f)) f_open = false;
+          if (t_open && defer(t)) t_open = false;
+
+          if (f_open) {
+            to_trace.push_back(t);
+            fall_through = f;
             result.body.push_back(std::move(block->GetTransfer()));
-          } else if (added.count(cjump.GetLTrue()) == 0) {
-            to_trace.push(cjump.GetLFalse());
-            to_trace.push(cjump.GetLTrue());
+          } else if (t_open) {
+            to_trace.push_back(f);
+            fall_through = t;
             result.body.push_back(std::make_unique<TreeStmCJump>(
                 TreeStmCJump::negate(cjump.GetRel()),
-                std::move(cjump.GetLeft()), std::move(cjump.GetRight()),
-                cjump.GetLFalse(), cjump.GetLTrue()));
+                std::move(cjump.GetLeft()), std::move(cjump.GetRight()), f,
+                t));
           } else {
+            to_trace.push_back(t);
+            to_trace.push_back(f);
             auto dummy = Label{};
             result.body.push_back(std::make_unique<TreeStmCJump>(
                 cjump.GetRel(), std::move(cjump.GetLeft()),
-                std::move(cjump.GetRight()), cjump.GetLTrue(), dummy));
+                std::move(cjump.GetRight()), t, dummy));
             result.body.push_back(std::make_unique<TreeStmLabel>(dummy));
-            result.body.push_back(
-                std::make_unique<TreeStmJump>(cjump.GetLFalse()));
+            result.body.push_back(std::make_unique<TreeStmJump>(f));
           }
           break;
         }
@@ -182,7 +504,6 @@ TreeFunction Trace(TreeFunction fun) {
           // nothing
           break;
       }
-      added.insert(l);
     }
   }
   result.body.push_back(std::make_unique<TreeStmLabel>(end_label));
@@ -190,9 +511,16 @@ TreeFunction Trace(TreeFunction fun) {
 }
 
 Tracer::TracedTreeProgram Tracer::Process(Canonizer::CanonizedTreeProgram prg) {
+  auto removed_branches = 0u;
+  return Process(std::move(prg), removed_branches);
+}
+
+Tracer::TracedTreeProgram Tracer::Process(Canonizer::CanonizedTreeProgram prg,
+                                          unsigned &removed_branches,
+                                          const Profile *profile) {
   std::vector<TreeFunction> functions;
   for (auto &fun : prg.functions) {
-    functions.push_back(Trace(std::move(fun)));
+    functions.push_back(Trace(std::move(fun), removed_branches, profile));
   };
   return TreeProgram{.functions = std::move(functions)};
 }
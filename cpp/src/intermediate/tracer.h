@@ -12,6 +12,7 @@
 
 #include "intermediate/canonizer.h"
 #include "intermediate/names.h"
+#include "intermediate/profile.h"
 #include "intermediate/tree.h"
 
 namespace mjc {
@@ -34,6 +35,13 @@ public:
 
   static TracedTreeProgram
   Process(Canonizer::CanonizedTreeProgram prg);
+  // Also adds the number of branches removed by simplifying the control
+  // flow graph to removed_branches. With a profile, the more frequently
+  // executed successor of a branch falls through and blocks that were never
+  // executed are placed at the end of their function.
+  static TracedTreeProgram
+  Process(Canonizer::CanonizedTreeProgram prg, unsigned &removed_branches,
+          const Profile *profile = nullptr);
 };
 
 } // namespace mjc
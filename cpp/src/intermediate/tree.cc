@@ -7,6 +7,9 @@ namespace mjc {
 
 std::ostream &operator<<(std::ostream &os, TreeFunction &fun) {
   os << fun.name << "(" << fun.parameter_count << ") {" << std::endl;
+  if (fun.frame_memory_size > 0) {
+    os << "  frame memory " << fun.frame_memory_size << std::endl;
+  }
   for (auto &s : fun.body) {
     os << "  " << *s << std::endl;
   }
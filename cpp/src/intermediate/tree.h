@@ -22,6 +22,8 @@ struct TreeFunction {
   std::size_t parameter_count;
   std::vector<std::unique_ptr<TreeStm>> body; // must not contain nullptr
   Temp return_temp;
+  // bytes of memory in the stack frame, addressed by FRAMEADDR
+  std::size_t frame_memory_size = 0;
 };
 
 struct TreeProgram {
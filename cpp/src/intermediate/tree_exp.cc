@@ -30,6 +30,12 @@ const TreeExp::Op TreeExpParam::GetOp() const { return TreeExpParamOp; }
 
 const int32_t TreeExpParam::GetNumber() const { return number_; }
 
+TreeExpFrameAddr::TreeExpFrameAddr(int32_t offset) : offset_{offset} {}
+
+const TreeExp::Op TreeExpFrameAddr::GetOp() const { return TreeExpFrameAddrOp; }
+
+const int32_t TreeExpFrameAddr::GetOffset() const { return offset_; }
+
 TreeExpBinOp::TreeExpBinOp(BinOp binop, std::unique_ptr<TreeExp> left,
                            std::unique_ptr<TreeExp> right)
     : left_(std::move(left)), op_(binop), right_(std::move(right)) {
@@ -46,8 +52,9 @@ const TreeExpBinOp::BinOp &TreeExpBinOp::GetBinOp() const { return op_; }
 std::unique_ptr<TreeExp> &TreeExpBinOp::GetRight() { return right_; }
 
 TreeExpCall::TreeExpCall(std::unique_ptr<TreeExp> fun,
-                         std::vector<std::unique_ptr<TreeExp>> args)
-    : fun_(std::move(fun)), args_(std::move(args)) {
+                         std::vector<std::unique_ptr<TreeExp>> args,
+                         bool tail_call)
+    : fun_(std::move(fun)), args_(std::move(args)), tail_call_(tail_call) {
   assert(fun_);
   assert(std::all_of(args.begin(), args.end(),
                      [](auto &arg) { return (bool)arg; }));
@@ -64,7 +71,19 @@ std::unique_ptr<TreeExp> &TreeExpCall::GetFun() { return fun_; }
 
 std::vector<std::unique_ptr<TreeExp>> &TreeExpCall::GetArgs() { return args_; }
 
-TreeExpMem::TreeExpMem(std::unique_ptr<TreeExp> addr) : addr_(std::move(addr)) {
+bool TreeExpCall::IsTailCall() const { return tail_call_; }
+
+const std::optional<std::vector<std::int32_t>> &TreeExpCall::GetStackMap()
+    const {
+  return stack_map_;
+}
+
+void TreeExpCall::SetStackMap(std::vector<std::int32_t> roots) {
+  stack_map_ = std::move(roots);
+}
+
+TreeExpMem::TreeExpMem(std::unique_ptr<TreeExp> addr, Kind kind)
+    : addr_(std::move(addr)), kind_(kind) {
   assert(addr_);
 }
 
@@ -72,6 +91,10 @@ const TreeExp::Op TreeExpMem::GetOp() const { return TreeExpMemOp; }
 
 std::unique_ptr<TreeExp> &TreeExpMem::GetAddr() { return addr_; }
 
+TreeExpMem::Kind TreeExpMem::GetKind() const { return kind_; }
+
+bool TreeExpMem::IsReference() const { return kind_ == REFERENCE; }
+
 TreeExpESeq::TreeExpESeq(std::vector<std::unique_ptr<TreeStm>> stms,
                          std::unique_ptr<TreeExp> exp)
     : stms_(std::move(stms)), exp_(std::move(exp)) {
@@ -106,8 +129,23 @@ class TreeExpOut : public TreeExpVisitor<void> {
     out_ << "PARAM(" << e.GetNumber() << ")";
   }
 
+  virtual void VisitFrameAddr(TreeExpFrameAddr &e) {
+    out_ << "FRAMEADDR(" << e.GetOffset() << ")";
+  }
+
   virtual void VisitMem(TreeExpMem &e) {
-    out_ << "MEM(" << *e.GetAddr() << ")";
+    switch (e.GetKind()) {
+      case TreeExpMem::WORD:
+        out_ << "MEM(";
+        break;
+      case TreeExpMem::REFERENCE:
+        out_ << "MEMREF(";
+        break;
+      case TreeExpMem::INT32:
+        out_ << "MEM32(";
+        break;
+    }
+    out_ << *e.GetAddr() << ")";
   }
 
   virtual void VisitBinOp(TreeExpBinOp &e) {
@@ -116,10 +154,16 @@ class TreeExpOut : public TreeExpVisitor<void> {
   }
 
   virtual void VisitCall(TreeExpCall &e) {
-    out_ << "CALL(" << *e.GetFun();
+    out_ << (e.IsTailCall() ? "TAILCALL(" : "CALL(") << *e.GetFun();
     for (auto const &arg : e.GetArgs()) {
       out_ << ", " << *arg;
     }
+    if (auto &roots = e.GetStackMap()) {
+      out_ << "; roots";
+      for (auto offset : *roots) {
+        out_ << " " << offset;
+      }
+    }
     out_ << ")";
   }
 
@@ -6,6 +6,7 @@
 #include <cstdint>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -23,6 +24,7 @@ public:
     TreeExpNameOp,
     TreeExpTempOp,
     TreeExpParamOp,
+    TreeExpFrameAddrOp,
     TreeExpMemOp,
     TreeExpBinOpOp,
     TreeExpCallOp,
@@ -80,6 +82,19 @@ private:
   int32_t number_;
 };
 
+// Address of the byte at the given offset in the memory that the function
+// reserves in its stack frame (see TreeFunction::frame_memory_size)
+class TreeExpFrameAddr : public TreeExp {
+public:
+  explicit TreeExpFrameAddr(int32_t offset);
+
+  virtual const Op GetOp() const;
+  const int32_t GetOffset() const;
+
+private:
+  int32_t offset_;
+};
+
 class TreeExpBinOp : public TreeExp {
 public:
   enum BinOp { PLUS, MINUS, MUL, DIV, AND, OR, LSHIFT, RSHIFT, ARSHIFT, XOR };
@@ -103,27 +118,48 @@ std::ostream &operator<<(std::ostream &os, TreeExpBinOp::BinOp type);
 class TreeExpCall : public TreeExp {
 public:
   explicit TreeExpCall(std::unique_ptr<TreeExp> fun,
-                       std::vector<std::unique_ptr<TreeExp>> args);
+                       std::vector<std::unique_ptr<TreeExp>> args,
+                       bool tail_call = false);
   explicit TreeExpCall(Label fun, std::unique_ptr<TreeExp> arg);
 
   virtual const Op GetOp() const;
   std::unique_ptr<TreeExp> &GetFun();
   std::vector<std::unique_ptr<TreeExp>> &GetArgs();
+  // A tail call is a call whose result is returned by the calling function
+  // without further computation.
+  bool IsTailCall() const;
+  // Offsets in the frame memory (see TreeExpFrameAddr) of the slots that
+  // hold the live references during the call, if the garbage collector is
+  // used (see GcRoots)
+  const std::optional<std::vector<std::int32_t>> &GetStackMap() const;
+  void SetStackMap(std::vector<std::int32_t> roots);
 
 private:
   std::unique_ptr<TreeExp> fun_;
   std::vector<std::unique_ptr<TreeExp>> args_;
+  bool tail_call_;
+  std::optional<std::vector<std::int32_t>> stack_map_;
 };
 
 class TreeExpMem : public TreeExp {
 public:
-  explicit TreeExpMem(std::unique_ptr<TreeExp> addr);
+  // The contents of the memory:
+  // - WORD: a word
+  // - REFERENCE: a word that holds the address of a heap object or 0
+  // - INT32: an int element of an array, which takes 32 bits even if the
+  //   word is wider
+  enum Kind { WORD, REFERENCE, INT32 };
+
+  explicit TreeExpMem(std::unique_ptr<TreeExp> addr, Kind kind = WORD);
 
   virtual const Op GetOp() const;
   std::unique_ptr<TreeExp> &GetAddr();
+  Kind GetKind() const;
+  bool IsReference() const;
 
 private:
   std::unique_ptr<TreeExp> addr_;
+  Kind kind_;
 };
 
 class TreeExpESeq : public TreeExp {
@@ -146,6 +182,7 @@ public:
   virtual RetTy VisitName(TreeExpName &e) = 0;
   virtual RetTy VisitTemp(TreeExpTemp &e) = 0;
   virtual RetTy VisitParam(TreeExpParam &e) = 0;
+  virtual RetTy VisitFrameAddr(TreeExpFrameAddr &e) = 0;
   virtual RetTy VisitMem(TreeExpMem &e) = 0;
   virtual RetTy VisitBinOp(TreeExpBinOp &e) = 0;
   virtual RetTy VisitCall(TreeExpCall &e) = 0;
@@ -161,6 +198,8 @@ public:
       return VisitTemp(static_cast<TreeExpTemp &>(exp));
     case TreeExp::TreeExpParamOp:
       return VisitParam(static_cast<TreeExpParam &>(exp));
+    case TreeExp::TreeExpFrameAddrOp:
+      return VisitFrameAddr(static_cast<TreeExpFrameAddr &>(exp));
     case TreeExp::TreeExpMemOp:
       return VisitMem(static_cast<TreeExpMem &>(exp));
     case TreeExp::TreeExpBinOpOp:
@@ -0,0 +1,26 @@
+#include "intermediate/vector.h"
+
+#include <string>
+
+namespace mjc {
+
+namespace {
+
+const char *const NAMES[] = {"load", "store", "splat", "index",
+                             "copy", "add",   "sub",   "mul",
+                             "zero", "sum",   "end"};
+
+}  // namespace
+
+Label Vector::Function(Op op) {
+  return Label{std::string{"L_vector$"} + NAMES[op]};
+}
+
+std::optional<Vector::Op> Vector::OfFunction(const Label &f) {
+  for (auto op = LOAD; op <= END; op = static_cast<Op>(op + 1)) {
+    if (f == Function(op)) return op;
+  }
+  return std::nullopt;
+}
+
+}  // namespace mjc
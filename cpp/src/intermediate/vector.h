@@ -0,0 +1,57 @@
+//
+// Operations on vector registers
+//
+
+#ifndef MJC_INTERMEDIATE_VECTOR_H
+#define MJC_INTERMEDIATE_VECTOR_H
+
+#include <optional>
+
+#include "intermediate/names.h"
+
+namespace mjc {
+
+// Vectorised loops (see MinijavaToTree) compute on vectors of consecutive
+// array elements in the vector registers of the target, which are numbered
+// from 0 and not allocated. The operations are the statements
+//   MOVE(TEMP t, CALL(NAME f, CONST v, args))
+// for the functions f = Function(op) below, where v is the number of the
+// register that the operation defines; the instruction selection expands
+// them inline. They are no calls: they neither collect garbage nor change
+// other registers than v.
+//
+//   LOAD v, MEM(a)   v <- the vector at address a
+//   STORE v, MEM(a)  the vector at address a <- v
+//   SPLAT v, e       each lane of v <- e
+//   INDEX v, e       lane k of v <- e + k
+//   COPY v, CONST w  v <- w
+//   ADD v, CONST w   v <- v + w, lane by lane
+//   SUB v, CONST w   v <- v - w
+//   MUL v, CONST w   v <- v * w, if the target supports it
+//   ZERO v           v <- 0
+//   SUM v            t <- the sum of the lanes of v; v is undefined after
+//   END              the vector registers are not used until the next
+//                    operation; v is ignored
+//
+// Memory operands are given as MEM(a) for the addressing of the selection,
+// but are not read as words. Vectors need not be aligned.
+class Vector {
+ public:
+  enum Op { LOAD, STORE, SPLAT, INDEX, COPY, ADD, SUB, MUL, ZERO, SUM, END };
+
+  // Vector operations of a target
+  struct Support {
+    unsigned lanes = 0;      // ints per vector; 0 if there are no vectors
+    unsigned registers = 0;  // number of vector registers
+    bool mul = false;        // whether MUL is supported
+  };
+
+  static Label Function(Op op);
+
+  // The operation of a call of f, if f is a function of a vector operation
+  static std::optional<Op> OfFunction(const Label &f);
+};
+
+}  // namespace mjc
+
+#endif
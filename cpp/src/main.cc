@@ -1,18 +1,33 @@
 #include <iostream>
+#include <algorithm>
 #include <fstream>
 #include <memory>
 #include <filesystem>
+#include <optional>
+#include <string>
 
 #include "intermediate/canonizer.h"
+#include "intermediate/escape_analysis.h"
+#include "intermediate/gc_roots.h"
+#include "intermediate/inline_allocation.h"
+#include "intermediate/inline_io.h"
 #include "intermediate/minijava_to_tree.h"
+#include "intermediate/profile.h"
+#include "intermediate/runtime_names.h"
 #include "intermediate/tracer.h"
 #include "minijava/ast.h"
 #include "minijava/error.h"
 #include "minijava/parser_context.h"
+#include "minijava/reachability.h"
 #include "minijava/symbol.h"
 #include "minijava/typecheck.h"
 
+#include "backend/x86/x86_dead_code.h"
+#include "backend/x86/x86_elf.h"
+#include "backend/x86/x86_function_order.h"
+#include "backend/x86/x86_peephole.h"
 #include "backend/x86/x86_prg.h"
+#include "backend/x86/x86_profile.h"
 #include "backend/x86/x86_target.h"
 
 #include "backend/regalloc.h"
@@ -20,13 +35,165 @@
 int main(int argc, char *argv[]) {
   using namespace mjc;
 
-  if (argc != 2) {
-    std::cerr << "Usage: mjc <filename.java>" << std::endl;
+  auto usage = []() {
+    std::cerr << "Usage: mjc [options] <filename.java>" << std::endl
+              << "Options:" << std::endl
+              << "  -S                    write assembler text <name>.s "
+                 "instead of the object"
+              << std::endl
+              << "                        file <name>.o" << std::endl
+              << "  -m32, -m64            generate code for i386 (default) "
+                 "or x86-64"
+              << std::endl
+              << "  -march=<cpu>          use the instructions of i386, "
+                 "i686, x86-64, x86-64-v2,"
+              << std::endl
+              << "                        x86-64-v3 or haswell (default: "
+                 "i386 or x86-64)"
+              << std::endl
+              << "  -fomit-frame-pointer  address the stack frame relative "
+                 "to ESP"
+              << std::endl
+              << "  -fno-escape-analysis  allocate all objects on the heap"
+              << std::endl
+              << "  -fno-inline-allocation" << std::endl
+              << "                        call the runtime for each "
+                 "allocation"
+              << std::endl
+              << "  -fno-inline-io        call the runtime for each byte "
+                 "written or read"
+              << std::endl
+              << "  -fno-gc               emit no stack maps, so that the "
+                 "runtime never"
+              << std::endl
+              << "                        collects garbage" << std::endl
+              << "  -fno-vectorize        do not vectorise loops over int "
+                 "arrays with the SSE2"
+              << std::endl
+              << "                        or AVX2 instructions of -march"
+              << std::endl
+              << "  -fno-unroll-loops     do not unroll small counted loops"
+              << std::endl
+              << "  -fno-unswitch-loops   do not move invariant conditions "
+                 "out of loops"
+              << std::endl
+              << "  -fno-peephole         disable the peephole optimiser"
+              << std::endl
+              << "  -fkeep-unused-methods also translate methods that are "
+                 "never called"
+              << std::endl
+              << "  -fno-reorder-functions" << std::endl
+              << "                        emit the functions in source order"
+              << std::endl
+              << "  -fprofile-generate[=<file>]" << std::endl
+              << "                        count block executions and calls "
+                 "and write them"
+              << std::endl
+              << "                        to <file> (default: <name>.profile) "
+                 "at exit"
+              << std::endl
+              << "  -fprofile-use[=<file>]" << std::endl
+              << "                        optimise using a profile "
+                 "(default: <name>.profile)"
+              << std::endl
+              << "  --stats               print optimisation statistics"
+              << std::endl;
+    return 1;
+  };
+
+  auto options = X86Target::Options{};
+  auto x86_64 = false;
+  auto march = std::optional<std::string>{};
+  auto keep_unused_methods = false;
+  auto escape_analysis = true;
+  auto inline_allocation = true;
+  auto inline_io = true;
+  auto vectorize = true;
+  auto unroll_loops = true;
+  auto unswitch_loops = true;
+  auto gc = true;
+  auto stats = false;
+  auto assembler_text = false;
+  auto filename = std::optional<std::string>{};
+  // profile files, empty for the default name
+  auto profile_generate = std::optional<std::string>{};
+  auto profile_use = std::optional<std::string>{};
+  for (int i = 1; i < argc; i++) {
+    auto arg = std::string{argv[i]};
+    auto value = [&arg](const std::string &option) {
+      return arg.substr(std::min(arg.size(), option.size() + 1));
+    };
+    if (arg == "-fprofile-generate" ||
+        arg.rfind("-fprofile-generate=", 0) == 0) {
+      profile_generate = value("-fprofile-generate");
+    } else if (arg == "-fprofile-use" || arg.rfind("-fprofile-use=", 0) == 0) {
+      profile_use = value("-fprofile-use");
+    } else if (arg == "-S") {
+      assembler_text = true;
+    } else if (arg == "-m32" || arg == "-m64") {
+      x86_64 = arg == "-m64";
+    } else if (arg.rfind("-march=", 0) == 0) {
+      march = value("-march");
+    } else if (arg == "-fomit-frame-pointer") {
+      options.omit_frame_pointer = true;
+    } else if (arg == "-fno-escape-analysis") {
+      escape_analysis = false;
+    } else if (arg == "-fno-inline-allocation") {
+      inline_allocation = false;
+    } else if (arg == "-fno-inline-io") {
+      inline_io = false;
+    } else if (arg == "-fno-vectorize") {
+      vectorize = false;
+    } else if (arg == "-fno-unroll-loops") {
+      unroll_loops = false;
+    } else if (arg == "-fno-unswitch-loops") {
+      unswitch_loops = false;
+    } else if (arg == "-fno-gc") {
+      gc = false;
+    } else if (arg == "-fno-peephole") {
+      options.peephole = false;
+    } else if (arg == "-fkeep-unused-methods") {
+      keep_unused_methods = true;
+    } else if (arg == "-fno-reorder-functions") {
+      options.reorder_functions = false;
+    } else if (arg == "--stats") {
+      stats = true;
+    } else if (arg.size() > 0 && arg[0] != '-' && !filename) {
+      filename = arg;
+    } else {
+      return usage();
+    }
+  }
+  if (!filename) {
+    return usage();
+  }
+  if (!options.SetArch(march.value_or(x86_64 ? "x86-64" : "i386"), x86_64)) {
+    std::cerr << "Unsupported -march=" << *march << std::endl;
     return 1;
   }
 
-  auto input = std::filesystem::path{argv[1]};
-  auto target = input.filename().replace_extension(".s");
+  auto input = std::filesystem::path{*filename};
+  auto target =
+      input.filename().replace_extension(assembler_text ? ".s" : ".o");
+  auto default_profile = input.filename().replace_extension(".profile");
+  if (profile_generate && profile_generate->empty()) {
+    profile_generate = default_profile.string();
+  }
+  auto profile = std::optional<Profile>{};
+  auto profile_file = std::filesystem::path{};
+  if (profile_use) {
+    profile_file = profile_use->empty() ? default_profile
+                                        : std::filesystem::path{*profile_use};
+    profile = Profile::Read(profile_file);
+    if (!profile) {
+      std::cerr << "Cannot read profile " << profile_file << std::endl;
+      return 1;
+    }
+  }
+  auto profile_ptr = profile ? &*profile : nullptr;
+  auto word_size = x86_64 ? X8664Target::WORD_SIZE : X86Target::WORD_SIZE;
+  auto int_size = x86_64 ? X8664Target::INT_SIZE : X86Target::INT_SIZE;
+
   try {
     // parsing
     auto parser_context = ParserContext{input};
@@ -37,16 +204,144 @@ int main(int argc, char *argv[]) {
     Typecheck(symbols, prg);
 
     // translation to intermediate language
-    auto tree = MinijavaToTree<X86Target>{symbols}.Process(prg);
+    auto reachable = std::optional<MethodSet>{};
+    if (!keep_unused_methods) {
+      reachable = ReachableMethods(symbols, prg);
+      if (stats) {
+        auto methods = 0u;
+        for (auto &cd : prg.classes) methods += cd.methods.size();
+        std::cerr << "unused methods: " << methods - reachable->size()
+                  << std::endl;
+      }
+    }
+    auto methods = reachable ? &*reachable : nullptr;
+    auto translate = [&](auto &&translation) {
+      auto tree = translation.Process(prg);
+      if (stats) {
+        std::cerr << "vectorised loops: " << translation.VectorisedLoops()
+                  << std::endl
+                  << "unrolled loops: " << translation.UnrolledLoops()
+                  << std::endl
+                  << "unswitched loops: " << translation.UnswitchedLoops()
+                  << std::endl;
+      }
+      return tree;
+    };
+    auto tree =
+        x86_64 ? translate(MinijavaToTree<X8664Target>{
+                     symbols, methods,
+                     vectorize ? X8664Target::Vectors(options)
+                               : Vector::Support{},
+                     unroll_loops, unswitch_loops})
+               : translate(MinijavaToTree<X86Target>{
+                     symbols, methods,
+                     vectorize ? X86Target::Vectors(options)
+                               : Vector::Support{},
+                     unroll_loops, unswitch_loops});
+    // a stale or foreign profile has no counts for this program
+    auto profiled = [&](auto &f) { return profile_ptr->HasFunction(f.name); };
+    if (profile_ptr &&
+        std::none_of(tree.functions.begin(), tree.functions.end(), profiled)) {
+      std::cerr << "Warning: profile " << profile_file
+                << " matches no function of the program and is ignored"
+                << std::endl;
+      profile_ptr = nullptr;
+    }
     auto canonized = Canonizer::Process(std::move(tree));
-    auto traced = Tracer::Process(std::move(canonized));
+    if (escape_analysis) {
+      auto escapes = EscapeAnalysis::Process(
+          canonized, RuntimeNames::AllocFunction(), word_size, int_size);
+      if (stats) {
+        std::cerr << "scalar replaced objects: " << escapes.scalar_replaced
+                  << std::endl
+                  << "stack allocated objects: " << escapes.stack_allocated
+                  << std::endl;
+      }
+    }
+    if (inline_allocation) {
+      auto inlined = InlineAllocation::Process(
+          canonized, {.alloc = RuntimeNames::AllocFunction(),
+                      .pointer = RuntimeNames::HeapPointer(),
+                      .limit = RuntimeNames::HeapLimit()});
+      if (stats) {
+        std::cerr << "inlined allocations: " << inlined << std::endl;
+      }
+    }
+    if (inline_io) {
+      auto inlined = InlineIo::Process(
+          canonized,
+          {.write = RuntimeNames::WriteFunction(),
+           .out_pointer = RuntimeNames::OutputPointer(),
+           .out_limit = RuntimeNames::OutputLimit(),
+           .read = RuntimeNames::ReadFunction(),
+           .in_pointer = RuntimeNames::InputPointer(),
+           .in_limit = RuntimeNames::InputLimit()},
+          word_size);
+      if (stats) {
+        std::cerr << "inlined I/O: " << inlined << std::endl;
+      }
+    }
+    if (gc) {
+      auto roots = GcRoots::Process(
+          canonized, RuntimeNames::AllocFunction(), word_size);
+      if (stats) {
+        std::cerr << "stack maps: " << roots.calls << " calls, "
+                  << roots.roots << " root slots" << std::endl;
+      }
+    }
+    auto removed_branches = 0u;
+    auto traced =
+        Tracer::Process(std::move(canonized), removed_branches, profile_ptr);
+    if (stats) {
+      std::cerr << "removed branches: " << removed_branches << std::endl;
+    }
 
     // instruction selection and register allocation
-    auto assem = X86Target::CodeGen(traced);
-    RegAlloc<X86Target>{}.Process(assem);
+    auto assem = x86_64 ? X8664Target::CodeGen(traced, options)
+                        : X86Target::CodeGen(traced, options);
+    if (x86_64) {
+      RegAlloc<X8664Target>{profile_ptr}.Process(assem);
+    } else {
+      RegAlloc<X86Target>{profile_ptr}.Process(assem);
+    }
+    auto dead = X86DeadCode::Process(assem);
+    if (stats) {
+      std::cerr << "dead instructions: " << dead << std::endl;
+    }
+    if (x86_64) {
+      X8664Target::LayoutFrames(assem);
+    } else {
+      X86Target::LayoutFrames(assem);
+    }
+    if (options.peephole) {
+      auto counts = X86Peephole::Process(assem);
+      if (stats) {
+        for (auto &[pattern, n] : counts) {
+          std::cerr << "peephole " << pattern << ": " << n << std::endl;
+        }
+      }
+    }
+
+    if (options.reorder_functions) {
+      auto order = X86FunctionOrder::Process(assem, profile_ptr);
+      if (stats) {
+        std::cerr << "hot text: " << order.hot_functions << " functions, ~"
+                  << order.hot_size << " bytes" << std::endl
+                  << "cold text: " << order.cold_functions << " functions, ~"
+                  << order.cold_size << " bytes" << std::endl;
+      }
+    }
+    if (profile_generate) {
+      X86Profile::Instrument(assem, *profile_generate);
+    }
 
-    auto out = std::ofstream{target};
-    out << assem;
+    if (assembler_text) {
+      auto out = std::ofstream{target};
+      out << assem;
+    } else {
+      auto out = std::ofstream{target, std::ios::binary};
+      X86Elf::Write(out, assem);
+    }
 
   } catch (CompileError &e) {
     e.report(input);
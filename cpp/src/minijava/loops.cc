@@ -0,0 +1,347 @@
+#include "minijava/loops.h"
+
+#include <functional>
+#include <limits>
+
+namespace mjc {
+
+namespace {
+
+class EffectsOfStm : public StmVisitor<void>, public ExpVisitor<void> {
+ public:
+  explicit EffectsOfStm(Effects &effects) : effects_(effects) {}
+
+  using StmVisitor<void>::Visit;
+  using ExpVisitor<void>::Visit;
+
+  virtual void VisitAssignment(const StmAssignment &s) {
+    effects_.assigned.insert(s.GetId());
+    Visit(s.GetExp());
+  }
+  virtual void VisitArrayAssignment(const StmArrayAssignment &s) {
+    effects_.stored.insert(s.GetId());
+    Visit(s.GetIndex());
+    Visit(s.GetExp());
+  }
+  virtual void VisitIf(const StmIf &s) {
+    Visit(s.GetCond());
+    Visit(s.GetTrueBranch());
+    Visit(s.GetFalseBranch());
+  }
+  virtual void VisitWhile(const StmWhile &s) {
+    effects_.loops = true;
+    Visit(s.GetCond());
+    Visit(s.GetBody());
+  }
+  virtual void VisitPrint(const StmPrint &s) {
+    effects_.io = true;
+    Visit(s.GetExp());
+  }
+  virtual void VisitWrite(const StmWrite &s) {
+    effects_.io = true;
+    Visit(s.GetExp());
+  }
+  virtual void VisitSeq(const StmSeq &s) {
+    for (auto &stm : s.GetStms()) Visit(*stm);
+  }
+
+  virtual void VisitNum(const ExpNum &e) {}
+  virtual void VisitId(const ExpId &e) {}
+  virtual void VisitBinOp(const ExpBinOp &e) {
+    Visit(e.GetLeft());
+    Visit(e.GetRight());
+  }
+  virtual void VisitInvoke(const ExpInvoke &e) {
+    effects_.invokes = true;
+    Visit(e.GetObj());
+    for (auto &a : e.GetArgs()) Visit(*a);
+  }
+  virtual void VisitArrayGet(const ExpArrayGet &e) {
+    Visit(e.GetArray());
+    Visit(e.GetIndex());
+  }
+  virtual void VisitArrayLength(const ExpArrayLength &e) {
+    Visit(e.GetArray());
+  }
+  virtual void VisitTrue(const ExpTrue &e) {}
+  virtual void VisitFalse(const ExpFalse &e) {}
+  virtual void VisitThis(const ExpThis &e) {}
+  virtual void VisitNew(const ExpNew &e) {}
+  virtual void VisitNewIntArray(const ExpNewIntArray &e) {
+    Visit(e.GetSize());
+  }
+  virtual void VisitNeg(const ExpNeg &e) { Visit(e.GetExp()); }
+  virtual void VisitRead(const ExpRead &e) { effects_.io = true; }
+
+ private:
+  Effects &effects_;
+};
+
+// Calls stm and exp for each statement and expression of a statement
+class Walk : public StmVisitor<void>, public ExpVisitor<void> {
+ public:
+  Walk(std::function<void(const Stm &)> stm,
+       std::function<void(const Exp &)> exp)
+      : stm_(std::move(stm)), exp_(std::move(exp)) {}
+
+  using StmVisitor<void>::Visit;
+  using ExpVisitor<void>::Visit;
+
+  virtual void VisitAssignment(const StmAssignment &s) {
+    stm_(s);
+    Visit(s.GetExp());
+  }
+  virtual void VisitArrayAssignment(const StmArrayAssignment &s) {
+    stm_(s);
+    Visit(s.GetIndex());
+    Visit(s.GetExp());
+  }
+  virtual void VisitIf(const StmIf &s) {
+    stm_(s);
+    Visit(s.GetCond());
+    Visit(s.GetTrueBranch());
+    Visit(s.GetFalseBranch());
+  }
+  virtual void VisitWhile(const StmWhile &s) {
+    stm_(s);
+    Visit(s.GetCond());
+    Visit(s.GetBody());
+  }
+  virtual void VisitPrint(const StmPrint &s) {
+    stm_(s);
+    Visit(s.GetExp());
+  }
+  virtual void VisitWrite(const StmWrite &s) {
+    stm_(s);
+    Visit(s.GetExp());
+  }
+  virtual void VisitSeq(const StmSeq &s) {
+    stm_(s);
+    for (auto &stm : s.GetStms()) Visit(*stm);
+  }
+
+  virtual void VisitNum(const ExpNum &e) { exp_(e); }
+  virtual void VisitId(const ExpId &e) { exp_(e); }
+  virtual void VisitBinOp(const ExpBinOp &e) {
+    exp_(e);
+    Visit(e.GetLeft());
+    Visit(e.GetRight());
+  }
+  virtual void VisitInvoke(const ExpInvoke &e) {
+    exp_(e);
+    Visit(e.GetObj());
+    for (auto &a : e.GetArgs()) Visit(*a);
+  }
+  virtual void VisitArrayGet(const ExpArrayGet &e) {
+    exp_(e);
+    Visit(e.GetArray());
+    Visit(e.GetIndex());
+  }
+  virtual void VisitArrayLength(const ExpArrayLength &e) {
+    exp_(e);
+    Visit(e.GetArray());
+  }
+  virtual void VisitTrue(const ExpTrue &e) { exp_(e); }
+  virtual void VisitFalse(const ExpFalse &e) { exp_(e); }
+  virtual void VisitThis(const ExpThis &e) { exp_(e); }
+  virtual void VisitNew(const ExpNew &e) { exp_(e); }
+  virtual void VisitNewIntArray(const ExpNewIntArray &e) {
+    exp_(e);
+    Visit(e.GetSize());
+  }
+  virtual void VisitNeg(const ExpNeg &e) {
+    exp_(e);
+    Visit(e.GetExp());
+  }
+  virtual void VisitRead(const ExpRead &e) { exp_(e); }
+
+ private:
+  std::function<void(const Stm &)> stm_;
+  std::function<void(const Exp &)> exp_;
+};
+
+bool IsId(const Exp &e, const Ident &id) {
+  return e.GetOp() == Exp::ExpIdOp &&
+         static_cast<const ExpId &>(e).GetId() == id;
+}
+
+std::optional<std::int32_t> Num(const Exp &e) {
+  if (e.GetOp() != Exp::ExpNumOp) return std::nullopt;
+  return static_cast<const ExpNum &>(e).GetNum();
+}
+
+void Flatten(const Stm &s, std::vector<const Stm *> &stms) {
+  if (s.GetOp() != Stm::StmSeqOp) {
+    stms.push_back(&s);
+    return;
+  }
+  for (auto &stm : static_cast<const StmSeq &>(s).GetStms()) {
+    Flatten(*stm, stms);
+  }
+}
+
+}  // namespace
+
+Effects EffectsOf(const Stm &s) {
+  auto effects = Effects{};
+  EffectsOfStm(effects).Visit(s);
+  return effects;
+}
+
+bool IsLocal(const Ident &id, const MethodSymbol &method) {
+  return method.GetLocals().contains(id) ||
+         method.GetParameters().contains(id);
+}
+
+bool IsInvariant(const Ident &id, const Effects &effects,
+                 const MethodSymbol &method) {
+  return effects.assigned.count(id) == 0 &&
+         (!effects.invokes || IsLocal(id, method));
+}
+
+bool IsInvariant(const Exp &e, const Effects &effects,
+                 const MethodSymbol &method) {
+  switch (e.GetOp()) {
+    case Exp::ExpNumOp:
+    case Exp::ExpTrueOp:
+    case Exp::ExpFalseOp:
+    case Exp::ExpThisOp:
+      return true;
+    case Exp::ExpIdOp:
+      return IsInvariant(static_cast<const ExpId &>(e).GetId(), effects,
+                         method);
+    case Exp::ExpBinOpOp: {
+      auto &b = static_cast<const ExpBinOp &>(e);
+      return IsInvariant(b.GetLeft(), effects, method) &&
+             IsInvariant(b.GetRight(), effects, method);
+    }
+    case Exp::ExpArrayLengthOp:
+      // the length of an array never changes
+      return IsInvariant(static_cast<const ExpArrayLength &>(e).GetArray(),
+                         effects, method);
+    case Exp::ExpNegOp:
+      return IsInvariant(static_cast<const ExpNeg &>(e).GetExp(), effects,
+                         method);
+    default:
+      return false;
+  }
+}
+
+bool MayFail(const Exp &e) {
+  switch (e.GetOp()) {
+    case Exp::ExpBinOpOp: {
+      auto &b = static_cast<const ExpBinOp &>(e);
+      return b.GetBinOp() == ExpBinOp::DIV || MayFail(b.GetLeft()) ||
+             MayFail(b.GetRight());
+    }
+    case Exp::ExpNegOp:
+      return MayFail(static_cast<const ExpNeg &>(e).GetExp());
+    case Exp::ExpArrayGetOp:
+    case Exp::ExpArrayLengthOp:
+    case Exp::ExpInvokeOp:
+    case Exp::ExpNewIntArrayOp:
+      return true;
+    default:
+      return false;
+  }
+}
+
+std::optional<CountedLoop> AnalyseCountedLoop(const StmWhile &s,
+                                              const MethodSymbol &method) {
+  auto &cond = s.GetCond();
+  if (cond.GetOp() != Exp::ExpBinOpOp) return std::nullopt;
+  auto &lt = static_cast<const ExpBinOp &>(cond);
+  if (lt.GetBinOp() != ExpBinOp::LT || lt.GetLeft().GetOp() != Exp::ExpIdOp)
+    return std::nullopt;
+  auto &index = static_cast<const ExpId &>(lt.GetLeft()).GetId();
+  if (!IsLocal(index, method)) return std::nullopt;
+
+  auto body = std::vector<const Stm *>{};
+  Flatten(s.GetBody(), body);
+  if (body.empty() || body.back()->GetOp() != Stm::StmAssignmentOp)
+    return std::nullopt;
+  auto &increment = static_cast<const StmAssignment &>(*body.back());
+  body.pop_back();
+  auto step = IndexOffset(increment.GetExp(), index);
+  if (increment.GetId() != index || !step || *step <= 0) return std::nullopt;
+
+  auto effects = EffectsOf(s.GetBody());
+  for (auto stm : body) {
+    if (EffectsOf(*stm).assigned.count(index) > 0) return std::nullopt;
+  }
+  if (!IsInvariant(lt.GetRight(), effects, method)) return std::nullopt;
+  return CountedLoop{.index = index,
+                     .bound = &lt.GetRight(),
+                     .step = *step,
+                     .body = std::move(body),
+                     .effects = std::move(effects)};
+}
+
+std::optional<std::int32_t> IndexOffset(const Exp &e, const Ident &i) {
+  if (IsId(e, i)) return 0;
+  if (e.GetOp() != Exp::ExpBinOpOp) return std::nullopt;
+  auto &b = static_cast<const ExpBinOp &>(e);
+  auto l = Num(b.GetLeft());
+  auto r = Num(b.GetRight());
+  switch (b.GetBinOp()) {
+    case ExpBinOp::PLUS:
+      if (IsId(b.GetLeft(), i) && r) return r;
+      if (IsId(b.GetRight(), i) && l) return l;
+      return std::nullopt;
+    case ExpBinOp::MINUS:
+      if (IsId(b.GetLeft(), i) && r &&
+          *r != std::numeric_limits<std::int32_t>::min())
+        return -*r;
+      return std::nullopt;
+    default:
+      return std::nullopt;
+  }
+}
+
+std::vector<IndexedAccess> IndexedAccesses(const Stm &s, const Ident &i) {
+  auto accesses = std::vector<IndexedAccess>{};
+  Walk(
+      [&](const Stm &stm) {
+        if (stm.GetOp() != Stm::StmArrayAssignmentOp) return;
+        auto &as = static_cast<const StmArrayAssignment &>(stm);
+        if (auto offset = IndexOffset(as.GetIndex(), i)) {
+          accesses.push_back({as.GetId(), *offset});
+        }
+      },
+      [&](const Exp &e) {
+        if (e.GetOp() != Exp::ExpArrayGetOp) return;
+        auto &g = static_cast<const ExpArrayGet &>(e);
+        if (g.GetArray().GetOp() != Exp::ExpIdOp) return;
+        if (auto offset = IndexOffset(g.GetIndex(), i)) {
+          auto &array = static_cast<const ExpId &>(g.GetArray()).GetId();
+          accesses.push_back({array, *offset});
+        }
+      })
+      .Visit(s);
+  return accesses;
+}
+
+std::vector<const StmIf *> InvariantIfs(const Stm &s, const Effects &effects,
+                                        const MethodSymbol &method) {
+  auto ifs = std::vector<const StmIf *>{};
+  Walk(
+      [&](const Stm &stm) {
+        if (stm.GetOp() != Stm::StmIfOp) return;
+        auto &cond = static_cast<const StmIf &>(stm).GetCond();
+        if (cond.GetOp() != Exp::ExpTrueOp && cond.GetOp() != Exp::ExpFalseOp &&
+            IsInvariant(cond, effects, method) && !MayFail(cond)) {
+          ifs.push_back(&static_cast<const StmIf &>(stm));
+        }
+      },
+      [](const Exp &) {})
+      .Visit(s);
+  return ifs;
+}
+
+unsigned Size(const Stm &s) {
+  auto size = 0u;
+  Walk([&](const Stm &) { size++; }, [&](const Exp &) { size++; }).Visit(s);
+  return size;
+}
+
+}  // namespace mjc
@@ -0,0 +1,88 @@
+//
+// Analysis of loops
+//
+#ifndef MJC_MINIJAVA_LOOPS_H
+#define MJC_MINIJAVA_LOOPS_H
+
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <vector>
+
+#include "minijava/ast.h"
+#include "minijava/symbol.h"
+
+namespace mjc {
+
+// What the execution of a statement may change
+struct Effects {
+  std::set<Ident> assigned;  // variables
+  std::set<Ident> stored;    // arrays whose elements are assigned
+  bool invokes = false;      // calls methods, which may change any field
+  bool io = false;           // writes or reads
+  bool loops = false;        // contains loops
+};
+
+Effects EffectsOf(const Stm &s);
+
+// Whether the variable is a local variable or a parameter of the method,
+// which methods that it invokes cannot change
+bool IsLocal(const Ident &id, const MethodSymbol &method);
+
+// Whether a variable keeps its value during the execution of a statement
+// with the given effects
+bool IsInvariant(const Ident &id, const Effects &effects,
+                 const MethodSymbol &method);
+
+// Whether an expression has the same value whenever it is evaluated during
+// the execution of a statement with the given effects: it has no side
+// effects and reads neither array elements nor variables that may change.
+// It may still fail, by a division by zero or the length of a null array.
+bool IsInvariant(const Exp &e, const Effects &effects,
+                 const MethodSymbol &method);
+
+// Whether the evaluation of an expression may fail or not terminate: it
+// divides, accesses an array or invokes a method
+bool MayFail(const Exp &e);
+
+// A loop
+//   while (i < n) { S1; ...; Sk; i = i + step; }
+// that counts a local variable or parameter i up to an invariant bound n by
+// a positive constant step, and whose statements S1, ..., Sk do not assign
+// to i. Since i < n before the increment, i does not overflow if the step is
+// 1.
+struct CountedLoop {
+  Ident index;
+  const Exp *bound;
+  std::int32_t step;
+  std::vector<const Stm *> body;  // S1, ..., Sk, without nested sequences
+  Effects effects;                // of the whole loop body
+};
+
+std::optional<CountedLoop> AnalyseCountedLoop(const StmWhile &s,
+                                              const MethodSymbol &method);
+
+// The constant offset c of an index expression i, i + c, c + i or i - c
+std::optional<std::int32_t> IndexOffset(const Exp &e, const Ident &i);
+
+// An access a[i + c] of an array variable a at a constant offset c of i
+struct IndexedAccess {
+  Ident array;
+  std::int32_t offset;
+};
+
+std::vector<IndexedAccess> IndexedAccesses(const Stm &s, const Ident &i);
+
+// The if statements in s, also in nested loops, whose conditions are
+// invariant during the execution of a statement with the given effects,
+// cannot fail and are not constants
+std::vector<const StmIf *> InvariantIfs(const Stm &s, const Effects &effects,
+                                        const MethodSymbol &method);
+
+// The number of statements and expressions in s, an estimate of the size
+// of its code
+unsigned Size(const Stm &s);
+
+}  // namespace mjc
+
+#endif
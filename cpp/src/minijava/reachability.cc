@@ -0,0 +1,124 @@
+#include "minijava/reachability.h"
+
+#include <cassert>
+#include <map>
+#include <vector>
+
+#include "minijava/typecheck.h"
+
+namespace mjc {
+
+namespace {
+
+// Collects the methods invoked in a method body
+class CallsInStm : public StmVisitor<void>, public ExpVisitor<void> {
+ public:
+  CallsInStm(const SymbolTable &symbols, const ClassSymbol &class_symbol,
+             const MethodSymbol &method_symbol, MethodSet &calls)
+      : symbols_(symbols),
+        class_symbol_(class_symbol),
+        method_symbol_(method_symbol),
+        calls_(calls) {}
+
+  using StmVisitor<void>::Visit;
+  using ExpVisitor<void>::Visit;
+
+  virtual void VisitAssignment(const StmAssignment &s) { Visit(s.GetExp()); }
+  virtual void VisitArrayAssignment(const StmArrayAssignment &s) {
+    Visit(s.GetIndex());
+    Visit(s.GetExp());
+  }
+  virtual void VisitIf(const StmIf &s) {
+    Visit(s.GetCond());
+    Visit(s.GetTrueBranch());
+    Visit(s.GetFalseBranch());
+  }
+  virtual void VisitWhile(const StmWhile &s) {
+    Visit(s.GetCond());
+    Visit(s.GetBody());
+  }
+  virtual void VisitPrint(const StmPrint &s) { Visit(s.GetExp()); }
+  virtual void VisitWrite(const StmWrite &s) { Visit(s.GetExp()); }
+  virtual void VisitSeq(const StmSeq &s) {
+    for (auto &stm : s.GetStms()) Visit(*stm);
+  }
+
+  virtual void VisitNum(const ExpNum &e) {}
+  virtual void VisitId(const ExpId &e) {}
+  virtual void VisitBinOp(const ExpBinOp &e) {
+    Visit(e.GetLeft());
+    Visit(e.GetRight());
+  }
+  virtual void VisitInvoke(const ExpInvoke &e) {
+    auto ty = TypeOf(symbols_, class_symbol_, method_symbol_, e.GetObj());
+    assert(ty->GetOp() == Type::TypeClassOp);
+    calls_.insert({static_cast<TypeClass &>(*ty).GetName(), e.GetMethod()});
+    Visit(e.GetObj());
+    for (auto &a : e.GetArgs()) Visit(*a);
+  }
+  virtual void VisitArrayGet(const ExpArrayGet &e) {
+    Visit(e.GetArray());
+    Visit(e.GetIndex());
+  }
+  virtual void VisitArrayLength(const ExpArrayLength &e) {
+    Visit(e.GetArray());
+  }
+  virtual void VisitTrue(const ExpTrue &e) {}
+  virtual void VisitFalse(const ExpFalse &e) {}
+  virtual void VisitThis(const ExpThis &e) {}
+  virtual void VisitNew(const ExpNew &e) {}
+  virtual void VisitNewIntArray(const ExpNewIntArray &e) {
+    Visit(e.GetSize());
+  }
+  virtual void VisitNeg(const ExpNeg &e) { Visit(e.GetExp()); }
+  virtual void VisitRead(const ExpRead &e) {}
+
+ private:
+  const SymbolTable &symbols_;
+  const ClassSymbol &class_symbol_;
+  const MethodSymbol &method_symbol_;
+  MethodSet &calls_;
+};
+
+}  // namespace
+
+MethodSet ReachableMethods(const SymbolTable &symbols, const Program &prg) {
+  auto decls = std::map<std::pair<Ident, Ident>, const MethodDecl *>{};
+  for (auto &cd : prg.classes) {
+    for (auto &md : cd.methods) {
+      decls[{cd.class_name, md.method_name}] = &md;
+    }
+  }
+
+  auto reachable = MethodSet{};
+  auto calls = MethodSet{};
+  auto &main_class =
+      symbols.GetClasses().find(prg.main_class.class_name)->second;
+  CallsInStm(symbols, main_class, main_class.GetMethods().find("main")->second,
+             calls)
+      .Visit(*prg.main_class.main_body);
+
+  // visit the bodies of newly reached methods until no new call is found
+  auto worklist = std::vector<std::pair<Ident, Ident>>(calls.begin(),
+                                                       calls.end());
+  while (!worklist.empty()) {
+    auto method = worklist.back();
+    worklist.pop_back();
+    if (!reachable.insert(method).second) continue;
+
+    auto &[cls, name] = method;
+    auto &class_symbol = symbols.GetClasses().find(cls)->second;
+    auto &method_symbol = class_symbol.GetMethods().find(name)->second;
+    auto &md = *decls.at(method);
+    auto callees = MethodSet{};
+    auto visitor = CallsInStm(symbols, class_symbol, method_symbol, callees);
+    visitor.Visit(*md.body);
+    visitor.Visit(*md.return_exp);
+    for (auto &c : callees) {
+      if (reachable.count(c) == 0) worklist.push_back(c);
+    }
+  }
+  return reachable;
+}
+
+}  // namespace mjc
@@ -0,0 +1,25 @@
+//
+// Reachability of methods
+//
+#ifndef MJC_MINIJAVA_REACHABILITY_H
+#define MJC_MINIJAVA_REACHABILITY_H
+
+#include <set>
+#include <utility>
+
+#include "minijava/ast.h"
+#include "minijava/symbol.h"
+
+namespace mjc {
+
+// Methods, identified by class name and method name
+using MethodSet = std::set<std::pair<Ident, Ident>>;
+
+// Computes the methods that may be called from the main function of a
+// well-typed program. MiniJava has no inheritance, so the class of each
+// invocation is known statically and the call graph is exact.
+MethodSet ReachableMethods(const SymbolTable &symbols, const Program &prg);
+
+}  // namespace mjc
+
+#endif
@@ -1,50 +1,781 @@
 /*
     Runtime library, for use in compiled MiniJava programs
+
+    The runtime needs only a few system calls. Compiled with
+    -DMJC_FREESTANDING, it makes them itself instead of using the C library
+    and provides the entry point _start, so that programs can be linked
+    statically without the C library (Linux on i386 and x86-64).
+
+    The values of compiled code are words of 4 bytes on i386 and 8 bytes on
+    x86-64 (mjc -m64). MiniJava ints are the lower 32 bits of their words.
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef intptr_t word;
+typedef uintptr_t uword;
+
+#ifdef MJC_FREESTANDING
+
+typedef word ssize_t;
+
+struct timespec {
+  word tv_sec;
+  word tv_nsec;
+};
+
+#define PROT_READ 1
+#define PROT_WRITE 2
+#define MAP_PRIVATE 2
+#define MAP_ANONYMOUS 0x20
+#define MAP_FAILED ((void *)-1)
+#define O_WRONLY 01
+#define O_CREAT 0100
+#define O_TRUNC 01000
+#define CLOCK_MONOTONIC 1
+
+#ifdef __x86_64__
+
+#define SYS_READ 0
+#define SYS_WRITE 1
+#define SYS_OPEN 2
+#define SYS_CLOSE 3
+#define SYS_MUNMAP 11
+#define SYS_CLOCK_GETTIME 228
+#define SYS_EXIT_GROUP 231
+
+static word syscall6(word n, word a, word b, word c, word d, word e, word f)
+{
+  word r;
+  register word r10 __asm__("r10") = d;
+  register word r8 __asm__("r8") = e;
+  register word r9 __asm__("r9") = f;
+  __asm__ volatile("syscall"
+                   : "=a"(r)
+                   : "a"(n), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8),
+                     "r"(r9)
+                   : "rcx", "r11", "memory");
+  return r;
+}
+
+static word syscall3(word n, word a, word b, word c)
+{
+  return syscall6(n, a, b, c, 0, 0, 0);
+}
+
+#else
+
+#define SYS_READ 3
+#define SYS_WRITE 4
+#define SYS_OPEN 5
+#define SYS_CLOSE 6
+#define SYS_MUNMAP 91
+#define SYS_CLOCK_GETTIME 265
+#define SYS_EXIT_GROUP 252
+
+static word syscall3(word n, word a, word b, word c)
+{
+  word r;
+  __asm__ volatile("int $0x80"
+                   : "=a"(r)
+                   : "a"(n), "b"(a), "c"(b), "d"(c)
+                   : "memory");
+  return r;
+}
+
+#endif
+
+static ssize_t read(int fd, void *buf, size_t n)
+{
+  return syscall3(SYS_READ, fd, (word)buf, n);
+}
+
+static ssize_t write(int fd, const void *buf, size_t n)
+{
+  return syscall3(SYS_WRITE, fd, (word)buf, n);
+}
+
+static int open(const char *file, int flags, int mode)
+{
+  return syscall3(SYS_OPEN, (word)file, flags, mode);
+}
+
+static int close(int fd)
+{
+  return syscall3(SYS_CLOSE, fd, 0, 0);
+}
+
+static void *mmap(void *addr, size_t n, int prot, int flags, int fd,
+                  word offset)
+{
+#ifdef __x86_64__
+  uword r = syscall6(9, (word)addr, n, prot, flags, fd, offset);
+#else
+  // the old mmap system call takes its arguments from memory
+  word args[6] = {(word)addr, n, prot, flags, fd, offset};
+  uword r = syscall3(90, (word)args, 0, 0);
+#endif
+  return r > -(uword)4096 ? MAP_FAILED : (void *)r;
+}
+
+static int munmap(void *addr, size_t n)
+{
+  return syscall3(SYS_MUNMAP, (word)addr, n, 0);
+}
+
+static int clock_gettime(int clock, struct timespec *t)
+{
+  return syscall3(SYS_CLOCK_GETTIME, clock, (word)t, 0);
+}
+
+__attribute__((noreturn))
+static void _exit(int rc)
+{
+  for (;;) syscall3(SYS_EXIT_GROUP, rc, 0, 0);
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#endif
+
+extern word Lmain(word);
+word L_raise(word rc);
+__attribute__((noreturn)) static void runtime_exit(int32_t rc);
+
+// Messages and the profile are written through a byte buffer
+struct text {
+  int fd;
+  uint32_t size;
+  char buf[512];
+};
+
+static struct text error_text = {.fd = 2};
+
+static void text_flush(struct text *t)
+{
+  for (uint32_t done = 0; done < t->size;) {
+    ssize_t w = write(t->fd, t->buf + done, t->size - done);
+    if (w <= 0) break;
+    done += w;
+  }
+  t->size = 0;
+}
+
+static void text_char(struct text *t, char c)
+{
+  if (t->size == sizeof(t->buf)) text_flush(t);
+  t->buf[t->size++] = c;
+}
+
+static void text_string(struct text *t, const char *s)
+{
+  while (*s != '\0') text_char(t, *s++);
+}
 
-extern int32_t Lmain(int32_t);
+static void text_uint(struct text *t, uword n)
+{
+  char digits[20];
+  int32_t k = 0;
+  do {
+    digits[k++] = '0' + n % 10;
+    n /= 10;
+  } while (n != 0);
+  while (k > 0) text_char(t, digits[--k]);
+}
+
+static void out_of_memory(void)
+{
+  text_string(&error_text, "Out of memory\n");
+  text_flush(&error_text);
+  runtime_exit(1);
+}
+
+// The environment of the process
+static char **environment;
+
+static int env_defined(const char *name)
+{
+  for (char **e = environment; *e != NULL; e++) {
+    const char *n = name;
+    const char *v = *e;
+    while (*n != '\0' && *n == *v) {
+      n++;
+      v++;
+    }
+    if (*n == '\0' && *v == '=') return 1;
+  }
+  return 0;
+}
 
-// Allocate <size> bytes of memory space and initialise it with zeroes
-int32_t L_halloc(int32_t size) {
-  return (int32_t)calloc(size, 1);
+// The heap consists of chunks of zeroed memory. Memory is taken from the
+// current chunk by advancing L_heap_ptr towards L_heap_limit. Compiled code
+// does this inline and calls L_halloc only when a request does not fit.
+// Chunks are aligned to their size, so that the chunk of an address is
+// found in a table of all chunks of the address space of user programs.
+#ifndef HEAP_CHUNK_SHIFT
+#define HEAP_CHUNK_SHIFT 22
+#endif
+#ifdef __x86_64__
+#define ADDRESS_BITS 47
+#else
+#define ADDRESS_BITS 32
+#endif
+#define HEAP_CHUNK_SIZE ((uword)1 << HEAP_CHUNK_SHIFT)
+#define HEAP_CHUNKS ((uword)1 << (ADDRESS_BITS - HEAP_CHUNK_SHIFT))
+// Largest number of chunks in the heap at a time
+#define HEAP_MAX_CHUNKS (HEAP_CHUNKS < 4096 ? HEAP_CHUNKS : 4096)
+// Requests of at least this size get a mapping of their own
+#define HEAP_HUGE_SIZE (HEAP_CHUNK_SIZE / 8)
+// Size of the heap below which there is no collection
+#ifndef HEAP_MIN_SIZE
+#define HEAP_MIN_SIZE (32u << 20)
+#endif
+
+char *L_heap_ptr = NULL;
+char *L_heap_limit = NULL;
+
+// Anonymous mappings are zeroed by the kernel when first touched
+static char *heap_map(uword size)
+{
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) out_of_memory();
+  return p;
+}
+
+// Objects and arrays start with a header word (see GcRoots::ObjectHeader
+// in the compiler):
+// - an array: its length, at least 0; the 32-bit elements follow and are
+//   padded to whole words
+// - an object: bit 31, the number of references in bits 15 to 29, which
+//   are the first fields, and the number of fields in bits 0 to 14
+// - an object or array that was copied by the collector: the two highest
+//   bits of the word and the new address shifted by 2
+#define HEADER_OBJECT 0x80000000u
+#define HEADER_FORWARD ((uword)3 << (8 * sizeof(uword) - 2))
+
+static uword object_words(uword header)
+{
+  if (header & HEADER_OBJECT) return 1 + (header & 0x7fff);
+  return 1 + (header * sizeof(int32_t) + sizeof(word) - 1) / sizeof(word);
+}
+
+static uword object_references(uword header)
+{
+  return header & HEADER_OBJECT ? (header >> 15) & 0x7fff : 0;
+}
+
+// The garbage collector copies the live objects of the chunks to new
+// chunks. Objects of at least HEAP_HUGE_SIZE are not moved; the dead ones
+// are unmapped. The roots are the words of the stack frames given by the
+// stack maps of the compiled program.
+enum { CHUNK_NONE, CHUNK_HEAP, CHUNK_COPY, CHUNK_HUGE };
+static uint8_t chunk_kind[HEAP_CHUNKS];
+static char *chunks[HEAP_MAX_CHUNKS];      // chunks of the heap, in order
+static char *chunks_end[HEAP_MAX_CHUNKS];  // end of the objects in each chunk
+static uint32_t chunk_count;
+
+// Huge objects follow a prefix in their mapping
+struct huge {
+  struct huge *next;
+  uword size;  // of the mapping
+  uword marked;
+  uword padding;
+};
+static struct huge *huge_objects;
+
+static uword heap_size;     // bytes in chunks and huge objects
+static uword heap_trigger = HEAP_MIN_SIZE;
+
+static struct {
+  uint32_t collections;
+  uint64_t copied;       // bytes
+  uint32_t pause_total;  // microseconds
+  uint32_t pause_max;
+  uword heap_max;        // bytes
+} gc_stats;
+
+// Stack maps of the compiled program, absent if it was compiled with -fno-gc
+// (see StackMapData in the compiler)
+struct stack_map {
+  uword return_address;
+  uword size;   // distance to the return address of the calling function
+  uword count;  // roots
+  word roots[]; // offsets relative to that return address
+};
+extern struct {
+  uword count;
+  uword entries[];
+} L_stack_maps __attribute__((weak));
+
+// Stack maps by return address, open addressing
+static const struct stack_map **stack_maps;
+static uint32_t stack_maps_mask;
+
+static uint32_t hash(uword return_address)
+{
+  return ((uint32_t)return_address * 2654435761u) >> 7;
+}
+
+static void build_stack_maps(void)
+{
+  uint32_t size = 1;
+  while (size < 2 * L_stack_maps.count) size *= 2;
+  stack_maps = (const struct stack_map **)heap_map(size * sizeof(void *));
+  stack_maps_mask = size - 1;
+  const uword *e = L_stack_maps.entries;
+  for (uint32_t i = 0; i < L_stack_maps.count; i++) {
+    const struct stack_map *m = (const struct stack_map *)e;
+    uint32_t h = hash(m->return_address) & stack_maps_mask;
+    while (stack_maps[h] != NULL) h = (h + 1) & stack_maps_mask;
+    stack_maps[h] = m;
+    e += 3 + m->count;
+  }
+}
+
+static const struct stack_map *find_stack_map(uword return_address)
+{
+  uint32_t h = hash(return_address) & stack_maps_mask;
+  while (stack_maps[h] != NULL) {
+    if (stack_maps[h]->return_address == return_address) return stack_maps[h];
+    h = (h + 1) & stack_maps_mask;
+  }
+  return NULL;
+}
+
+static char *map_chunk(uint8_t kind)
+{
+  // map twice the size and keep the aligned part
+  char *p = heap_map(2 * HEAP_CHUNK_SIZE);
+  char *chunk = (char *)(((uintptr_t)p + HEAP_CHUNK_SIZE - 1) &
+                         ~(uintptr_t)(HEAP_CHUNK_SIZE - 1));
+  if (chunk > p) munmap(p, chunk - p);
+  munmap(chunk + HEAP_CHUNK_SIZE, p + HEAP_CHUNK_SIZE - chunk);
+  chunk_kind[(uintptr_t)chunk >> HEAP_CHUNK_SHIFT] = kind;
+  return chunk;
+}
+
+// Appends a new chunk to the heap and makes it the current one
+static void new_chunk(uint8_t kind)
+{
+  if (chunk_count == HEAP_MAX_CHUNKS) out_of_memory();
+  if (chunk_count > 0) chunks_end[chunk_count - 1] = L_heap_ptr;
+  L_heap_ptr = map_chunk(kind);
+  L_heap_limit = L_heap_ptr + HEAP_CHUNK_SIZE;
+  chunks[chunk_count++] = L_heap_ptr;
+  heap_size += HEAP_CHUNK_SIZE;
+}
+
+static struct huge *huge_object(char *p)
+{
+  for (struct huge *h = huge_objects; h != NULL; h = h->next) {
+    if ((char *)(h + 1) == p) return h;
+  }
+  return NULL;
+}
+
+static char *map_huge(uword n)
+{
+  uword size = (sizeof(struct huge) + n + 4095) & ~(uword)4095;
+  if (size < n) out_of_memory();
+  struct huge *h = (struct huge *)heap_map(size);
+  h->next = huge_objects;
+  h->size = size;
+  huge_objects = h;
+  uintptr_t first = (uintptr_t)h >> HEAP_CHUNK_SHIFT;
+  uintptr_t last = ((uintptr_t)h + size - 1) >> HEAP_CHUNK_SHIFT;
+  for (uintptr_t c = first; c <= last; c++) chunk_kind[c] = CHUNK_HUGE;
+  heap_size += size;
+  return (char *)(h + 1);
+}
+
+// Copies the object that a root or field refers to, unless it has been
+// copied already, and updates the reference. Other words are left alone.
+static void forward(uword *ref)
+{
+  char *p = (char *)*ref;
+  switch (chunk_kind[(uintptr_t)p >> HEAP_CHUNK_SHIFT]) {
+  case CHUNK_HEAP: {
+    uword header = *(uword *)p;
+    if ((header & HEADER_FORWARD) == HEADER_FORWARD) {
+      *ref = header << 2;
+      return;
+    }
+    uword size = sizeof(word) * object_words(header);
+    if (size > (uword)(L_heap_limit - L_heap_ptr)) {
+      new_chunk(CHUNK_COPY);
+    }
+    char *copy = L_heap_ptr;
+    L_heap_ptr += size;
+    for (uword i = 0; i < size / sizeof(word); i++) {
+      ((uword *)copy)[i] = ((uword *)p)[i];
+    }
+    *(uword *)p = HEADER_FORWARD | ((uword)copy >> 2);
+    *ref = (uword)copy;
+    gc_stats.copied += size;
+    return;
+  }
+  case CHUNK_HUGE: {
+    struct huge *h = huge_object(p);
+    if (h != NULL) h->marked = 1;
+    return;
+  }
+  default:
+    return;
+  }
+}
+
+static uint64_t microseconds(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+// Collects the garbage, given the location of the return address of the
+// compiled function that called the allocation function
+static void collect(uword *return_address)
+{
+  uint64_t start = microseconds();
+  if (stack_maps == NULL) build_stack_maps();
+
+  // the chunks of the heap become the old space
+  uint32_t old_count = chunk_count;
+  char *old_chunks[HEAP_MAX_CHUNKS];
+  for (uint32_t i = 0; i < old_count; i++) old_chunks[i] = chunks[i];
+  chunk_count = 0;
+  heap_size = 0;
+  new_chunk(CHUNK_COPY);
+
+  // roots
+  uword *ra = return_address;
+  const struct stack_map *m;
+  while ((m = find_stack_map(*ra)) != NULL) {
+    char *caller = (char *)ra + m->size;
+    for (uword i = 0; i < m->count; i++) {
+      forward((uword *)(caller + m->roots[i]));
+    }
+    ra = (uword *)caller;
+  }
+
+  // the fields of the copied objects, which may copy more objects; huge
+  // objects hold no references, since only arrays are that large
+  uint32_t scanned = 0;
+  char *scan = chunks[0];
+  for (;;) {
+    char *end = scanned + 1 == chunk_count ? L_heap_ptr : chunks_end[scanned];
+    if (scan == end) {
+      if (scanned + 1 == chunk_count) break;
+      scan = chunks[++scanned];
+      continue;
+    }
+    uword header = *(uword *)scan;
+    for (uword i = 1; i <= object_references(header); i++) {
+      forward((uword *)scan + i);
+    }
+    scan += sizeof(word) * object_words(header);
+  }
+
+  for (uint32_t i = 0; i < old_count; i++) {
+    chunk_kind[(uintptr_t)old_chunks[i] >> HEAP_CHUNK_SHIFT] = CHUNK_NONE;
+    munmap(old_chunks[i], HEAP_CHUNK_SIZE);
+  }
+  for (uint32_t i = 0; i < chunk_count; i++) {
+    chunk_kind[(uintptr_t)chunks[i] >> HEAP_CHUNK_SHIFT] = CHUNK_HEAP;
+  }
+  for (struct huge **h = &huge_objects; *h != NULL;) {
+    struct huge *o = *h;
+    if (o->marked) {
+      o->marked = 0;
+      heap_size += o->size;
+      h = &o->next;
+      continue;
+    }
+    *h = o->next;
+    uintptr_t first = (uintptr_t)o >> HEAP_CHUNK_SHIFT;
+    uintptr_t last = ((uintptr_t)o + o->size - 1) >> HEAP_CHUNK_SHIFT;
+    for (uintptr_t c = first; c <= last; c++) chunk_kind[c] = CHUNK_NONE;
+    munmap(o, o->size);
+  }
+  // mark the regions of the remaining huge objects again
+  for (struct huge *o = huge_objects; o != NULL; o = o->next) {
+    uintptr_t first = (uintptr_t)o >> HEAP_CHUNK_SHIFT;
+    uintptr_t last = ((uintptr_t)o + o->size - 1) >> HEAP_CHUNK_SHIFT;
+    for (uintptr_t c = first; c <= last; c++) chunk_kind[c] = CHUNK_HUGE;
+  }
+
+  heap_trigger = 2 * heap_size > HEAP_MIN_SIZE ? 2 * heap_size : HEAP_MIN_SIZE;
+  uint32_t pause = microseconds() - start;
+  gc_stats.collections++;
+  gc_stats.pause_total += pause;
+  if (pause > gc_stats.pause_max) gc_stats.pause_max = pause;
+}
+
+static void print_gc_stats(void)
+{
+  struct text *t = &error_text;
+  text_string(t, "gc: ");
+  text_uint(t, gc_stats.collections);
+  text_string(t, " collections, ");
+  text_uint(t, gc_stats.copied >> 10);
+  text_string(t, " KB copied, pause total ");
+  text_uint(t, gc_stats.pause_total);
+  text_string(t, " us, max ");
+  text_uint(t, gc_stats.pause_max);
+  text_string(t, " us, heap max ");
+  text_uint(t, gc_stats.heap_max >> 10);
+  text_string(t, " KB\n");
+  text_flush(t);
+}
+
+// Allocate <size> bytes of memory space and initialise it with zeroes.
+// The size is a multiple of the word size. Called by L_halloc with the
+// location of the return address of the compiled code.
+__attribute__((used))
+static char *heap_alloc(word size, uword *return_address)
+{
+  if ((int32_t)size <= 0) {
+    L_raise(1);  // negative array length
+  }
+  uword n = (uint32_t)size;
+  if (n > (uword)(L_heap_limit - L_heap_ptr) || n >= HEAP_HUGE_SIZE) {
+    if (&L_stack_maps != NULL && heap_size + n > heap_trigger) {
+      collect(return_address);
+    }
+    if (heap_size > gc_stats.heap_max) gc_stats.heap_max = heap_size;
+  }
+  if (n >= HEAP_HUGE_SIZE) {
+    return map_huge(n);
+  }
+  if (n > (uword)(L_heap_limit - L_heap_ptr)) {
+    // the rest of the current chunk is not used
+    new_chunk(CHUNK_HEAP);
+  }
+  char *p = L_heap_ptr;
+  L_heap_ptr += n;
+  return p;
+}
+
+// word L_halloc(word size) passes the location of its return address to
+// heap_alloc and keeps the stack 16-byte aligned.
+#ifdef __x86_64__
+__asm__(".text\n"
+        ".globl L_halloc\n"
+        "L_halloc:\n"
+        "  movq %rsp, %rsi\n"
+        "  subq $8, %rsp\n"
+        "  call heap_alloc\n"
+        "  addq $8, %rsp\n"
+        "  ret\n");
+#else
+__asm__(".text\n"
+        ".globl L_halloc\n"
+        "L_halloc:\n"
+        "  movl %esp, %eax\n"
+        "  subl $4, %esp\n"
+        "  pushl %eax\n"
+        "  pushl 4(%eax)\n"
+        "  call heap_alloc\n"
+        "  addl $12, %esp\n"
+        "  ret\n");
+#endif
+
+// The standard output and input are buffered with one byte per word, so
+// that compiled code can access the buffers with word loads and stores.
+// The free part of the output buffer lies between L_out_ptr and
+// L_out_limit and the unread part of the input buffer between L_in_ptr and
+// L_in_limit. Compiled code writes and reads inline and calls L_write and
+// L_read only when the output buffer is full or the input buffer is empty.
+#define IO_BUFFER_SIZE (1u << 16)
+
+static word out_buffer[IO_BUFFER_SIZE];
+word *L_out_ptr = out_buffer;
+word *L_out_limit = out_buffer + IO_BUFFER_SIZE;
+
+static word in_buffer[IO_BUFFER_SIZE];
+word *L_in_ptr = in_buffer;
+word *L_in_limit = in_buffer;
+
+// Bytes passed to the system calls
+static unsigned char io_bytes[IO_BUFFER_SIZE];
+
+static void out_flush(void)
+{
+  uint32_t n = L_out_ptr - out_buffer;
+  for (uint32_t i = 0; i < n; i++) {
+    io_bytes[i] = (unsigned char)out_buffer[i];
+  }
+  L_out_ptr = out_buffer;
+  for (uint32_t done = 0; done < n;) {
+    ssize_t w = write(1, io_bytes + done, n - done);
+    if (w <= 0) return;
+    done += w;
+  }
 }
 
 // Print an integer to the standard output
-int32_t L_println_int(int32_t n)
+word L_println_int(word value)
 {
-  printf("%" PRId32 "\n",n);
+  int32_t n = (int32_t)value;
+  // a sign, 10 digits and the newline
+  if (L_out_limit - L_out_ptr < 12) out_flush();
+  uint32_t u = n < 0 ? -(uint32_t)n : (uint32_t)n;
+  int32_t digits[10];
+  int32_t k = 0;
+  do {
+    digits[k++] = '0' + u % 10;
+    u /= 10;
+  } while (u != 0);
+  if (n < 0) *L_out_ptr++ = '-';
+  while (k > 0) *L_out_ptr++ = digits[--k];
+  *L_out_ptr++ = '\n';
   return 0;
 }
 
 // Write character to standard output
-int32_t L_write(int32_t n)
+word L_write(word n)
 {
-  putchar(n);
+  if (L_out_ptr == L_out_limit) out_flush();
+  *L_out_ptr++ = n;
   return 0;
 }
 
-// Read character from standard input
-int32_t L_read()
+// Read character from standard input, -1 at the end of the input
+word L_read()
 {
-  return getchar();
+  if (L_in_ptr == L_in_limit) {
+    // a prompt must be visible before the program waits for input
+    out_flush();
+    ssize_t n = read(0, io_bytes, IO_BUFFER_SIZE);
+    if (n <= 0) return -1;
+    for (ssize_t i = 0; i < n; i++) {
+      in_buffer[i] = io_bytes[i];
+    }
+    L_in_ptr = in_buffer;
+    L_in_limit = in_buffer + n;
+  }
+  return *L_in_ptr++;
 }
 
 // Abort the execution with an error code
-int32_t L_raise(int32_t rc)
+word L_raise(word value)
 {
-  fprintf(stderr, "Program terminated with error code %" PRId32 ,rc);
-  exit(rc);
-  return 0;
+  int32_t rc = (int32_t)value;
+  out_flush();
+  text_string(&error_text, "Program terminated with error code ");
+  if (rc < 0) text_char(&error_text, '-');
+  text_uint(&error_text, rc < 0 ? -(uint32_t)rc : (uint32_t)rc);
+  text_flush(&error_text);
+  runtime_exit(rc);
 }
 
+// Abort the execution because of an array index out of bounds. Compiled
+// code jumps here instead of calling, so the stack may not be aligned.
+__attribute__((cold, noreturn, force_align_arg_pointer))
+void L_raise_bounds(void)
+{
+  L_raise(1);
+  runtime_exit(1);
+}
+
+// Profile counters of a program compiled with -fprofile-generate,
+// absent otherwise
+extern struct {
+  word size;
+  const char *file;
+  struct {
+    const char *key;
+    uword count;
+  } counters[];
+} L_profile __attribute__((weak));
+
+static void write_profile(void)
+{
+  int fd = open(L_profile.file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    text_string(&error_text, "Cannot write profile ");
+    text_string(&error_text, L_profile.file);
+    text_string(&error_text, "\n");
+    text_flush(&error_text);
+    return;
+  }
+  struct text f = {.fd = fd};
+  for (word i = 0; i < L_profile.size; i++) {
+    text_string(&f, L_profile.counters[i].key);
+    text_char(&f, ' ');
+    text_uint(&f, L_profile.counters[i].count);
+    text_char(&f, '\n');
+  }
+  text_flush(&f);
+  close(f.fd);
+}
+
+// Ends the process after flushing the output and writing the profile and
+// the statistics
+static void runtime_exit(int32_t rc)
+{
+  out_flush();
+  if (&L_profile != NULL) {
+    write_profile();
+  }
+  if (env_defined("MJC_GC_STATS")) {
+    print_gc_stats();
+  }
+  _exit(rc);
+}
+
+// Calls the compiled main method of the main class of the MiniJava program
+__attribute__((noreturn))
+static void run(char **envp)
+{
+  environment = envp;
+  Lmain(0);   // call main method with dummy argument for (unused) string array
+  runtime_exit(0);
+}
+
+#ifdef MJC_FREESTANDING
+
+// The kernel starts the process with the number of arguments at the stack
+// pointer, followed by the arguments and the environment, each terminated
+// by a null pointer.
+__attribute__((used, noreturn))
+static void start(uword *sp)
+{
+  run((char **)(sp + sp[0] + 2));
+}
+
+// Actual entry point: aligns the stack to 16 bytes for the call of start
+#ifdef __x86_64__
+__asm__(".text\n"
+        ".globl _start\n"
+        "_start:\n"
+        "  movq %rsp, %rdi\n"
+        "  andq $-16, %rsp\n"
+        "  call start\n");
+#else
+__asm__(".text\n"
+        ".globl _start\n"
+        "_start:\n"
+        "  movl %esp, %eax\n"
+        "  andl $-16, %esp\n"
+        "  subl $12, %esp\n"
+        "  pushl %eax\n"
+        "  call start\n");
+#endif
+
+#else
+
 // Actual entry point: wrapper around the compiled main method
 // of the main class of the MiniJava program
-int main()
+int main(int argc, char *argv[], char *envp[])
 {
-  Lmain(0);   // call main method with dummy argument for (unused) string array
-  return 0;
+  run(envp);
 }
+
+#endif
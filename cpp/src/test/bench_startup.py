@@ -0,0 +1,87 @@
+#!/bin/python3
+# Measures the time from exec to exit of the Small testcases, linked with
+# the C library and linked statically with the freestanding runtime.
+import glob
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+if len(sys.argv) < 4:
+    print("usage: bench_startup mjc runtime.c testdir [runs]")
+    sys.exit(1)
+
+mjc = os.path.abspath(sys.argv[1])
+runtime_c = os.path.abspath(sys.argv[2])
+test_dir = os.path.abspath(sys.argv[3])
+runs = int(sys.argv[4]) if len(sys.argv) > 4 else 200
+
+links = {
+    "libc": ["-m32"],
+    "freestanding": ["-m32", "-static", "-nostdlib", "-ffreestanding",
+                     "-fno-pie", "-no-pie", "-fno-stack-protector",
+                     "-DMJC_FREESTANDING"],
+}
+
+
+def compile_bin(base):
+    bin = subprocess.run([mjc, base + ".java"],
+                         stdout=subprocess.DEVNULL,
+                         stderr=subprocess.DEVNULL)
+    if bin.returncode != 0:
+        return {}
+    binaries = {}
+    for name, options in links.items():
+        binary = os.path.abspath(base + "." + name)
+        gcc = subprocess.run(["gcc"] + options +
+                             [base + ".o", runtime_c, "-o", binary],
+                             stdout=subprocess.DEVNULL,
+                             stderr=subprocess.DEVNULL)
+        if gcc.returncode == 0:
+            binaries[name] = binary
+    return binaries
+
+
+def run_once(binary, stdin):
+    actions = [(os.POSIX_SPAWN_OPEN, 0, stdin, os.O_RDONLY, 0),
+               (os.POSIX_SPAWN_OPEN, 1, os.devnull, os.O_WRONLY, 0)]
+    start = time.perf_counter_ns()
+    pid = os.posix_spawn(binary, [binary], {}, file_actions=actions)
+    os.waitpid(pid, 0)
+    return time.perf_counter_ns() - start
+
+
+def bench(binaries, stdin):
+    times = {name: [] for name in binaries}
+    # alternate the variants, so that both see the same system load
+    for _ in range(runs):
+        for name, binary in binaries.items():
+            times[name].append(run_once(binary, stdin))
+    return {name: statistics.median(t) / 1000 for name, t in times.items()}
+
+
+totals = {name: [] for name in links}
+print("%-20s %12s %12s" % ("test (median us)", *links))
+with tempfile.TemporaryDirectory() as tmpdirname:
+    os.chdir(tmpdirname)
+    for java in sorted(glob.glob(os.path.join(test_dir, "Small", "*.java"))):
+        base = os.path.splitext(os.path.basename(java))[0]
+        subprocess.run(["cp", java, "."])
+        binaries = compile_bin(base)
+        if not binaries:
+            print("%-20s compilation failed" % base)
+            continue
+        inp = os.path.splitext(java)[0] + ".in"
+        medians = bench(binaries, inp if os.path.exists(inp) else os.devnull)
+        row = ["%12.1f" % medians[n] if n in medians else "%12s" % "-"
+               for n in links]
+        print("%-20s %s" % (base, " ".join(row)))
+        if len(medians) == len(links):
+            for name, t in medians.items():
+                totals[name].append(t)
+
+if all(totals.values()):
+    print("%-20s %s" % ("geometric mean", " ".join(
+        "%12.1f" % statistics.geometric_mean(t) for t in totals.values())))
@@ -5,12 +5,23 @@ import os
 import sys
 
 if len(sys.argv) < 4:
-    print("usage: compile mjc runtime.c input.java")
+    print("usage: compile mjc runtime.c input.java [--freestanding] "
+          "[mjc options]")
     sys.exit(1)
 
 mjc = sys.argv[1]
 runtime_c = sys.argv[2]
 input_file = sys.argv[3]
+mjc_options = sys.argv[4:]
+
+# link statically with the runtime built without the C library
+freestanding = mjc_options[:1] == ["--freestanding"]
+if freestanding:
+    mjc_options = mjc_options[1:]
+gcc_options = ["-m64" if "-m64" in mjc_options else "-m32"]
+if freestanding:
+    gcc_options += ["-static", "-nostdlib", "-ffreestanding", "-fno-pie",
+                    "-no-pie", "-fno-stack-protector", "-DMJC_FREESTANDING"]
 
 
 def tr(f):
@@ -27,17 +38,18 @@ def compile_java(base):
     return javac.returncode == 0
 
 
-def compile_bin(base):
-    assembler = base + ".s"
-    if os.path.exists(assembler):
-        os.remove(assembler)
-    bin = subprocess.run([mjc, base + ".java"],
+def compile_bin(base, options):
+    obj = base + ".o"
+    if os.path.exists(obj):
+        os.remove(obj)
+    bin = subprocess.run([mjc] + options + [base + ".java"],
                          stdout=subprocess.DEVNULL,
                          stderr=subprocess.DEVNULL)
     if bin.returncode != 0:
         return False
 
-    gcc = subprocess.run(["gcc", "-m32", assembler, runtime_c, "-o", base + ".bin"],
+    gcc = subprocess.run(["gcc"] + gcc_options +
+                         [obj, runtime_c, "-o", base + ".bin"],
                          stdout=subprocess.DEVNULL,
                          stderr=subprocess.DEVNULL)
     return gcc.returncode == 0
@@ -55,6 +67,15 @@ def run_java(base, log):
     return java.returncode == 0
 
 
+def train(base):
+    # a run of an instrumented build writes the profile for -fprofile-use
+    options = ["-fprofile-generate" if o == "-fprofile-use" else o
+               for o in mjc_options]
+    if not compile_bin(base, options):
+        return False
+    return run_bin(base, os.devnull) and os.path.exists(base + ".profile")
+
+
 def run_bin(base, log):
     inp = None
     if os.path.exists(base + ".in"):
@@ -78,7 +99,9 @@ def test_file(java):
     if not run_java(base, javalog):
         return False
 
-    if not compile_bin(base):
+    if "-fprofile-use" in mjc_options and not train(base):
+        return False
+    if not compile_bin(base, mjc_options):
         return False
     if not run_bin(base, binlog):
         return False
@@ -0,0 +1,127 @@
+#!/bin/python3
+# Checks that the object file written by mjc is equivalent to the one that
+# the assembler makes from the text written with -S: the same contents of
+# the sections, relocations and global symbols.
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+if len(sys.argv) < 3:
+    print("usage: test_object mjc input.java [mjc options]")
+    sys.exit(1)
+
+mjc = sys.argv[1]
+input_file = sys.argv[2]
+mjc_options = sys.argv[3:]
+
+SHF_ALLOC = 0x2
+SHT_SYMTAB = 2
+SHT_RELA = 4
+SHT_REL = 9
+STT_SECTION = 3
+STB_LOCAL = 0
+
+
+def tr(f):
+    if f:
+        print("OK")
+    else:
+        print("FAIL")
+
+
+def read_elf(file):
+    data = open(file, "rb").read()
+    elf64 = data[4] == 2
+    if elf64:
+        shoff, = struct.unpack_from("<Q", data, 40)
+        shnum, shstrndx = struct.unpack_from("<HH", data, 60)
+        sections = [struct.unpack_from("<IIQQQQIIQQ", data, shoff + 64 * i)
+                    for i in range(shnum)]
+    else:
+        shoff, = struct.unpack_from("<I", data, 32)
+        shnum, shstrndx = struct.unpack_from("<HH", data, 48)
+        sections = [struct.unpack_from("<10I", data, shoff + 40 * i)
+                    for i in range(shnum)]
+
+    def string(table, offset):
+        start = sections[table][4] + offset
+        return data[start:data.index(b"\0", start)].decode()
+
+    names = [string(shstrndx, s[0]) for s in sections]
+    symtab = next(i for i, s in enumerate(sections) if s[1] == SHT_SYMTAB)
+    symbols = []
+    symbol_size = 24 if elf64 else 16
+    for k in range(sections[symtab][5] // symbol_size):
+        offset = sections[symtab][4] + symbol_size * k
+        if elf64:
+            name, info, _, shndx, value, _ = struct.unpack_from(
+                "<IBBHQQ", data, offset)
+        else:
+            name, value, _, info, _, shndx = struct.unpack_from(
+                "<IIIBBH", data, offset)
+        symbols.append((string(sections[symtab][6], name), value, info,
+                        shndx))
+
+    contents = {}
+    relocations = {}
+    for i, s in enumerate(sections):
+        if s[2] & SHF_ALLOC and s[5] > 0:
+            contents[names[i]] = data[s[4]:s[4] + s[5]]
+        if s[1] == SHT_REL:
+            rels = []
+            for k in range(s[5] // 8):
+                offset, info = struct.unpack_from("<II", data, s[4] + 8 * k)
+                name, _, sym_info, shndx = symbols[info >> 8]
+                if sym_info & 0xf == STT_SECTION:
+                    name = names[shndx]
+                rels.append((offset, info & 0xff, name))
+            relocations[names[s[7]]] = sorted(rels)
+        if s[1] == SHT_RELA:
+            rels = []
+            for k in range(s[5] // 24):
+                offset, info, addend = struct.unpack_from(
+                    "<QQq", data, s[4] + 24 * k)
+                name, _, sym_info, shndx = symbols[info >> 32]
+                if sym_info & 0xf == STT_SECTION:
+                    name = names[shndx]
+                rels.append((offset, info & 0xffffffff, name, addend))
+            relocations[names[s[7]]] = sorted(rels)
+    globals = sorted((name, names[shndx] if shndx else "", value)
+                     for name, value, info, shndx in symbols
+                     if info >> 4 != STB_LOCAL)
+    return contents, relocations, globals
+
+
+def test_file(java):
+    base, _ = os.path.splitext(java)
+    print("Testing object file of " + base + ": ", end="", flush=True)
+    text = subprocess.run([mjc, "-S"] + mjc_options + [java],
+                          stdout=subprocess.DEVNULL,
+                          stderr=subprocess.DEVNULL)
+    if text.returncode != 0:
+        return False
+    gcc = subprocess.run(["gcc", "-m64" if "-m64" in mjc_options else "-m32",
+                          "-c", base + ".s",
+                          "-o", base + ".as.o"],
+                         stdout=subprocess.DEVNULL,
+                         stderr=subprocess.DEVNULL)
+    if gcc.returncode != 0:
+        return False
+    obj = subprocess.run([mjc] + mjc_options + [java],
+                         stdout=subprocess.DEVNULL,
+                         stderr=subprocess.DEVNULL)
+    if obj.returncode != 0:
+        return False
+    return read_elf(base + ".o") == read_elf(base + ".as.o")
+
+
+with tempfile.TemporaryDirectory() as tmpdirname:
+    print('created temporary directory', tmpdirname)
+    os.chdir(tmpdirname)
+    subprocess.run(["cp", input_file, "."])
+    java = os.path.basename(input_file)
+    ok = test_file(java)
+    tr(ok)
+    sys.exit(0 if ok else 1)
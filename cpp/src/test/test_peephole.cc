@@ -0,0 +1,159 @@
+// Unit tests for the patterns of the peephole optimiser
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "backend/x86/x86_function.h"
+#include "backend/x86/x86_instr.h"
+#include "backend/x86/x86_peephole.h"
+
+using namespace mjc;
+
+namespace {
+
+using InstrVector = std::vector<std::unique_ptr<X86Instr>>;
+
+int failures = 0;
+
+template <typename... Instrs>
+InstrVector Body(Instrs... instrs) {
+  InstrVector v;
+  (v.push_back(std::move(instrs)), ...);
+  // all registers are used at the end, so that none is dead
+  v.push_back(std::make_unique<CallInstr>(
+      Label("Lend"),
+      std::vector<X86Register>{EAX, EBX, ECX, EDX, ESI, EDI}));
+  v.push_back(std::make_unique<RetInstr>());
+  return v;
+}
+
+std::string Print(X86Function &f) {
+  auto s = std::stringstream{};
+  s << f;
+  return s.str();
+}
+
+// Checks that the peephole optimiser turns `before` into `after` and that
+// the pattern matched the given number of times.
+void Check(const std::string &pattern, unsigned hits, InstrVector before,
+           InstrVector after) {
+  auto f = X86Function(Label("Lf"), std::move(before));
+  auto expected = X86Function(Label("Lf"), std::move(after));
+  auto counts = X86Peephole::Process(f);
+  if (Print(f) != Print(expected) || counts[pattern] != hits) {
+    std::cout << "FAIL " << pattern << ":" << std::endl
+              << "expected (" << hits << " hits):" << std::endl
+              << Print(expected) << "got (" << counts[pattern]
+              << " hits):" << std::endl
+              << Print(f);
+    failures++;
+  }
+}
+
+auto Mov(Operand dst, Operand src) {
+  return std::make_unique<BinaryInstr>(MOV, dst, src);
+}
+auto Bin(BinaryInstrKind kind, Operand dst, Operand src) {
+  return std::make_unique<BinaryInstr>(kind, dst, src);
+}
+auto Un(UnaryInstrKind kind, Operand src) {
+  return std::make_unique<UnaryInstr>(kind, src);
+}
+auto J(JInstr::Kind cond, const char *l) {
+  return std::make_unique<JInstr>(cond, Label(l));
+}
+auto Cmov(JInstr::Kind cond, Operand dst, Operand src) {
+  return std::make_unique<CondInstr>(CMOV, cond, dst, src);
+}
+auto Jmp(const char *l) { return std::make_unique<JmpInstr>(Label(l)); }
+auto Lab(const char *l) { return std::make_unique<LabelInstr>(Label(l)); }
+auto Imm(std::int32_t i) { return Operand::Imm(i); }
+auto Slot(std::int32_t i) { return Operand::FrameSlot(i); }
+
+}  // namespace
+
+int main() {
+  Check("self-move", 1, Body(Mov(EAX, EAX)), Body());
+
+  Check("jump-to-next", 1, Body(Jmp("L1"), Lab("L1")), Body(Lab("L1")));
+  Check("jump-to-next", 0, Body(Jmp("L1"), Lab("L2"), Lab("L1")),
+        Body(Jmp("L1"), Lab("L2"), Lab("L1")));
+
+  Check("move-back", 1, Body(Mov(EAX, EBX), Mov(EBX, EAX)),
+        Body(Mov(EAX, EBX)));
+  Check("move-back", 1, Body(Mov(Slot(-4), EBX), Mov(EBX, Slot(-4))),
+        Body(Mov(Slot(-4), EBX)));
+  // the address depends on the destination of the first move
+  Check("move-back", 0,
+        Body(Mov(EAX, Operand::Mem(EAX, 4)), Mov(Operand::Mem(EAX, 4), EAX)),
+        Body(Mov(EAX, Operand::Mem(EAX, 4)), Mov(Operand::Mem(EAX, 4), EAX)));
+
+  Check("store-load", 1, Body(Mov(Slot(-8), ECX), Mov(EDX, Slot(-8))),
+        Body(Mov(Slot(-8), ECX), Mov(EDX, ECX)));
+  Check("load-load", 1, Body(Mov(ECX, Slot(-8)), Mov(EDX, Slot(-8))),
+        Body(Mov(ECX, Slot(-8)), Mov(EDX, ECX)));
+  Check("load-load", 0,
+        Body(Mov(ECX, Operand::Mem(ECX)), Mov(EDX, Operand::Mem(ECX))),
+        Body(Mov(ECX, Operand::Mem(ECX)), Mov(EDX, Operand::Mem(ECX))));
+
+  // ESI is dead after the comparison, EAX is not
+  Check("compare-immediate", 1,
+        Body(Mov(ESI, Imm(5)), Bin(CMP, ESI, EBX), J(JInstr::L, "L1"),
+             Mov(ESI, Imm(0)), Lab("L1"), Mov(ESI, Imm(1))),
+        Body(Bin(CMP, EBX, Imm(5)), J(JInstr::G, "L1"), Mov(ESI, Imm(0)),
+             Lab("L1"), Mov(ESI, Imm(1))));
+  Check("compare-immediate", 1,
+        Body(Mov(ESI, Imm(5)), Bin(CMP, ESI, EBX), J(JInstr::B, "L1"),
+             Lab("L1"), Mov(ESI, Imm(1))),
+        Body(Bin(CMP, EBX, Imm(5)), J(JInstr::A, "L1"), Lab("L1"),
+             Mov(ESI, Imm(1))));
+  Check("compare-immediate", 0,
+        Body(Mov(EAX, Imm(5)), Bin(CMP, EAX, EBX), J(JInstr::L, "L1"),
+             Lab("L1")),
+        Body(Mov(EAX, Imm(5)), Bin(CMP, EAX, EBX), J(JInstr::L, "L1"),
+             Lab("L1")));
+
+  Check("increment", 2, Body(Bin(ADD, EAX, Imm(1)), Bin(SUB, EBX, Imm(1))),
+        Body(Un(INC, EAX), Un(DEC, EBX)));
+  Check("increment", 0, Body(Bin(ADD, EAX, Imm(2))),
+        Body(Bin(ADD, EAX, Imm(2))));
+  Check("increment", 0,
+        Body(Bin(ADD, EAX, Imm(1)), Mov(EBX, ECX), J(JInstr::B, "L1"),
+             Lab("L1")),
+        Body(Bin(ADD, EAX, Imm(1)), Mov(EBX, ECX), J(JInstr::B, "L1"),
+             Lab("L1")));
+  Check("increment", 1,
+        Body(Bin(ADD, EAX, Imm(1)), Bin(CMP, EAX, EBX), J(JInstr::B, "L1"),
+             Lab("L1")),
+        Body(Un(INC, EAX), Bin(CMP, EAX, EBX), J(JInstr::B, "L1"),
+             Lab("L1")));
+  Check("increment", 0,
+        Body(Bin(SUB, EAX, Imm(1)), Cmov(JInstr::AE, EBX, ECX)),
+        Body(Bin(SUB, EAX, Imm(1)), Cmov(JInstr::AE, EBX, ECX)));
+
+  Check("compare-zero", 1, Body(Bin(CMP, EDI, Imm(0)), J(JInstr::L, "L1"),
+                                Lab("L1")),
+        Body(Bin(TEST, EDI, EDI), J(JInstr::L, "L1"), Lab("L1")));
+
+  Check("redundant-test", 1,
+        Body(Bin(AND, EAX, EBX), Bin(TEST, EAX, EAX), J(JInstr::L, "L1"),
+             Lab("L1")),
+        Body(Bin(AND, EAX, EBX), J(JInstr::L, "L1"), Lab("L1")));
+  Check("redundant-test", 1,
+        Body(Bin(SUB, EAX, EBX), Bin(CMP, EAX, Imm(0)), J(JInstr::E, "L1"),
+             Lab("L1")),
+        Body(Bin(SUB, EAX, EBX), J(JInstr::E, "L1"), Lab("L1")));
+  // SUB may set the overflow flag, which JL reads
+  Check("redundant-test", 0,
+        Body(Bin(SUB, EAX, EBX), Bin(TEST, EAX, EAX), J(JInstr::L, "L1"),
+             Lab("L1")),
+        Body(Bin(SUB, EAX, EBX), Bin(TEST, EAX, EAX), J(JInstr::L, "L1"),
+             Lab("L1")));
+
+  if (failures == 0) {
+    std::cout << "OK" << std::endl;
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -21,17 +21,16 @@ def tr(f):
 
 
 def compile_bin(base):
-    assembler = base + ".s"
-    if os.path.exists(assembler):
-        os.remove(assembler)
-    out = open(base + ".s", "w")
+    obj = base + ".o"
+    if os.path.exists(obj):
+        os.remove(obj)
     bin = subprocess.run([mjc, base + ".java"],
-                         stdout=out,
+                         stdout=subprocess.DEVNULL,
                          stderr=subprocess.DEVNULL)
     if bin.returncode != 0:
         return False
 
-    gcc = subprocess.run(["gcc", "-m32", assembler, runtime_c, "-o", base + ".bin"],
+    gcc = subprocess.run(["gcc", "-m32", obj, runtime_c, "-o", base + ".bin"],
                          stdout=subprocess.DEVNULL,
                          stderr=subprocess.DEVNULL)
     return gcc.returncode == 0
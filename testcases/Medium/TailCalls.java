@@ -0,0 +1,134 @@
+// Calls in tail position: self-recursion, recursion over different
+// receivers, mutual recursion and calls with more or fewer arguments.
+// expected output:
+// 500500
+// 6
+// 21
+// 1
+// 0
+// 12
+// 7
+// 3
+// -----------------------------------------------------------------------------
+
+class TailCalls {
+    public static void main(String[] a) {
+        System.out.println(new Tail().run());
+    }
+}
+
+class Tail {
+    public int sum(int n, int acc) {
+        int r;
+        if (n < 1)
+            r = acc;
+        else
+            r = this.sum(n - 1, acc + n);
+        return r;
+    }
+
+    public int gcd(int x, int y) {
+        int r;
+        if (y < 1) {
+            r = x;
+        } else {
+            r = this.gcd(y, x - (x / y) * y);
+        }
+        return r;
+    }
+
+    public int swap(int x, int y, int n) {
+        int r;
+        if (n < 1) {
+            r = x * 10 + y;
+        } else {
+            r = this.swap(y, x, n - 1);
+        }
+        return r;
+    }
+
+    public int add3(int x, int y, int z) {
+        return x + y + z;
+    }
+
+    public int fewer(int x) {
+        return this.add3(x, x + 1, x + 2);
+    }
+
+    public int more(int x, int y, int z, int w) {
+        return this.add3(x, y, w);
+    }
+
+    public int run() {
+        int r;
+        Node l;
+        Even e;
+        l = new Node();
+        r = l.init(7);
+        System.out.println(this.sum(1000, 0));
+        System.out.println(this.gcd(84, 18));
+        System.out.println(this.swap(1, 2, 3));
+        e = new Even();
+        System.out.println(e.even(1000));
+        System.out.println(e.even(777));
+        System.out.println(this.fewer(3));
+        System.out.println(this.more(1, 2, 100, 4));
+        r = l.count(0);
+        return r - 4;
+    }
+}
+
+class Node {
+    Node next;
+    boolean last;
+
+    public int init(int n) {
+        int r;
+        if (n < 2) {
+            last = true;
+            r = 0;
+        } else {
+            last = false;
+            next = new Node();
+            r = next.init(n - 1);
+        }
+        return r;
+    }
+
+    public int count(int acc) {
+        int r;
+        if (last)
+            r = acc + 1;
+        else
+            r = next.count(acc + 1);
+        return r;
+    }
+}
+
+class Even {
+    public int even(int n) {
+        int r;
+        Odd o;
+        if (n < 1) {
+            r = 1;
+        } else {
+            o = new Odd();
+            r = o.odd(n - 1);
+        }
+        return r;
+    }
+}
+
+class Odd {
+    public int odd(int n) {
+        int r;
+        Even e;
+        if (n < 1) {
+            r = 0;
+        } else {
+            e = new Even();
+            r = e.even(n - 1);
+        }
+        return r;
+    }
+}
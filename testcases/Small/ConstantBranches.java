@@ -0,0 +1,49 @@
+// Branches on constant conditions, empty branches and loops that are
+// never entered. Prints 1, 2, 3, 4, 6.
+
+class ConstantBranches {
+    public static void main(String[] a) {
+        System.out.println(new Branches().run(4));
+    }
+}
+
+class Branches {
+    public int run(int n) {
+        int i;
+        int r;
+        r = 0;
+        if (true) {
+            System.out.println(1);
+        } else {
+            System.out.println(0 - 1);
+        }
+        if (false) {
+            System.out.println(0 - 2);
+        } else {
+            System.out.println(2);
+        }
+        while (false) {
+            System.out.println(0 - 3);
+        }
+        if (1 < 2 && !(3 < 2)) {
+            System.out.println(3);
+        } else {
+        }
+        if (n < 0) {
+        } else {
+            if (n < 3) {
+            } else {
+                System.out.println(4);
+            }
+        }
+        i = 0;
+        while (i < n) {
+            if (true) {
+                r = r + i;
+            } else {
+            }
+            i = i + 1;
+        }
+        return r;
+    }
+}
@@ -0,0 +1,87 @@
+class Escape {
+    public static void main(String[] argv) {
+        System.out.println(new Allocs().run(6));
+    }
+}
+
+class Pair {
+    int a;
+    int b;
+
+    public int set(int x, int y) {
+        a = x;
+        b = y;
+        return 0;
+    }
+
+    public int sum() {
+        return a + b;
+    }
+
+    public int add(Pair p) {
+        return a * p.sum() + b;
+    }
+
+    public Pair self() {
+        return this;
+    }
+}
+
+class Allocs {
+    Pair kept;
+
+    public int run(int n) {
+        int i;
+        int j;
+        int s;
+        int d;
+        int[] small;
+        int[] local;
+        Pair p;
+        Pair q;
+        Pair prev;
+
+        s = 0;
+        i = 0;
+        prev = new Pair();
+        d = prev.set(100, 200);
+        while (i < n) {
+            // constant indices only
+            small = new int[3];
+            small[0] = i;
+            small[2] = small[0] + small.length;
+            s = s + small[1] + small[2];
+
+            // indexed, zeroed on each iteration
+            local = new int[4];
+            j = 0;
+            while (j < i && j < local.length) {
+                local[j] = local[j] + j + 1;
+                j = j + 1;
+            }
+            j = 0;
+            while (j < local.length) {
+                s = s + local[j];
+                j = j + 1;
+            }
+
+            // passed to methods that do not let it escape
+            p = new Pair();
+            d = p.set(i, 2 * i);
+            q = new Pair();
+            d = q.set(3, 4);
+            s = s + p.add(q) + prev.sum();
+
+            // still used in the next iteration
+            d = prev.set(prev.sum(), i);
+            prev = new Pair();
+            d = prev.set(i, 1);
+
+            // escapes through the field and the return value
+            kept = new Pair().self();
+            d = kept.set(i, i);
+            i = i + 1;
+        }
+        return s + kept.sum() + prev.sum();
+    }
+}
@@ -0,0 +1,110 @@
+class Garbage {
+    public static void main(String[] argv) {
+        System.out.println(new Churn().run(6000));
+    }
+}
+
+class Node {
+    int value;
+    Node next;
+    int[] data;
+
+    public Node init(Node n, int v) {
+        next = n;
+        value = v;
+        data = new int[3];
+        data[0] = v;
+        data[2] = v * 2;
+        return this;
+    }
+
+    public Node getNext() {
+        return next;
+    }
+
+    public int sum() {
+        return value + data[0] + data[2];
+    }
+}
+
+class Tree {
+    Tree left;
+    Tree right;
+    int key;
+
+    public Tree build(int depth, int k) {
+        key = k;
+        if (0 < depth) {
+            left = new Tree().build(depth - 1, 2 * k);
+            right = new Tree().build(depth - 1, 2 * k + 1);
+        } else {
+        }
+        return this;
+    }
+
+    public int total(int depth) {
+        int s;
+        s = key;
+        if (0 < depth) {
+            s = s + left.total(depth - 1) + right.total(depth - 1);
+        } else {
+        }
+        return s;
+    }
+}
+
+class Churn {
+    Node kept;
+    int keptCount;
+
+    public int run(int rounds) {
+        int r;
+        int i;
+        int s;
+        Node list;
+        Node p;
+        Tree t;
+        Tree old;
+
+        s = 0;
+        r = 0;
+        old = new Tree().build(6, 1);
+        list = new Node();
+        while (r < rounds) {
+            // a list that dies at the end of the round
+            list = new Node().init(list, r);
+            i = 0;
+            while (i < 200) {
+                list = new Node().init(list, i);
+                i = i + 1;
+            }
+            p = list;
+            i = 0;
+            while (i < 201) {
+                s = s + p.sum();
+                p = p.getNext();
+                i = i + 1;
+            }
+
+            // some nodes survive until the end
+            if (r - r / 100 * 100 < 1) {
+                kept = new Node().init(kept, r);
+                keptCount = keptCount + 1;
+            } else {
+            }
+
+            // a tree that dies, built recursively
+            t = new Tree().build(5, r);
+            s = s + t.total(5) - old.total(6);
+            r = r + 1;
+            list = new Node();
+        }
+        p = kept;
+        while (0 < keptCount) {
+            s = s + p.sum();
+            p = p.getNext();
+            keptCount = keptCount - 1;
+        }
+        return s + old.total(6);
+    }
+}
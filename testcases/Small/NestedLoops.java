@@ -0,0 +1,44 @@
+class NestedLoops {
+    public static void main(String[] argv) {
+        System.out.println(new Loops().run(5));
+    }
+}
+
+class Loops {
+    int calls;
+
+    public boolean below(int i, int n) {
+        calls = calls + 1;
+        return i < n;
+    }
+
+    public int run(int n) {
+        int i;
+        int j;
+        int sum;
+
+        calls = 0;
+        sum = 0;
+        i = 0;
+        // loop with a call and a short-cut condition
+        while (this.below(i, n) && !(sum < 0)) {
+            j = 0;
+            while (j < i) {
+                if (j < 2) {
+                    sum = sum + j;
+                } else {
+                    sum = sum + 2 * j;
+                }
+                j = j + 1;
+            }
+            System.out.println(sum);
+            i = i + 1;
+        }
+        System.out.println(calls);
+        // loop that is never entered
+        while (n < 0) {
+            System.out.println(0 - 1);
+        }
+        return sum;
+    }
+}
@@ -0,0 +1,107 @@
+// Counted loops that are unrolled, with remainders, steps greater than 1,
+// shifted accesses, constant trip counts, calls in the body and an index
+// that approaches the largest int
+
+class Unroll {
+    public static void main(String[] argv) {
+        System.out.println(new Loops().run(23));
+    }
+}
+
+class Loops {
+    int[] f;
+    int g;
+
+    public int bump() {
+        g = g + 1;
+        f = new int[12];
+        return g;
+    }
+
+    public int run(int n) {
+        int[] a;
+        int[] b;
+        int i;
+        int s;
+        int m;
+        a = new int[n];
+        b = new int[n + 2];
+        i = 0;
+        while (i < n) {
+            a[i] = i * i;
+            i = i + 1;
+        }
+        i = 1;
+        s = 0;
+        while (i < n - 1) {
+            b[i + 1] = a[i - 1] + a[i + 1];
+            s = s + b[i];
+            i = i + 1;
+        }
+        System.out.println(s);
+        i = 0;
+        s = 0;
+        while (i < n) {
+            s = s + a[i] * 3;
+            i = i + 3;
+        }
+        System.out.println(s);
+        System.out.println(i);
+        i = 5;
+        s = 0;
+        while (i < 12) {
+            s = s + i * i;
+            i = i + 2;
+        }
+        System.out.println(s);
+        System.out.println(i);
+        i = 2147483640;
+        s = 0;
+        while (i < 2147483647) {
+            s = s + 1;
+            i = i + 1;
+        }
+        System.out.println(s);
+        System.out.println(i);
+        i = 0 - 3;
+        s = 0;
+        while (i < 3) {
+            s = s + i;
+            i = i + 1;
+        }
+        System.out.println(s);
+        // the call replaces the array
+        f = new int[10];
+        g = 0;
+        i = 0;
+        s = 0;
+        while (i < 9) {
+            s = s + f[i] + this.bump();
+            i = i + 1;
+        }
+        System.out.println(s);
+        i = 0;
+        s = 0;
+        while (i < 8) {
+            if (i < 4)
+                s = s + a[i];
+            else
+                s = s - b[i + 1];
+            i = i + 1;
+        }
+        System.out.println(s);
+        // accesses that are not executed would be out of bounds, so that only
+        // the original loop runs
+        i = 0;
+        s = 0;
+        m = n - 3;
+        while (i < n) {
+            if (i < m)
+                s = s + a[i + 3];
+            else
+                s = s + 1;
+            i = i + 1;
+        }
+        return s;
+    }
+}
@@ -0,0 +1,63 @@
+// Loops that test conditions which do not change in the loop: parameters,
+// a field that the loop does not assign and combinations of them, also in
+// a nested loop
+
+class Unswitch {
+    public static void main(String[] argv) {
+        {
+            System.out.println(new Modes().run(7, true, 1));
+            System.out.println(new Modes().run(9, false, 5));
+        }
+    }
+}
+
+class Modes {
+    boolean verbose;
+
+    public int run(int n, boolean up, int k) {
+        int i;
+        int j;
+        int s;
+        int[] a;
+        a = new int[n];
+        verbose = k < 3;
+        i = 0;
+        s = 0;
+        while (i < n) {
+            if (up)
+                s = s + i;
+            else
+                s = s - i;
+            if (verbose && k < 2)
+                a[i] = 0 - s;
+            else
+                a[i] = s;
+            i = i + 1;
+        }
+        i = 0;
+        while (i < n) {
+            if (!verbose)
+                s = s + a[i];
+            else
+                s = s * 3;
+            i = i + 1;
+        }
+        i = 0;
+        while (i < n) {
+            j = 0;
+            while (j < i) {
+                if (up)
+                    s = s + a[j];
+                else
+                    s = s - 1;
+                j = j + 1;
+            }
+            if (verbose)
+                System.out.println(s);
+            else {
+            }
+            i = i + 1;
+        }
+        return s;
+    }
+}
@@ -0,0 +1,85 @@
+// Loops over int arrays that can be vectorised, with trip counts that are
+// not multiples of the vector length, reductions, shifted reads and a loop
+// whose source and destination alias
+
+class Vector {
+    public static void main(String[] argv) {
+        System.out.println(new Loops().run(37));
+    }
+}
+
+class Loops {
+    int[] f;
+
+    public int run(int n) {
+        int[] a;
+        int[] b;
+        int[] c;
+        int i;
+        int s;
+        int k;
+        int d;
+        a = new int[n];
+        b = new int[n];
+        c = new int[n + 3];
+        i = 0;
+        while (i < n) {
+            a[i] = i * 3 + 1;
+            i = i + 1;
+        }
+        i = 0;
+        while (i < n) {
+            b[i] = a[i] * a[i] - i;
+            i = i + 1;
+        }
+        s = 0;
+        i = 0;
+        k = 5;
+        while (i < n) {
+            s = s + b[i] * k;
+            s = s - a[i];
+            i = i + 1;
+        }
+        System.out.println(s);
+        i = 1;
+        while (i < n - 1) {
+            c[i] = a[i - 1] + a[i + 1] + 7;
+            i = i + 1;
+        }
+        d = 0;
+        i = 0;
+        while (i < n + 3) {
+            d = d + c[i];
+            i = i + 1;
+        }
+        System.out.println(d);
+        // the source is the destination, read one element behind
+        b = a;
+        i = 1;
+        while (i < n) {
+            a[i] = b[i - 1] + 1;
+            i = i + 1;
+        }
+        System.out.println(a[n - 1]);
+        s = 0;
+        i = 0;
+        while (i < n) {
+            s = s + i;
+            i = i + 1;
+        }
+        System.out.println(s);
+        f = new int[10];
+        i = 0;
+        while (i < 10) {
+            f[i] = 10 - i;
+            i = i + 1;
+        }
+        s = 0;
+        i = 0;
+        while (i < 10) {
+            s = s + f[i] * f[i];
+            i = i + 1;
+        }
+        return s;
+    }
+}